@@ -0,0 +1,52 @@
+/////////////
+// action_executor.cpp : Dedicated thread that applies lock/unlock actions queued by the input thread.
+//////
+
+#include "action_executor.h"
+
+ActionExecutor::ActionExecutor(Handler handler)
+	: m_handler(std::move(handler)) {
+}
+
+ActionExecutor::~ActionExecutor() {
+	Stop();
+}
+
+void ActionExecutor::Start() {
+	if (m_thread.joinable()) {
+		return;
+	}
+	m_stopping.store(false, std::memory_order_relaxed);
+	m_thread = std::thread(&ActionExecutor::Run, this);
+}
+
+void ActionExecutor::Stop() {
+	if (!m_thread.joinable()) {
+		return;
+	}
+	m_stopping.store(true, std::memory_order_release);
+	m_pending.release();
+	m_thread.join();
+}
+
+bool ActionExecutor::Submit(const LockCommand& command) {
+	if (!m_queue.TryPush(command)) {
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	m_pending.release();
+	return true;
+}
+
+void ActionExecutor::Run() {
+	for (;;) {
+		m_pending.acquire();
+		LockCommand command;
+		while (m_queue.TryPop(command)) {
+			m_handler(command);
+		}
+		if (m_stopping.load(std::memory_order_acquire) && m_queue.Empty()) {
+			return;
+		}
+	}
+}
@@ -0,0 +1,53 @@
+/////////////
+// action_executor.h : Runs lock/unlock actions on a dedicated thread so the input thread never waits on device toggles.
+//////
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <semaphore>
+#include <thread>
+#include "spsc_queue.h"
+
+enum class LockAction : uint8_t {
+	Lock,
+	Unlock,
+};
+
+struct LockCommand {
+	LockAction action = LockAction::Lock;
+	uint64_t triggerNs = 0; // arrival time of the key press that completed the gesture
+	uint64_t matchNs = 0;   // when the gesture engine reported the match
+};
+
+class ActionExecutor {
+public:
+	using Handler = std::function<void(const LockCommand&)>;
+
+	explicit ActionExecutor(Handler handler);
+	~ActionExecutor();
+
+	ActionExecutor(const ActionExecutor&) = delete;
+	ActionExecutor& operator=(const ActionExecutor&) = delete;
+
+	void Start();
+	// Drains any queued actions, then joins the executor thread.
+	void Stop();
+
+	// Called from the input thread only. Never blocks; returns false if the queue is full.
+	bool Submit(const LockCommand& command);
+
+	uint64_t Dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+	void Run();
+
+	Handler m_handler;
+	SpscQueue<LockCommand, 16> m_queue;
+	std::counting_semaphore<> m_pending{ 0 };
+	std::atomic<bool> m_stopping{ false };
+	std::atomic<uint64_t> m_dropped{ 0 };
+	std::thread m_thread;
+};
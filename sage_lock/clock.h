@@ -0,0 +1,140 @@
+/////////////
+// clock.h : Monotonic nanosecond timestamps for the input pipeline.
+// steady_clock is QueryPerformanceCounter on Windows and CLOCK_MONOTONIC on Linux, so event
+// timing no longer inherits the 10-16ms granularity of GetTickCount64.
+//////
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+inline uint64_t MonotonicNowNs() {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Injectable time source, so the pipeline can run against simulated time.
+class Clock {
+public:
+	virtual ~Clock() = default;
+	virtual uint64_t NowNs() const = 0;
+	// Lets this much time pass for the caller, e.g. a simulated device's toggle latency.
+	virtual void SleepNs(uint64_t ns) = 0;
+	// Threads about to sleep on the clock, e.g. pool workers just handed devices to toggle, and
+	// their withdrawal once they are done. A simulated clock holds time still until every held
+	// thread is asleep; real clocks ignore both.
+	virtual void Hold(unsigned) {}
+	virtual void Release(unsigned) {}
+};
+
+class SystemClock : public Clock {
+public:
+	uint64_t NowNs() const override { return MonotonicNowNs(); }
+	void SleepNs(uint64_t ns) override { std::this_thread::sleep_for(std::chrono::nanoseconds(ns)); }
+};
+
+// Only moves when told to, or as a discrete-event clock when threads sleep on it: a sleeper blocks
+// until the clock reaches its wake time, and once every held thread is asleep the clock jumps to
+// the earliest wake time. Sleeps that start together therefore end at their own end times, and
+// the clock at the latest of them, however the threads were scheduled. Safe from any thread.
+class VirtualClock : public Clock {
+public:
+	explicit VirtualClock(uint64_t startNs = 0) : m_nowNs(startNs) {}
+
+	uint64_t NowNs() const override { return m_nowNs.load(std::memory_order_acquire); }
+	void SetNs(uint64_t nowNs) {
+		m_nowNs.store(nowNs, std::memory_order_seq_cst);
+		WakeSleepers();
+	}
+	uint64_t AdvanceNs(uint64_t deltaNs) {
+		const uint64_t nowNs = m_nowNs.fetch_add(deltaNs, std::memory_order_seq_cst) + deltaNs;
+		WakeSleepers();
+		return nowNs;
+	}
+	// Moves the clock to nowNs unless it is already past it.
+	void AdvanceToNs(uint64_t nowNs) {
+		MoveTo(nowNs);
+		WakeSleepers();
+	}
+	void SleepNs(uint64_t ns) override;
+	void Hold(unsigned threads) override {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_held += threads;
+	}
+	void Release(unsigned threads) override {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_held -= threads;
+		}
+		m_changed.notify_all();
+	}
+
+private:
+	// On the sleeper's stack, so sleeping never allocates.
+	struct Sleeper {
+		uint64_t wakeNs;
+		Sleeper* next;
+	};
+
+	void MoveTo(uint64_t nowNs) {
+		uint64_t current = m_nowNs.load(std::memory_order_acquire);
+		while (current < nowNs && !m_nowNs.compare_exchange_weak(current, nowNs, std::memory_order_seq_cst)) {
+		}
+	}
+	void WakeSleepers() {
+		// seq_cst on both sides: either a new sleeper sees the new time, or this sees the sleeper
+		if (m_sleeping.load(std::memory_order_seq_cst) != 0) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_changed.notify_all();
+		}
+	}
+
+	std::atomic<uint64_t> m_nowNs;
+	std::mutex m_mutex;
+	std::condition_variable m_changed;
+	Sleeper* m_sleepers = nullptr;      // guarded by m_mutex, as is m_held
+	unsigned m_held = 0;
+	std::atomic<unsigned> m_sleeping{ 0 }; // entries in m_sleepers; written under m_mutex
+};
+
+inline void VirtualClock::SleepNs(uint64_t ns) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	Sleeper self{ NowNs() + ns, m_sleepers };
+	m_sleepers = &self;
+	m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+	for (;;) {
+		const uint64_t nowNs = NowNs();
+		if (nowNs >= self.wakeNs) {
+			break;
+		}
+		// a sleeper already due is awake in all but name and may yet start a shorter sleep, so
+		// only the ones still waiting count towards the held threads
+		unsigned pending = 0;
+		uint64_t earliestNs = self.wakeNs;
+		for (const Sleeper* sleeper = m_sleepers; sleeper != nullptr; sleeper = sleeper->next) {
+			if (sleeper->wakeNs > nowNs) {
+				pending++;
+				earliestNs = std::min(earliestNs, sleeper->wakeNs);
+			}
+		}
+		if (pending >= m_held) {
+			MoveTo(earliestNs);
+			m_changed.notify_all();
+		}
+		else {
+			m_changed.wait(lock);
+		}
+	}
+	for (Sleeper** link = &m_sleepers; *link != nullptr; link = &(*link)->next) {
+		if (*link == &self) {
+			*link = self.next;
+			break;
+		}
+	}
+	m_sleeping.fetch_sub(1, std::memory_order_seq_cst);
+}
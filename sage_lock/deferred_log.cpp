@@ -0,0 +1,447 @@
+/////////////
+// deferred_log.cpp : Per-thread log rings, the format table, the log thread and the record formatter.
+//////
+
+#include "deferred_log.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <mutex>
+#include <semaphore>
+#include <thread>
+#include <vector>
+#include "spsc_queue.h"
+
+namespace {
+
+constexpr size_t kLogRingSize = 256;
+constexpr uint32_t kWakeEvery = kLogRingSize / 4;
+constexpr std::chrono::milliseconds kLogDrainInterval{ 20 };
+constexpr uint16_t kOverflowFormat = kMaxLogFormats - 1;
+
+// One per thread that has logged. Shared with the log thread, which frees it once the thread has
+// exited and the ring is empty.
+struct ThreadRing {
+	SpscQueue<LogRecord, kLogRingSize> ring;
+	std::atomic<uint64_t> dropped{ 0 };
+	std::atomic<bool> exited{ false };
+	uint32_t thread = 0;
+	uint32_t sinceWake = 0;       // owner thread only
+	uint64_t droppedReported = 0; // log thread only
+};
+
+struct ThreadRingOwner {
+	std::shared_ptr<ThreadRing> ring;
+
+	~ThreadRingOwner() {
+		if (ring) {
+			ring->exited.store(true, std::memory_order_release);
+		}
+	}
+};
+
+struct LogState {
+	// format table; ids are indexes, 0 means not registered yet
+	std::array<std::atomic<const char*>, kMaxLogFormats> formats{};
+	uint16_t formatCount = 1;
+	std::mutex formatMutex;
+
+	std::vector<std::shared_ptr<ThreadRing>> rings;
+	uint32_t nextThread = 1;
+	std::mutex ringMutex;
+
+	// everything below is owned by whoever holds drainMutex
+	std::mutex drainMutex;
+	std::unique_ptr<LogSink> sink;
+	std::vector<std::shared_ptr<ThreadRing>> draining;
+	std::vector<LogRecord> pending;
+	std::vector<LogRecord> merged;
+	std::string line;
+	uint64_t startNs = 0;
+
+	std::atomic<bool> stopping{ false };
+	std::counting_semaphore<> wake{ 0 };
+	std::thread thread;
+
+	std::atomic<uint64_t> records{ 0 };
+	std::atomic<uint64_t> dropped{ 0 };
+	std::atomic<uint64_t> formatNs{ 0 };
+};
+
+LogState g_Log;
+thread_local ThreadRingOwner t_Ring;
+
+ThreadRing* AttachThread() {
+	auto ring = std::make_shared<ThreadRing>();
+	{
+		std::lock_guard<std::mutex> lock(g_Log.ringMutex);
+		ring->thread = g_Log.nextThread++;
+		g_Log.rings.push_back(ring);
+	}
+	t_Ring.ring = std::move(ring);
+	return t_Ring.ring.get();
+}
+
+void AppendUtf8(std::string& out, const uint8_t* units, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		uint32_t c = (uint32_t)units[i * 2] | ((uint32_t)units[i * 2 + 1] << 8);
+		if (c >= 0xD800 && c < 0xDC00 && i + 1 < count) {
+			const uint32_t low = (uint32_t)units[i * 2 + 2] | ((uint32_t)units[i * 2 + 3] << 8);
+			if (low >= 0xDC00 && low < 0xE000) {
+				c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+				i++;
+			}
+		}
+		if (c < 0x80) {
+			out += (char)c;
+		}
+		else if (c < 0x800) {
+			out += (char)(0xC0 | (c >> 6));
+			out += (char)(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000) {
+			out += (char)(0xE0 | (c >> 12));
+			out += (char)(0x80 | ((c >> 6) & 0x3F));
+			out += (char)(0x80 | (c & 0x3F));
+		}
+		else {
+			out += (char)(0xF0 | (c >> 18));
+			out += (char)(0x80 | ((c >> 12) & 0x3F));
+			out += (char)(0x80 | ((c >> 6) & 0x3F));
+			out += (char)(0x80 | (c & 0x3F));
+		}
+	}
+}
+
+// Walks a record's arguments in order.
+class ArgReader {
+public:
+	explicit ArgReader(const LogRecord& record) : m_record(record) {}
+
+	// False once the arguments run out. Strings are returned in text, converted to UTF-8.
+	bool Next(LogArgType& type, uint64_t& bits, std::string& text) {
+		if (m_index == m_record.argCount) {
+			return false;
+		}
+		m_index++;
+		type = (LogArgType)m_record.payload[m_offset];
+		if (type == LogArgType::String || type == LogArgType::WideString) {
+			const size_t len = m_record.payload[m_offset + 1];
+			const uint8_t* data = m_record.payload + m_offset + 2;
+			text.clear();
+			if (type == LogArgType::String) {
+				text.assign((const char*)data, len);
+				m_offset += 2 + len;
+			}
+			else {
+				AppendUtf8(text, data, len);
+				m_offset += 2 + len * 2;
+			}
+			return true;
+		}
+		memcpy(&bits, m_record.payload + m_offset + 1, sizeof(bits));
+		m_offset += 1 + sizeof(bits);
+		return true;
+	}
+
+private:
+	const LogRecord& m_record;
+	size_t m_offset = 0;
+	size_t m_index = 0;
+};
+
+template <typename T>
+void AppendFormatted(std::string& out, const char* spec, T value) {
+	char buffer[512];
+	const int len = snprintf(buffer, sizeof(buffer), spec, value);
+	if (len > 0) {
+		out.append(buffer, std::min((size_t)len, sizeof(buffer) - 1));
+	}
+}
+
+void Drain() {
+	std::lock_guard<std::mutex> drainLock(g_Log.drainMutex);
+	const uint64_t startNs = MonotonicNowNs();
+	{
+		std::lock_guard<std::mutex> lock(g_Log.ringMutex);
+		g_Log.draining.assign(g_Log.rings.begin(), g_Log.rings.end());
+	}
+	g_Log.pending.clear();
+	LogRecord popped;
+	for (const auto& ring : g_Log.draining) {
+		const size_t earlier = g_Log.pending.size();
+		while (ring->ring.TryPop(popped)) {
+			g_Log.pending.push_back(popped);
+		}
+		// each ring is in order; merge it into the earlier rings' records so the output reads in time
+		// order. stable_sort would allocate a scratch buffer on every drain; merging keeps to two
+		// buffers that stop growing once they have seen the busiest drain
+		if (earlier != 0 && earlier != g_Log.pending.size()) {
+			const auto middle = g_Log.pending.begin() + earlier;
+			g_Log.merged.resize(g_Log.pending.size());
+			std::merge(g_Log.pending.begin(), middle, middle, g_Log.pending.end(), g_Log.merged.begin(),
+				[](const LogRecord& a, const LogRecord& b) { return a.timeNs < b.timeNs; });
+			g_Log.pending.swap(g_Log.merged);
+		}
+	}
+
+	uint64_t dropped = 0;
+	for (const auto& record : g_Log.pending) {
+		const uint64_t sinceStartNs = record.timeNs > g_Log.startNs ? record.timeNs - g_Log.startNs : 0;
+		g_Log.line.clear();
+		AppendFormatted(g_Log.line, "[%12.6f] ", (double)sinceStartNs / 1e9);
+		FormatLogRecord(record, g_Log.formats[record.format].load(std::memory_order_acquire), g_Log.line);
+		if (g_Log.line.back() != '\n') {
+			g_Log.line += '\n';
+		}
+		if (g_Log.sink) {
+			g_Log.sink->Write(g_Log.line);
+		}
+	}
+	for (const auto& ring : g_Log.draining) {
+		const uint64_t ringDropped = ring->dropped.load(std::memory_order_relaxed);
+		if (ringDropped != ring->droppedReported) {
+			g_Log.line.clear();
+			AppendFormatted(g_Log.line, "(%llu log record(s) dropped", (unsigned long long)(ringDropped - ring->droppedReported));
+			AppendFormatted(g_Log.line, " on thread %u)\n", ring->thread);
+			if (g_Log.sink) {
+				g_Log.sink->Write(g_Log.line);
+			}
+			dropped += ringDropped - ring->droppedReported;
+			ring->droppedReported = ringDropped;
+		}
+	}
+	if (g_Log.sink && (!g_Log.pending.empty() || dropped > 0)) {
+		g_Log.sink->Flush();
+	}
+	{
+		// exited is set after the thread's last push, so an empty ring here stays empty
+		std::lock_guard<std::mutex> lock(g_Log.ringMutex);
+		std::erase_if(g_Log.rings, [](const std::shared_ptr<ThreadRing>& ring) {
+			return ring->exited.load(std::memory_order_acquire) && ring->ring.Empty();
+		});
+	}
+	g_Log.draining.clear();
+
+	g_Log.records.fetch_add(g_Log.pending.size(), std::memory_order_relaxed);
+	g_Log.dropped.fetch_add(dropped, std::memory_order_relaxed);
+	if (!g_Log.pending.empty()) {
+		g_Log.formatNs.fetch_add(MonotonicNowNs() - startNs, std::memory_order_relaxed);
+	}
+}
+
+void LogThread() {
+	for (;;) {
+		g_Log.wake.try_acquire_for(kLogDrainInterval);
+		const bool stopping = g_Log.stopping.load(std::memory_order_acquire);
+		Drain();
+		if (stopping) {
+			return;
+		}
+	}
+}
+
+}
+
+namespace deferred_log_detail {
+
+uint16_t RegisterSite(LogSite& site, const char* format) {
+	std::lock_guard<std::mutex> lock(g_Log.formatMutex);
+	uint16_t id = site.format.load(std::memory_order_relaxed);
+	if (id != 0) {
+		return id;
+	}
+	if (g_Log.formatCount == kOverflowFormat) {
+		id = kOverflowFormat;
+	}
+	else {
+		id = g_Log.formatCount++;
+		g_Log.formats[id].store(format, std::memory_order_release);
+	}
+	site.format.store(id, std::memory_order_release);
+	return id;
+}
+
+void Push(LogRecord& record) {
+	ThreadRing* ring = t_Ring.ring.get();
+	if (ring == nullptr) {
+		ring = AttachThread();
+	}
+	record.thread = ring->thread;
+	if (!ring->ring.TryPush(record)) {
+		ring->dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+	// the log thread polls; only a burst big enough to threaten the ring is worth waking it for
+	else if (++ring->sinceWake == kWakeEvery) {
+		ring->sinceWake = 0;
+		g_Log.wake.release();
+	}
+}
+
+}
+
+FileLogSink::~FileLogSink() {
+	if (m_owned) {
+		fclose(m_file);
+	}
+}
+
+std::unique_ptr<FileLogSink> FileLogSink::Open(const char* path) {
+	FILE* file = fopen(path, "a");
+	if (file == nullptr) {
+		return nullptr;
+	}
+	return std::unique_ptr<FileLogSink>(new FileLogSink(file, true));
+}
+
+void FileLogSink::Write(const std::string& line) {
+	fwrite(line.data(), 1, line.size(), m_file);
+}
+
+void FileLogSink::Flush() {
+	fflush(m_file);
+}
+
+bool StartDeferredLog(std::unique_ptr<LogSink> sink) {
+	if (g_Log.thread.joinable()) {
+		return false;
+	}
+	g_Log.formats[kOverflowFormat].store("(log format table full)", std::memory_order_release);
+	{
+		std::lock_guard<std::mutex> lock(g_Log.drainMutex);
+		g_Log.sink = std::move(sink);
+		g_Log.startNs = MonotonicNowNs();
+		g_Log.pending.reserve(kLogRingSize * 4);
+		g_Log.merged.reserve(kLogRingSize * 4);
+		g_Log.line.reserve(1024);
+	}
+	g_Log.stopping.store(false, std::memory_order_relaxed);
+	g_Log.thread = std::thread(LogThread);
+	deferred_log_detail::active.store(true, std::memory_order_release);
+	return true;
+}
+
+void StopDeferredLog() {
+	if (!g_Log.thread.joinable()) {
+		return;
+	}
+	deferred_log_detail::active.store(false, std::memory_order_release);
+	g_Log.stopping.store(true, std::memory_order_release);
+	g_Log.wake.release();
+	g_Log.thread.join();
+	std::lock_guard<std::mutex> lock(g_Log.drainMutex);
+	g_Log.sink.reset();
+}
+
+void FlushDeferredLog() {
+	Drain();
+}
+
+LogStats DeferredLogStats() {
+	LogStats stats;
+	stats.records = g_Log.records.load(std::memory_order_relaxed);
+	stats.dropped = g_Log.dropped.load(std::memory_order_relaxed);
+	stats.formatNs = g_Log.formatNs.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void FormatLogRecord(const LogRecord& record, const char* format, std::string& out) {
+	if (format == nullptr) {
+		AppendFormatted(out, "(unknown log format %u)", (unsigned)record.format);
+		return;
+	}
+	ArgReader args(record);
+	LogArgType type;
+	uint64_t bits = 0;
+	// one buffer per thread, so the log thread formats record after record without reallocating
+	thread_local std::string text;
+	char spec[32];
+	for (const char* p = format; *p != '\0';) {
+		const char* percent = strchr(p, '%');
+		if (percent == nullptr) {
+			out.append(p);
+			break;
+		}
+		out.append(p, percent - p);
+		p = percent + 1;
+		if (*p == '%') {
+			out += '%';
+			p++;
+			continue;
+		}
+		// %[flags][width][.precision][length]conversion; the length is replaced to match the stored argument
+		while (*p != '\0' && strchr("-+ #0", *p) != nullptr) {
+			p++;
+		}
+		while ((*p >= '0' && *p <= '9') || *p == '.') {
+			p++;
+		}
+		const size_t prefix = std::min((size_t)(p - percent), sizeof(spec) - 8);
+		while (*p != '\0' && strchr("hljztLqI", *p) != nullptr) {
+			const bool msvcWidth = *p == 'I';
+			p++;
+			while (msvcWidth && *p >= '0' && *p <= '9') {
+				p++;
+			}
+		}
+		const char conversion = *p;
+		if (conversion == '\0') {
+			break;
+		}
+		p++;
+		if (!args.Next(type, bits, text)) {
+			out.append("<?>");
+			continue;
+		}
+		memcpy(spec, percent, prefix);
+		const bool isString = type == LogArgType::String || type == LogArgType::WideString;
+		const double asDouble = type == LogArgType::Double ? std::bit_cast<double>(bits) :
+			type == LogArgType::Int ? (double)(int64_t)bits : (double)bits;
+		const uint64_t asInteger = type == LogArgType::Double ? (uint64_t)(int64_t)asDouble : bits;
+		switch (conversion) {
+		case 's':
+		case 'S':
+			if (prefix == 1 || !isString) {
+				if (isString) {
+					out.append(text);
+				}
+				else {
+					AppendFormatted(out, type == LogArgType::Int ? "%lld" : "%llu", (unsigned long long)asInteger);
+				}
+			}
+			else {
+				memcpy(spec + prefix, "s", 2);
+				AppendFormatted(out, spec, text.c_str());
+			}
+			break;
+		case 'c':
+			memcpy(spec + prefix, "c", 2);
+			AppendFormatted(out, spec, (int)asInteger);
+			break;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			if (isString) {
+				out.append(text);
+				break;
+			}
+			spec[prefix] = conversion;
+			spec[prefix + 1] = '\0';
+			AppendFormatted(out, spec, asDouble);
+			break;
+		case 'p':
+			AppendFormatted(out, "0x%llx", (unsigned long long)asInteger);
+			break;
+		default: // d i u o x X
+			if (isString) {
+				out.append(text);
+				break;
+			}
+			spec[prefix] = 'l';
+			spec[prefix + 1] = 'l';
+			spec[prefix + 2] = conversion;
+			spec[prefix + 3] = '\0';
+			AppendFormatted(out, spec, (long long)asInteger);
+			break;
+		}
+	}
+}
@@ -0,0 +1,239 @@
+/////////////
+// deferred_log.h : Binary logger with deferred formatting. A call site stores its format string id
+// and raw arguments into a per-thread lock-free ring; a background thread formats the records and
+// hands the text to a sink. Logging never blocks and never formats on the calling thread, so it is
+// safe inside the toggle path.
+//
+//	SAGE_LOG("Toggle %s: %s in %llu us\n", id, ToggleStatusName(status), elapsedUs);
+//
+// Format strings are printf-style and must be string literals: only their address is kept. Integer,
+// floating point, pointer and string arguments are supported; strings (narrow or wide) are copied
+// into the record and cut short if the record runs out of room. '*' widths are not supported.
+//////
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include "clock.h"
+
+constexpr size_t kLogRecordSize = 256;
+constexpr size_t kMaxLogFormats = 4096;
+
+enum class LogArgType : uint8_t {
+	Int,
+	UInt,
+	Double,
+	String,     // 1-byte length, UTF-8 bytes
+	WideString, // 1-byte length, UTF-16 code units
+};
+
+struct LogRecord {
+	uint64_t timeNs;
+	uint32_t thread;  // small number handed out in the order threads first log
+	uint16_t format;  // id from the format table
+	uint8_t argCount;
+	uint8_t size;     // payload bytes used
+	uint8_t payload[kLogRecordSize - 16];
+};
+
+static_assert(sizeof(LogRecord) == kLogRecordSize, "one ring slot per record");
+
+// One per call site; constant-initialized, so the check on every call is a plain load. The id is
+// published after its format string, so the log thread always finds the string.
+struct LogSite {
+	std::atomic<uint16_t> format{ 0 };
+};
+
+// Receives formatted lines on the log thread.
+class LogSink {
+public:
+	virtual ~LogSink() = default;
+	virtual void Write(const std::string& line) = 0;
+	virtual void Flush() {}
+};
+
+// Appends to a file, or to stderr.
+class FileLogSink : public LogSink {
+public:
+	explicit FileLogSink(FILE* file) : m_file(file), m_owned(false) {}
+	~FileLogSink() override;
+
+	// Appends to path; nullptr if it cannot be opened.
+	static std::unique_ptr<FileLogSink> Open(const char* path);
+
+	void Write(const std::string& line) override;
+	void Flush() override;
+
+private:
+	FileLogSink(FILE* file, bool owned) : m_file(file), m_owned(owned) {}
+
+	FILE* m_file;
+	const bool m_owned;
+};
+
+struct LogStats {
+	uint64_t records = 0;     // formatted and written
+	uint64_t dropped = 0;     // lost to a full ring
+	uint64_t formatNs = 0;    // spent formatting and writing on the log thread
+};
+
+// Starts the log thread. Records written before Start are discarded.
+bool StartDeferredLog(std::unique_ptr<LogSink> sink);
+// Formats everything logged so far, then stops the log thread and releases the sink.
+void StopDeferredLog();
+// Formats everything logged so far, on the calling thread.
+void FlushDeferredLog();
+LogStats DeferredLogStats();
+
+// Formats one record against its format string. Unused by the hot path; the log thread and tools call it.
+void FormatLogRecord(const LogRecord& record, const char* format, std::string& out);
+
+namespace deferred_log_detail {
+
+inline std::atomic<bool> active{ false };
+
+uint16_t RegisterSite(LogSite& site, const char* format);
+void Push(LogRecord& record);
+
+class RecordWriter {
+public:
+	explicit RecordWriter(LogRecord& record) : m_record(record) {}
+
+	template <typename T>
+	void Put(const T& value) {
+		if constexpr (std::is_same_v<T, bool>) {
+			PutNumber(LogArgType::UInt, (uint64_t)value);
+		}
+		else if constexpr (std::is_convertible_v<const T&, const char*>) {
+			const char* text = value;
+			PutString(text != nullptr ? std::string_view(text) : std::string_view("(null)"));
+		}
+		else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+			PutString(std::string_view(value));
+		}
+		else if constexpr (std::is_convertible_v<const T&, const wchar_t*>) {
+			const wchar_t* text = value;
+			PutWideString(text != nullptr ? std::wstring_view(text) : std::wstring_view(L"(null)"));
+		}
+		else if constexpr (std::is_convertible_v<const T&, std::wstring_view>) {
+			PutWideString(std::wstring_view(value));
+		}
+		else if constexpr (std::is_floating_point_v<T>) {
+			PutNumber(LogArgType::Double, (double)value);
+		}
+		else if constexpr (std::is_enum_v<T>) {
+			PutNumber(LogArgType::Int, (int64_t)value);
+		}
+		else if constexpr (std::is_signed_v<T>) {
+			PutNumber(LogArgType::Int, (int64_t)value);
+		}
+		else if constexpr (std::is_unsigned_v<T>) {
+			PutNumber(LogArgType::UInt, (uint64_t)value);
+		}
+		else {
+			static_assert(std::is_pointer_v<T>, "unsupported log argument type");
+			PutNumber(LogArgType::UInt, (uint64_t)(uintptr_t)value);
+		}
+	}
+
+private:
+	size_t Room() const { return sizeof(m_record.payload) - m_record.size; }
+
+	template <typename T>
+	void PutNumber(LogArgType type, T value) {
+		if (Room() < 1 + sizeof(value)) {
+			return;
+		}
+		m_record.payload[m_record.size] = (uint8_t)type;
+		memcpy(m_record.payload + m_record.size + 1, &value, sizeof(value));
+		m_record.size += 1 + sizeof(value);
+		m_record.argCount++;
+	}
+
+	void PutString(std::string_view text) {
+		if (Room() < 2) {
+			return;
+		}
+		const size_t len = std::min({ text.size(), Room() - 2, (size_t)UINT8_MAX });
+		m_record.payload[m_record.size] = (uint8_t)LogArgType::String;
+		m_record.payload[m_record.size + 1] = (uint8_t)len;
+		memcpy(m_record.payload + m_record.size + 2, text.data(), len);
+		m_record.size += (uint8_t)(2 + len);
+		m_record.argCount++;
+	}
+
+	// Stored as UTF-16 whatever the width of wchar_t: where it is UTF-32 (Linux), a character beyond
+	// the BMP becomes a surrogate pair. A pair that does not fit is left out whole.
+	void PutWideString(std::wstring_view text) {
+		if (Room() < 2) {
+			return;
+		}
+		const size_t maxLen = std::min((Room() - 2) / 2, (size_t)UINT8_MAX);
+		uint8_t* units = m_record.payload + m_record.size + 2;
+		size_t len = 0;
+		for (wchar_t c : text) {
+			uint32_t code = (uint32_t)c;
+			if (code > 0x10FFFF) {
+				code = 0xFFFD;
+			}
+			if (code > 0xFFFF) {
+				if (len + 2 > maxLen) {
+					break;
+				}
+				PutUnit(units, len++, (uint16_t)(0xD800 + ((code - 0x10000) >> 10)));
+				PutUnit(units, len++, (uint16_t)(0xDC00 + ((code - 0x10000) & 0x3FF)));
+			}
+			else {
+				if (len + 1 > maxLen) {
+					break;
+				}
+				PutUnit(units, len++, (uint16_t)code);
+			}
+		}
+		m_record.payload[m_record.size] = (uint8_t)LogArgType::WideString;
+		m_record.payload[m_record.size + 1] = (uint8_t)len;
+		m_record.size += (uint8_t)(2 + len * 2);
+		m_record.argCount++;
+	}
+
+	static void PutUnit(uint8_t* units, size_t index, uint16_t unit) {
+		memcpy(units + index * 2, &unit, 2);
+	}
+
+	LogRecord& m_record;
+};
+
+}
+
+template <typename... Args>
+void WriteLog(LogSite& site, const char* format, const Args&... args) {
+	if (!deferred_log_detail::active.load(std::memory_order_relaxed)) {
+		return;
+	}
+	uint16_t id = site.format.load(std::memory_order_acquire);
+	if (id == 0) {
+		id = deferred_log_detail::RegisterSite(site, format);
+	}
+	LogRecord record; // the payload is only read up to size
+	record.timeNs = MonotonicNowNs();
+	record.format = id;
+	record.argCount = 0;
+	record.size = 0;
+	deferred_log_detail::RecordWriter writer(record);
+	(writer.Put(args), ...);
+	deferred_log_detail::Push(record);
+}
+
+#define SAGE_LOG(...) \
+	do { \
+		static LogSite sageLogSite; \
+		WriteLog(sageLogSite, __VA_ARGS__); \
+	} while (0)
@@ -0,0 +1,144 @@
+/////////////
+// device_cache.cpp : Fixed-layout cache file for DeviceCache.
+//
+// Layout: a header, then kDeviceCacheCapacity fixed-size entries. Store writes the entries and then
+// the header, whose checksum covers the entries, so a torn write reads back as an empty cache.
+//////
+
+#include "device_cache.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+constexpr uint32_t kMagic = 0x4B434C53; // "SLCK"
+constexpr uint32_t kVersion = 1;
+
+struct Header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t checksum;
+};
+
+struct Entry {
+	char identity[kDeviceCacheMaxString + 1];
+	char id[kDeviceCacheMaxString + 1];
+	uint64_t lastSeen;
+	uint8_t classes;
+	uint8_t reserved[7];
+};
+
+constexpr size_t kFileSize = sizeof(Header) + kDeviceCacheCapacity * sizeof(Entry);
+
+// FNV-1a over the used entries.
+uint32_t Checksum(const Entry* entries, uint32_t count) {
+	uint32_t hash = 2166136261u;
+	const uint8_t* bytes = (const uint8_t*)entries;
+	for (size_t i = 0; i < count * sizeof(Entry); i++) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+void CopyString(char (&dest)[kDeviceCacheMaxString + 1], std::string_view src) {
+	memset(dest, 0, sizeof(dest));
+	memcpy(dest, src.data(), src.size());
+}
+
+}
+
+uint64_t DeviceCacheNow() {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool DeviceCache::Open(const char* path) {
+	if (!m_file.OpenReadWrite(path, kFileSize)) {
+		return false;
+	}
+	Header* header = (Header*)m_file.WritableData();
+	const Entry* entries = (const Entry*)(header + 1);
+	if (header->magic != kMagic || header->version != kVersion || header->count > kDeviceCacheCapacity ||
+		header->checksum != Checksum(entries, header->count)) {
+		*header = { kMagic, kVersion, 0, Checksum(entries, 0) };
+	}
+	return true;
+}
+
+std::vector<CachedDevice> DeviceCache::Load(uint64_t now) const {
+	std::vector<CachedDevice> devices;
+	if (!IsOpen()) {
+		return devices;
+	}
+	const Header* header = (const Header*)m_file.Data();
+	const Entry* entries = (const Entry*)(header + 1);
+	for (uint32_t i = 0; i < header->count; i++) {
+		const Entry& entry = entries[i];
+		if (entry.lastSeen + kDeviceCacheExpirySec < now) {
+			continue;
+		}
+		// strings are stored NUL-padded; a full-length one ends at the array bound
+		CachedDevice device;
+		device.identity.assign(entry.identity, strnlen(entry.identity, kDeviceCacheMaxString));
+		device.id.assign(entry.id, strnlen(entry.id, kDeviceCacheMaxString));
+		device.classes = entry.classes;
+		device.lastSeen = entry.lastSeen;
+		devices.push_back(std::move(device));
+	}
+	return devices;
+}
+
+void DeviceCache::Store(const std::vector<CachedDevice>& present, uint64_t now) {
+	if (!IsOpen()) {
+		return;
+	}
+	std::vector<CachedDevice> merged;
+	for (const auto& device : present) {
+		if (device.identity.size() <= kDeviceCacheMaxString && device.id.size() <= kDeviceCacheMaxString) {
+			merged.push_back(device);
+			merged.back().lastSeen = now;
+		}
+	}
+	for (auto& cached : Load(now)) {
+		const bool found = std::any_of(merged.begin(), merged.end(), [&](const CachedDevice& d) { return d.id == cached.id; });
+		if (!found) {
+			merged.push_back(std::move(cached));
+		}
+	}
+	// the most recently seen are kept when there are more devices than entries
+	std::stable_sort(merged.begin(), merged.end(), [](const CachedDevice& a, const CachedDevice& b) { return a.lastSeen > b.lastSeen; });
+	if (merged.size() > kDeviceCacheCapacity) {
+		merged.resize(kDeviceCacheCapacity);
+	}
+
+	Header* header = (Header*)m_file.WritableData();
+	Entry* entries = (Entry*)(header + 1);
+	for (size_t i = 0; i < merged.size(); i++) {
+		Entry entry = {};
+		CopyString(entry.identity, merged[i].identity);
+		CopyString(entry.id, merged[i].id);
+		entry.lastSeen = merged[i].lastSeen;
+		entry.classes = merged[i].classes;
+		entries[i] = entry;
+	}
+	header->count = (uint32_t)merged.size();
+	header->checksum = Checksum(entries, header->count);
+	m_file.Flush();
+}
+
+CacheValidation ApplyEnumeration(TouchDeviceRegistry& registry, const std::vector<std::string>& seeded, const std::vector<CachedDevice>& found) {
+	CacheValidation result;
+	for (const auto& device : found) {
+		if (registry.Add(device.id)) {
+			result.added++;
+		}
+	}
+	for (const auto& id : seeded) {
+		const bool present = std::any_of(found.begin(), found.end(), [&](const CachedDevice& d) { return d.id == id; });
+		if (!present && registry.RemoveUnlessLocked(id)) {
+			result.removed++;
+		}
+	}
+	return result;
+}
@@ -0,0 +1,61 @@
+/////////////
+// device_cache.h : Touch devices classified on previous runs, kept in a small memory-mapped file so
+// startup can seed the device set without enumerating every HID device first.
+//
+// The cached set is only a head start. A full enumeration still runs, in the background once input
+// is being listened to, and ApplyEnumeration brings the registry in line with what it found. A
+// device missed by a stale cache is locked on arrival by the registry, like any hotplugged device.
+//////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "mapped_file.h"
+#include "touch_device_registry.h"
+
+struct CachedDevice {
+	std::string identity;  // platform key that tells the device is still the one that was classified
+	std::string id;        // the id handed to the toggler
+	uint8_t classes = 0;   // HidClassification::classes; 0 if not classified from a descriptor
+	uint64_t lastSeen = 0; // seconds since the epoch
+};
+
+// Entries not seen by an enumeration for this long are dropped.
+constexpr uint64_t kDeviceCacheExpirySec = 30ull * 24 * 60 * 60;
+constexpr size_t kDeviceCacheCapacity = 32;
+constexpr size_t kDeviceCacheMaxString = 255; // longer identities and ids are not cached
+
+// Seconds since the epoch, the clock lastSeen is kept in.
+uint64_t DeviceCacheNow();
+
+// Single writer: one thread at a time may call Store.
+class DeviceCache {
+public:
+	// Maps the cache file, creating it if missing. A file that is corrupt or from another version is
+	// treated as empty.
+	bool Open(const char* path);
+	void Close() { m_file.Close(); }
+	bool IsOpen() const { return m_file.Data() != nullptr; }
+
+	// Entries seen within kDeviceCacheExpirySec of now.
+	std::vector<CachedDevice> Load(uint64_t now) const;
+	// Merges a full enumeration: present devices are stamped now, absent ones keep their last-seen
+	// time until they expire.
+	void Store(const std::vector<CachedDevice>& present, uint64_t now);
+
+private:
+	MappedFile m_file;
+};
+
+struct CacheValidation {
+	size_t added = 0;   // enumerated but not seeded from the cache
+	size_t removed = 0; // seeded from the cache but not enumerated
+};
+
+// Reconciles a registry seeded with the seeded ids against a full enumeration. Seeded devices that
+// were not found are removed unless the lock is on (see TouchDeviceRegistry::RemoveUnlessLocked).
+CacheValidation ApplyEnumeration(TouchDeviceRegistry& registry, const std::vector<std::string>& seeded, const std::vector<CachedDevice>& found);
@@ -0,0 +1,101 @@
+/////////////
+// device_id_table.cpp : Arena and hash index for DeviceIdTable.
+//////
+
+#include "device_id_table.h"
+#include <algorithm>
+#include <cstring>
+
+uint32_t DeviceIdTable::Hash(std::string_view id) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (char c : id) {
+		hash = (hash ^ (uint8_t)c) * 16777619u;
+	}
+	return hash;
+}
+
+DeviceHandle DeviceIdTable::Find(std::string_view id) const {
+	if (m_index.empty()) {
+		return kNoDeviceHandle;
+	}
+	const uint32_t hash = Hash(id);
+	const size_t mask = m_index.size() - 1;
+	for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+		const DeviceHandle handle = m_index[slot];
+		if (handle == kNoDeviceHandle) {
+			return kNoDeviceHandle;
+		}
+		if (m_entries[handle].hash == hash && View(handle) == id) {
+			return handle;
+		}
+	}
+}
+
+DeviceHandle DeviceIdTable::Intern(std::string_view id) {
+	const DeviceHandle existing = Find(id);
+	if (existing != kNoDeviceHandle) {
+		return existing;
+	}
+	if ((m_entries.size() + 1) * 2 > m_index.size()) {
+		Rehash(m_index.empty() ? 16 : m_index.size() * 2);
+	}
+	const DeviceHandle handle = (DeviceHandle)m_entries.size();
+	const Entry entry = { Store(id), (uint32_t)id.size(), Hash(id) };
+	m_entries.push_back(entry);
+
+	const size_t mask = m_index.size() - 1;
+	size_t slot = entry.hash & mask;
+	while (m_index[slot] != kNoDeviceHandle) {
+		slot = (slot + 1) & mask;
+	}
+	m_index[slot] = handle;
+	return handle;
+}
+
+const char* DeviceIdTable::Store(std::string_view id) {
+	if (m_chunks.empty() || m_chunkBytes - m_chunkUsed < id.size()) {
+		AddChunk(std::max(kChunkBytes, id.size()));
+	}
+	char* data = m_chunks.back().get() + m_chunkUsed;
+	memcpy(data, id.data(), id.size());
+	m_chunkUsed += id.size();
+	return data;
+}
+
+void DeviceIdTable::AddChunk(size_t bytes) {
+	m_chunks.emplace_back(new char[bytes]);
+	m_chunkBytes = bytes;
+	m_chunkUsed = 0;
+	m_arenaBytes += bytes;
+}
+
+void DeviceIdTable::Rehash(size_t slots) {
+	m_index.assign(slots, kNoDeviceHandle);
+	const size_t mask = slots - 1;
+	for (DeviceHandle handle = 0; handle < (DeviceHandle)m_entries.size(); handle++) {
+		size_t slot = m_entries[handle].hash & mask;
+		while (m_index[slot] != kNoDeviceHandle) {
+			slot = (slot + 1) & mask;
+		}
+		m_index[slot] = handle;
+	}
+}
+
+void DeviceIdTable::Reserve(size_t count, size_t bytes) {
+	if (m_chunks.empty() || m_chunkBytes - m_chunkUsed < bytes) {
+		AddChunk(std::max(kChunkBytes, bytes));
+	}
+	m_entries.reserve(count);
+	size_t slots = 16;
+	while (slots < count * 2) {
+		slots *= 2;
+	}
+	if (slots > m_index.size()) {
+		Rehash(slots);
+	}
+}
+
+size_t DeviceIdTable::MemoryBytes() const {
+	return m_arenaBytes + m_chunks.capacity() * sizeof(m_chunks[0]) + m_entries.capacity() * sizeof(Entry) + m_index.capacity() * sizeof(DeviceHandle);
+}
@@ -0,0 +1,61 @@
+/////////////
+// device_id_table.h : Interned device id strings. Every id is stored once, as UTF-8, in an arena of
+// fixed chunks and named by a stable integer handle; a hash index finds the handle for an id in
+// O(1).
+//
+// Ids are never removed and chunks never move: a device that is unplugged and plugged in again
+// gets its old handle back, a view of an id stays valid as long as the table, and the table only
+// grows with the number of distinct devices ever seen.
+//////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+using DeviceHandle = uint32_t;
+constexpr DeviceHandle kNoDeviceHandle = UINT32_MAX;
+
+class DeviceIdTable {
+public:
+	// Returns the id's handle, adding it if it is new.
+	DeviceHandle Intern(std::string_view id);
+	// Returns the id's handle, or kNoDeviceHandle.
+	DeviceHandle Find(std::string_view id) const;
+	// Valid for the life of the table.
+	std::string_view View(DeviceHandle handle) const {
+		const Entry& entry = m_entries[handle];
+		return std::string_view(entry.data, entry.size);
+	}
+
+	size_t Count() const { return m_entries.size(); }
+	// Sizes the arena, entries and index for count ids totalling bytes.
+	void Reserve(size_t count, size_t bytes);
+	// Heap bytes held, by capacity.
+	size_t MemoryBytes() const;
+
+private:
+	struct Entry {
+		const char* data;
+		uint32_t size;
+		uint32_t hash;
+	};
+
+	static constexpr size_t kChunkBytes = 4096;
+
+	static uint32_t Hash(std::string_view id);
+	void Rehash(size_t slots);
+	// Copies the id into the arena, starting a chunk if the current one is too full.
+	const char* Store(std::string_view id);
+	void AddChunk(size_t bytes);
+
+	std::vector<std::unique_ptr<char[]>> m_chunks;
+	size_t m_chunkBytes = 0; // size of the last chunk
+	size_t m_chunkUsed = 0;  // bytes of it taken
+	size_t m_arenaBytes = 0; // all chunks
+	std::vector<Entry> m_entries;
+	std::vector<DeviceHandle> m_index; // open addressing, power-of-two size, at most half full
+};
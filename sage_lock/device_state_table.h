@@ -0,0 +1,111 @@
+/////////////
+// device_state_table.h : Fixed-capacity open-addressing map from an input device handle to its state.
+// Keeps key presses from different keyboards from interleaving into one gesture. Probing walks a
+// dense array of handles; the states live in a parallel array of cache-line aligned slots. Both
+// are part of the table, so lookups and inserts never allocate.
+//////
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include "spsc_queue.h"
+
+template <typename Value, size_t Capacity>
+class DeviceStateTable {
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+	// Marks an empty slot; no input backend hands out this handle (it is INVALID_HANDLE_VALUE on Windows).
+	static constexpr uint64_t kNoDevice = ~0ull;
+
+	DeviceStateTable() { m_devices.fill(kNoDevice); }
+
+	// Returns the state for the device, or nullptr if it has none.
+	Value* Find(uint64_t device) {
+		for (size_t i = Home(device);; i = (i + 1) & kMask) {
+			if (m_devices[i] == device) {
+				return &m_slots[i].value;
+			}
+			if (m_devices[i] == kNoDevice) {
+				return nullptr;
+			}
+		}
+	}
+
+	// Returns the state for the device, constructing it from args on first sight.
+	// Returns nullptr when the table is full.
+	template <typename... Args>
+	Value* FindOrInsert(uint64_t device, Args&&... args) {
+		for (size_t i = Home(device);; i = (i + 1) & kMask) {
+			if (m_devices[i] == device) {
+				return &m_slots[i].value;
+			}
+			if (m_devices[i] == kNoDevice) {
+				if (m_size == kMaxSize || device == kNoDevice) {
+					return nullptr;
+				}
+				m_devices[i] = device;
+				m_slots[i].value = Value(std::forward<Args>(args)...);
+				m_size++;
+				return &m_slots[i].value;
+			}
+		}
+	}
+
+	// Forgets a device, e.g. when it is unplugged. Uses backward-shift deletion so no tombstones build up.
+	bool Erase(uint64_t device) {
+		if (device == kNoDevice) {
+			return false;
+		}
+		size_t i = Home(device);
+		for (;; i = (i + 1) & kMask) {
+			if (m_devices[i] == kNoDevice) {
+				return false;
+			}
+			if (m_devices[i] == device) {
+				break;
+			}
+		}
+		for (size_t j = (i + 1) & kMask; m_devices[j] != kNoDevice; j = (j + 1) & kMask) {
+			// move j into the hole at i unless j's home lies cyclically in (i, j]
+			const size_t home = Home(m_devices[j]);
+			if (((j - home) & kMask) >= ((j - i) & kMask)) {
+				m_devices[i] = m_devices[j];
+				m_slots[i] = m_slots[j];
+				i = j;
+			}
+		}
+		m_devices[i] = kNoDevice;
+		m_size--;
+		return true;
+	}
+
+	size_t Size() const { return m_size; }
+	static constexpr size_t MaxSize() { return kMaxSize; }
+
+private:
+	static constexpr size_t kMask = Capacity - 1;
+	// never filling past 3/4 keeps probe chains short and guarantees every probe loop hits an empty slot
+	static constexpr size_t kMaxSize = Capacity - Capacity / 4;
+
+	struct alignas(kCacheLineSize) Slot {
+		Value value{};
+	};
+
+	static size_t Home(uint64_t device) {
+		// splitmix64 finalizer: handles are pointer-like and share their low bits
+		device ^= device >> 30;
+		device *= 0xBF58476D1CE4E5B9ull;
+		device ^= device >> 27;
+		device *= 0x94D049BB133111EBull;
+		device ^= device >> 31;
+		return (size_t)device & kMask;
+	}
+
+	alignas(kCacheLineSize) std::array<uint64_t, Capacity> m_devices;
+	std::array<Slot, Capacity> m_slots{};
+	size_t m_size = 0;
+};
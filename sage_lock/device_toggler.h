@@ -0,0 +1,45 @@
+/////////////
+// device_toggler.h : Pluggable backends that enable or disable a single touch device.
+// Windows provides pnputil (process spawn) and setupapi (in-process) backends in sage_lock.cpp,
+// Linux provides the evdev "inhibited" sysfs backend.
+//////
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Device ids as handed to a toggler. Immutable once shared, so a list can be read without locks.
+// The registry's lists view ids in its DeviceIdTable and must not outlive the registry.
+using DeviceList = std::shared_ptr<const std::vector<std::string_view>>;
+
+// A list that owns its ids, for callers without a registry.
+inline DeviceList MakeDeviceList(std::vector<std::string> ids) {
+	struct Owned {
+		std::vector<std::string> ids;
+		std::vector<std::string_view> views;
+	};
+	auto owned = std::make_shared<Owned>();
+	owned->ids = std::move(ids);
+	owned->views.assign(owned->ids.begin(), owned->ids.end());
+	return DeviceList(owned, &owned->views);
+}
+
+class DeviceToggler {
+public:
+	virtual ~DeviceToggler() = default;
+
+	// Short backend name used to select it at startup and in logs.
+	virtual const char* Name() const = 0;
+	// Enables or disables one device. Returns false if the device could not be toggled.
+	// Called concurrently from the toggle fan-out workers, so implementations must be thread safe.
+	virtual bool Toggle(std::string_view deviceId, bool enable) = 0;
+};
+
+#ifdef __linux__
+// Writes /sys/class/input/<deviceId>/inhibited, where deviceId is an input node name such as "input7".
+// The root is configurable so the backend can be pointed at a fake sysfs tree.
+std::unique_ptr<DeviceToggler> CreateSysfsInhibitToggler(std::string sysfsInputRoot = "/sys/class/input");
+#endif
@@ -0,0 +1,48 @@
+/////////////
+// device_toggler_linux.cpp : Linux device toggler backed by the evdev "inhibited" sysfs attribute.
+// An inhibited input device stops delivering events without being unbound, so a lock is an open/write/close.
+//////
+
+#include "device_toggler.h"
+#include "trace_spans.h"
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+class SysfsInhibitToggler : public DeviceToggler {
+public:
+	explicit SysfsInhibitToggler(std::string root)
+		: m_root(std::move(root)) {
+	}
+
+	const char* Name() const override { return "sysfs"; }
+
+	bool Toggle(std::string_view deviceId, bool enable) override {
+		SAGE_SPAN("sysfs inhibit");
+		char path[512];
+		int len = snprintf(path, sizeof(path), "%s/%.*s/inhibited", m_root.c_str(), (int)deviceId.size(), deviceId.data());
+		if (len < 0 || len >= (int)sizeof(path)) {
+			return false;
+		}
+		int fd = open(path, O_WRONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return false;
+		}
+		// enabling a device means lifting the inhibit
+		const char value = enable ? '0' : '1';
+		bool ok = write(fd, &value, 1) == 1;
+		close(fd);
+		return ok;
+	}
+
+private:
+	const std::string m_root;
+};
+
+}
+
+std::unique_ptr<DeviceToggler> CreateSysfsInhibitToggler(std::string sysfsInputRoot) {
+	return std::make_unique<SysfsInhibitToggler>(std::move(sysfsInputRoot));
+}
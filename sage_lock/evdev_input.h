@@ -0,0 +1,101 @@
+/////////////
+// evdev_input.h : Linux input backend. One edge-triggered epoll loop multiplexes every keyboard that
+// can send volume keys and turns their evdev events into KeyEvents. Linux only.
+//
+// Any fd carrying struct input_event records works as a device, so pipes and socketpairs stand in
+// for /dev/input nodes in the bench.
+//
+// Keyboards are opened with an EVIOCSMASK filter that lets only the gesture keys through. The
+// kernel drops everything else, including the SYN_REPORT of a packet left empty, so ordinary
+// typing never wakes the loop.
+//////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <linux/input.h>
+#include <vector>
+#include "key_event.h"
+
+// Counted on the Run thread; read them from there or after Run returns.
+struct EvdevStats {
+	uint64_t wakeups = 0;   // epoll_wait returns
+	uint64_t reads = 0;     // read() calls on device fds, each draining up to a batch of records
+	uint64_t events = 0;    // input_event records read
+	uint64_t keyEvents = 0; // records passed on as KeyEvents
+	uint64_t unmaskedDevices = 0; // keyboards whose kernel has no EVIOCSMASK (before Linux 4.4)
+	uint64_t maskFailures = 0;    // keyboards where EVIOCSMASK failed for any other reason; also left unmasked
+	uint64_t clockFallbacks = 0;  // keyboards that refused EVIOCSCLOCKID; their events are stamped as read
+};
+
+// The events EvdevInput asks the kernel to deliver: gesture keys and SYN.
+bool EvdevWanted(uint16_t type, uint16_t code);
+
+class EvdevInput {
+public:
+	static constexpr size_t kMaxReadBatch = 64;
+
+	using EventFn = std::function<void(const KeyEvent&)>;
+	using RemovedFn = std::function<void(uint64_t device)>;
+
+	// onEvent runs on the thread that calls Run.
+	explicit EvdevInput(EventFn onEvent);
+	~EvdevInput();
+
+	EvdevInput(const EvdevInput&) = delete;
+	EvdevInput& operator=(const EvdevInput&) = delete;
+
+	// Called on the Run thread when a device goes away (unplugged, or EOF on a pipe).
+	void SetRemovedCallback(RemovedFn onRemoved) { m_onRemoved = std::move(onRemoved); }
+
+	// Creates the epoll instance and the stop eventfd. Returns false if either fails.
+	bool Init();
+	// Records drained per read(), 1 to kMaxReadBatch; the default is kMaxReadBatch.
+	void SetReadBatch(size_t events) { m_readBatch = events < 1 ? 1 : events > kMaxReadBatch ? kMaxReadBatch : events; }
+	// Kernel-side filtering for keyboards opened afterwards; on by default.
+	void SetKernelMasking(bool enabled) { m_masking = enabled; }
+	// Opens every event node under dir that reports KEY_VOLUMEUP or KEY_VOLUMEDOWN.
+	// Returns the number of keyboards added.
+	size_t OpenKeyboards(const char* dir = "/dev/input");
+	// Opens one event node the same way. Fails if it cannot be opened or has no volume keys.
+	bool OpenKeyboard(const char* path);
+	// Watches an already open fd and takes ownership of it. The fd is made non-blocking.
+	// Event timestamps are taken from the records, so writers to a pipe must stamp them with
+	// CLOCK_MONOTONIC; with recordTimes false they are ignored and events are stamped as they are read.
+	bool AddFd(int fd, uint64_t device, bool recordTimes = true);
+
+	// Dispatches events until Stop is called.
+	void Run();
+	// Safe from any thread and from a signal handler.
+	void Stop();
+
+	size_t DeviceCount() const { return m_open; }
+	const EvdevStats& Stats() const { return m_stats; }
+
+private:
+	struct Device {
+		int fd;
+		uint64_t device;
+		bool recordTimes; // the records' timestamps are on CLOCK_MONOTONIC
+	};
+
+	// Reads until the fd is empty; returns false once the device is gone.
+	bool Drain(const Device& device, bool hangup);
+	void RemoveDevice(size_t index);
+	// Masks out every event type and code the gesture engine ignores. Returns 0 or the errno of the
+	// first failure; ENOTTY means the kernel predates EVIOCSMASK.
+	int ApplyMask(int fd);
+
+	EventFn m_onEvent;
+	RemovedFn m_onRemoved;
+	int m_epoll = -1;
+	int m_stopEvent = -1;
+	std::vector<Device> m_devices; // fd -1 marks a free slot; the slot index is the epoll tag
+	size_t m_open = 0;
+	bool m_masking = true;
+	size_t m_readBatch = kMaxReadBatch;
+	input_event m_buffer[kMaxReadBatch]; // one burst from one device
+	EvdevStats m_stats;
+};
@@ -0,0 +1,273 @@
+/////////////
+// evdev_input_linux.cpp : epoll-driven evdev reader for the Linux daemon.
+//////
+
+#include "evdev_input.h"
+#include "clock.h"
+#include "trace_spans.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint64_t kStopTag = ~0ull;
+constexpr size_t kLongBits = sizeof(unsigned long) * 8;
+
+bool TestBit(const unsigned long* bits, unsigned bit) {
+	return (bits[bit / kLongBits] >> (bit % kLongBits)) & 1;
+}
+
+constexpr uint16_t kGestureKeyCodes[] = { KEY_VOLUMEUP, KEY_VOLUMEDOWN, KEY_MUTE };
+
+bool ToGestureKey(uint16_t code, GestureKey& key) {
+	switch (code) {
+	case KEY_VOLUMEUP: key = GestureKey::VolumeUp; return true;
+	case KEY_VOLUMEDOWN: key = GestureKey::VolumeDown; return true;
+	case KEY_MUTE: key = GestureKey::VolumeMute; return true;
+	default: return false;
+	}
+}
+
+// Types evdev keeps a per-code mask for. EV_REP, EV_PWR and EV_FF_STATUS have none, and EVIOCSMASK
+// rejects them with EINVAL.
+bool HasCodeMask(unsigned type) {
+	switch (type) {
+	case EV_KEY: case EV_REL: case EV_ABS: case EV_MSC: case EV_SW: case EV_LED: case EV_SND: case EV_FF:
+		return true;
+	default:
+		return false;
+	}
+}
+
+}
+
+bool EvdevWanted(uint16_t type, uint16_t code) {
+	GestureKey key;
+	return type == EV_SYN || (type == EV_KEY && ToGestureKey(code, key));
+}
+
+int EvdevInput::ApplyMask(int fd) {
+	unsigned long types[EV_MAX / kLongBits + 1] = {};
+	if (ioctl(fd, EVIOCGBIT(0, sizeof(types)), types) < 0) {
+		return errno;
+	}
+	// SYN stays unmasked: evdev only wakes readers on a SYN_REPORT, and drops it when its packet is empty
+	for (unsigned type = EV_SYN + 1; type <= EV_MAX; type++) {
+		if (!TestBit(types, type) || !HasCodeMask(type)) {
+			continue;
+		}
+		unsigned long codes[KEY_MAX / kLongBits + 1] = {};
+		if (type == EV_KEY) {
+			for (auto code : kGestureKeyCodes) {
+				codes[code / kLongBits] |= 1ul << (code % kLongBits);
+			}
+		}
+		input_mask mask = {};
+		mask.type = type;
+		mask.codes_size = sizeof(codes);
+		mask.codes_ptr = (uint64_t)(uintptr_t)codes;
+		if (ioctl(fd, EVIOCSMASK, &mask) < 0) {
+			return errno;
+		}
+	}
+	return 0;
+}
+
+EvdevInput::EvdevInput(EventFn onEvent)
+	: m_onEvent(std::move(onEvent)) {
+}
+
+EvdevInput::~EvdevInput() {
+	for (const auto& device : m_devices) {
+		if (device.fd >= 0) {
+			close(device.fd);
+		}
+	}
+	if (m_stopEvent >= 0) {
+		close(m_stopEvent);
+	}
+	if (m_epoll >= 0) {
+		close(m_epoll);
+	}
+}
+
+bool EvdevInput::Init() {
+	m_epoll = epoll_create1(EPOLL_CLOEXEC);
+	m_stopEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (m_epoll < 0 || m_stopEvent < 0) {
+		return false;
+	}
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.u64 = kStopTag;
+	return epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_stopEvent, &ev) == 0;
+}
+
+size_t EvdevInput::OpenKeyboards(const char* dir) {
+	DIR* input = opendir(dir);
+	if (input == nullptr) {
+		return 0;
+	}
+	size_t added = 0;
+	while (dirent* entry = readdir(input)) {
+		if (strncmp(entry->d_name, "event", 5) != 0) {
+			continue;
+		}
+		char path[512];
+		int len = snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		added += len > 0 && len < (int)sizeof(path) && OpenKeyboard(path);
+	}
+	closedir(input);
+	return added;
+}
+
+bool EvdevInput::OpenKeyboard(const char* path) {
+	int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	unsigned long types[EV_MAX / kLongBits + 1] = {};
+	unsigned long keys[KEY_MAX / kLongBits + 1] = {};
+	struct stat st;
+	if (ioctl(fd, EVIOCGBIT(0, sizeof(types)), types) < 0 || !TestBit(types, EV_KEY) ||
+		ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) < 0 ||
+		!(TestBit(keys, KEY_VOLUMEUP) || TestBit(keys, KEY_VOLUMEDOWN)) ||
+		fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+	// kernel timestamps default to CLOCK_REALTIME; ask for the clock the rest of the pipeline uses.
+	// Without it (before Linux 3.4) the records' times cannot be compared with MonotonicNowNs, so the
+	// events are stamped as they are read instead.
+	int clockId = CLOCK_MONOTONIC;
+	const bool recordTimes = ioctl(fd, EVIOCSCLOCKID, &clockId) == 0;
+	if (!recordTimes) {
+		m_stats.clockFallbacks++;
+	}
+	if (m_masking) {
+		// either way the keyboard still works, it just wakes the loop for every key
+		const int error = ApplyMask(fd);
+		if (error == ENOTTY) {
+			m_stats.unmaskedDevices++;
+		}
+		else if (error != 0) {
+			m_stats.maskFailures++;
+		}
+	}
+	return AddFd(fd, (uint64_t)st.st_rdev, recordTimes);
+}
+
+bool EvdevInput::AddFd(int fd, uint64_t device, bool recordTimes) {
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	size_t index = 0;
+	while (index < m_devices.size() && m_devices[index].fd >= 0) {
+		index++;
+	}
+	if (index == m_devices.size()) {
+		m_devices.push_back({ -1, 0, true });
+	}
+	epoll_event ev = {};
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.u64 = index;
+	if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		close(fd);
+		return false;
+	}
+	m_devices[index] = { fd, device, recordTimes };
+	m_open++;
+	return true;
+}
+
+void EvdevInput::Run() {
+	epoll_event ready[16];
+	for (;;) {
+		int count = epoll_wait(m_epoll, ready, 16, -1);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		m_stats.wakeups++;
+		for (int i = 0; i < count; i++) {
+			if (ready[i].data.u64 == kStopTag) {
+				uint64_t value;
+				read(m_stopEvent, &value, sizeof(value));
+				return;
+			}
+			const size_t index = (size_t)ready[i].data.u64;
+			const bool hangup = (ready[i].events & (EPOLLHUP | EPOLLERR)) != 0;
+			if (m_devices[index].fd >= 0 && !Drain(m_devices[index], hangup)) {
+				RemoveDevice(index);
+			}
+		}
+	}
+}
+
+void EvdevInput::Stop() {
+	const uint64_t one = 1;
+	write(m_stopEvent, &one, sizeof(one));
+}
+
+bool EvdevInput::Drain(const Device& device, bool hangup) {
+	// edge triggered: the fd only signals again once it has been read dry. evdev and pipes both hand
+	// over everything queued in one read, so a short read means the fd is empty and saves the
+	// extra read() that would only return EAGAIN. After a hangup, read on to the EOF or ENODEV.
+	const size_t capacity = m_readBatch * sizeof(input_event);
+	for (;;) {
+		ssize_t got;
+		{
+			SAGE_SPAN("evdev read");
+			got = read(device.fd, m_buffer, capacity);
+		}
+		m_stats.reads++;
+		if (got < 0) {
+			return errno == EAGAIN || errno == EINTR; // ENODEV once the device is unplugged
+		}
+		if (got == 0 || got % sizeof(input_event) != 0) {
+			return false; // EOF, or a torn record from a broken writer
+		}
+		const size_t count = (size_t)got / sizeof(input_event);
+		m_stats.events += count;
+		const uint64_t readNs = device.recordTimes ? 0 : MonotonicNowNs();
+		for (size_t i = 0; i < count; i++) {
+			const input_event& ev = m_buffer[i];
+			GestureKey key;
+			if (ev.type != EV_KEY || !ToGestureKey(ev.code, key)) {
+				continue;
+			}
+			m_stats.keyEvents++;
+			KeyEvent event;
+			event.timeNs = device.recordTimes ? (uint64_t)ev.input_event_sec * 1000000000ull + (uint64_t)ev.input_event_usec * 1000 : readNs;
+			event.device = device.device;
+			event.key = key;
+			// value 2 is autorepeat; it is passed on as a press and the gesture engine drops it
+			event.down = ev.value != 0;
+			m_onEvent(event);
+		}
+		if ((size_t)got < capacity && !hangup) {
+			return true;
+		}
+	}
+}
+
+void EvdevInput::RemoveDevice(size_t index) {
+	Device& device = m_devices[index];
+	epoll_ctl(m_epoll, EPOLL_CTL_DEL, device.fd, nullptr);
+	close(device.fd);
+	device.fd = -1;
+	m_open--;
+	if (m_onRemoved) {
+		m_onRemoved(device.device);
+	}
+}
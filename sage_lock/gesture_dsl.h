@@ -0,0 +1,180 @@
+/////////////
+// gesture_dsl.h : Text form of gestures, parsed and compiled into a GestureSet at compile time.
+//
+//   "VOLUP VOLDOWN VOLUP VOLDOWN within 2000ms, max gap 500ms"
+//
+// Keys are VOLUP, VOLDOWN and MUTE. "within" bounds first to last press, "max gap" bounds the time
+// between two presses; each may be given once, accepts us, ms or s and defaults to unlimited.
+// ParseGesture also works at runtime for gestures read from configuration.
+//////
+
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <string_view>
+#include "gesture_matcher.h"
+
+// The gesture sage_lock has always used to toggle the lock.
+inline constexpr std::string_view kToggleGestureDsl = "VOLUP VOLDOWN VOLUP VOLDOWN within 2000ms, max gap 500ms";
+
+struct GestureParseResult {
+	GestureSpec spec;
+	const char* error = nullptr; // nullptr on success
+};
+
+namespace gesture_dsl_detail {
+
+constexpr bool IsSeparator(char c) {
+	return c == ' ' || c == '\t' || c == ',';
+}
+
+// Splits off the next token, skipping spaces and commas.
+constexpr std::string_view NextToken(std::string_view& text) {
+	size_t begin = 0;
+	while (begin < text.size() && IsSeparator(text[begin])) {
+		begin++;
+	}
+	size_t end = begin;
+	while (end < text.size() && !IsSeparator(text[end])) {
+		end++;
+	}
+	std::string_view token = text.substr(begin, end - begin);
+	text.remove_prefix(end);
+	return token;
+}
+
+enum class DurationParse {
+	Ok,
+	Malformed,
+	OutOfRange, // more nanoseconds than a uint64_t holds
+};
+
+// Parses "500ms", "2s", "250us" or "500 ms" into nanoseconds.
+constexpr DurationParse ParseDuration(std::string_view& text, uint64_t& ns) {
+	constexpr uint64_t kMax = std::numeric_limits<uint64_t>::max();
+	std::string_view token = NextToken(text);
+	size_t digits = 0;
+	uint64_t value = 0;
+	bool overflow = false;
+	while (digits < token.size() && token[digits] >= '0' && token[digits] <= '9') {
+		const uint64_t digit = (uint64_t)(token[digits] - '0');
+		overflow |= value > (kMax - digit) / 10;
+		value = value * 10 + digit;
+		digits++;
+	}
+	if (digits == 0) {
+		return DurationParse::Malformed;
+	}
+	std::string_view unit = token.substr(digits);
+	if (unit.empty()) {
+		std::string_view rest = text;
+		unit = NextToken(rest);
+		if (unit == "us" || unit == "ms" || unit == "s") {
+			text = rest;
+		}
+	}
+	uint64_t scale = 0;
+	if (unit == "us") {
+		scale = 1000;
+	}
+	else if (unit == "ms") {
+		scale = 1000000;
+	}
+	else if (unit == "s") {
+		scale = 1000000000;
+	}
+	else {
+		return DurationParse::Malformed;
+	}
+	if (overflow || value > kMax / scale) {
+		return DurationParse::OutOfRange;
+	}
+	ns = value * scale;
+	return DurationParse::Ok;
+}
+
+}
+
+constexpr GestureParseResult ParseGesture(std::string_view text) {
+	using namespace gesture_dsl_detail;
+	GestureParseResult result;
+	result.spec.windowNs = std::numeric_limits<uint64_t>::max();
+	result.spec.maxGapNs = std::numeric_limits<uint64_t>::max();
+	bool haveWindow = false;
+	bool haveMaxGap = false;
+
+	for (std::string_view token = NextToken(text); !token.empty(); token = NextToken(text)) {
+		GestureKey key = GestureKey::Count;
+		if (token == "VOLUP") {
+			key = GestureKey::VolumeUp;
+		}
+		else if (token == "VOLDOWN") {
+			key = GestureKey::VolumeDown;
+		}
+		else if (token == "MUTE") {
+			key = GestureKey::VolumeMute;
+		}
+
+		if (key != GestureKey::Count) {
+			if (result.spec.length == kMaxGestureLength) {
+				result.error = "gesture is too long";
+				return result;
+			}
+			result.spec.keys[result.spec.length++] = key;
+		}
+		else if (token == "within") {
+			if (haveWindow) {
+				result.error = "'within' given twice";
+				return result;
+			}
+			haveWindow = true;
+			const DurationParse parsed = ParseDuration(text, result.spec.windowNs);
+			if (parsed != DurationParse::Ok) {
+				result.error = parsed == DurationParse::OutOfRange ? "duration out of range" : "expected a duration after 'within'";
+				return result;
+			}
+		}
+		else if (token == "max") {
+			if (haveMaxGap) {
+				result.error = "'max gap' given twice";
+				return result;
+			}
+			haveMaxGap = true;
+			const DurationParse parsed = NextToken(text) != "gap" ? DurationParse::Malformed : ParseDuration(text, result.spec.maxGapNs);
+			if (parsed != DurationParse::Ok) {
+				result.error = parsed == DurationParse::OutOfRange ? "duration out of range" : "expected 'max gap <duration>'";
+				return result;
+			}
+		}
+		else {
+			result.error = "unknown token";
+			return result;
+		}
+	}
+	if (result.spec.length == 0) {
+		result.error = "gesture has no keys";
+	}
+	return result;
+}
+
+// Compile-time only: a malformed gesture or an overfull set fails the build.
+consteval GestureSpec CompileGesture(std::string_view text) {
+	GestureParseResult result = ParseGesture(text);
+	if (result.error != nullptr) {
+		throw result.error;
+	}
+	return result.spec;
+}
+
+// Gesture indices follow the order of the texts.
+consteval GestureSet CompileGestures(std::initializer_list<std::string_view> texts) {
+	GestureSet set;
+	for (auto text : texts) {
+		if (set.Add(CompileGesture(text)) < 0) {
+			throw "too many gestures";
+		}
+	}
+	return set;
+}
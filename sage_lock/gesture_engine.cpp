@@ -0,0 +1,34 @@
+/////////////
+// gesture_engine.cpp : Per-device gesture matching over the merged key event stream.
+//////
+
+#include "gesture_engine.h"
+
+GestureEngine::GestureEngine(const GestureSet& gestures)
+	: m_gestures(gestures), m_overflow(gestures) {
+}
+
+int GestureEngine::OnKeyEvent(const KeyEvent& event) {
+	DeviceInput* input = m_devices.FindOrInsert(event.device, m_gestures);
+	if (input == nullptr) {
+		input = &m_overflow;
+	}
+	if (!event.down) {
+		if (input->heldKey == event.key) {
+			input->heldKey = GestureKey::Count;
+		}
+		m_stats.releases++;
+		return -1;
+	}
+	if (input->heldKey == event.key) {
+		m_stats.repeatsDropped++;
+		return -1;
+	}
+	input->heldKey = event.key;
+	m_stats.presses++;
+	return input->matcher.OnKey(event.key, event.timeNs);
+}
+
+void GestureEngine::ForgetDevice(uint64_t device) {
+	m_devices.Erase(device);
+}
@@ -0,0 +1,55 @@
+/////////////
+// gesture_engine.h : Turns the stream of key events from every keyboard into gesture matches.
+// Shared by the daemon's input path and the offline trace replay.
+//
+// Holding a key makes the keyboard autorepeat it: more key-downs with no key-up in between. The
+// engine tracks the held key per device and drops those repeats before they reach the matcher,
+// so a held volume key costs one table lookup per repeat and can never complete a gesture.
+//////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "device_state_table.h"
+#include "gesture_matcher.h"
+#include "key_event.h"
+
+struct KeyFilterStats {
+	uint64_t presses = 0;        // key-downs passed to the matcher
+	uint64_t releases = 0;
+	uint64_t repeatsDropped = 0; // autorepeat key-downs filtered out
+};
+
+class GestureEngine {
+public:
+	static constexpr size_t kDeviceCapacity = 1024;
+
+	// The set must outlive the engine. The engine is large; keep it static or on the heap.
+	explicit GestureEngine(const GestureSet& gestures);
+
+	// Returns the index of the gesture this event completes on its device, or -1.
+	int OnKeyEvent(const KeyEvent& event);
+	// Drops a device's partial gestures, e.g. when it is unplugged.
+	void ForgetDevice(uint64_t device);
+
+	const GestureSet& Gestures() const { return m_gestures; }
+	// Input thread only.
+	const KeyFilterStats& Stats() const { return m_stats; }
+
+private:
+	struct DeviceInput {
+		DeviceInput() = default;
+		explicit DeviceInput(const GestureSet& gestures) : matcher(gestures) {}
+
+		GestureMatcher matcher;
+		// keyboards only autorepeat the most recently pressed key, so one held key per device is enough
+		GestureKey heldKey = GestureKey::Count;
+	};
+
+	const GestureSet& m_gestures;
+	// each keyboard gets its own matcher so presses from two keyboards can't complete each other's gesture
+	DeviceStateTable<DeviceInput, kDeviceCapacity> m_devices;
+	DeviceInput m_overflow; // shared by keyboards beyond the table's capacity
+	KeyFilterStats m_stats;
+};
@@ -0,0 +1,193 @@
+/////////////
+// gesture_matcher.h : Bit-parallel (Shift-And) matcher for volume key gestures.
+// Every configured gesture is packed into one bitmask, so each key event costs the same few
+// word operations no matter how many gestures are being tracked.
+//
+// Gesture positions are laid out back to back in one bitmask. A set bit in the active mask means
+// "the last keys match this gesture up to this position". Per key press:
+//   active = ((active & survivors(gap)) << 1 | starts) & keyMask[key]
+// and any active end-of-gesture bit is a candidate match, confirmed against the gesture's window.
+// All timestamps are monotonic nanoseconds. The matcher is constexpr so its timing can be
+// checked at compile time against a virtual clock.
+//////
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+enum class GestureKey : uint8_t {
+	VolumeUp,
+	VolumeDown,
+	VolumeMute,
+	Count,
+};
+
+constexpr size_t kGestureKeyCount = (size_t)GestureKey::Count;
+constexpr size_t kGestureWords = 2;
+constexpr size_t kMaxGesturePositions = kGestureWords * 64;
+constexpr size_t kMaxGestureLength = 16;
+constexpr size_t kMaxGestures = 32;
+constexpr size_t kMaxGapClasses = 8;
+
+struct GestureSpec {
+	std::array<GestureKey, kMaxGestureLength> keys{};
+	uint8_t length = 0;
+	uint64_t windowNs = 0; // first to last key of the gesture
+	uint64_t maxGapNs = 0; // between two consecutive keys
+};
+
+// One bit per gesture position.
+struct GestureBits {
+	std::array<uint64_t, kGestureWords> w{};
+
+	constexpr bool Any() const {
+		uint64_t any = 0;
+		for (auto word : w) {
+			any |= word;
+		}
+		return any != 0;
+	}
+	constexpr bool Test(size_t bit) const { return (w[bit / 64] >> (bit % 64)) & 1; }
+	constexpr void Set(size_t bit) { w[bit / 64] |= 1ull << (bit % 64); }
+};
+
+// The compiled, read-only form of a set of gestures: one position mask per key is the whole
+// transition table. Everything here is constexpr so gesture sets can be built at compile time.
+class GestureSet {
+public:
+	// Returns the gesture index, or -1 if the set is out of positions, gestures or gap classes.
+	constexpr int Add(const GestureSpec& spec);
+
+	constexpr size_t Count() const { return m_count; }
+	constexpr size_t Positions() const { return m_positions; }
+	constexpr const GestureSpec& Spec(size_t gesture) const { return m_specs[gesture]; }
+	constexpr const GestureBits& KeyMask(GestureKey key) const { return m_keyMask[(size_t)key]; }
+	constexpr const GestureBits& StartMask() const { return m_startMask; }
+	constexpr const GestureBits& EndMask() const { return m_endMask; }
+
+private:
+	friend class GestureMatcher;
+
+	struct GapClass {
+		uint64_t maxGapNs = 0;
+		GestureBits positions; // every position of every gesture with this max gap
+	};
+
+	std::array<GestureBits, kGestureKeyCount> m_keyMask{};
+	GestureBits m_startMask;
+	GestureBits m_endMask;
+	std::array<GapClass, kMaxGapClasses> m_gapClasses{};
+	size_t m_gapClassCount = 0;
+	std::array<uint8_t, kMaxGesturePositions> m_gestureAt{};
+	std::array<GestureSpec, kMaxGestures> m_specs{};
+	size_t m_count = 0;
+	size_t m_positions = 0;
+};
+
+// Matching state for one key stream.
+class GestureMatcher {
+public:
+	// An unbound matcher is only a placeholder, e.g. an empty slot in a per-device table.
+	constexpr GestureMatcher() = default;
+	constexpr explicit GestureMatcher(const GestureSet& set) : m_set(&set) {}
+
+	// Feeds one key press stamped with its arrival time. Returns the index of the gesture it
+	// completes, or -1. A match clears all partial matches, so the next gesture needs fresh presses.
+	constexpr int OnKey(GestureKey key, uint64_t timeNs);
+	constexpr void Reset();
+
+private:
+	const GestureSet* m_set = nullptr;
+	GestureBits m_active;
+	uint64_t m_lastTimeNs = 0;
+	bool m_hasLast = false;
+	// timestamps of the most recent key presses, for the whole-gesture window
+	std::array<uint64_t, kMaxGestureLength> m_recent{};
+	uint32_t m_recentCount = 0;
+};
+
+constexpr int GestureSet::Add(const GestureSpec& spec) {
+	if (spec.length == 0 || spec.length > kMaxGestureLength ||
+		m_count == kMaxGestures || m_positions + spec.length > kMaxGesturePositions) {
+		return -1;
+	}
+
+	size_t gapClass = 0;
+	while (gapClass < m_gapClassCount && m_gapClasses[gapClass].maxGapNs != spec.maxGapNs) {
+		gapClass++;
+	}
+	if (gapClass == m_gapClassCount) {
+		if (m_gapClassCount == kMaxGapClasses) {
+			return -1;
+		}
+		m_gapClasses[m_gapClassCount++].maxGapNs = spec.maxGapNs;
+	}
+
+	const int gesture = (int)m_count++;
+	m_specs[gesture] = spec;
+	m_startMask.Set(m_positions);
+	m_endMask.Set(m_positions + spec.length - 1);
+	for (size_t i = 0; i < spec.length; i++) {
+		const size_t pos = m_positions + i;
+		m_keyMask[(size_t)spec.keys[i]].Set(pos);
+		m_gapClasses[gapClass].positions.Set(pos);
+		m_gestureAt[pos] = (uint8_t)gesture;
+	}
+	m_positions += spec.length;
+	return gesture;
+}
+
+constexpr void GestureMatcher::Reset() {
+	m_active = {};
+	m_hasLast = false;
+	m_recentCount = 0;
+}
+
+constexpr int GestureMatcher::OnKey(GestureKey key, uint64_t timeNs) {
+	const GestureSet& set = *m_set;
+
+	// partial matches of gestures whose max gap was exceeded die before the shift
+	if (m_hasLast) {
+		const uint64_t gap = timeNs - m_lastTimeNs;
+		for (size_t c = 0; c < set.m_gapClassCount; c++) {
+			if (gap > set.m_gapClasses[c].maxGapNs) {
+				for (size_t w = 0; w < kGestureWords; w++) {
+					m_active.w[w] &= ~set.m_gapClasses[c].positions.w[w];
+				}
+			}
+		}
+	}
+	m_lastTimeNs = timeNs;
+	m_hasLast = true;
+	m_recent[m_recentCount++ % kMaxGestureLength] = timeNs;
+
+	const GestureBits& keyMask = set.m_keyMask[(size_t)key];
+	uint64_t carry = 0;
+	uint64_t ends = 0;
+	for (size_t w = 0; w < kGestureWords; w++) {
+		const uint64_t word = m_active.w[w];
+		m_active.w[w] = ((word << 1) | carry | set.m_startMask.w[w]) & keyMask.w[w];
+		carry = word >> 63;
+		ends |= m_active.w[w] & set.m_endMask.w[w];
+	}
+	if (ends == 0) {
+		return -1;
+	}
+
+	for (size_t w = 0; w < kGestureWords; w++) {
+		for (uint64_t candidates = m_active.w[w] & set.m_endMask.w[w]; candidates != 0; candidates &= candidates - 1) {
+			const size_t pos = w * 64 + std::countr_zero(candidates);
+			const int gesture = set.m_gestureAt[pos];
+			const GestureSpec& spec = set.m_specs[gesture];
+			const uint64_t firstTimeNs = m_recent[(m_recentCount - spec.length) % kMaxGestureLength];
+			if (timeNs - firstTimeNs <= spec.windowNs) {
+				Reset();
+				return gesture;
+			}
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,151 @@
+/////////////
+// hid_descriptor.h : Classifies a HID device straight from its report descriptor bytes.
+//
+// Only the top-level application collections matter: each one is a separate function of the
+// device (a keyboard, a touch screen, a pen, ...), identified by the usage page and usage in
+// effect when the collection opens. The parser walks the items once, keeps the global usage
+// page (with Push/Pop) and the first local usage, and never allocates. It is constexpr, so a
+// descriptor known at build time can be classified at build time too.
+//////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+enum class HidClass : uint8_t {
+	TouchScreen,
+	HeatMap,    // capacitive heat map digitizer (Surface touch screens)
+	MultiPoint,
+	Pen,
+	TouchPad,
+	Count,
+};
+
+struct HidClassification {
+	uint8_t classes = 0; // one bit per HidClass
+	uint8_t applications = 0; // top-level application collections seen
+	const char* error = nullptr; // nullptr for a well-formed descriptor
+
+	constexpr bool Has(HidClass c) const { return (classes >> (unsigned)c) & 1; }
+	// The classes GetTouchScreens has always locked.
+	constexpr bool IsTouchTarget() const {
+		return error == nullptr && (Has(HidClass::TouchScreen) || Has(HidClass::HeatMap) || Has(HidClass::MultiPoint));
+	}
+};
+
+constexpr uint16_t kHidPageDigitizer = 0x0D;
+constexpr size_t kHidMaxDescriptorSize = 4096; // HID_MAX_DESCRIPTOR_SIZE on Linux
+
+namespace hid_descriptor_detail {
+
+constexpr int kMaxGlobalStack = 8;
+
+// Application usages on the digitizer page that map to a class.
+constexpr int DigitizerClass(uint16_t usage) {
+	switch (usage) {
+	case 0x02: return (int)HidClass::Pen;
+	case 0x04: return (int)HidClass::TouchScreen;
+	case 0x05: return (int)HidClass::TouchPad;
+	case 0x0C: return (int)HidClass::MultiPoint;
+	case 0x0F: return (int)HidClass::HeatMap;
+	default: return -1;
+	}
+}
+
+}
+
+constexpr HidClassification ClassifyHidDescriptor(std::span<const uint8_t> descriptor) {
+	using namespace hid_descriptor_detail;
+	HidClassification result;
+	uint16_t usagePages[kMaxGlobalStack] = {}; // [0] is current, the rest are pushed
+	int globalDepth = 0;
+	uint32_t firstUsage = 0; // (page << 16) | usage; page 0 means "the current usage page"
+	bool haveUsage = false;
+	int collectionDepth = 0;
+
+	for (size_t i = 0; i < descriptor.size();) {
+		const uint8_t prefix = descriptor[i++];
+		if (prefix == 0xFE) {
+			// long item: size, tag, data; reserved by the spec and skipped
+			if (i + 2 > descriptor.size() || i + 2 + descriptor[i] > descriptor.size()) {
+				result.error = "truncated long item";
+				return result;
+			}
+			i += 2 + descriptor[i];
+			continue;
+		}
+		const size_t size = (prefix & 3) == 3 ? 4 : (prefix & 3);
+		if (i + size > descriptor.size()) {
+			result.error = "truncated item";
+			return result;
+		}
+		uint32_t data = 0;
+		for (size_t b = 0; b < size; b++) {
+			data |= (uint32_t)descriptor[i + b] << (8 * b);
+		}
+		i += size;
+
+		const uint8_t type = (prefix >> 2) & 3;
+		const uint8_t tag = prefix >> 4;
+		if (type == 1) { // global
+			if (tag == 0x0) {
+				usagePages[globalDepth] = (uint16_t)data;
+			}
+			else if (tag == 0xA) { // push
+				if (globalDepth + 1 == kMaxGlobalStack) {
+					result.error = "push stack overflow";
+					return result;
+				}
+				usagePages[globalDepth + 1] = usagePages[globalDepth];
+				globalDepth++;
+			}
+			else if (tag == 0xB) { // pop
+				if (globalDepth == 0) {
+					result.error = "pop without push";
+					return result;
+				}
+				globalDepth--;
+			}
+		}
+		else if (type == 2) { // local
+			if (tag == 0x0 && !haveUsage) {
+				// a 4-byte usage carries its own page in the high half
+				firstUsage = size == 4 ? data : (data & 0xFFFF);
+				haveUsage = true;
+			}
+		}
+		else if (type == 0) { // main
+			if (tag == 0xA) { // collection
+				if (collectionDepth == 0 && (data & 0xFF) == 0x01) {
+					const uint16_t page = (firstUsage >> 16) != 0 ? (uint16_t)(firstUsage >> 16) : usagePages[globalDepth];
+					const int c = page == kHidPageDigitizer ? DigitizerClass((uint16_t)firstUsage) : -1;
+					if (c >= 0) {
+						result.classes |= (uint8_t)(1u << c);
+					}
+					result.applications++;
+				}
+				collectionDepth++;
+			}
+			else if (tag == 0xC) { // end collection
+				if (collectionDepth == 0) {
+					result.error = "end collection without collection";
+					return result;
+				}
+				collectionDepth--;
+			}
+			// local items only apply to the main item that follows them
+			haveUsage = false;
+			firstUsage = 0;
+		}
+		else {
+			result.error = "reserved item type";
+			return result;
+		}
+	}
+	if (collectionDepth != 0) {
+		result.error = "unterminated collection";
+	}
+	return result;
+}
@@ -0,0 +1,112 @@
+/////////////
+// input_trace.cpp : Binary input trace writer and reader.
+//////
+
+#include "input_trace.h"
+#include <array>
+#include <chrono>
+#include <cstring>
+
+TraceRecord ToTraceRecord(const KeyEvent& event) {
+	TraceRecord record = {};
+	record.timeNs = event.timeNs;
+	record.device = event.device;
+	record.key = (uint8_t)event.key;
+	record.down = event.down ? 1 : 0;
+	return record;
+}
+
+bool ToKeyEvent(const TraceRecord& record, KeyEvent& event) {
+	if (record.key >= kGestureKeyCount) {
+		return false;
+	}
+	event.timeNs = record.timeNs;
+	event.device = record.device;
+	event.key = (GestureKey)record.key;
+	event.down = record.down != 0;
+	return true;
+}
+
+InputTraceRecorder::~InputTraceRecorder() {
+	Stop();
+}
+
+bool InputTraceRecorder::Start(const char* path) {
+	if (m_writer.joinable()) {
+		return false;
+	}
+	m_file = fopen(path, "wb");
+	if (m_file == nullptr) {
+		return false;
+	}
+	TraceFileHeader header = {};
+	memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+	header.version = kTraceVersion;
+	header.recordSize = sizeof(TraceRecord);
+	fwrite(&header, sizeof(header), 1, m_file);
+
+	m_stopping.store(false, std::memory_order_relaxed);
+	m_writer = std::thread(&InputTraceRecorder::WriterLoop, this);
+	m_active.store(true, std::memory_order_release);
+	return true;
+}
+
+void InputTraceRecorder::Stop() {
+	if (!m_writer.joinable()) {
+		return;
+	}
+	m_active.store(false, std::memory_order_release);
+	m_stopping.store(true, std::memory_order_release);
+	m_wake.release();
+	m_writer.join();
+	fclose(m_file);
+	m_file = nullptr;
+}
+
+void InputTraceRecorder::WriterLoop() {
+	std::array<TraceRecord, 256> batch;
+	for (;;) {
+		m_wake.try_acquire_for(std::chrono::milliseconds(100));
+		const bool stopping = m_stopping.load(std::memory_order_acquire);
+		bool wrote = false;
+		for (;;) {
+			size_t n = 0;
+			while (n < batch.size() && m_ring.TryPop(batch[n])) {
+				n++;
+			}
+			if (n == 0) {
+				break;
+			}
+			fwrite(batch.data(), sizeof(TraceRecord), n, m_file);
+			wrote = true;
+		}
+		if (wrote) {
+			fflush(m_file);
+		}
+		if (stopping) {
+			return;
+		}
+	}
+}
+
+bool InputTraceReader::Open(const char* path) {
+	m_records = nullptr;
+	m_count = 0;
+	m_invalid = 0;
+	if (!m_file.OpenRead(path) || m_file.Size() < sizeof(TraceFileHeader)) {
+		return false;
+	}
+	TraceFileHeader header;
+	memcpy(&header, m_file.Data(), sizeof(header));
+	if (memcmp(header.magic, kTraceMagic, sizeof(header.magic)) != 0 ||
+		header.version != kTraceVersion || header.recordSize != sizeof(TraceRecord)) {
+		return false;
+	}
+	const size_t body = m_file.Size() - sizeof(TraceFileHeader);
+	m_records = (const TraceRecord*)(m_file.Data() + sizeof(TraceFileHeader));
+	m_count = body / sizeof(TraceRecord);
+	for (size_t i = 0; i < m_count; i++) {
+		m_invalid += m_records[i].key >= kGestureKeyCount;
+	}
+	return true;
+}
@@ -0,0 +1,106 @@
+/////////////
+// input_trace.h : Compact binary trace of the key events reaching the gesture engine, and a reader
+// that memory-maps one for replay.
+//
+// File layout (little endian): a 16-byte TraceFileHeader followed by fixed 24-byte TraceRecords.
+//////
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <semaphore>
+#include <thread>
+#include "key_event.h"
+#include "mapped_file.h"
+#include "spsc_queue.h"
+
+constexpr char kTraceMagic[8] = { 'S', 'L', 'T', 'R', 'A', 'C', 'E', '\0' };
+constexpr uint32_t kTraceVersion = 1;
+
+struct TraceFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t recordSize;
+};
+
+struct TraceRecord {
+	uint64_t timeNs;
+	uint64_t device;
+	uint8_t key;  // GestureKey
+	uint8_t down; // 1 = press, 0 = release
+	uint8_t reserved[6];
+};
+
+static_assert(sizeof(TraceFileHeader) == 16, "trace header layout is part of the file format");
+static_assert(sizeof(TraceRecord) == 24, "trace record layout is part of the file format");
+
+TraceRecord ToTraceRecord(const KeyEvent& event);
+// Fails, leaving the event untouched, on a record whose key is not a GestureKey: a corrupt or
+// newer trace must not index the matcher's per-key tables out of bounds.
+bool ToKeyEvent(const TraceRecord& record, KeyEvent& event);
+
+// Records from the input thread through a lock-free ring; a background thread writes the file.
+class InputTraceRecorder {
+public:
+	InputTraceRecorder() = default;
+	~InputTraceRecorder();
+
+	InputTraceRecorder(const InputTraceRecorder&) = delete;
+	InputTraceRecorder& operator=(const InputTraceRecorder&) = delete;
+
+	bool Start(const char* path);
+	// Writes out everything recorded so far and closes the file.
+	void Stop();
+
+	// Input thread only. Never blocks; drops the record if the writer has fallen behind.
+	void Record(const KeyEvent& event) {
+		if (!m_active.load(std::memory_order_relaxed)) {
+			return;
+		}
+		if (!m_ring.TryPush(ToTraceRecord(event))) {
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+		// the writer polls; only a burst big enough to threaten the ring is worth waking it for
+		else if (++m_sinceWake == kWakeEvery) {
+			m_sinceWake = 0;
+			m_wake.release();
+		}
+	}
+
+	uint64_t Dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+	void WriterLoop();
+
+	static constexpr uint32_t kRingSize = 4096;
+	static constexpr uint32_t kWakeEvery = kRingSize / 4;
+
+	SpscQueue<TraceRecord, kRingSize> m_ring;
+	uint32_t m_sinceWake = 0; // input thread only
+	std::atomic<bool> m_active{ false };
+	std::atomic<bool> m_stopping{ false };
+	std::atomic<uint64_t> m_dropped{ 0 };
+	std::counting_semaphore<> m_wake{ 0 };
+	FILE* m_file = nullptr;
+	std::thread m_writer;
+};
+
+// A trace file mapped into memory; records are read in place.
+class InputTraceReader {
+public:
+	// Fails on a missing file or a bad header. A partial last record, left by a crash mid-write, is ignored.
+	bool Open(const char* path);
+
+	size_t Count() const { return m_count; }
+	// Records ToKeyEvent will refuse; they are still included in Count and Records.
+	size_t Invalid() const { return m_invalid; }
+	const TraceRecord* Records() const { return m_records; }
+
+private:
+	MappedFile m_file;
+	const TraceRecord* m_records = nullptr;
+	size_t m_count = 0;
+	size_t m_invalid = 0;
+};
@@ -0,0 +1,29 @@
+/////////////
+// key_event.h : A gesture key press or release as it travels from the input backend to the gesture matcher.
+//////
+
+#pragma once
+
+#include <cstdint>
+#include "gesture_matcher.h"
+
+struct KeyEvent {
+	uint64_t timeNs = 0; // monotonic, captured as close to arrival as the backend allows
+	uint64_t device = 0; // backend handle of the keyboard that sent it
+	GestureKey key = GestureKey::VolumeUp;
+	bool down = true; // only presses advance gestures; releases end autorepeat
+};
+
+// Arrival time on the monotonic clock of a message the system stamped messageMs on its millisecond
+// tick count (GetMessageTime on Windows), from tickNowMs and nowNs read together as it is handled.
+// A message from the current tick is stamped nowNs; an older one, its age before that, to the
+// tick's resolution (10-16 ms). The tick count wraps every 49.7 days and the age with it; a stamp
+// ahead of tickNowMs counts as current.
+inline uint64_t MessageArrivalNs(uint32_t messageMs, uint32_t tickNowMs, uint64_t nowNs) {
+	const uint32_t ageMs = tickNowMs - messageMs;
+	if (ageMs == 0 || ageMs > UINT32_MAX / 2) {
+		return nowNs;
+	}
+	const uint64_t ageNs = (uint64_t)ageMs * 1000000;
+	return ageNs < nowNs ? nowNs - ageNs : 0;
+}
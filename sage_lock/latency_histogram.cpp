@@ -0,0 +1,33 @@
+/////////////
+// latency_histogram.cpp : Percentile lookup for LatencyHistogram.
+//////
+
+#include "latency_histogram.h"
+#include <algorithm>
+#include <cmath>
+
+uint64_t LatencyHistogram::Percentile(double p) const {
+	const uint64_t total = Count();
+	if (total == 0) {
+		return 0;
+	}
+	// rank of the sample, 1-based: p50 of 4 samples is the 2nd, p100 the last
+	const uint64_t rank = std::clamp<uint64_t>((uint64_t)std::ceil(p / 100.0 * (double)total), 1, total);
+	uint64_t seen = 0;
+	for (size_t i = 0; i < kBucketCount; i++) {
+		seen += m_counts[i].load(std::memory_order_relaxed);
+		if (seen >= rank) {
+			// the last bucket is open-ended; only Max bounds it
+			return i == kBucketCount - 1 ? Max() : std::min(BucketHighest(i), Max());
+		}
+	}
+	return Max();
+}
+
+void LatencyHistogram::Reset() {
+	for (auto& count : m_counts) {
+		count.store(0, std::memory_order_relaxed);
+	}
+	m_total.store(0, std::memory_order_relaxed);
+	m_max.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,62 @@
+/////////////
+// latency_histogram.h : HDR-style latency histogram. Values below 256 ns get a bucket each; above
+// that, every power of two is split into 128 buckets, so a reported percentile is never more than
+// 1/128 (under 0.8%) above the true value. Recording is a bit scan and a relaxed increment, with
+// fixed storage, so it stays on in production. One thread records; any thread may read.
+//////
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+class LatencyHistogram {
+public:
+	static constexpr unsigned kSubBucketBits = 8;
+	static constexpr size_t kSubBuckets = size_t(1) << kSubBucketBits;
+	static constexpr unsigned kMaxBits = 42; // about 73 minutes in ns; longer values land in the last bucket
+	static constexpr size_t kBucketCount = kSubBuckets + (kMaxBits - kSubBucketBits) * (kSubBuckets / 2);
+
+	static constexpr size_t BucketIndex(uint64_t value) {
+		if (value < kSubBuckets) {
+			return (size_t)value;
+		}
+		const unsigned shift = (unsigned)std::bit_width(value) - kSubBucketBits;
+		if (shift >= kMaxBits - kSubBucketBits + 1) {
+			return kBucketCount - 1;
+		}
+		return kSubBuckets + (shift - 1) * (kSubBuckets / 2) + (size_t)((value >> shift) - kSubBuckets / 2);
+	}
+	// Highest value that lands in the bucket.
+	static constexpr uint64_t BucketHighest(size_t index) {
+		if (index < kSubBuckets) {
+			return index;
+		}
+		const unsigned shift = (unsigned)((index - kSubBuckets) / (kSubBuckets / 2)) + 1;
+		const uint64_t sub = (index - kSubBuckets) % (kSubBuckets / 2) + kSubBuckets / 2;
+		return ((sub + 1) << shift) - 1;
+	}
+
+	void Record(uint64_t valueNs) {
+		m_counts[BucketIndex(valueNs)].fetch_add(1, std::memory_order_relaxed);
+		m_total.fetch_add(1, std::memory_order_relaxed);
+		if (valueNs > m_max.load(std::memory_order_relaxed)) {
+			m_max.store(valueNs, std::memory_order_relaxed);
+		}
+	}
+
+	uint64_t Count() const { return m_total.load(std::memory_order_relaxed); }
+	uint64_t Max() const { return m_max.load(std::memory_order_relaxed); }
+	// Upper end of the bucket holding the p-th percentile sample, capped at Max; 0 if empty.
+	uint64_t Percentile(double p) const;
+	// Not safe against a concurrent Record.
+	void Reset();
+
+private:
+	std::array<std::atomic<uint32_t>, kBucketCount> m_counts{};
+	std::atomic<uint64_t> m_total{ 0 };
+	std::atomic<uint64_t> m_max{ 0 };
+};
@@ -0,0 +1,138 @@
+/////////////
+// lock_pipeline.cpp : Gesture matching on the input thread, device toggling on the executor thread.
+//////
+
+#include "lock_pipeline.h"
+#include "trace_spans.h"
+
+const char* LockStageName(LockStage stage) {
+	switch (stage) {
+	case LockStage::Match: return "match";
+	case LockStage::Dispatch: return "dispatch";
+	case LockStage::Device: return "device";
+	case LockStage::Toggle: return "toggle";
+	case LockStage::EndToEnd: return "end-to-end";
+	case LockStage::Count: break;
+	}
+	return "unknown";
+}
+
+LockPipeline::LockPipeline(const GestureSet& gestures, DeviceToggler& toggler, Clock& clock, LockPipelineConfig config)
+	: m_clock(clock),
+	m_toggler(toggler),
+	m_config(config),
+	m_engine(std::make_unique<GestureEngine>(gestures)),
+	m_registry(toggler),
+	m_executor([this](const LockCommand& command) { ApplyCommand(command); }) {
+}
+
+LockPipeline::~LockPipeline() {
+	Stop();
+}
+
+void LockPipeline::Start() {
+	if (!m_fanout) {
+		// devices can arrive later, so size the pool for the configured bound, not today's count
+		m_fanout = std::make_unique<ToggleFanout>([this](std::string_view id, bool enable) {
+			return m_toggler.Toggle(id, enable);
+		}, m_config.toggleWorkers, m_clock);
+	}
+	// lock/unlock cycles reuse these instead of allocating; only a change to the device set costs
+	// an allocation, on the first cycle after it
+	const size_t devices = m_registry.List()->size();
+	m_fanout->Reserve(devices);
+	m_results.reserve(devices);
+	m_executor.Start();
+}
+
+void LockPipeline::Stop() {
+	m_executor.Stop();
+}
+
+int LockPipeline::OnKeyEvent(const KeyEvent& event) {
+	SAGE_SPAN("gesture check");
+	const int gesture = m_engine->OnKeyEvent(event);
+	if (m_metrics != nullptr) {
+		m_metrics->Add(MetricCounter::KeyEvents);
+		if (gesture >= 0) {
+			m_metrics->Add(MetricCounter::Gestures);
+		}
+	}
+	if (gesture == m_config.toggleGesture) {
+		// only hand the action off here; the toggles run on the executor thread
+		LockCommand command;
+		command.action = m_locked ? LockAction::Unlock : LockAction::Lock;
+		command.triggerNs = event.timeNs;
+		command.matchNs = m_clock.NowNs();
+		if (m_executor.Submit(command)) {
+			m_locked = !m_locked;
+		}
+		else if (m_metrics != nullptr) {
+			m_metrics->Add(MetricCounter::DroppedCommands);
+		}
+	}
+	return gesture;
+}
+
+// Runs on the action executor thread, never on the input thread.
+void LockPipeline::ApplyCommand(const LockCommand& command) {
+	SAGE_SPAN(command.action == LockAction::Lock ? "lock" : "unlock");
+	const bool enable = (command.action == LockAction::Unlock);
+	const uint64_t dispatchNs = m_clock.NowNs();
+	const DeviceList devices = m_registry.BeginCycle(!enable);
+	{
+		SAGE_SPAN("toggle fanout");
+		m_fanout->Run(devices, enable, m_config.toggleDeadline, m_results);
+	}
+	const uint64_t feedbackNs = m_clock.NowNs();
+
+	RecordLatency(LockStage::Match, command.triggerNs, command.matchNs);
+	RecordLatency(LockStage::Dispatch, command.matchNs, dispatchNs);
+	for (const auto& result : m_results) {
+		m_latency[(size_t)LockStage::Device].Record(result.doneNs);
+	}
+	RecordLatency(LockStage::Toggle, dispatchNs, feedbackNs);
+	RecordLatency(LockStage::EndToEnd, command.triggerNs, feedbackNs);
+	if (m_feedback) {
+		SAGE_SPAN("feedback");
+		m_feedback(enable);
+	}
+	if (m_observer) {
+		LockCycle cycle;
+		cycle.action = command.action;
+		cycle.triggerNs = command.triggerNs;
+		cycle.matchNs = command.matchNs;
+		cycle.dispatchNs = dispatchNs;
+		cycle.feedbackNs = feedbackNs;
+		cycle.completeNs = m_clock.NowNs();
+		cycle.devices = devices.get();
+		cycle.results = &m_results;
+		m_observer(cycle);
+	}
+	if (m_metrics != nullptr) {
+		PublishMetrics(command, devices ? devices->size() : 0, feedbackNs);
+	}
+}
+
+// Executor thread, after feedback; the percentile scans stay off the lock path.
+void LockPipeline::PublishMetrics(const LockCommand& command, size_t devices, uint64_t feedbackNs) {
+	m_metrics->Add(command.action == LockAction::Lock ? MetricCounter::Locks : MetricCounter::Unlocks);
+	for (const auto& result : m_results) {
+		m_metrics->Add(result.status == ToggleStatus::Ok ? MetricCounter::TogglesOk :
+			result.status == ToggleStatus::Failed ? MetricCounter::ToggleFailures : MetricCounter::ToggleTimeouts);
+	}
+	m_metrics->Set(MetricGauge::Locked, command.action == LockAction::Lock ? 1 : 0);
+	m_metrics->Set(MetricGauge::Devices, devices);
+	m_metrics->Set(MetricGauge::LastLatencyUs, feedbackNs > command.triggerNs ? (feedbackNs - command.triggerNs) / 1000 : 0);
+
+	MetricsStageSummary stages[kMetricsStages];
+	for (size_t i = 0; i < kMetricsStages; i++) {
+		const LatencyHistogram& latency = m_latency[i];
+		stages[i].count = latency.Count();
+		stages[i].p50Ns = latency.Percentile(50);
+		stages[i].p99Ns = latency.Percentile(99);
+		stages[i].p999Ns = latency.Percentile(99.9);
+		stages[i].maxNs = latency.Max();
+	}
+	m_metrics->PublishLatency(stages);
+}
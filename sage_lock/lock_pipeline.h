@@ -0,0 +1,123 @@
+/////////////
+// lock_pipeline.h : The whole detect -> toggle -> feedback path, independent of the input source,
+// the toggle backend and the clock.
+//
+// The input thread calls OnKeyEvent. A completed toggle gesture becomes a LockCommand on the action
+// executor, which fans the toggle out over the devices and then runs the feedback callback.
+//
+// Every cycle is timestamped at each stage and recorded into one latency histogram per stage. The
+// histograms are always on; read them from any thread. With SetMetrics, counters, gauges and a
+// summary of the histograms are also published to shared memory for external readers.
+//////
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "action_executor.h"
+#include "clock.h"
+#include "device_toggler.h"
+#include "gesture_engine.h"
+#include "key_event.h"
+#include "latency_histogram.h"
+#include "shared_metrics.h"
+#include "toggle_fanout.h"
+#include "touch_device_registry.h"
+
+struct LockPipelineConfig {
+	int toggleGesture = 0;      // gesture index that flips the lock
+	unsigned toggleWorkers = 4; // upper bound; never more workers than devices
+	std::chrono::milliseconds toggleDeadline{ 10000 };
+};
+
+// Latency stages of a lock cycle, each recorded into its own histogram.
+enum class LockStage : uint8_t {
+	Match,    // key press arrival -> gesture matched
+	Dispatch, // gesture matched -> executor starts toggling
+	Device,   // toggling starts -> one device done, or given up on at the deadline; one sample per device
+	Toggle,   // toggling starts -> every device done or timed out, i.e. feedback (the sound) starts
+	EndToEnd, // key press arrival -> feedback starts
+	Count,
+};
+
+const char* LockStageName(LockStage stage);
+
+static_assert((size_t)LockStage::Count == kMetricsStages, "shared metrics carry one summary per stage");
+
+// One finished lock or unlock, reported after feedback has started.
+struct LockCycle {
+	LockAction action = LockAction::Lock;
+	uint64_t triggerNs = 0;  // arrival of the key press that completed the gesture
+	uint64_t matchNs = 0;    // gesture matched on the input thread
+	uint64_t dispatchNs = 0; // executor picked the command up and started toggling
+	uint64_t feedbackNs = 0; // every device done (or timed out), feedback about to start
+	uint64_t completeNs = 0; // all devices done (or timed out) and feedback started
+	const std::vector<std::string_view>* devices = nullptr;  // the devices this cycle toggled
+	const std::vector<ToggleResult>* results = nullptr; // one per device, in the same order; both valid during the callback
+};
+
+class LockPipeline {
+public:
+	using FeedbackFn = std::function<void(bool devicesEnabled)>;
+	using CycleFn = std::function<void(const LockCycle&)>;
+
+	// gestures, toggler and clock must outlive the pipeline.
+	LockPipeline(const GestureSet& gestures, DeviceToggler& toggler, Clock& clock, LockPipelineConfig config = {});
+	~LockPipeline();
+
+	LockPipeline(const LockPipeline&) = delete;
+	LockPipeline& operator=(const LockPipeline&) = delete;
+
+	// Configuration; call before Start.
+	void SetDevices(std::vector<std::string> devices) { m_registry.Reset(std::move(devices)); }
+	void SetFeedback(FeedbackFn feedback) { m_feedback = std::move(feedback); }
+	void SetCycleObserver(CycleFn observer) { m_observer = std::move(observer); }
+	// metrics must outlive the pipeline; pass nullptr to stop publishing.
+	void SetMetrics(SharedMetrics* metrics) { m_metrics = metrics; }
+
+	void Start();
+	// Finishes any queued lock/unlock, then stops the executor thread.
+	void Stop();
+
+	// Input thread only. Returns the gesture index the event completed, or -1.
+	int OnKeyEvent(const KeyEvent& event);
+	void ForgetDevice(uint64_t device) { m_engine->ForgetDevice(device); }
+
+	// State as seen by the input thread: true once a lock has been queued.
+	bool Locked() const { return m_locked; }
+	// Input thread only: autorepeat and press/release counts.
+	const KeyFilterStats& KeyStats() const { return m_engine->Stats(); }
+	// Gestures dropped because the executor queue was full.
+	uint64_t DroppedCommands() const { return m_executor.Dropped(); }
+	// The touch devices; hotplug handlers add and remove devices here from any thread.
+	TouchDeviceRegistry& Devices() { return m_registry; }
+	const DeviceToggler& Toggler() const { return m_toggler; }
+	const LatencyHistogram& Latency(LockStage stage) const { return m_latency[(size_t)stage]; }
+
+private:
+	void ApplyCommand(const LockCommand& command);
+	void PublishMetrics(const LockCommand& command, size_t devices, uint64_t feedbackNs);
+	void RecordLatency(LockStage stage, uint64_t fromNs, uint64_t toNs) {
+		m_latency[(size_t)stage].Record(toNs > fromNs ? toNs - fromNs : 0);
+	}
+
+	Clock& m_clock;
+	DeviceToggler& m_toggler;
+	const LockPipelineConfig m_config;
+	std::unique_ptr<GestureEngine> m_engine;
+	TouchDeviceRegistry m_registry;
+	FeedbackFn m_feedback;
+	CycleFn m_observer;
+	SharedMetrics* m_metrics = nullptr;
+	std::unique_ptr<ToggleFanout> m_fanout;
+	std::vector<ToggleResult> m_results; // executor thread only
+	std::array<LatencyHistogram, (size_t)LockStage::Count> m_latency; // recorded on the executor thread
+	ActionExecutor m_executor;
+	bool m_locked = false;
+};
@@ -0,0 +1,177 @@
+/////////////
+// mapped_file.cpp : Platform file mapping for MappedFile.
+//////
+
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::OpenRead(const char* path) {
+	Close();
+	m_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		m_file = nullptr;
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size)) {
+		Close();
+		return false;
+	}
+	m_size = (size_t)size.QuadPart;
+	if (m_size == 0) {
+		return true;
+	}
+	m_mapping = CreateFileMappingW(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping == NULL) {
+		Close();
+		return false;
+	}
+	m_data = (uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (m_data == NULL) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool MappedFile::OpenReadWrite(const char* path, size_t size) {
+	Close();
+	if (size == 0) {
+		return false;
+	}
+	m_file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		m_file = nullptr;
+		return false;
+	}
+	LARGE_INTEGER current;
+	LARGE_INTEGER wanted;
+	wanted.QuadPart = (LONGLONG)size;
+	if (!GetFileSizeEx(m_file, &current) ||
+		(current.QuadPart != wanted.QuadPart && (!SetFilePointerEx(m_file, wanted, NULL, FILE_BEGIN) || !SetEndOfFile(m_file)))) {
+		Close();
+		return false;
+	}
+	m_size = size;
+	m_mapping = CreateFileMappingW(m_file, NULL, PAGE_READWRITE, 0, 0, NULL);
+	if (m_mapping == NULL) {
+		Close();
+		return false;
+	}
+	m_data = (uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+	if (m_data == NULL) {
+		Close();
+		return false;
+	}
+	m_writable = true;
+	return true;
+}
+
+void MappedFile::Flush() {
+	if (m_writable) {
+		FlushViewOfFile(m_data, m_size);
+	}
+}
+
+void MappedFile::Close() {
+	if (m_data != nullptr) {
+		UnmapViewOfFile(m_data);
+	}
+	if (m_mapping != nullptr) {
+		CloseHandle(m_mapping);
+	}
+	if (m_file != nullptr) {
+		CloseHandle(m_file);
+	}
+	m_data = nullptr;
+	m_mapping = nullptr;
+	m_file = nullptr;
+	m_size = 0;
+	m_writable = false;
+}
+
+#else
+
+bool MappedFile::OpenRead(const char* path) {
+	Close();
+	m_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (m_fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(m_fd, &st) != 0) {
+		Close();
+		return false;
+	}
+	m_size = (size_t)st.st_size;
+	if (m_size == 0) {
+		return true;
+	}
+	void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	if (data == MAP_FAILED) {
+		Close();
+		return false;
+	}
+	m_data = (uint8_t*)data;
+	return true;
+}
+
+bool MappedFile::OpenReadWrite(const char* path, size_t size) {
+	Close();
+	if (size == 0) {
+		return false;
+	}
+	m_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (m_fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(m_fd, &st) != 0 || ((size_t)st.st_size != size && ftruncate(m_fd, (off_t)size) != 0)) {
+		Close();
+		return false;
+	}
+	m_size = size;
+	void* data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (data == MAP_FAILED) {
+		Close();
+		return false;
+	}
+	m_data = (uint8_t*)data;
+	m_writable = true;
+	return true;
+}
+
+void MappedFile::Flush() {
+	if (m_writable) {
+		msync(m_data, m_size, MS_ASYNC);
+	}
+}
+
+void MappedFile::Close() {
+	if (m_data != nullptr) {
+		munmap(m_data, m_size);
+	}
+	if (m_fd >= 0) {
+		close(m_fd);
+	}
+	m_data = nullptr;
+	m_fd = -1;
+	m_size = 0;
+	m_writable = false;
+}
+
+#endif
@@ -0,0 +1,42 @@
+/////////////
+// mapped_file.h : Memory mapping of a whole file (MapViewOfFile on Windows, mmap elsewhere), read-only
+// or shared and writable.
+//////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Maps the whole file. An empty file opens successfully with Size() == 0.
+	bool OpenRead(const char* path);
+	// Maps the file for writing, creating it or resizing it to size bytes first. Writes go to the file.
+	bool OpenReadWrite(const char* path, size_t size);
+	// Asks the OS to write dirty pages back now rather than at some later point.
+	void Flush();
+	void Close();
+
+	const uint8_t* Data() const { return m_data; }
+	// nullptr unless opened with OpenReadWrite.
+	uint8_t* WritableData() { return m_writable ? m_data : nullptr; }
+	size_t Size() const { return m_size; }
+
+private:
+	uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+	bool m_writable = false;
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#else
+	int m_fd = -1;
+#endif
+};
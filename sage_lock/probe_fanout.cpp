@@ -0,0 +1,113 @@
+/////////////
+// probe_fanout.cpp : Worker pool and timeout handling for ProbeDevices.
+//////
+
+#include "probe_fanout.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <semaphore>
+#include <thread>
+#include "clock.h"
+
+namespace {
+
+enum class SlotState : uint8_t {
+	Pending,
+	Running,
+	Found,
+	NotFound,
+	TimedOut,
+};
+
+struct Slot {
+	std::atomic<SlotState> state{ SlotState::Pending };
+	uint64_t startNs = 0;  // written before state becomes Running
+	CachedDevice device;   // written before state becomes Found
+};
+
+// Shared with the workers, so an abandoned probe can still finish into it after ProbeDevices returns.
+struct ProbeRun {
+	ProbeRun(std::vector<std::string> paths, ProbeFn probe, std::shared_ptr<LateProbeSink> late)
+		: paths(std::move(paths)), probe(std::move(probe)), late(std::move(late)), slots(new Slot[this->paths.size()]) {
+	}
+
+	const std::vector<std::string> paths;
+	const ProbeFn probe;
+	const std::shared_ptr<LateProbeSink> late;
+	std::unique_ptr<Slot[]> slots;
+	std::atomic<size_t> next{ 0 };
+	std::counting_semaphore<> settled{ 0 }; // released once per slot a worker finishes in time
+};
+
+void ProbeWorker(std::shared_ptr<ProbeRun> run) {
+	for (size_t i = run->next.fetch_add(1); i < run->paths.size(); i = run->next.fetch_add(1)) {
+		Slot& slot = run->slots[i];
+		slot.startNs = MonotonicNowNs();
+		slot.state.store(SlotState::Running, std::memory_order_release);
+
+		CachedDevice device;
+		const bool found = run->probe(run->paths[i], device);
+		if (found) {
+			slot.device = std::move(device);
+		}
+		SlotState expected = SlotState::Running;
+		if (!slot.state.compare_exchange_strong(expected, found ? SlotState::Found : SlotState::NotFound, std::memory_order_acq_rel)) {
+			// timed out: a replacement worker already has the rest of the list
+			if (found && run->late) {
+				run->late->Report(slot.device);
+			}
+			return;
+		}
+		run->settled.release();
+	}
+}
+
+}
+
+ProbeReport ProbeDevices(std::vector<std::string> paths, ProbeFn probe, unsigned workerCount, std::chrono::milliseconds timeout,
+	std::shared_ptr<LateProbeSink> late) {
+	ProbeReport report;
+	const uint64_t startNs = MonotonicNowNs();
+	const size_t count = paths.size();
+	if (count == 0) {
+		return report;
+	}
+	auto run = std::make_shared<ProbeRun>(std::move(paths), std::move(probe), std::move(late));
+	workerCount = (unsigned)std::clamp<size_t>(workerCount, 1, count);
+	// detached: a worker stuck in a probe must not hold up the caller
+	for (unsigned i = 0; i < workerCount; i++) {
+		std::thread(ProbeWorker, run).detach();
+	}
+
+	const uint64_t timeoutNs = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+	const auto tick = std::max(std::chrono::milliseconds(1), timeout / 8);
+	size_t settled = 0;
+	while (settled < count) {
+		if (run->settled.try_acquire_for(tick)) {
+			settled++;
+			continue;
+		}
+		for (size_t i = 0; i < count; i++) {
+			Slot& slot = run->slots[i];
+			// the clock is read after the state, so it is never behind a start time it can see
+			if (slot.state.load(std::memory_order_acquire) != SlotState::Running || MonotonicNowNs() - slot.startNs < timeoutNs) {
+				continue;
+			}
+			SlotState expected = SlotState::Running;
+			if (slot.state.compare_exchange_strong(expected, SlotState::TimedOut, std::memory_order_acq_rel)) {
+				report.timedOut.push_back(run->paths[i]);
+				settled++;
+				std::thread(ProbeWorker, run).detach();
+			}
+		}
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (run->slots[i].state.load(std::memory_order_acquire) == SlotState::Found) {
+			report.found.push_back(run->slots[i].device);
+		}
+	}
+	report.elapsedUs = (MonotonicNowNs() - startNs) / 1000;
+	return report;
+}
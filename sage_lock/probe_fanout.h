@@ -0,0 +1,62 @@
+/////////////
+// probe_fanout.h : Classifies devices found by enumeration on a small pool of worker threads, so one
+// slow device (a sleeping Bluetooth HID) costs its own timeout instead of stalling the whole scan.
+//
+// Each device has its own result slot; workers publish into it with an atomic status and the caller
+// collects the slots once every device has finished or timed out. A probe that overruns its timeout
+// is abandoned and a replacement worker takes over the rest of the list. The abandoned worker
+// finishes in the background and reports a late touch screen to a LateProbeSink, which the caller
+// closes before tearing down whatever the callback touches.
+//////
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "device_cache.h"
+
+struct ProbeReport {
+	std::vector<CachedDevice> found;   // in enumeration order
+	std::vector<std::string> timedOut; // paths whose probe was abandoned
+	uint64_t elapsedUs = 0;
+};
+
+// Probes one enumerated device. Returns true and fills device if it is a touch screen.
+// Called concurrently, and possibly after ProbeDevices has returned, so it must not capture locals.
+using ProbeFn = std::function<bool(const std::string& path, CachedDevice& device)>;
+// Receives a touch screen whose probe finished after its timeout, on the abandoned worker's thread.
+using LateProbeFn = std::function<void(const CachedDevice& device)>;
+
+// Where late touch screens go. Abandoned workers share it and may outlive the caller, so the
+// caller shuts it with Close before destroying anything the callback uses.
+class LateProbeSink {
+public:
+	explicit LateProbeSink(LateProbeFn late) : m_late(std::move(late)) {}
+
+	// Calls the callback unless the sink is closed. One report at a time.
+	void Report(const CachedDevice& device) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_late) {
+			m_late(device);
+		}
+	}
+	// Waits for a report in progress; none runs afterwards.
+	void Close() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_late = nullptr;
+	}
+
+private:
+	std::mutex m_mutex;
+	LateProbeFn m_late;
+};
+
+// Probes every path on up to workerCount threads and waits until each one has finished or has been
+// running for longer than timeout.
+ProbeReport ProbeDevices(std::vector<std::string> paths, ProbeFn probe, unsigned workerCount, std::chrono::milliseconds timeout,
+	std::shared_ptr<LateProbeSink> late = nullptr);
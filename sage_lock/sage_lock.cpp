@@ -1,259 +1,718 @@
-/////////////
-// sage_lock.cpp : This file contains code to lock HID touch devices when a volume up/down pattern is detected.
-// Author: Phillip McNallen (2023)
-//////
-
-#include <Windows.h>
-#include <Windowsx.h>
-#include <iostream>
-#include <array>
-#include <initguid.h>
-#include <ntddstor.h>
-#include <hidusage.h>
-#include <SetupAPI.h>
-#include <Cfgmgr32.h>
-#include <Hidclass.h>
-#include <Hidsdi.h>
-#include <hidusage.h>
-#include <vector>
-#include <string>
-#include <iomanip>
-
-#pragma comment(lib, "hid.lib")
-#pragma comment(lib, "SetupAPI.lib")
-#pragma comment(lib, "Winmm.lib")
-
-// function dbgprint prints to visual studio output window
-void dbgprint(const wchar_t* format, ...) {
-	wchar_t buffer[4096];
-	va_list args;
-	va_start(args, format);
-	vswprintf_s(buffer, 4096, format, args);
-	OutputDebugStringW(buffer);
-	va_end(args);
-}
-
-std::wstring GetLastErrorAsWString()
-{
-	DWORD errorMessageID = ::GetLastError();
-	if (errorMessageID == 0) {
-		return std::wstring(L"No error"); //No error message has been recorded
-	}
-	wchar_t lpBuffer[256];
-	size_t size = FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-				NULL, errorMessageID, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), lpBuffer, sizeof(lpBuffer), NULL);
-	return lpBuffer;
-}
-
-
-// GLOBALS TO TRACK VOLUME UP DOWN UP DOWN EVENTS
-std::array<DWORD, 4> Volume_Event_History{};
-WORD Current_Index = 0;
-DWORD64 Last_Volume_Event = 0;
-int lock_enabled = 0;
-std::vector<std::wstring> g_TouchScreens;
-
-// Check Volume_Event_History for UP DOWN UP DOWN events in the last 2 seconds
-auto CheckForVolumeUpDownUpDown() {
-	Current_Index = 0;
-	return (Volume_Event_History[0] == VK_VOLUME_UP &&
-		Volume_Event_History[1] == VK_VOLUME_DOWN &&
-		Volume_Event_History[2] == VK_VOLUME_UP &&
-		Volume_Event_History[3] == VK_VOLUME_DOWN);
-}
-
-// This function returns the index of the next available slot in the volume history array.
-// The index is determined by the time since the last volume change event.
-auto GetAvailableKbdHistoryIndex() {
-	auto dwCurrentTime = GetTickCount64();
-	auto timeSinceLast = dwCurrentTime - Last_Volume_Event;
-	Last_Volume_Event = dwCurrentTime;
-	if ((timeSinceLast) > 500) {
-		Current_Index = 0;
-	}
-	else {
-		Current_Index++;
-	}
-	if (Current_Index > 3) {
-		Current_Index = 0;
-	}
-	return Current_Index;
-}
-
-// wrap a call to run the program pnputil with /disable-device and /enable-device
-void ToggleTouchDevice(const wchar_t* deviceId, bool enable) {
-	wchar_t cmd[4096];
-	swprintf_s(cmd, L"pnputil.exe %s \"%s\"", enable ? L"/enable-device" : L"/disable-device", deviceId);
-	dbgprint(L"Running command: %s\n", cmd);
-	// Use CreateProcessW
-	STARTUPINFO si;
-	PROCESS_INFORMATION pi;
-	ZeroMemory(&si, sizeof(si));
-	si.cb = sizeof(si);
-	ZeroMemory(&pi, sizeof(pi));
-	if (!CreateProcessW(NULL, cmd, NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &si, &pi)) {
-		dbgprint(L"CreateProcess failed (%d).\n", GetLastError());
-		return;
-	}
-	// Wait until child process exits.
-	WaitForSingleObject(pi.hProcess, INFINITE);
-	// Close process and thread handles.
-	CloseHandle(pi.hProcess);
-	CloseHandle(pi.hThread);
-}
-
-void GetTouchScreens()
-{
-	HDEVINFO deviceInfoSet = SetupDiGetClassDevs(&GUID_DEVINTERFACE_HID, NULL, NULL, DIGCF_DEVICEINTERFACE | DIGCF_PRESENT);
-	if (deviceInfoSet == INVALID_HANDLE_VALUE) {
-		dbgprint(L"SetupDiGetClassDevs failed: %s", GetLastErrorAsWString().c_str());
-		return;
-	}
-
-	SP_DEVICE_INTERFACE_DATA deviceInterfaceData;
-	ZeroMemory(&deviceInterfaceData, sizeof(deviceInterfaceData));
-	deviceInterfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
-
-	for (DWORD i = 0; SetupDiEnumDeviceInterfaces(deviceInfoSet, NULL, &GUID_DEVINTERFACE_HID, i, &deviceInterfaceData); i++)
-	{
-		DWORD requiredSize = 0;
-		SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, NULL, 0, &requiredSize, NULL);
-
-		PSP_DEVICE_INTERFACE_DETAIL_DATA detailData = (PSP_DEVICE_INTERFACE_DETAIL_DATA)LocalAlloc(LMEM_FIXED, requiredSize);
-		if (detailData == NULL)
-			continue;
-
-		detailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
-		SP_DEVINFO_DATA devInfoData;
-		ZeroMemory(&devInfoData, sizeof(devInfoData));
-		devInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
-
-		if (SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, detailData, requiredSize, NULL, &devInfoData))
-		{
-			HANDLE deviceHandle = CreateFile(detailData->DevicePath, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
-			if (deviceHandle != INVALID_HANDLE_VALUE)
-			{
-				PHIDP_PREPARSED_DATA preparsedData;
-				HIDP_CAPS caps;
-				if (HidD_GetPreparsedData(deviceHandle, &preparsedData) == TRUE)
-				{
-					if (HidP_GetCaps(preparsedData, &caps) != HIDP_STATUS_SUCCESS) {
-						dbgprint(L"HidP_GetCaps failed\n");
-					}
-					// filter for touch-screen type devices
-					if (caps.UsagePage == HID_USAGE_PAGE_DIGITIZER &&
-						(caps.Usage == HID_USAGE_DIGITIZER_HEAT_MAP || // surface pro touch screen device is heat_map type
-							caps.Usage == HID_USAGE_DIGITIZER_TOUCH_SCREEN ||
-							caps.Usage == HID_USAGE_DIGITIZER_MULTI_POINT))
-					{
-						CONFIGRET cr;
-						// get string with deviceid 
-						WCHAR deviceId[MAX_DEVICE_ID_LEN];
-						if ((cr = CM_Get_Device_IDW(devInfoData.DevInst, deviceId, MAX_DEVICE_ID_LEN, 0)) != CR_SUCCESS) {
-							dbgprint(L"CM_Get_Device_IDA failed with error %08X\n", cr);
-						}
-
-						dbgprint(L"Found touch screen device: %s\n", deviceId);
-						g_TouchScreens.push_back(deviceId);
-
-						CloseHandle(deviceHandle);
-					}
-					HidD_FreePreparsedData(preparsedData);
-				}
-			}
-		}
-		LocalFree(detailData);
-	}
-	SetupDiDestroyDeviceInfoList(deviceInfoSet);
-}
-
-void SoundEffect(bool enable)
-{
-	LPCWSTR soundFile = enable ? L"C:\\Windows\\Media\\Speech On.wav" : L"C:\\Windows\\Media\\Speech Off.wav";
-	PlaySound(soundFile, NULL, SND_FILENAME | SND_ASYNC);
-}
-
-void SetKbdHistoryIndex(DWORD vkKey) {
-	auto i = GetAvailableKbdHistoryIndex();
-	Volume_Event_History[i] = vkKey;
-	if ((i == 3) && CheckForVolumeUpDownUpDown()) {
-		lock_enabled = !lock_enabled;
-		
-		for (auto screen : g_TouchScreens) {
-			ToggleTouchDevice(screen.c_str(), !lock_enabled);
-		}
-		SoundEffect(!lock_enabled);
-	}
-}
-
-LRESULT CALLBACK pWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
-	if (uMsg == WM_INPUT) {
-		UINT dwSize = 0;
-		GetRawInputData((HRAWINPUT)lParam, RID_INPUT, nullptr, &dwSize, sizeof(RAWINPUTHEADER));
-		if (dwSize > 0) {
-			static BYTE lpb[64];
-			auto eventInfo = (RAWINPUT*)lpb;
-			if (GetRawInputData((HRAWINPUT)lParam, RID_INPUT, lpb, &dwSize, sizeof(RAWINPUTHEADER)) == dwSize &&
-				eventInfo->header.dwType == RIM_TYPEKEYBOARD &&
-				eventInfo->data.keyboard.Message == WM_KEYDOWN &&
-				(eventInfo->data.keyboard.VKey == VK_VOLUME_UP ||
-					eventInfo->data.keyboard.VKey == VK_VOLUME_DOWN))
-				SetKbdHistoryIndex(eventInfo->data.keyboard.VKey);
-		}
-	}
-	return DefWindowProc(hWnd, uMsg, wParam, lParam);
-}
-
-DWORD WINAPI InputEventThread(LPVOID lpParameter) {
-	static const wchar_t* winClassName = L"RECV_RAW_INPT";
-	WNDCLASSEX wx = {};
-	wx.cbSize = sizeof(WNDCLASSEX);
-	wx.lpfnWndProc = pWndProc; // Callback to handle messages
-	wx.hInstance = GetModuleHandle(NULL);
-	wx.lpszClassName = winClassName;
-	HWND hWnd = NULL;
-	if (RegisterClassEx(&wx)) {
-		hWnd = CreateWindowEx(0, winClassName, L"IOInptWin", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, NULL, NULL);
-	}
-
-	RAWINPUTDEVICE Rid[1]; // 1 = number of devices to listen to
-	Rid[0].usUsagePage = HID_USAGE_PAGE_GENERIC;
-	Rid[0].usUsage = HID_USAGE_GENERIC_KEYBOARD;
-	Rid[0].dwFlags = RIDEV_INPUTSINK;
-	Rid[0].hwndTarget = hWnd;
-	RegisterRawInputDevices(Rid, 1, sizeof(Rid[0]));
-
-	MSG msg;
-	while (GetMessage(&msg, NULL, 0, 0)) {
-		TranslateMessage(&msg);
-		DispatchMessage(&msg);
-	}
-	return 0;
-}
-
-// CheckIfAlreadyRunning is a function that installs a global mutex and checks if it already exists
-// if it does, it means that the program is already running and we should exit
-bool CheckIfAlreadyRunning() {
-	HANDLE hMutex = CreateMutex(NULL, TRUE, L"Global\\SAGE_LOCK_INSTANCE");
-	if (GetLastError() == ERROR_ALREADY_EXISTS) {
-		CloseHandle(hMutex);
-		return true;
-	}
-	return false;
-}
-
-int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd)
-{
-	if (CheckIfAlreadyRunning()) {
-		MessageBoxW(NULL, L"SageLock is already running", L"SageLock", MB_OK | MB_ICONERROR);
-		return 0;
-	}
-
-	// Populate Touch List
-	GetTouchScreens();
-
-	HANDLE hInputThread = CreateThread(NULL, NULL, InputEventThread, NULL, NULL, NULL);
-	WaitForSingleObject(hInputThread, INFINITE);
-	return 0;
-}
-
+/////////////
+// sage_lock.cpp : This file contains code to lock HID touch devices when a volume up/down pattern is detected.
+// Author: Phillip McNallen (2023)
+//////
+
+#include <Windows.h>
+#include <Windowsx.h>
+#include <iostream>
+#include <array>
+#include <initguid.h>
+#include <ntddstor.h>
+#include <hidusage.h>
+#include <SetupAPI.h>
+#include <Cfgmgr32.h>
+#include <Dbt.h>
+#include <Hidclass.h>
+#include <Hidsdi.h>
+#include <hidusage.h>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <iomanip>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include "clock.h"
+#include "deferred_log.h"
+#include "device_cache.h"
+#include "device_toggler.h"
+#include "gesture_dsl.h"
+#include "hid_descriptor.h"
+#include "input_trace.h"
+#include "key_event.h"
+#include "lock_pipeline.h"
+#include "probe_fanout.h"
+#include "shared_metrics.h"
+#include "trace_spans.h"
+
+#pragma comment(lib, "hid.lib")
+#pragma comment(lib, "SetupAPI.lib")
+#pragma comment(lib, "Winmm.lib")
+
+std::wstring GetLastErrorAsWString()
+{
+	DWORD errorMessageID = ::GetLastError();
+	if (errorMessageID == 0) {
+		return std::wstring(L"No error"); //No error message has been recorded
+	}
+	wchar_t lpBuffer[256];
+	size_t size = FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+				NULL, errorMessageID, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), lpBuffer, sizeof(lpBuffer), NULL);
+	return lpBuffer;
+}
+
+
+// GLOBALS TO TRACK VOLUME UP DOWN UP DOWN EVENTS
+// gesture tables are compiled from their text form at build time; index 0 toggles the lock
+constexpr GestureSet g_Gestures = CompileGestures({ kToggleGestureDsl });
+constexpr int TOGGLE_GESTURE = 0;
+InputTraceRecorder g_TraceRecorder; // records raw key events when started with --trace=<file>
+DeviceCache g_DeviceCache; // touch screens found on earlier runs, see --cache=<file>
+
+// convert a device id between the UTF-8 form used by the toggle backends and the wide form used by Win32
+std::string WideToUtf8(const wchar_t* wide) {
+	int size = WideCharToMultiByte(CP_UTF8, 0, wide, -1, NULL, 0, NULL, NULL);
+	if (size <= 1) {
+		return std::string();
+	}
+	std::string utf8(size - 1, '\0');
+	WideCharToMultiByte(CP_UTF8, 0, wide, -1, utf8.data(), size, NULL, NULL);
+	return utf8;
+}
+
+bool Utf8ToWide(std::string_view utf8, wchar_t* wide, int wideLen) {
+	int n = MultiByteToWideChar(CP_UTF8, 0, utf8.data(), (int)utf8.size(), wide, wideLen - 1);
+	if (n <= 0) {
+		return false;
+	}
+	wide[n] = L'\0';
+	return true;
+}
+
+// log lines go to the visual studio output window, formatted on the log thread instead of the caller's
+class DebuggerLogSink : public LogSink {
+public:
+	void Write(const std::string& line) override {
+		wchar_t wide[1024];
+		if (Utf8ToWide(line, wide, 1024)) {
+			OutputDebugStringW(wide);
+		}
+	}
+};
+
+// wrap a call to run the program pnputil with /disable-device and /enable-device
+class PnputilToggler : public DeviceToggler {
+public:
+	const char* Name() const override { return "pnputil"; }
+
+	bool Toggle(std::string_view deviceId, bool enable) override {
+		wchar_t wideId[MAX_DEVICE_ID_LEN];
+		if (!Utf8ToWide(deviceId, wideId, MAX_DEVICE_ID_LEN)) {
+			return false;
+		}
+		wchar_t cmd[4096];
+		swprintf_s(cmd, L"pnputil.exe %s \"%s\"", enable ? L"/enable-device" : L"/disable-device", wideId);
+		SAGE_LOG("Running command: pnputil.exe %s \"%s\"\n", enable ? "/enable-device" : "/disable-device", deviceId);
+		// Use CreateProcessW
+		STARTUPINFO si;
+		PROCESS_INFORMATION pi;
+		ZeroMemory(&si, sizeof(si));
+		si.cb = sizeof(si);
+		ZeroMemory(&pi, sizeof(pi));
+		BOOL created;
+		{
+			SAGE_SPAN("CreateProcessW");
+			created = CreateProcessW(NULL, cmd, NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
+		}
+		if (!created) {
+			SAGE_LOG("CreateProcess failed (%d).\n", GetLastError());
+			return false;
+		}
+		// Wait until child process exits.
+		{
+			SAGE_SPAN("WaitForSingleObject");
+			WaitForSingleObject(pi.hProcess, INFINITE);
+		}
+		DWORD exitCode = 1;
+		GetExitCodeProcess(pi.hProcess, &exitCode);
+		// Close process and thread handles.
+		CloseHandle(pi.hProcess);
+		CloseHandle(pi.hThread);
+		return exitCode == 0;
+	}
+};
+
+// does what pnputil /disable-device does, but in-process through the class installer (DIF_PROPERTYCHANGE)
+class SetupApiToggler : public DeviceToggler {
+public:
+	const char* Name() const override { return "setupapi"; }
+
+	bool Toggle(std::string_view deviceId, bool enable) override {
+		wchar_t wideId[MAX_DEVICE_ID_LEN];
+		if (!Utf8ToWide(deviceId, wideId, MAX_DEVICE_ID_LEN)) {
+			return false;
+		}
+		SAGE_SPAN("SetupDiCallClassInstaller");
+		HDEVINFO devs = SetupDiCreateDeviceInfoList(NULL, NULL);
+		if (devs == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		SP_DEVINFO_DATA devInfoData;
+		ZeroMemory(&devInfoData, sizeof(devInfoData));
+		devInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
+
+		bool ok = false;
+		if (SetupDiOpenDeviceInfoW(devs, wideId, NULL, 0, &devInfoData)) {
+			SP_PROPCHANGE_PARAMS params;
+			ZeroMemory(&params, sizeof(params));
+			params.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
+			params.ClassInstallHeader.InstallFunction = DIF_PROPERTYCHANGE;
+			params.StateChange = enable ? DICS_ENABLE : DICS_DISABLE;
+			params.Scope = DICS_FLAG_GLOBAL;
+			ok = SetupDiSetClassInstallParamsW(devs, &devInfoData, &params.ClassInstallHeader, sizeof(params)) &&
+				SetupDiCallClassInstaller(DIF_PROPERTYCHANGE, devs, &devInfoData);
+		}
+		if (!ok) {
+			SAGE_LOG("SetupApi toggle of %s failed: %s\n", deviceId, GetLastErrorAsWString());
+		}
+		SetupDiDestroyDeviceInfoList(devs);
+		return ok;
+	}
+};
+
+// "--trace=<file>" records every volume key event for offline replay with sage_lock_replay
+void StartTraceFromCommandLine(const char* cmdLine) {
+	const char* arg = (cmdLine != NULL) ? strstr(cmdLine, "--trace=") : NULL;
+	if (arg == NULL) {
+		return;
+	}
+	arg += strlen("--trace=");
+	std::string path(arg, strcspn(arg, " "));
+	if (!g_TraceRecorder.Start(path.c_str())) {
+		SAGE_LOG("Could not open trace file %s\n", path);
+	}
+}
+
+// "--cache=<file>" moves the device cache; it defaults to %LOCALAPPDATA%\sage_lock.devices
+std::string DeviceCachePathFromCommandLine(const char* cmdLine) {
+	const char* arg = (cmdLine != NULL) ? strstr(cmdLine, "--cache=") : NULL;
+	if (arg != NULL) {
+		arg += strlen("--cache=");
+		return std::string(arg, strcspn(arg, " "));
+	}
+	char localAppData[MAX_PATH];
+	DWORD len = GetEnvironmentVariableA("LOCALAPPDATA", localAppData, MAX_PATH);
+	if (len == 0 || len >= MAX_PATH) {
+		return std::string();
+	}
+	return std::string(localAppData) + "\\sage_lock.devices";
+}
+
+// "--metrics=<name>" renames the shared memory segment sage_lock_stat reads; it defaults to Local\sage_lock_metrics
+std::string MetricsNameFromCommandLine(const char* cmdLine) {
+	const char* arg = (cmdLine != NULL) ? strstr(cmdLine, "--metrics=") : NULL;
+	if (arg == NULL) {
+		return kDefaultMetricsName;
+	}
+	arg += strlen("--metrics=");
+	return std::string(arg, strcspn(arg, " "));
+}
+
+// "--spans=<file>" writes the recorded trace spans as Chrome trace JSON at exit, and whenever the
+// Local\sage_lock_dump_spans event is signalled; empty when not given
+std::string SpansPathFromCommandLine(const char* cmdLine) {
+	const char* arg = (cmdLine != NULL) ? strstr(cmdLine, "--spans=") : NULL;
+	if (arg == NULL) {
+		return std::string();
+	}
+	arg += strlen("--spans=");
+	return std::string(arg, strcspn(arg, " "));
+}
+
+// pick the toggle backend from the command line, e.g. "--toggler=pnputil"; setupapi is the default
+std::unique_ptr<DeviceToggler> CreateDeviceToggler(const char* cmdLine) {
+	if (cmdLine != NULL && strstr(cmdLine, "--toggler=pnputil") != NULL) {
+		return std::make_unique<PnputilToggler>();
+	}
+	return std::make_unique<SetupApiToggler>();
+}
+
+// device ids are compared as strings; Win32 treats them case-insensitively and reports either case
+std::string NormalizeDeviceId(std::string id) {
+	for (auto& c : id) {
+		c = (char)toupper((unsigned char)c);
+	}
+	return id;
+}
+
+std::string NormalizeDeviceId(const wchar_t* deviceId) {
+	return NormalizeDeviceId(WideToUtf8(deviceId));
+}
+
+// returns true and the device instance id if the HID interface belongs to a touch screen
+bool ProbeTouchScreen(HDEVINFO deviceInfoSet, SP_DEVICE_INTERFACE_DATA* deviceInterfaceData, CachedDevice& touchScreen)
+{
+	bool found = false;
+	DWORD requiredSize = 0;
+	SetupDiGetDeviceInterfaceDetail(deviceInfoSet, deviceInterfaceData, NULL, 0, &requiredSize, NULL);
+
+	PSP_DEVICE_INTERFACE_DETAIL_DATA detailData = (PSP_DEVICE_INTERFACE_DETAIL_DATA)LocalAlloc(LMEM_FIXED, requiredSize);
+	if (detailData == NULL)
+		return false;
+
+	detailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+	SP_DEVINFO_DATA devInfoData;
+	ZeroMemory(&devInfoData, sizeof(devInfoData));
+	devInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
+
+	if (SetupDiGetDeviceInterfaceDetail(deviceInfoSet, deviceInterfaceData, detailData, requiredSize, NULL, &devInfoData))
+	{
+		HANDLE deviceHandle = CreateFile(detailData->DevicePath, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+		if (deviceHandle != INVALID_HANDLE_VALUE)
+		{
+			PHIDP_PREPARSED_DATA preparsedData;
+			HIDP_CAPS caps;
+			if (HidD_GetPreparsedData(deviceHandle, &preparsedData) == TRUE)
+			{
+				if (HidP_GetCaps(preparsedData, &caps) != HIDP_STATUS_SUCCESS) {
+					SAGE_LOG("HidP_GetCaps failed\n");
+				}
+				// filter for touch-screen type devices
+				else if (caps.UsagePage == HID_USAGE_PAGE_DIGITIZER &&
+					(caps.Usage == HID_USAGE_DIGITIZER_HEAT_MAP || // surface pro touch screen device is heat_map type
+						caps.Usage == HID_USAGE_DIGITIZER_TOUCH_SCREEN ||
+						caps.Usage == HID_USAGE_DIGITIZER_MULTI_POINT))
+				{
+					CONFIGRET cr;
+					// get string with deviceid 
+					WCHAR deviceId[MAX_DEVICE_ID_LEN];
+					if ((cr = CM_Get_Device_IDW(devInfoData.DevInst, deviceId, MAX_DEVICE_ID_LEN, 0)) != CR_SUCCESS) {
+						SAGE_LOG("CM_Get_Device_IDA failed with error %08X\n", cr);
+					}
+					else {
+						SAGE_LOG("Found touch screen device: %s\n", deviceId);
+						touchScreen.id = NormalizeDeviceId(deviceId);
+						touchScreen.identity = NormalizeDeviceId(detailData->DevicePath);
+						touchScreen.classes = (uint8_t)(1u << (unsigned)(caps.Usage == HID_USAGE_DIGITIZER_HEAT_MAP ? HidClass::HeatMap :
+							caps.Usage == HID_USAGE_DIGITIZER_MULTI_POINT ? HidClass::MultiPoint : HidClass::TouchScreen));
+						found = true;
+					}
+				}
+				HidD_FreePreparsedData(preparsedData);
+			}
+			CloseHandle(deviceHandle);
+		}
+	}
+	LocalFree(detailData);
+	return found;
+}
+
+// interface paths of every present HID device; nothing is opened, so this is quick even when a device is asleep
+std::vector<std::string> GetHidInterfacePaths()
+{
+	std::vector<std::string> paths;
+	HDEVINFO deviceInfoSet = SetupDiGetClassDevs(&GUID_DEVINTERFACE_HID, NULL, NULL, DIGCF_DEVICEINTERFACE | DIGCF_PRESENT);
+	if (deviceInfoSet == INVALID_HANDLE_VALUE) {
+		SAGE_LOG("SetupDiGetClassDevs failed: %s", GetLastErrorAsWString());
+		return paths;
+	}
+
+	SP_DEVICE_INTERFACE_DATA deviceInterfaceData;
+	ZeroMemory(&deviceInterfaceData, sizeof(deviceInterfaceData));
+	deviceInterfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+
+	for (DWORD i = 0; SetupDiEnumDeviceInterfaces(deviceInfoSet, NULL, &GUID_DEVINTERFACE_HID, i, &deviceInterfaceData); i++)
+	{
+		DWORD requiredSize = 0;
+		SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, NULL, 0, &requiredSize, NULL);
+		PSP_DEVICE_INTERFACE_DETAIL_DATA detailData = (PSP_DEVICE_INTERFACE_DETAIL_DATA)LocalAlloc(LMEM_FIXED, requiredSize);
+		if (detailData == NULL) {
+			continue;
+		}
+		detailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+		if (SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, detailData, requiredSize, NULL, NULL)) {
+			paths.push_back(WideToUtf8(detailData->DevicePath));
+		}
+		LocalFree(detailData);
+	}
+	SetupDiDestroyDeviceInfoList(deviceInfoSet);
+	return paths;
+}
+
+// probes one HID interface by path with its own device info set, so probes can run on any thread
+bool ProbeTouchScreenPath(const wchar_t* interfacePath, CachedDevice& touchScreen) {
+	HDEVINFO deviceInfoSet = SetupDiCreateDeviceInfoList(&GUID_DEVINTERFACE_HID, NULL);
+	if (deviceInfoSet == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	SP_DEVICE_INTERFACE_DATA deviceInterfaceData;
+	ZeroMemory(&deviceInterfaceData, sizeof(deviceInterfaceData));
+	deviceInterfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+	const bool found = SetupDiOpenDeviceInterfaceW(deviceInfoSet, interfacePath, 0, &deviceInterfaceData) &&
+		ProbeTouchScreen(deviceInfoSet, &deviceInterfaceData, touchScreen);
+	SetupDiDestroyDeviceInfoList(deviceInfoSet);
+	return found;
+}
+
+// "\\?\HID#VID_045E&PID_0C1A#7&2a4b2d1&0&0000#{4d1e55b2-...}" -> "HID\VID_045E&PID_0C1A\7&2A4B2D1&0&0000"
+std::string InterfacePathToDeviceId(const wchar_t* interfacePath) {
+	std::wstring path(interfacePath);
+	if (path.rfind(L"\\\\?\\", 0) == 0) {
+		path.erase(0, 4);
+	}
+	size_t guid = path.rfind(L'#');
+	if (guid != std::wstring::npos) {
+		path.erase(guid);
+	}
+	for (auto& c : path) {
+		if (c == L'#') {
+			c = L'\\';
+		}
+	}
+	return NormalizeDeviceId(path.c_str());
+}
+
+void SoundEffect(bool enable)
+{
+	LPCWSTR soundFile = enable ? L"C:\\Windows\\Media\\Speech On.wav" : L"C:\\Windows\\Media\\Speech Off.wav";
+	SAGE_SPAN("PlaySound");
+	PlaySound(soundFile, NULL, SND_FILENAME | SND_ASYNC);
+}
+
+// Toggles are fanned out so lock latency is the slowest device, not the sum of all of them
+constexpr unsigned MAX_TOGGLE_WORKERS = 4;
+constexpr std::chrono::milliseconds TOGGLE_DEADLINE{ 10000 };
+// Startup probes run in parallel too; a sleeping Bluetooth device can take seconds to open
+constexpr unsigned MAX_PROBE_WORKERS = 8;
+constexpr std::chrono::milliseconds PROBE_TIMEOUT{ 2000 };
+SystemClock g_Clock;
+std::unique_ptr<DeviceToggler> g_Toggler;
+SharedMetrics g_Metrics; // before g_Pipeline, which publishes into it until destroyed
+std::unique_ptr<LockPipeline> g_Pipeline;
+
+// a new HID interface: probe just that one instead of re-enumerating every device
+void OnHidInterfaceArrival(const wchar_t* interfacePath) {
+	CachedDevice touchScreen;
+	if (ProbeTouchScreenPath(interfacePath, touchScreen) && g_Pipeline->Devices().Add(touchScreen.id)) {
+		// while locked, Add has already disabled it
+		SAGE_LOG("Touch screen arrived: %s\n", touchScreen.id);
+	}
+}
+
+// full enumeration, run once in the background at startup; WM_DEVICECHANGE keeps the list current afterwards.
+// Interfaces are probed in parallel, and one that does not answer within PROBE_TIMEOUT is added if it turns out
+// to be a touch screen once it does. WinMain closes the sink before g_Pipeline goes away.
+std::shared_ptr<LateProbeSink> g_LateProbes = std::make_shared<LateProbeSink>([](const CachedDevice& touchScreen) {
+	if (g_Pipeline->Devices().Add(touchScreen.id)) {
+		SAGE_LOG("Touch screen answered late: %s\n", touchScreen.id);
+	}
+});
+
+ProbeReport GetTouchScreens() {
+	return ProbeDevices(GetHidInterfacePaths(), [](const std::string& path, CachedDevice& touchScreen) {
+		wchar_t widePath[1024];
+		return Utf8ToWide(path, widePath, 1024) && ProbeTouchScreenPath(widePath, touchScreen);
+	}, MAX_PROBE_WORKERS, PROBE_TIMEOUT, g_LateProbes);
+}
+
+void OnHidInterfaceRemoval(const wchar_t* interfacePath) {
+	// disabling a touch screen removes its interface too, so while locked a removal is most likely
+	// our own doing; the device must stay in the list to be enabled again on unlock
+	if (g_Pipeline->Devices().Locked()) {
+		return;
+	}
+	std::string deviceId = InterfacePathToDeviceId(interfacePath);
+	if (g_Pipeline->Devices().Remove(deviceId)) {
+		SAGE_LOG("Touch screen removed: %s\n", deviceId);
+	}
+}
+
+// WM_DEVICECHANGE arrives on the raw input thread, and probing a new interface opens it: a sleeping
+// Bluetooth device can hold that up for seconds, and adding one while locked waits for its disable.
+// Notifications are queued for one worker instead, which keeps arrivals and removals in order.
+struct HotplugNotification {
+	bool arrival;
+	std::wstring interfacePath;
+};
+std::mutex g_HotplugMutex;
+std::condition_variable g_HotplugReady;
+std::deque<HotplugNotification> g_HotplugQueue;
+bool g_HotplugStopping = false;
+
+void PostHotplug(bool arrival, const wchar_t* interfacePath) {
+	{
+		std::lock_guard<std::mutex> lock(g_HotplugMutex);
+		g_HotplugQueue.push_back({ arrival, interfacePath });
+	}
+	g_HotplugReady.notify_one();
+}
+
+// Handles queued notifications until StopHotplugWorker; whatever is queued by then is still handled.
+void HotplugWorker() {
+	std::unique_lock<std::mutex> lock(g_HotplugMutex);
+	for (;;) {
+		g_HotplugReady.wait(lock, [] { return g_HotplugStopping || !g_HotplugQueue.empty(); });
+		if (g_HotplugQueue.empty()) {
+			return;
+		}
+		HotplugNotification notification = std::move(g_HotplugQueue.front());
+		g_HotplugQueue.pop_front();
+		lock.unlock();
+		if (notification.arrival) {
+			OnHidInterfaceArrival(notification.interfacePath.c_str());
+		}
+		else {
+			OnHidInterfaceRemoval(notification.interfacePath.c_str());
+		}
+		lock.lock();
+	}
+}
+
+void StopHotplugWorker() {
+	{
+		std::lock_guard<std::mutex> lock(g_HotplugMutex);
+		g_HotplugStopping = true;
+	}
+	g_HotplugReady.notify_one();
+}
+
+// Runs on the action executor thread once every device has been toggled.
+void LogLockCycle(const LockCycle& cycle) {
+	const auto& results = *cycle.results;
+	for (size_t i = 0; i < results.size(); i++) {
+		SAGE_LOG("Toggle %s via %s: %s in %llu us\n", (*cycle.devices)[i], g_Toggler->Name(), ToggleStatusName(results[i].status), results[i].elapsedUs);
+	}
+	SAGE_LOG("%s took %llu us from last key press\n", cycle.action == LockAction::Lock ? "Lock" : "Unlock", (cycle.completeNs - cycle.triggerNs) / 1000);
+}
+
+// p50/p99/p999 of every lock cycle stage since startup
+void LogLatency(const LockPipeline& pipeline) {
+	for (size_t i = 0; i < (size_t)LockStage::Count; i++) {
+		const LatencyHistogram& latency = pipeline.Latency((LockStage)i);
+		SAGE_LOG("Latency %s: n=%llu p50=%.1f us p99=%.1f us p999=%.1f us max=%.1f us\n", LockStageName((LockStage)i), latency.Count(),
+			latency.Percentile(50) / 1000.0, latency.Percentile(99) / 1000.0, latency.Percentile(99.9) / 1000.0, latency.Max() / 1000.0);
+	}
+}
+
+void SetKbdHistoryIndex(const KeyEvent& event) {
+	g_TraceRecorder.Record(event);
+	g_Pipeline->OnKeyEvent(event);
+}
+
+// feeds one raw keyboard record to the gesture pipeline if it is a volume key
+void DispatchRawInput(const RAWINPUT* raw, uint64_t timeNs) {
+	if (raw->header.dwType != RIM_TYPEKEYBOARD ||
+		(raw->data.keyboard.VKey != VK_VOLUME_UP && raw->data.keyboard.VKey != VK_VOLUME_DOWN)) {
+		return;
+	}
+	KeyEvent event;
+	event.timeNs = timeNs;
+	event.key = (raw->data.keyboard.VKey == VK_VOLUME_UP) ? GestureKey::VolumeUp : GestureKey::VolumeDown;
+	event.device = (uint64_t)raw->header.hDevice;
+	// key-ups are passed on too: the engine needs them to tell a new press from autorepeat
+	event.down = (raw->data.keyboard.Flags & RI_KEY_BREAK) == 0;
+	SetKbdHistoryIndex(event);
+}
+
+// records drained per GetRawInputBuffer call; keyboard records are a few dozen bytes each
+constexpr UINT RAW_INPUT_BATCH_BYTES = 64 * sizeof(RAWINPUT);
+
+LRESULT CALLBACK pWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
+	if (uMsg == WM_INPUT) {
+		// read the clocks before anything else so gesture timing sees arrival time, not processing time
+		const uint64_t nowNs = MonotonicNowNs();
+		const DWORD tickNowMs = GetTickCount();
+		// a keyboard record always fits in a RAWINPUT, so one call reads it without probing the size first.
+		// Once a message's record has been drained by GetRawInputBuffer below, this call fails and is skipped.
+		RAWINPUT raw;
+		UINT dwSize = sizeof(raw);
+		UINT got;
+		{
+			SAGE_SPAN("GetRawInputData");
+			got = GetRawInputData((HRAWINPUT)lParam, RID_INPUT, &raw, &dwSize, sizeof(RAWINPUTHEADER));
+		}
+		if (got != (UINT)-1) {
+			DispatchRawInput(&raw, MessageArrivalNs((DWORD)GetMessageTime(), tickNowMs, nowNs));
+		}
+		// then drain everything else already queued in as few calls as possible, instead of one
+		// message and two GetRawInputData calls per key during a burst
+		alignas(8) static BYTE batch[RAW_INPUT_BATCH_BYTES];
+		for (;;) {
+			UINT cbSize = sizeof(batch);
+			UINT count = GetRawInputBuffer((RAWINPUT*)batch, &cbSize, sizeof(RAWINPUTHEADER));
+			if (count == 0 || count == (UINT)-1) {
+				break;
+			}
+			// The records carry no time; their WM_INPUT messages, still queued in the same order, do.
+			// Taking one message per record stamps each with its own arrival and spares the message
+			// loop a wakeup for it. A message whose record is still readable arrived after the drain:
+			// it is handled after the batch, and the records left without a message keep the time of
+			// the one being handled.
+			const RAWINPUT* next = (const RAWINPUT*)batch;
+			MSG queued;
+			bool newer = false;
+			for (UINT i = 0; i < count; i++) {
+				uint64_t timeNs = nowNs;
+				if (!newer && PeekMessage(&queued, hWnd, WM_INPUT, WM_INPUT, PM_REMOVE)) {
+					dwSize = sizeof(raw);
+					newer = GetRawInputData((HRAWINPUT)queued.lParam, RID_INPUT, &raw, &dwSize, sizeof(RAWINPUTHEADER)) != (UINT)-1;
+					if (!newer) {
+						timeNs = MessageArrivalNs(queued.time, tickNowMs, nowNs);
+					}
+					DefWindowProc(hWnd, WM_INPUT, queued.wParam, queued.lParam);
+				}
+				DispatchRawInput(next, timeNs);
+				next = NEXTRAWINPUTBLOCK(next);
+			}
+			if (newer) {
+				DispatchRawInput(&raw, MessageArrivalNs(queued.time, tickNowMs, nowNs));
+			}
+		}
+	}
+	else if (uMsg == WM_INPUT_DEVICE_CHANGE && wParam == GIDC_REMOVAL) {
+		g_Pipeline->ForgetDevice((uint64_t)lParam);
+	}
+	else if (uMsg == WM_DEVICECHANGE && (wParam == DBT_DEVICEARRIVAL || wParam == DBT_DEVICEREMOVECOMPLETE)) {
+		auto header = (PDEV_BROADCAST_HDR)lParam;
+		if (header != NULL && header->dbch_devicetype == DBT_DEVTYP_DEVICEINTERFACE) {
+			auto deviceInterface = (PDEV_BROADCAST_DEVICEINTERFACE_W)header;
+			PostHotplug(wParam == DBT_DEVICEARRIVAL, deviceInterface->dbcc_name);
+		}
+	}
+	return DefWindowProc(hWnd, uMsg, wParam, lParam);
+}
+
+DWORD WINAPI InputEventThread(LPVOID lpParameter) {
+	static const wchar_t* winClassName = L"RECV_RAW_INPT";
+	WNDCLASSEX wx = {};
+	wx.cbSize = sizeof(WNDCLASSEX);
+	wx.lpfnWndProc = pWndProc; // Callback to handle messages
+	wx.hInstance = GetModuleHandle(NULL);
+	wx.lpszClassName = winClassName;
+	HWND hWnd = NULL;
+	if (RegisterClassEx(&wx)) {
+		hWnd = CreateWindowEx(0, winClassName, L"IOInptWin", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, NULL, NULL);
+	}
+
+	RAWINPUTDEVICE Rid[1]; // 1 = number of devices to listen to
+	Rid[0].usUsagePage = HID_USAGE_PAGE_GENERIC;
+	Rid[0].usUsage = HID_USAGE_GENERIC_KEYBOARD;
+	Rid[0].dwFlags = RIDEV_INPUTSINK | RIDEV_DEVNOTIFY; // DEVNOTIFY: WM_INPUT_DEVICE_CHANGE on unplug
+	Rid[0].hwndTarget = hWnd;
+	RegisterRawInputDevices(Rid, 1, sizeof(Rid[0]));
+
+	// touch screens attached later (dock, USB reset, resume) arrive as WM_DEVICECHANGE
+	DEV_BROADCAST_DEVICEINTERFACE_W hidFilter = {};
+	hidFilter.dbcc_size = sizeof(hidFilter);
+	hidFilter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+	hidFilter.dbcc_classguid = GUID_DEVINTERFACE_HID;
+	HDEVNOTIFY hDevNotify = RegisterDeviceNotificationW(hWnd, &hidFilter, DEVICE_NOTIFY_WINDOW_HANDLE);
+
+	MSG msg;
+	while (GetMessage(&msg, NULL, 0, 0)) {
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+	if (hDevNotify != NULL) {
+		UnregisterDeviceNotification(hDevNotify);
+	}
+	return 0;
+}
+
+// CheckIfAlreadyRunning is a function that installs a global mutex and checks if it already exists
+// if it does, it means that the program is already running and we should exit
+bool CheckIfAlreadyRunning() {
+	HANDLE hMutex = CreateMutex(NULL, TRUE, L"Global\\SAGE_LOCK_INSTANCE");
+	if (GetLastError() == ERROR_ALREADY_EXISTS) {
+		CloseHandle(hMutex);
+		return true;
+	}
+	return false;
+}
+
+int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd)
+{
+	if (CheckIfAlreadyRunning()) {
+		MessageBoxW(NULL, L"SageLock is already running", L"SageLock", MB_OK | MB_ICONERROR);
+		return 0;
+	}
+	StartDeferredLog(std::make_unique<DebuggerLogSink>());
+
+	// Seed the touch list from the cache instead of opening every HID device before listening;
+	// the full enumeration runs once the input thread is up
+	std::vector<CachedDevice> cached;
+	std::vector<std::string> seeded;
+	const std::string cachePath = DeviceCachePathFromCommandLine(lpCmdLine);
+	if (!cachePath.empty() && g_DeviceCache.Open(cachePath.c_str())) {
+		cached = g_DeviceCache.Load(DeviceCacheNow());
+		for (const auto& device : cached) {
+			seeded.push_back(device.id);
+		}
+	}
+
+	StartTraceFromCommandLine(lpCmdLine);
+	g_Toggler = CreateDeviceToggler(lpCmdLine);
+	SAGE_LOG("Using %s toggle backend\n", g_Toggler->Name());
+	LockPipelineConfig config;
+	config.toggleGesture = TOGGLE_GESTURE;
+	config.toggleWorkers = MAX_TOGGLE_WORKERS;
+	config.toggleDeadline = TOGGLE_DEADLINE;
+	g_Pipeline = std::make_unique<LockPipeline>(g_Gestures, *g_Toggler, g_Clock, config);
+	g_Pipeline->SetDevices(seeded);
+	g_Pipeline->SetFeedback(SoundEffect);
+	g_Pipeline->SetCycleObserver(LogLockCycle);
+	const std::string metricsName = MetricsNameFromCommandLine(lpCmdLine);
+	if (g_Metrics.Create(metricsName.c_str())) {
+		g_Pipeline->SetMetrics(&g_Metrics);
+	}
+	else {
+		SAGE_LOG("Could not create metrics segment %s\n", metricsName);
+	}
+	g_Pipeline->Start();
+	const std::string spansPath = SpansPathFromCommandLine(lpCmdLine);
+	HANDLE dumpSpansEvent = NULL;
+	if (!spansPath.empty()) {
+		if (!SAGE_TRACE_SPANS) {
+			SAGE_LOG("--spans given, but this build has no trace spans (SAGE_TRACE_SPANS=0)\n");
+		}
+		// auto-reset, so each SetEvent from outside produces one dump
+		dumpSpansEvent = CreateEventW(NULL, FALSE, FALSE, L"Local\\sage_lock_dump_spans");
+	}
+	if (dumpSpansEvent != NULL) {
+		std::thread([dumpSpansEvent, spansPath] {
+			while (WaitForSingleObject(dumpSpansEvent, INFINITE) == WAIT_OBJECT_0) {
+				if (!WriteTraceSpans(spansPath.c_str())) {
+					SAGE_LOG("Could not write trace spans to %s\n", spansPath);
+				}
+			}
+		}).detach();
+	}
+	std::thread hotplugThread(HotplugWorker);
+	HANDLE hInputThread = CreateThread(NULL, NULL, InputEventThread, NULL, NULL, NULL);
+	// instance ids are stable, so cached devices are trusted until this finishes; one that was not
+	// cached and shows up here while locked is disabled by Add
+	std::thread validateThread([&cached, &seeded] {
+		ProbeReport report = GetTouchScreens();
+		// a cached touch screen that did not answer in time is still there, just slow
+		for (const auto& path : report.timedOut) {
+			const std::string identity = NormalizeDeviceId(path);
+			for (const auto& device : cached) {
+				if (device.identity == identity) {
+					report.found.push_back(device);
+				}
+			}
+		}
+		const CacheValidation validation = ApplyEnumeration(g_Pipeline->Devices(), seeded, report.found);
+		g_DeviceCache.Store(report.found, DeviceCacheNow());
+		SAGE_LOG("Found %zu touch screen(s) in %llu us, %zu probe(s) timed out: %zu not cached, %zu cached but gone\n",
+			report.found.size(), report.elapsedUs, report.timedOut.size(), validation.added, validation.removed);
+	});
+	WaitForSingleObject(hInputThread, INFINITE);
+	StopHotplugWorker();
+	hotplugThread.join();
+	validateThread.join();
+	// an abandoned probe may still answer; it must not reach the pipeline once this returns
+	g_LateProbes->Close();
+	g_Pipeline->Stop();
+	LogLatency(*g_Pipeline);
+	if (!spansPath.empty() && !WriteTraceSpans(spansPath.c_str())) {
+		SAGE_LOG("Could not write trace spans to %s\n", spansPath);
+	}
+	g_TraceRecorder.Stop();
+	StopDeferredLog();
+	return 0;
+}
+
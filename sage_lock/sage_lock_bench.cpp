@@ -0,0 +1,1939 @@
+/////////////
+// sage_lock_bench.cpp : Benchmarks for the portable sage_lock components.
+// Runs headless on Linux against fake device backends; pass benchmark names to run just those (an
+// unknown name lists the valid ones and exits 2).
+// --json runs the *_sweep suite (or the named sweeps) and prints one JSON document for regression tracking.
+//////
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <filesystem>
+#include <iterator>
+#include <string>
+#include <new>
+#include <thread>
+#include <semaphore>
+#include <unordered_map>
+#include <vector>
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/input.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#include "evdev_input.h"
+#include "touch_hotplug.h"
+#include "uinput_keyboard.h"
+#endif
+#include "action_executor.h"
+#include "deferred_log.h"
+#include "device_cache.h"
+#include "device_id_table.h"
+#include "device_state_table.h"
+#include "device_toggler.h"
+#include "gesture_dsl.h"
+#include "gesture_engine.h"
+#include "gesture_matcher.h"
+#include "hid_descriptor.h"
+#include "tests/hid_corpus.h"
+#include "input_trace.h"
+#include "latency_histogram.h"
+#include "lock_pipeline.h"
+#include "probe_fanout.h"
+#include "shared_metrics.h"
+#include "sim_devices.h"
+#include "key_event.h"
+#include "toggle_fanout.h"
+#include "touch_device_registry.h"
+#include "trace_spans.h"
+
+using BenchClock = std::chrono::steady_clock;
+
+// Set by a benchmark that checks an invariant rather than only measuring; main returns it.
+static int g_Failed = 0;
+
+// Global allocation counter for id_table. Only counts while enabled, so other benchmarks pay one
+// relaxed load per allocation. The steady-state lock path is held to zero allocations by
+// tests/alloc_free_test.cpp.
+static std::atomic<bool> g_CountAllocations{ false };
+static std::atomic<uint64_t> g_Allocations{ 0 };
+static std::atomic<uint64_t> g_AllocatedBytes{ 0 };
+
+// GCC pairs the inlined free below with operator new rather than malloc and warns
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+	if (g_CountAllocations.load(std::memory_order_relaxed)) {
+		g_Allocations.fetch_add(1, std::memory_order_relaxed);
+		g_AllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	}
+	if (void* p = malloc(size != 0 ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+static double ElapsedUs(BenchClock::time_point start, BenchClock::time_point end) {
+	return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+// Fake device backend: each toggle costs a fixed amount of wall time, like a pnputil run.
+struct FakeDeviceBackend {
+	int deviceCount = 2;
+	std::chrono::milliseconds toggleLatency{ 50 };
+
+	void Apply(LockAction action) {
+		(void)action;
+		for (int i = 0; i < deviceCount; i++) {
+			std::this_thread::sleep_for(toggleLatency);
+		}
+	}
+};
+
+// Measures how long the input thread is stalled per gesture, toggling inline (old behavior)
+// versus handing the action to the executor thread.
+static void BenchInputStall() {
+	constexpr int kGestures = 8;
+	FakeDeviceBackend backend;
+
+	std::vector<double> inlineStalls;
+	for (int i = 0; i < kGestures; i++) {
+		auto start = BenchClock::now();
+		backend.Apply(i & 1 ? LockAction::Unlock : LockAction::Lock);
+		inlineStalls.push_back(ElapsedUs(start, BenchClock::now()));
+	}
+
+	std::vector<double> queuedStalls;
+	ActionExecutor executor([&backend](const LockCommand& command) { backend.Apply(command.action); });
+	executor.Start();
+	for (int i = 0; i < kGestures; i++) {
+		auto start = BenchClock::now();
+		executor.Submit({ i & 1 ? LockAction::Unlock : LockAction::Lock, 0 });
+		queuedStalls.push_back(ElapsedUs(start, BenchClock::now()));
+	}
+	executor.Stop();
+
+	auto report = [](const char* mode, std::vector<double>& stalls) {
+		std::sort(stalls.begin(), stalls.end());
+		double total = 0;
+		for (auto s : stalls) {
+			total += s;
+		}
+		printf("input_stall %-8s gestures=%zu mean_us=%.2f max_us=%.2f\n", mode, stalls.size(), total / stalls.size(), stalls.back());
+	};
+	report("inline", inlineStalls);
+	report("queued", queuedStalls);
+	if (executor.Dropped() != 0) {
+		printf("input_stall dropped=%llu\n", (unsigned long long)executor.Dropped());
+	}
+}
+
+// Simulated slow backend with a configurable latency per device. Device ids are "0", "1", ...
+struct SlowDeviceBackend {
+	std::vector<std::chrono::milliseconds> latency;
+
+	DeviceList Devices() const {
+		std::vector<std::string> ids;
+		for (size_t i = 0; i < latency.size(); i++) {
+			ids.push_back(std::to_string(i));
+		}
+		return MakeDeviceList(std::move(ids));
+	}
+
+	bool Toggle(std::string_view deviceId, bool enable) {
+		(void)enable;
+		std::this_thread::sleep_for(latency[std::stoul(std::string(deviceId))]);
+		return true;
+	}
+};
+
+// Wall time of one lock across devices with different latencies: sequential loop versus fan-out.
+static void BenchToggleFanout() {
+	using std::chrono::milliseconds;
+	SlowDeviceBackend backend{ { milliseconds(120), milliseconds(40), milliseconds(80), milliseconds(60) } };
+	milliseconds sum{ 0 }, max{ 0 };
+	for (auto l : backend.latency) {
+		sum += l;
+		max = std::max(max, l);
+	}
+	printf("toggle_fanout devices=%zu sum_ms=%lld max_ms=%lld\n", backend.latency.size(), (long long)sum.count(), (long long)max.count());
+
+	const DeviceList devices = backend.Devices();
+	SystemClock clock;
+	auto start = BenchClock::now();
+	for (const auto& device : *devices) {
+		backend.Toggle(device, false);
+	}
+	printf("toggle_fanout sequential  wall_ms=%.1f\n", ElapsedUs(start, BenchClock::now()) / 1000);
+
+	for (unsigned workers : { 1u, 2u, 4u }) {
+		ToggleFanout fanout([&backend](std::string_view id, bool enable) { return backend.Toggle(id, enable); }, workers, clock);
+		start = BenchClock::now();
+		auto results = fanout.Run(devices, false, milliseconds(1000));
+		printf("toggle_fanout workers=%u wall_ms=%.1f", workers, ElapsedUs(start, BenchClock::now()) / 1000);
+		for (const auto& result : results) {
+			printf(" %s/%lluus", ToggleStatusName(result.status), (unsigned long long)result.elapsedUs);
+		}
+		printf("\n");
+	}
+
+	// a deadline shorter than the slowest device reports that device as timed out
+	ToggleFanout fanout([&backend](std::string_view id, bool enable) { return backend.Toggle(id, enable); }, 4, clock);
+	start = BenchClock::now();
+	auto results = fanout.Run(devices, false, milliseconds(100));
+	printf("toggle_fanout deadline_ms=100 wall_ms=%.1f device0=%s\n", ElapsedUs(start, BenchClock::now()) / 1000, ToggleStatusName(results[0].status));
+}
+
+#ifdef __linux__
+// Stand-in for the pnputil backend: spawns a shell per toggle to write the same sysfs attribute.
+class SpawnToggler : public DeviceToggler {
+public:
+	explicit SpawnToggler(std::string root) : m_root(std::move(root)) {}
+
+	const char* Name() const override { return "spawn"; }
+
+	bool Toggle(std::string_view deviceId, bool enable) override {
+		std::string script = std::string("echo ") + (enable ? "0" : "1") + " > " + m_root + "/" + std::string(deviceId) + "/inhibited";
+		char* args[] = { (char*)"sh", (char*)"-c", script.data(), nullptr };
+		pid_t pid;
+		if (posix_spawn(&pid, "/bin/sh", nullptr, nullptr, args, environ) != 0) {
+			return false;
+		}
+		int status = 0;
+		waitpid(pid, &status, 0);
+		return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+
+private:
+	std::string m_root;
+};
+
+// Per-toggle cost of the in-process sysfs backend versus a process spawn, against a fake sysfs tree.
+static void BenchTogglerBackends() {
+	char root[] = "/tmp/sage_lock_sysfs.XXXXXX";
+	if (mkdtemp(root) == nullptr) {
+		printf("toggler_backends skipped: mkdtemp failed\n");
+		return;
+	}
+	const char* devices[] = { "input3", "input7" };
+	for (auto device : devices) {
+		std::string dir = std::string(root) + "/" + device;
+		mkdir(dir.c_str(), 0755);
+		FILE* f = fopen((dir + "/inhibited").c_str(), "w");
+		if (f) {
+			fputs("0", f);
+			fclose(f);
+		}
+	}
+
+	SpawnToggler spawn(root);
+	auto sysfs = CreateSysfsInhibitToggler(root);
+	for (DeviceToggler* toggler : { (DeviceToggler*)&spawn, sysfs.get() }) {
+		constexpr int kLocks = 200;
+		int failures = 0;
+		auto start = BenchClock::now();
+		for (int i = 0; i < kLocks; i++) {
+			for (auto device : devices) {
+				failures += !toggler->Toggle(device, i & 1);
+			}
+		}
+		double us = ElapsedUs(start, BenchClock::now());
+		printf("toggler_backends %-6s locks=%d us_per_lock=%.2f failures=%d\n", toggler->Name(), kLocks, us / kLocks, failures);
+	}
+
+	for (auto device : devices) {
+		std::string dir = std::string(root) + "/" + device;
+		unlink((dir + "/inhibited").c_str());
+		rmdir(dir.c_str());
+	}
+	rmdir(root);
+}
+#endif
+
+// Small deterministic PRNG so every run replays the same synthetic stream.
+struct XorShift {
+	uint64_t state = 0x9E3779B97F4A7C15ull;
+
+	uint64_t Next() {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return state;
+	}
+	uint32_t Below(uint32_t n) { return (uint32_t)(Next() % n); }
+};
+
+constexpr uint64_t kNsPerMs = 1000000;
+
+static std::vector<KeyEvent> MakeKeyStream(size_t count, uint32_t maxGapMs) {
+	XorShift rng;
+	std::vector<KeyEvent> events(count);
+	uint64_t timeNs = 0;
+	for (auto& event : events) {
+		timeNs += 1000 + rng.Below(maxGapMs * 1000) * 1000ull;
+		event.key = (GestureKey)rng.Below(kGestureKeyCount);
+		event.timeNs = timeNs;
+	}
+	return events;
+}
+
+static void AddRandomGestures(GestureSet& set, size_t count, XorShift& rng) {
+	while (set.Count() < count) {
+		GestureSpec spec;
+		spec.length = (uint8_t)(3 + rng.Below(4));
+		for (size_t i = 0; i < spec.length; i++) {
+			spec.keys[i] = (GestureKey)rng.Below(kGestureKeyCount);
+		}
+		spec.maxGapNs = 250 * kNsPerMs * (1 + rng.Below(3));
+		spec.windowNs = spec.maxGapNs * spec.length;
+		if (set.Add(spec) < 0) {
+			break;
+		}
+	}
+}
+
+// Matcher throughput over millions of synthetic key presses as the number of gestures grows.
+static void BenchGestureMatcher() {
+	constexpr size_t kEvents = 4000000;
+	auto events = MakeKeyStream(kEvents, 600);
+	for (size_t gestures : { 1, 4, 8, 16, 32 }) {
+		XorShift rng;
+		GestureSet set;
+		AddRandomGestures(set, gestures, rng);
+		GestureMatcher matcher(set);
+		size_t matches = 0;
+		auto start = BenchClock::now();
+		for (const auto& event : events) {
+			matches += matcher.OnKey(event.key, event.timeNs) >= 0;
+		}
+		double us = ElapsedUs(start, BenchClock::now());
+		printf("gesture_matcher gestures=%zu events=%zu matches=%zu events_per_sec=%.0f ns_per_event=%.2f\n",
+			set.Count(), kEvents, matches, kEvents / (us / 1e6), us * 1000 / kEvents);
+	}
+}
+
+// The pre-matcher check from sage_lock.cpp: a 4-slot history reset on every 500ms gap.
+struct LegacyVolumeCheck {
+	std::array<GestureKey, 4> history{};
+	uint16_t index = 0;
+	uint64_t lastMs = 0;
+
+	bool OnKey(GestureKey key, uint64_t timeMs) {
+		if (timeMs - lastMs > 500) {
+			index = 0;
+		}
+		else if (++index > 3) {
+			index = 0;
+		}
+		lastMs = timeMs;
+		history[index] = key;
+		if (index != 3) {
+			return false;
+		}
+		index = 0;
+		return history[0] == GestureKey::VolumeUp && history[1] == GestureKey::VolumeDown &&
+			history[2] == GestureKey::VolumeUp && history[3] == GestureKey::VolumeDown;
+	}
+};
+
+// The toggle gesture compiled from its DSL text at build time versus the old hand-coded check.
+static void BenchCompiledGesture() {
+	static constexpr GestureSet kCompiled = CompileGestures({ kToggleGestureDsl });
+	constexpr size_t kEvents = 4000000;
+	auto events = MakeKeyStream(kEvents, 400);
+	for (auto& event : events) {
+		event.key = (GestureKey)((size_t)event.key % 2);
+	}
+
+	LegacyVolumeCheck legacy;
+	size_t matches = 0;
+	auto start = BenchClock::now();
+	for (const auto& event : events) {
+		matches += legacy.OnKey(event.key, event.timeNs / kNsPerMs);
+	}
+	double us = ElapsedUs(start, BenchClock::now());
+	printf("compiled_gesture legacy   matches=%zu ns_per_event=%.2f\n", matches, us * 1000 / kEvents);
+
+	GestureMatcher matcher(kCompiled);
+	matches = 0;
+	start = BenchClock::now();
+	for (const auto& event : events) {
+		matches += matcher.OnKey(event.key, event.timeNs) >= 0;
+	}
+	us = ElapsedUs(start, BenchClock::now());
+	printf("compiled_gesture compiled matches=%zu ns_per_event=%.2f\n", matches, us * 1000 / kEvents);
+}
+
+// Per-device matcher lookup with many keyboards interleaving presses: fixed open-addressing table
+// versus a node-based unordered_map.
+static void BenchDeviceGestures() {
+	static constexpr GestureSet kGestures = CompileGestures({ kToggleGestureDsl });
+	constexpr size_t kEvents = 4000000;
+	auto events = MakeKeyStream(kEvents, 400);
+	for (size_t devices : { 1, 16, 128, 512 }) {
+		XorShift rng;
+		for (auto& event : events) {
+			// handles look like pointers: spaced out, low bits shared
+			event.device = 0x10000 + rng.Below((uint32_t)devices) * 0x40;
+		}
+
+		static DeviceStateTable<GestureMatcher, 1024> table;
+		table = {};
+		size_t matches = 0;
+		auto start = BenchClock::now();
+		for (const auto& event : events) {
+			GestureMatcher* matcher = table.FindOrInsert(event.device, kGestures);
+			matches += matcher->OnKey(event.key, event.timeNs) >= 0;
+		}
+		double tableUs = ElapsedUs(start, BenchClock::now());
+
+		std::unordered_map<uint64_t, GestureMatcher> map;
+		size_t mapMatches = 0;
+		start = BenchClock::now();
+		for (const auto& event : events) {
+			auto it = map.try_emplace(event.device, kGestures).first;
+			mapMatches += it->second.OnKey(event.key, event.timeNs) >= 0;
+		}
+		double mapUs = ElapsedUs(start, BenchClock::now());
+
+		printf("device_gestures devices=%zu matches=%zu table_ns_per_event=%.2f unordered_map_ns_per_event=%.2f\n",
+			devices, matches, tableUs * 1000 / kEvents, mapUs * 1000 / kEvents);
+		if (matches != mapMatches) {
+			printf("device_gestures MISMATCH table=%zu map=%zu\n", matches, mapMatches);
+		}
+	}
+}
+
+// Records a synthetic stream through the trace recorder, then maps the file and replays it.
+static void BenchTraceReplay() {
+	constexpr size_t kEvents = 1000000;
+	auto events = MakeKeyStream(kEvents, 400);
+	XorShift rng;
+	for (auto& event : events) {
+		event.device = 0x10000 + rng.Below(4) * 0x40;
+	}
+
+	const char* path = "sage_lock_bench.trace";
+	InputTraceRecorder recorder;
+	if (!recorder.Start(path)) {
+		printf("trace_replay skipped: cannot write %s\n", path);
+		return;
+	}
+	auto start = BenchClock::now();
+	for (const auto& event : events) {
+		recorder.Record(event);
+		// real input arrives far slower than this loop; pace it so the ring is not simply overrun
+		if (((&event - events.data()) & 1023) == 1023) {
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+	}
+	double recordUs = ElapsedUs(start, BenchClock::now());
+	recorder.Stop();
+
+	static constexpr GestureSet kGestures = CompileGestures({ kToggleGestureDsl });
+	InputTraceReader reader;
+	if (!reader.Open(path)) {
+		printf("trace_replay failed to read back %s\n", path);
+		return;
+	}
+	auto engine = std::make_unique<GestureEngine>(kGestures);
+	size_t matches = 0;
+	start = BenchClock::now();
+	KeyEvent replayed;
+	for (size_t i = 0; i < reader.Count(); i++) {
+		matches += ToKeyEvent(reader.Records()[i], replayed) && engine->OnKeyEvent(replayed) >= 0;
+	}
+	double replayUs = ElapsedUs(start, BenchClock::now());
+	printf("trace_replay recorded=%zu dropped=%llu record_wall_ms=%.1f replayed=%zu matches=%zu replay_events_per_sec=%.0f\n",
+		kEvents, (unsigned long long)recorder.Dropped(), recordUs / 1000, reader.Count(), matches, reader.Count() / (replayUs / 1e6));
+	remove(path);
+}
+
+// Classification throughput over a few thousand synthetic composite devices, each built from 1-3
+// corpus collections with a random run of padding input items in between. Every result is checked
+// against the classes the device was built from.
+static void BenchHidClassify() {
+	namespace corpus = hid_corpus;
+	struct Part {
+		std::span<const uint8_t> bytes;
+		uint8_t classes;
+	};
+	const Part parts[] = {
+		{ corpus::kTouchScreen, 1 << (int)HidClass::TouchScreen },
+		{ corpus::kPen, 1 << (int)HidClass::Pen },
+		{ corpus::kTouchPad, 1 << (int)HidClass::TouchPad },
+		{ corpus::kHeatMapClosed, 1 << (int)HidClass::HeatMap },
+		{ corpus::kMultiPoint, 1 << (int)HidClass::MultiPoint },
+		{ corpus::kKeyboard, 0 },
+		{ corpus::kExtendedUsage, 1 << (int)HidClass::TouchScreen },
+		{ corpus::kPushPop, 1 << (int)HidClass::TouchScreen },
+	};
+	constexpr size_t kDevices = 4096;
+	XorShift rng;
+	std::vector<uint8_t> bytes;
+	std::vector<size_t> offsets;
+	std::vector<uint8_t> expected;
+	size_t touchTargets = 0;
+	for (size_t d = 0; d < kDevices; d++) {
+		offsets.push_back(bytes.size());
+		uint8_t classes = 0;
+		const size_t count = 1 + rng.Next() % 3;
+		for (size_t c = 0; c < count; c++) {
+			const Part& part = parts[rng.Next() % std::size(parts)];
+			bytes.insert(bytes.end(), part.bytes.begin(), part.bytes.end());
+			classes |= part.classes;
+			// vendor page padding: Usage Page, Report Size, Report Count, Input (Constant)
+			const uint8_t pad[] = { 0x06, 0x00, 0xFF, 0x75, 0x08, 0x95, 0x01, 0x81, 0x03 };
+			for (uint32_t p = rng.Next() % 16; p > 0; p--) {
+				bytes.insert(bytes.end(), std::begin(pad), std::end(pad));
+			}
+		}
+		expected.push_back(classes);
+		const uint8_t touchMask = (1 << (int)HidClass::TouchScreen) | (1 << (int)HidClass::HeatMap) | (1 << (int)HidClass::MultiPoint);
+		touchTargets += (classes & touchMask) != 0;
+	}
+	offsets.push_back(bytes.size());
+
+	constexpr int kRounds = 50;
+	size_t mismatches = 0;
+	size_t classified = 0;
+	const auto start = BenchClock::now();
+	for (int r = 0; r < kRounds; r++) {
+		for (size_t d = 0; d < kDevices; d++) {
+			const HidClassification result = ClassifyHidDescriptor(std::span<const uint8_t>(bytes.data() + offsets[d], offsets[d + 1] - offsets[d]));
+			mismatches += result.error != nullptr || result.classes != expected[d];
+			classified += result.IsTouchTarget();
+		}
+	}
+	const double us = ElapsedUs(start, BenchClock::now());
+	const double descriptors = (double)kDevices * kRounds;
+	printf("hid_classify devices=%zu avg_bytes=%.0f ns_per_descriptor=%.1f mb_per_s=%.0f touch=%zu mismatches=%zu\n",
+		kDevices, (double)bytes.size() / kDevices, us * 1000.0 / descriptors, bytes.size() * (double)kRounds / us,
+		classified / kRounds, mismatches + (classified / kRounds != touchTargets));
+}
+
+static double Percentile(const std::vector<double>& sorted, double p) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	size_t rank = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+// Feeds one toggle gesture per cycle into a headless pipeline over simulated devices and reports
+// the latency from the last key press to feedback.
+static void RunPipelineCycles(Clock& clock, VirtualClock* virtualClock, size_t cycles, SimDeviceRegistry& registry, const char* label) {
+	static constexpr GestureSet kGestures = CompileGestures({ kToggleGestureDsl });
+	SimDeviceToggler toggler(registry, clock);
+	LockPipeline pipeline(kGestures, toggler, clock);
+	pipeline.SetDevices(registry.Ids());
+
+	std::counting_semaphore<> done(0);
+	std::vector<double> latencyUs;
+	latencyUs.reserve(cycles);
+	size_t failedToggles = 0, locks = 0;
+	pipeline.SetCycleObserver([&](const LockCycle& cycle) {
+		latencyUs.push_back((cycle.completeNs - cycle.triggerNs) / 1000.0);
+		locks += cycle.action == LockAction::Lock;
+		for (const auto& result : *cycle.results) {
+			failedToggles += result.status != ToggleStatus::Ok;
+		}
+		done.release();
+	});
+	pipeline.Start();
+
+	const GestureKey keys[] = { GestureKey::VolumeUp, GestureKey::VolumeDown, GestureKey::VolumeUp, GestureKey::VolumeDown };
+	for (size_t c = 0; c < cycles; c++) {
+		for (auto key : keys) {
+			if (virtualClock != nullptr) {
+				virtualClock->AdvanceNs(120 * kNsPerMs);
+			}
+			KeyEvent event;
+			event.key = key;
+			event.device = 1;
+			event.timeNs = clock.NowNs();
+			pipeline.OnKeyEvent(event);
+		}
+		done.acquire();
+	}
+	pipeline.Stop();
+
+	std::sort(latencyUs.begin(), latencyUs.end());
+	printf("pipeline_latency %s devices=%zu cycles=%zu locks=%zu failed_toggles=%zu p50_us=%.1f p90_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f\n",
+		label, registry.Count(), latencyUs.size(), locks, failedToggles, Percentile(latencyUs, 50), Percentile(latencyUs, 90),
+		Percentile(latencyUs, 99), Percentile(latencyUs, 99.9), latencyUs.empty() ? 0.0 : latencyUs.back());
+}
+
+// Per-stage histograms of a headless pipeline over four simulated devices, checked against exact
+// percentiles of the same cycles, and the cost of one Record.
+static void BenchLockStages() {
+	static constexpr GestureSet kGestures = CompileGestures({ kToggleGestureDsl });
+	constexpr size_t kCycles = 2000;
+	SystemClock clock;
+	SimDeviceRegistry registry;
+	registry.AddMany(4, 200000, 200000, 0.01);
+	SimDeviceToggler toggler(registry, clock);
+	LockPipeline pipeline(kGestures, toggler, clock);
+	pipeline.SetDevices(registry.Ids());
+
+	std::counting_semaphore<> done(0);
+	std::array<std::vector<uint64_t>, (size_t)LockStage::Count> exact;
+	pipeline.SetCycleObserver([&](const LockCycle& cycle) {
+		exact[(size_t)LockStage::Match].push_back(cycle.matchNs - cycle.triggerNs);
+		exact[(size_t)LockStage::Dispatch].push_back(cycle.dispatchNs - cycle.matchNs);
+		for (const auto& result : *cycle.results) {
+			exact[(size_t)LockStage::Device].push_back(result.doneNs);
+		}
+		exact[(size_t)LockStage::Toggle].push_back(cycle.feedbackNs - cycle.dispatchNs);
+		exact[(size_t)LockStage::EndToEnd].push_back(cycle.feedbackNs - cycle.triggerNs);
+		done.release();
+	});
+	pipeline.Start();
+	const GestureKey keys[] = { GestureKey::VolumeUp, GestureKey::VolumeDown, GestureKey::VolumeUp, GestureKey::VolumeDown };
+	for (size_t c = 0; c < kCycles; c++) {
+		for (auto key : keys) {
+			KeyEvent event;
+			event.key = key;
+			event.device = 1;
+			event.timeNs = clock.NowNs();
+			pipeline.OnKeyEvent(event);
+		}
+		done.acquire();
+	}
+	pipeline.Stop();
+
+	for (size_t i = 0; i < (size_t)LockStage::Count; i++) {
+		const LatencyHistogram& latency = pipeline.Latency((LockStage)i);
+		auto& values = exact[i];
+		std::sort(values.begin(), values.end());
+		bool ok = latency.Count() == values.size();
+		double reported[3] = {};
+		const double percentiles[3] = { 50, 99, 99.9 };
+		for (size_t p = 0; p < 3 && ok; p++) {
+			const size_t rank = std::max<size_t>(1, (size_t)std::ceil(percentiles[p] / 100.0 * values.size()));
+			const uint64_t truth = values[rank - 1];
+			const uint64_t value = latency.Percentile(percentiles[p]);
+			ok = value >= truth && value <= truth + truth / 128 + 1;
+			reported[p] = value / 1000.0;
+		}
+		g_Failed |= !ok;
+		printf("lock_stages stage=%-10s samples=%-5llu p50_us=%-8.1f p99_us=%-8.1f p999_us=%-8.1f max_us=%-8.1f %s\n", LockStageName((LockStage)i),
+			(unsigned long long)latency.Count(), reported[0], reported[1], reported[2], latency.Max() / 1000.0, ok ? "ok" : "FAILED");
+	}
+
+	constexpr size_t kRecords = 10000000;
+	auto histogram = std::make_unique<LatencyHistogram>();
+	XorShift rng;
+	const auto start = BenchClock::now();
+	for (size_t i = 0; i < kRecords; i++) {
+		histogram->Record(rng.Below(10000000));
+	}
+	printf("lock_stages record_ns=%.2f p50_us=%.1f\n", ElapsedUs(start, BenchClock::now()) * 1000.0 / kRecords, histogram->Percentile(50) / 1000.0);
+}
+
+// A pipeline publishing into a POSIX shm segment, read back through a second read-only mapping the
+// way sage_lock_stat does: counters must match the simulated run exactly. Then a writer publishing
+// latency summaries flat out against a reader that checks every copy for a torn read.
+static void BenchSharedMetrics() {
+	static constexpr GestureSet kGestures = CompileGestures({ kToggleGestureDsl });
+	constexpr size_t kCycles = 500;
+	const char* name = "/sage_lock_bench.metrics";
+	SharedMetrics metrics;
+	if (!metrics.Create(name)) {
+		printf("shared_metrics could not create %s\n", name);
+		g_Failed = true;
+		return;
+	}
+	SystemClock clock;
+	SimDeviceRegistry registry;
+	registry.AddMany(3, 50000, 50000, 0.05);
+	SimDeviceToggler toggler(registry, clock);
+	LockPipeline pipeline(kGestures, toggler, clock);
+	pipeline.SetDevices(registry.Ids());
+	pipeline.SetMetrics(&metrics);
+	std::counting_semaphore<> done(0);
+	pipeline.SetCycleObserver([&](const LockCycle&) { done.release(); });
+	pipeline.Start();
+	const GestureKey keys[] = { GestureKey::VolumeUp, GestureKey::VolumeDown, GestureKey::VolumeUp, GestureKey::VolumeDown };
+	for (size_t c = 0; c < kCycles; c++) {
+		for (auto key : keys) {
+			KeyEvent event;
+			event.key = key;
+			event.device = 1;
+			event.timeNs = clock.NowNs();
+			pipeline.OnKeyEvent(event);
+		}
+		done.acquire();
+	}
+	pipeline.Stop();
+
+	SharedMetrics reader;
+	bool ok = reader.OpenRead(name);
+	MetricsStageSummary stages[kMetricsStages] = {};
+	if (ok) {
+		ok = reader.ReadLatency(stages) &&
+			reader.Get(MetricCounter::KeyEvents) == kCycles * 4 && reader.Get(MetricCounter::Gestures) == kCycles &&
+			reader.Get(MetricCounter::Locks) == kCycles / 2 && reader.Get(MetricCounter::Unlocks) == kCycles / 2 &&
+			reader.Get(MetricCounter::TogglesOk) + reader.Get(MetricCounter::ToggleFailures) == toggler.Toggles() &&
+			reader.Get(MetricCounter::ToggleFailures) == toggler.Failures() && reader.Get(MetricGauge::Locked) == 0 &&
+			reader.Get(MetricGauge::Devices) == 3 && stages[(size_t)LockStage::EndToEnd].count == kCycles &&
+			stages[(size_t)LockStage::EndToEnd].p99Ns == pipeline.Latency(LockStage::EndToEnd).Percentile(99);
+	}
+
+	constexpr size_t kSamples = 100000;
+	auto start = BenchClock::now();
+	uint64_t sink = 0;
+	for (size_t i = 0; i < kSamples && ok; i++) {
+		for (size_t c = 0; c < (size_t)MetricCounter::Count; c++) {
+			sink += reader.Get((MetricCounter)c);
+		}
+		ok = reader.ReadLatency(stages);
+		sink += stages[0].count;
+	}
+	const double sampleNs = ElapsedUs(start, BenchClock::now()) * 1000.0 / kSamples;
+
+	// every word of publication i is i, so a mixed copy is a torn read
+	std::atomic<bool> stop{ false };
+	uint64_t published = 0;
+	const MetricsStageSummary zero[kMetricsStages] = {};
+	metrics.PublishLatency(zero);
+	std::thread writer([&] {
+		MetricsStageSummary summary[kMetricsStages];
+		while (!stop.load(std::memory_order_relaxed)) {
+			published++;
+			for (auto& stage : summary) {
+				stage = { published, published, published, published, published };
+			}
+			metrics.PublishLatency(summary);
+		}
+	});
+	uint64_t reads = 0, retries = 0, torn = 0;
+	start = BenchClock::now();
+	while (ElapsedUs(start, BenchClock::now()) < 200000) {
+		unsigned attempts = 0;
+		ok = reader.ReadLatency(stages, &attempts) && ok;
+		retries += attempts;
+		const uint64_t first = stages[0].count;
+		for (const auto& stage : stages) {
+			torn += stage.count != first || stage.p50Ns != first || stage.p99Ns != first || stage.p999Ns != first || stage.maxNs != first;
+		}
+		reads++;
+	}
+	stop = true;
+	writer.join();
+	reader.Close();
+	metrics.Close();
+	ok = ok && torn == 0 && !reader.OpenRead(name);
+	g_Failed |= !ok;
+	printf("shared_metrics cycles=%zu toggles=%llu failures=%llu sample_ns=%.1f reads=%llu publishes=%llu retries=%llu torn=%llu %s\n", kCycles,
+		(unsigned long long)toggler.Toggles(), (unsigned long long)toggler.Failures(), sampleNs, (unsigned long long)reads,
+		(unsigned long long)published, (unsigned long long)retries, (unsigned long long)torn, ok && sink != 0 ? "ok" : "FAILED");
+}
+
+static void BenchPipelineLatency() {
+	// virtual time: gesture timing is exact and repeatable, and the toggles advance the clock by
+	// their simulated latency, so the figures are the device times alone, free of scheduling noise
+	{
+		VirtualClock clock(1000 * kNsPerMs);
+		SimDeviceRegistry registry;
+		registry.AddMany(2, 200000, 200000, 0.05);
+		RunPipelineCycles(clock, &clock, 1000, registry, "virtual");
+	}
+	// real time: simulated devices take 200-400us each with 1% failures
+	for (size_t devices : { 1, 2, 8 }) {
+		SystemClock clock;
+		SimDeviceRegistry registry;
+		registry.AddMany(devices, 200000, 200000, 0.01);
+		RunPipelineCycles(clock, nullptr, 2000, registry, "system ");
+	}
+}
+
+// Stands in for GetTouchScreens: every HID interface is opened and classified in turn.
+static std::vector<CachedDevice> SimEnumerate(const std::vector<std::string>& touchScreens, size_t interfaces, std::chrono::microseconds probe) {
+	std::vector<CachedDevice> found;
+	for (size_t i = 0; i < interfaces; i++) {
+		std::this_thread::sleep_for(probe);
+		if (i < touchScreens.size()) {
+			CachedDevice device;
+			device.identity = "\\\\?\\" + touchScreens[i];
+			device.id = touchScreens[i];
+			device.classes = 1 << (int)HidClass::TouchScreen;
+			found.push_back(std::move(device));
+		}
+	}
+	return found;
+}
+
+// Time from process start to the first completed lock covering every touch screen. Cold enumerates
+// synchronously before listening, as startup used to; warm seeds the device set from the cache file
+// and validates it in the background.
+static void BenchStartupCache() {
+	static constexpr GestureSet kGestures = CompileGestures({ kToggleGestureDsl });
+	constexpr size_t kInterfaces = 48;
+	constexpr std::chrono::microseconds kProbe{ 2000 };
+	const std::string path = (std::filesystem::temp_directory_path() / "sage_lock_bench.devices").string();
+	std::filesystem::remove(path);
+
+	SimDeviceRegistry registry;
+	registry.AddMany(3, 0, 0, 0);
+	const std::vector<std::string> ids = registry.Ids();
+	SystemClock clock;
+	SimDeviceToggler toggler(registry, clock);
+
+	for (const char* mode : { "cold", "warm", "stale" }) {
+		const bool cold = strcmp(mode, "cold") == 0;
+		if (strcmp(mode, "stale") == 0) {
+			// last run saw a touch screen that is gone now and missed one that is here. The lock lands
+			// before validation finishes, so the new one is locked on arrival and the gone one is kept
+			// until unlock, as a disabled device would be
+			std::filesystem::remove(path);
+			DeviceCache previous;
+			previous.Open(path.c_str());
+			previous.Store(SimEnumerate({ ids[0], ids[1], "SIM\\TOUCH\\GONE" }, 3, std::chrono::microseconds(0)), DeviceCacheNow());
+		}
+		const auto start = BenchClock::now();
+		DeviceCache cache;
+		std::vector<std::string> seeded;
+		std::vector<CachedDevice> found;
+		if (cold) {
+			found = SimEnumerate(ids, kInterfaces, kProbe);
+			for (const auto& device : found) {
+				seeded.push_back(device.id);
+			}
+		}
+		else {
+			cache.Open(path.c_str());
+			for (const auto& device : cache.Load(DeviceCacheNow())) {
+				seeded.push_back(device.id);
+			}
+		}
+		LockPipeline pipeline(kGestures, toggler, clock);
+		pipeline.SetDevices(seeded);
+		std::counting_semaphore<> done(0);
+		size_t locked = 0;
+		pipeline.SetCycleObserver([&](const LockCycle& cycle) {
+			locked = cycle.devices->size();
+			done.release();
+		});
+		pipeline.Start();
+		const double listeningUs = ElapsedUs(start, BenchClock::now());
+
+		double validateUs = 0;
+		CacheValidation validation;
+		std::thread validateThread;
+		if (!cold) {
+			validateThread = std::thread([&] {
+				const auto validateStart = BenchClock::now();
+				found = SimEnumerate(ids, kInterfaces, kProbe);
+				validation = ApplyEnumeration(pipeline.Devices(), seeded, found);
+				cache.Store(found, DeviceCacheNow());
+				validateUs = ElapsedUs(validateStart, BenchClock::now());
+			});
+		}
+		for (auto key : { GestureKey::VolumeUp, GestureKey::VolumeDown, GestureKey::VolumeUp, GestureKey::VolumeDown }) {
+			KeyEvent event;
+			event.key = key;
+			event.device = 1;
+			event.timeNs = clock.NowNs();
+			pipeline.OnKeyEvent(event);
+		}
+		done.acquire();
+		const double readyUs = ElapsedUs(start, BenchClock::now());
+		if (validateThread.joinable()) {
+			validateThread.join();
+		}
+		pipeline.Stop();
+		if (cold) {
+			// the first run leaves the cache behind for the warm one
+			cache.Open(path.c_str());
+			cache.Store(found, DeviceCacheNow());
+		}
+		printf("startup_cache %-5s listening_us=%.0f first_lock_us=%.0f locked=%zu validate_us=%.0f added=%zu removed=%zu locked_on_arrival=%llu devices_after=%zu\n",
+			mode, listeningUs, readyUs, locked, validateUs, validation.added, validation.removed,
+			(unsigned long long)pipeline.Devices().LockedOnArrival(), pipeline.Devices().Count());
+	}
+	std::filesystem::remove(path);
+}
+
+// Startup classification of a few hundred HID interfaces: most answer in well under a millisecond, a
+// few take tens, and two sleeping Bluetooth devices take most of a second. Serial probing waits for
+// all of them; the fanout bounds the slow ones by the per-device timeout.
+static void BenchProbeFanout() {
+	constexpr size_t kInterfaces = 300;
+	constexpr auto kTimeout = std::chrono::milliseconds(100);
+	struct SimProbes {
+		std::vector<std::chrono::microseconds> latency;
+		std::atomic<size_t> finished{ 0 };
+		std::atomic<size_t> late{ 0 };
+	};
+	auto sim = std::make_shared<SimProbes>();
+	XorShift rng;
+	std::vector<std::string> paths;
+	size_t touchScreens = 0;
+	for (size_t i = 0; i < kInterfaces; i++) {
+		paths.push_back("SIM\\HID\\" + std::to_string(i));
+		touchScreens += i % 10 == 0;
+		if (i == 40 || i == 205) {
+			sim->latency.emplace_back(800000); // asleep; 40 is a touch screen, 205 is not
+		}
+		else if (rng.Next() % 50 == 0) {
+			sim->latency.emplace_back(20000);
+		}
+		else {
+			sim->latency.emplace_back(100 + rng.Next() % 800);
+		}
+	}
+	// captures only the shared state: abandoned probes outlive the call
+	const ProbeFn probe = [sim](const std::string& path, CachedDevice& device) {
+		const size_t i = std::stoul(path.substr(path.rfind('\\') + 1));
+		std::this_thread::sleep_for(sim->latency[i]);
+		sim->finished.fetch_add(1);
+		if (i % 10 != 0) {
+			return false;
+		}
+		device.id = path;
+		device.identity = path;
+		return true;
+	};
+	const auto late = std::make_shared<LateProbeSink>([sim](const CachedDevice&) { sim->late.fetch_add(1); });
+
+	auto start = BenchClock::now();
+	size_t serialFound = 0;
+	for (const auto& path : paths) {
+		CachedDevice device;
+		serialFound += probe(path, device);
+	}
+	printf("probe_fanout serial     interfaces=%zu found=%zu/%zu elapsed_ms=%.1f\n", kInterfaces, serialFound, touchScreens,
+		ElapsedUs(start, BenchClock::now()) / 1000);
+
+	for (unsigned workers : { 1, 4, 8, 16 }) {
+		sim->finished = 0;
+		sim->late = 0;
+		const ProbeReport report = ProbeDevices(paths, probe, workers, kTimeout, late);
+		// let the abandoned probes finish before the next run reuses the counters
+		start = BenchClock::now();
+		while (sim->finished.load() < kInterfaces) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		printf("probe_fanout workers=%-2u interfaces=%zu found=%zu/%zu elapsed_ms=%.1f timed_out=%zu late_found=%zu straggler_ms=%.0f\n",
+			workers, kInterfaces, report.found.size(), touchScreens, report.elapsedUs / 1000.0, report.timedOut.size(), sim->late.load(),
+			ElapsedUs(start, BenchClock::now()) / 1000);
+	}
+}
+
+// Heap allocations and requested bytes while running fn.
+template <typename Fn>
+static std::pair<uint64_t, uint64_t> CountAllocations(Fn&& fn) {
+	g_Allocations = 0;
+	g_AllocatedBytes = 0;
+	g_CountAllocations = true;
+	fn();
+	g_CountAllocations = false;
+	return { g_Allocations.load(), g_AllocatedBytes.load() };
+}
+
+// Memory for N device instance ids held three ways: UTF-16 strings (the original touch screen list),
+// UTF-8 strings (the registry before interning) and the interned table. Byte counts are what was
+// asked of the allocator; each allocation costs malloc another 8-16 bytes on top. Then lookup cost:
+// the table's hash index against a linear search, which is what the string lists offered.
+static void BenchIdTable() {
+	for (size_t count : { 10, 1000, 100000 }) {
+		std::vector<std::string> ids;
+		for (size_t i = 0; i < count; i++) {
+			char id[96];
+			snprintf(id, sizeof(id), "HID\\VID_%04zX&PID_%04zX&MI_00\\7&%08zX&0&0000", 0x045E + i % 7, i % 0x10000, i * 2654435761u % 0xFFFFFFFF);
+			ids.push_back(id);
+		}
+
+		std::vector<std::wstring> wide;
+		const auto wideAllocs = CountAllocations([&] {
+			for (const auto& id : ids) {
+				wide.emplace_back(id.begin(), id.end());
+			}
+		});
+		std::vector<std::string> utf8;
+		const auto utf8Allocs = CountAllocations([&] {
+			for (const auto& id : ids) {
+				utf8.push_back(id);
+			}
+		});
+		DeviceIdTable table;
+		const auto tableAllocs = CountAllocations([&] {
+			for (const auto& id : ids) {
+				table.Intern(id);
+			}
+		});
+
+		// a thousand lookups spread over the set
+		const size_t lookups = std::min<size_t>(count, 1000);
+		const size_t stride = count / lookups;
+		size_t hits = 0;
+		auto start = BenchClock::now();
+		for (int round = 0; round < 100; round++) {
+			for (size_t i = 0; i < count; i += stride) {
+				hits += table.Find(ids[i]) != kNoDeviceHandle;
+			}
+		}
+		const double tableNs = ElapsedUs(start, BenchClock::now()) * 1000.0 / (100.0 * lookups);
+		start = BenchClock::now();
+		for (size_t i = 0; i < count; i += stride) {
+			hits += std::find(utf8.begin(), utf8.end(), ids[i]) != utf8.end();
+		}
+		const double linearNs = ElapsedUs(start, BenchClock::now()) * 1000.0 / lookups;
+
+		printf("id_table ids=%-6zu wstring_bytes=%-9llu allocs=%-6llu string_bytes=%-9llu allocs=%-6llu table_bytes=%-8zu allocs=%-3llu bytes_per_id=%.1f find_ns=%.1f linear_ns=%.1f hits=%zu\n",
+			count, (unsigned long long)wideAllocs.second, (unsigned long long)wideAllocs.first, (unsigned long long)utf8Allocs.second,
+			(unsigned long long)utf8Allocs.first, table.MemoryBytes(), (unsigned long long)tableAllocs.first, (double)table.MemoryBytes() / count,
+			tableNs, linearNs, hits);
+	}
+}
+
+// dbgprint as sage_lock.cpp had it: vswprintf into a 4096-wchar stack buffer, then a synchronous
+// call out of the process. A write to /dev/null stands in for OutputDebugStringW, which costs at
+// least a kernel transition even with no debugger attached.
+static int g_DevNull = -1;
+static void DbgprintEquivalent(const wchar_t* format, ...) {
+	wchar_t buffer[4096];
+	va_list args;
+	va_start(args, format);
+	vswprintf(buffer, 4096, format, args);
+	va_end(args);
+	if (write(g_DevNull, buffer, wcslen(buffer) * sizeof(wchar_t)) < 0) {
+		g_Failed = true;
+	}
+}
+
+// Per-call cost of the toggle path's log line through dbgprint and through SAGE_LOG, on one thread
+// and on four at once. SAGE_LOG calls are timed in bursts that fit the ring; formatting happens on
+// the log thread and is reported separately. The formatter is checked against snprintf first.
+static void BenchLogCall() {
+	constexpr size_t kCalls = 200000;
+	constexpr size_t kBurst = 128;
+	const char* id = "HID\\VID_045E&PID_0C1A&MI_00\\7&2A4B2D1&0&0000";
+
+	LogRecord record = {};
+	deferred_log_detail::RecordWriter writer(record);
+	writer.Put(id);
+	writer.Put("setupapi");
+	writer.Put(-42);
+	writer.Put(3.25);
+	writer.Put(L"wide \u00e9");
+	writer.Put(0xBEEFu);
+	std::string formatted;
+	FormatLogRecord(record, "Toggle %-8.20s via %s: %5d %.3f %s %08X %d\n", formatted);
+	char expected[256];
+	snprintf(expected, sizeof(expected), "Toggle %-8.20s via %s: %5d %.3f %s %08X <?>\n", id, "setupapi", -42, 3.25, "wide \xc3\xa9", 0xBEEFu);
+	const bool formatOk = formatted == expected;
+	g_Failed |= !formatOk;
+
+	g_DevNull = open("/dev/null", O_WRONLY);
+	FILE* devNull = fopen("/dev/null", "w");
+	StartDeferredLog(std::make_unique<FileLogSink>(devNull));
+
+	auto start = BenchClock::now();
+	for (size_t i = 0; i < kCalls; i++) {
+		DbgprintEquivalent(L"Toggle %s via %s: %s in %llu us\n", id, "setupapi", "ok", (unsigned long long)i);
+	}
+	const double dbgprintNs = ElapsedUs(start, BenchClock::now()) * 1000.0 / kCalls;
+
+	double deferredUs = 0;
+	for (size_t i = 0; i < kCalls; i += kBurst) {
+		start = BenchClock::now();
+		for (size_t j = i; j < i + kBurst; j++) {
+			SAGE_LOG("Toggle %s via %s: %s in %llu us\n", id, "setupapi", "ok", (unsigned long long)j);
+		}
+		deferredUs += ElapsedUs(start, BenchClock::now());
+		FlushDeferredLog();
+	}
+	const double deferredNs = deferredUs * 1000.0 / kCalls;
+	const LogStats single = DeferredLogStats();
+
+	// four threads flat out: callers never wait, and whatever the log thread cannot keep up with is
+	// dropped. Timed as a whole, since the threads may share cores.
+	constexpr unsigned kThreads = 4;
+	std::vector<std::thread> threads;
+	start = BenchClock::now();
+	for (unsigned t = 0; t < kThreads; t++) {
+		threads.emplace_back([&] {
+			for (size_t i = 0; i < kCalls; i++) {
+				SAGE_LOG("Toggle %s via %s: %s in %llu us\n", id, "setupapi", "ok", (unsigned long long)i);
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	const double threadedNs = ElapsedUs(start, BenchClock::now()) * 1000.0 / (kThreads * kCalls);
+	StopDeferredLog();
+	fclose(devNull);
+	close(g_DevNull);
+	const LogStats total = DeferredLogStats();
+
+	printf("log_call format=%s dbgprint_ns=%.1f deferred_ns=%.1f speedup=%.1fx format_ns_per_record=%.1f\n", formatOk ? "ok" : "FAILED",
+		dbgprintNs, deferredNs, dbgprintNs / deferredNs, (double)single.formatNs / std::max<uint64_t>(single.records, 1));
+	printf("log_call threads=%u cores=%u deferred_ns=%.1f written=%llu dropped=%llu\n", kThreads, std::thread::hardware_concurrency(), threadedNs,
+		(unsigned long long)(total.records - single.records), (unsigned long long)(total.dropped - single.dropped));
+}
+
+static size_t CountOccurrences(const std::string& text, const std::string& needle) {
+	size_t count = 0;
+	for (size_t at = text.find(needle); at != std::string::npos; at = text.find(needle, at + needle.size())) {
+		count++;
+	}
+	return count;
+}
+
+// Cost of one span against the two clock reads it is made of, using TraceSpan directly so it is
+// measured whatever SAGE_TRACE_SPANS is set to. Then checks the dump: a thread's spans all come out,
+// a wrapped ring gives exactly its newest kSpanRingSize - 1, and dumping while four threads record
+// still produces well-formed output.
+static void BenchTraceSpans() {
+	constexpr size_t kSpans = 2000000;
+	const std::string path = (std::filesystem::temp_directory_path() / "sage_lock_bench.trace.json").string();
+
+	double spanNs = 0;
+	double clockNs = 0;
+	std::thread([&] {
+		{ TraceSpan warm("bench warm"); } // attaches this thread's ring
+		auto start = BenchClock::now();
+		for (size_t i = 0; i < kSpans; i++) {
+			TraceSpan span("bench span");
+		}
+		spanNs = ElapsedUs(start, BenchClock::now()) * 1000.0 / kSpans;
+		uint64_t sink = 0;
+		start = BenchClock::now();
+		for (size_t i = 0; i < kSpans; i++) {
+			sink += MonotonicNowNs();
+			sink += MonotonicNowNs();
+		}
+		clockNs = ElapsedUs(start, BenchClock::now()) * 1000.0 / kSpans;
+		g_Failed |= sink == 0;
+	}).join();
+
+	constexpr size_t kShort = 1000;
+	std::thread([] {
+		for (size_t i = 0; i < kShort; i++) {
+			TraceSpan span("bench short");
+		}
+	}).join();
+
+	std::atomic<bool> stop{ false };
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < 4; t++) {
+		threads.emplace_back([&] {
+			while (!stop.load(std::memory_order_relaxed)) {
+				TraceSpan span("bench busy");
+			}
+		});
+	}
+	bool written = true;
+	for (int i = 0; i < 20; i++) {
+		written &= WriteTraceSpans(path.c_str());
+	}
+	stop = true;
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	std::string json;
+	if (FILE* file = fopen(path.c_str(), "rb")) {
+		char buffer[65536];
+		size_t got;
+		while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+			json.append(buffer, got);
+		}
+		fclose(file);
+	}
+	std::filesystem::remove(path);
+	const size_t events = CountOccurrences(json, "\"ph\":\"X\"");
+	const bool wellFormed = json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0) == 0 && json.size() > 4 &&
+		json.compare(json.size() - 4, 4, "\n]}\n") == 0 && events == CountOccurrences(json, "{\"name\":");
+	const size_t wrapped = CountOccurrences(json, "\"bench span\"");
+	const size_t shortSpans = CountOccurrences(json, "\"bench short\"");
+	const bool ok = written && wellFormed && wrapped == kSpanRingSize - 1 && shortSpans == kShort;
+	g_Failed |= !ok;
+	printf("trace_spans compiled_in=%d span_ns=%.1f clock_pair_ns=%.1f dumped_events=%zu wrapped=%zu short=%zu total_recorded=%llu %s\n",
+		SAGE_TRACE_SPANS, spanNs, clockNs, events, wrapped, shortSpans, (unsigned long long)TraceSpanCount(), ok ? "ok" : "FAILED");
+}
+
+// Replays key streams where every press is held and autorepeats before its release. The engine
+// drops the repeats, so the matcher sees the same presses and the same matches at every storm size.
+static void BenchAutorepeatStorm() {
+	static constexpr GestureSet kGestures = CompileGestures({ kToggleGestureDsl });
+	constexpr size_t kPresses = 200000;
+	auto presses = MakeKeyStream(kPresses, 400);
+	for (auto& press : presses) {
+		press.key = (GestureKey)((size_t)press.key % 2);
+	}
+	for (size_t repeats : { 0, 4, 16, 64 }) {
+		// press, repeats spread over the hold, release just before the next press
+		std::vector<KeyEvent> events;
+		events.reserve(kPresses * (repeats + 2));
+		for (size_t i = 0; i < kPresses; i++) {
+			const uint64_t holdNs = (i + 1 < kPresses ? presses[i + 1].timeNs - presses[i].timeNs : kNsPerMs) - 1;
+			KeyEvent event = presses[i];
+			events.push_back(event);
+			for (size_t r = 1; r <= repeats; r++) {
+				event.timeNs = presses[i].timeNs + holdNs * r / (repeats + 1);
+				events.push_back(event);
+			}
+			event.timeNs = presses[i].timeNs + holdNs;
+			event.down = false;
+			events.push_back(event);
+		}
+
+		auto engine = std::make_unique<GestureEngine>(kGestures);
+		size_t matches = 0;
+		auto start = BenchClock::now();
+		for (const auto& event : events) {
+			matches += engine->OnKeyEvent(event) >= 0;
+		}
+		double us = ElapsedUs(start, BenchClock::now());
+		const KeyFilterStats& stats = engine->Stats();
+		printf("autorepeat_storm repeats_per_press=%zu events=%zu matcher_calls=%llu repeats_dropped=%llu matches=%zu ns_per_event=%.2f ns_per_press=%.2f\n",
+			repeats, events.size(), (unsigned long long)stats.presses, (unsigned long long)stats.repeatsDropped, matches,
+			us * 1000 / events.size(), us * 1000 / kPresses);
+	}
+}
+
+#ifdef __linux__
+static input_event MakeInputEvent(uint16_t type, uint16_t code, int32_t value) {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	input_event ev = {};
+	ev.input_event_sec = now.tv_sec;
+	ev.input_event_usec = now.tv_nsec / 1000;
+	ev.type = type;
+	ev.code = code;
+	ev.value = value;
+	return ev;
+}
+
+static bool WriteInputEvent(int fd, uint16_t type, uint16_t code, int32_t value) {
+	input_event ev = MakeInputEvent(type, code, value);
+	return write(fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev);
+}
+
+// Pipes stand in for keyboards. A writer thread types the toggle gesture on one of them (press,
+// release and SYN_REPORT per key, as a real keyboard does) and waits until the epoll loop has
+// matched it; latency is from the kernel-style stamp of the last press to the match callback.
+static void BenchEvdevWakeup() {
+	static constexpr GestureSet kGestures = CompileGestures({ kToggleGestureDsl });
+	constexpr size_t kCycles = 5000;
+	for (size_t devices : { 1, 8, 64 }) {
+		auto engine = std::make_unique<GestureEngine>(kGestures);
+		std::vector<double> latencyUs;
+		latencyUs.reserve(kCycles);
+		std::counting_semaphore<> matched(0);
+		std::counting_semaphore<> unplugged(0);
+		size_t removed = 0;
+		EvdevInput input([&](const KeyEvent& event) {
+			if (engine->OnKeyEvent(event) >= 0) {
+				latencyUs.push_back((MonotonicNowNs() - event.timeNs) / 1000.0);
+				matched.release();
+			}
+		});
+		input.SetRemovedCallback([&](uint64_t) {
+			removed++;
+			unplugged.release();
+		});
+		std::vector<int> writers;
+		if (!input.Init()) {
+			printf("evdev_wakeup skipped: epoll unavailable\n");
+			return;
+		}
+		for (size_t i = 0; i < devices; i++) {
+			int fds[2];
+			if (pipe(fds) != 0) {
+				break;
+			}
+			input.AddFd(fds[0], 0x100 + i);
+			writers.push_back(fds[1]);
+		}
+		std::thread loop([&] { input.Run(); });
+
+		const uint16_t keys[] = { KEY_VOLUMEUP, KEY_VOLUMEDOWN, KEY_VOLUMEUP, KEY_VOLUMEDOWN };
+		for (size_t c = 0; c < kCycles; c++) {
+			const int fd = writers[c % writers.size()];
+			for (auto key : keys) {
+				WriteInputEvent(fd, EV_KEY, key, 1);
+				WriteInputEvent(fd, EV_SYN, SYN_REPORT, 0);
+				WriteInputEvent(fd, EV_KEY, key, 0);
+				WriteInputEvent(fd, EV_SYN, SYN_REPORT, 0);
+			}
+			matched.acquire();
+		}
+		// closing the write ends unplugs every stand-in device
+		for (int fd : writers) {
+			close(fd);
+			unplugged.acquire();
+		}
+		input.Stop();
+		loop.join();
+
+		std::sort(latencyUs.begin(), latencyUs.end());
+		printf("evdev_wakeup devices=%zu matches=%zu removed=%zu p50_us=%.1f p90_us=%.1f p99_us=%.1f max_us=%.1f\n", devices,
+			latencyUs.size(), removed, Percentile(latencyUs, 50), Percentile(latencyUs, 90), Percentile(latencyUs, 99),
+			latencyUs.empty() ? 0.0 : latencyUs.back());
+	}
+}
+// Heavy typing with an occasional toggle gesture on a uinput keyboard, unmasked versus with the
+// EVIOCSMASK filter the daemon applies. The kernel drops masked events, and a SYN_REPORT whose packet
+// ended up empty with them, so letters never reach the reader.
+static void BenchEvdevMask() {
+	static constexpr GestureSet kGestures = CompileGestures({ kToggleGestureDsl });
+	constexpr size_t kKeystrokes = 20000;
+	constexpr size_t kGestureEvery = 1000;
+	for (bool masked : { false, true }) {
+		auto keyboard = std::make_unique<UinputKeyboard>();
+		if (!keyboard->Create("sage_lock_bench keyboard")) {
+			printf("evdev_mask skipped: cannot create a uinput keyboard (needs write access to /dev/uinput)\n");
+			return;
+		}
+		auto engine = std::make_unique<GestureEngine>(kGestures);
+		size_t matches = 0;
+		std::atomic<size_t> keyEvents{ 0 };
+		std::binary_semaphore unplugged(0);
+		EvdevInput input([&](const KeyEvent& event) {
+			matches += engine->OnKeyEvent(event) >= 0;
+			keyEvents.fetch_add(1, std::memory_order_release);
+		});
+		input.SetRemovedCallback([&](uint64_t) { unplugged.release(); });
+		input.SetKernelMasking(masked);
+		if (!input.Init() || !input.OpenKeyboard(keyboard->EventPath().c_str())) {
+			printf("evdev_mask skipped: cannot open %s\n", keyboard->EventPath().c_str());
+			return;
+		}
+		if (input.Stats().maskFailures != 0) {
+			printf("evdev_mask EVIOCSMASK failed on %s\n", keyboard->EventPath().c_str());
+			g_Failed = true;
+		}
+		double cpuMs = 0;
+		std::thread loop([&] {
+			input.Run();
+			timespec cpu;
+			clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+			cpuMs = cpu.tv_sec * 1e3 + cpu.tv_nsec / 1e6;
+		});
+
+		size_t packets = 0;
+		auto sendKey = [&](uint16_t code, int32_t value) {
+			keyboard->SendKey(code, value);
+			packets++;
+			// roughly 50k keystrokes a second: far above human typing, slow enough that each packet is its own wakeup
+			auto until = BenchClock::now() + std::chrono::microseconds(10);
+			while (BenchClock::now() < until) {
+			}
+		};
+		XorShift rng;
+		const uint16_t gesture[] = { KEY_VOLUMEUP, KEY_VOLUMEDOWN, KEY_VOLUMEUP, KEY_VOLUMEDOWN };
+		for (size_t k = 0; k < kKeystrokes; k++) {
+			const uint16_t letter = (uint16_t)(KEY_Q + rng.Below(10));
+			sendKey(letter, 1);
+			sendKey(letter, 0);
+			if (k % kGestureEvery == kGestureEvery - 1) {
+				for (auto key : gesture) {
+					sendKey(key, 1);
+					sendKey(key, 0);
+				}
+			}
+		}
+		// evdev discards unread events on unplug, so wait for the last gesture key before destroying the keyboard
+		const auto waitStart = BenchClock::now();
+		while (keyEvents.load(std::memory_order_acquire) < kKeystrokes / kGestureEvery * 8 && ElapsedUs(waitStart, BenchClock::now()) < 5e6) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		keyboard.reset();
+		unplugged.acquire();
+		input.Stop();
+		loop.join();
+
+		const EvdevStats& stats = input.Stats();
+		g_Failed |= matches != kKeystrokes / kGestureEvery;
+		printf("evdev_mask %-8s packets=%zu wakeups=%llu reads=%llu events=%llu matches=%zu reader_cpu_ms=%.2f\n",
+			masked ? "masked" : "unmasked", packets, (unsigned long long)stats.wakeups, (unsigned long long)stats.reads,
+			(unsigned long long)stats.events, matches, cpuMs);
+	}
+}
+// Bursts of volume key packets (a held key, a macro pad, a replayed stream) read one record per
+// read() versus a batch per read(). Reports syscalls per event and events per second of reader CPU.
+static void BenchEvdevBurst() {
+	static constexpr GestureSet kGestures = CompileGestures({ kToggleGestureDsl });
+	constexpr size_t kBursts = 2000;
+	constexpr size_t kPacketsPerBurst = 64;
+	for (size_t batch : { (size_t)1, (size_t)8, EvdevInput::kMaxReadBatch }) {
+		auto engine = std::make_unique<GestureEngine>(kGestures);
+		size_t matches = 0;
+		std::binary_semaphore unplugged(0);
+		EvdevInput input([&](const KeyEvent& event) { matches += engine->OnKeyEvent(event) >= 0; });
+		input.SetRemovedCallback([&](uint64_t) { unplugged.release(); });
+		input.SetReadBatch(batch);
+		int fds[2];
+		if (!input.Init() || pipe(fds) != 0) {
+			printf("evdev_burst skipped: epoll or pipe unavailable\n");
+			return;
+		}
+		input.AddFd(fds[0], 1);
+		double cpuMs = 0;
+		std::thread loop([&] {
+			input.Run();
+			timespec cpu;
+			clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+			cpuMs = cpu.tv_sec * 1e3 + cpu.tv_nsec / 1e6;
+		});
+
+		// each packet is a key record and its SYN_REPORT; a burst goes out in one write, as the
+		// kernel queues a burst before the reader gets to run
+		const uint16_t keys[] = { KEY_VOLUMEUP, KEY_VOLUMEDOWN };
+		std::vector<input_event> burst;
+		for (size_t b = 0; b < kBursts; b++) {
+			burst.clear();
+			for (size_t p = 0; p < kPacketsPerBurst; p++) {
+				burst.push_back(MakeInputEvent(EV_KEY, keys[(p / 2) % 2], (int32_t)((p + 1) % 2)));
+				burst.push_back(MakeInputEvent(EV_SYN, SYN_REPORT, 0));
+			}
+			write(fds[1], burst.data(), burst.size() * sizeof(input_event));
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+		close(fds[1]);
+		unplugged.acquire();
+		input.Stop();
+		loop.join();
+
+		const EvdevStats& stats = input.Stats();
+		const uint64_t syscalls = stats.reads + stats.wakeups;
+		printf("evdev_burst batch=%-2zu events=%llu wakeups=%llu reads=%llu syscalls_per_event=%.3f matches=%zu events_per_cpu_sec=%.0f\n",
+			batch, (unsigned long long)stats.events, (unsigned long long)stats.wakeups, (unsigned long long)stats.reads,
+			(double)syscalls / stats.events, matches, stats.events / (cpuMs / 1e3));
+	}
+}
+// Counts toggles instead of touching any device.
+class CountingToggler : public DeviceToggler {
+public:
+	const char* Name() const override { return "counting"; }
+	bool Toggle(std::string_view, bool enable) override {
+		(enable ? m_enables : m_disables).fetch_add(1);
+		return true;
+	}
+	uint64_t Disables() const { return m_disables.load(); }
+
+private:
+	std::atomic<uint64_t> m_enables{ 0 };
+	std::atomic<uint64_t> m_disables{ 0 };
+};
+
+static void WriteSysfsInput(const std::string& root, const std::string& name, bool touchScreen) {
+	const std::string dir = root + "/" + name;
+	mkdir(dir.c_str(), 0755);
+	mkdir((dir + "/capabilities").c_str(), 0755);
+	if (FILE* f = fopen((dir + "/properties").c_str(), "w")) {
+		fputs(touchScreen ? "2\n" : "0\n", f);
+		fclose(f);
+	}
+	if (FILE* f = fopen((dir + "/capabilities/abs").c_str(), "w")) {
+		// X, Y and the multitouch axes, printed the way the kernel does: one hex word per long, high first
+		const uint64_t abs = touchScreen ? 0x6f800000000003ull : 0;
+		if (sizeof(unsigned long) == 8) {
+			fprintf(f, "%lx\n", (unsigned long)abs);
+		}
+		else {
+			fprintf(f, "%lx %lx\n", (unsigned long)(abs >> 32), (unsigned long)abs);
+		}
+		fclose(f);
+	}
+}
+
+static std::string MakeUevent(const char* action, const std::string& name) {
+	const std::string devpath = "/devices/virtual/input/" + name;
+	std::string message = std::string(action) + "@" + devpath;
+	message += '\0';
+	message += std::string("ACTION=") + action;
+	message += '\0';
+	message += "DEVPATH=" + devpath;
+	message += '\0';
+	message += "SUBSYSTEM=input";
+	message += '\0';
+	return message;
+}
+
+// Cost of keeping the touch device set current: a full sysfs rescan per change versus probing only
+// the device a uevent names. Then a touch screen hotplugged while locked, through a socketpair
+// standing in for the netlink socket, must be disabled on arrival.
+static void BenchHotplugRescan() {
+	char root[] = "/tmp/sage_lock_sysfs.XXXXXX";
+	if (mkdtemp(root) == nullptr) {
+		printf("hotplug_rescan skipped: mkdtemp failed\n");
+		return;
+	}
+	constexpr size_t kInputs = 256;
+	std::vector<std::string> names;
+	for (size_t i = 0; i < kInputs; i++) {
+		names.push_back("input" + std::to_string(i));
+		WriteSysfsInput(root, names.back(), i % 64 == 0);
+	}
+
+	constexpr int kScans = 20;
+	size_t found = 0;
+	auto start = BenchClock::now();
+	for (int i = 0; i < kScans; i++) {
+		found = FindSysfsTouchScreens(root).size();
+	}
+	const double scanUs = ElapsedUs(start, BenchClock::now()) / kScans;
+
+	CountingToggler toggler;
+	TouchDeviceRegistry registry(toggler);
+	registry.Reset(FindSysfsTouchScreens(root));
+	TouchHotplugMonitor direct(-1, root, registry);
+	std::vector<std::string> messages;
+	for (const auto& name : names) {
+		messages.push_back(MakeUevent("change", name));
+	}
+	start = BenchClock::now();
+	for (const auto& message : messages) {
+		Uevent event;
+		if (ParseUevent(message.data(), message.size(), event)) {
+			direct.OnUevent(event);
+		}
+	}
+	const double eventUs = ElapsedUs(start, BenchClock::now()) / messages.size();
+	printf("hotplug_rescan inputs=%zu touch=%zu full_scan_us=%.1f per_uevent_us=%.2f speedup=%.0fx\n",
+		kInputs, found, scanUs, eventUs, scanUs / eventUs);
+
+	// lock, then plug in a touch screen
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds) == 0) {
+		TouchHotplugMonitor monitor(fds[0], root, registry);
+		if (monitor.Init()) {
+			std::thread loop([&] { monitor.Run(); });
+			registry.BeginCycle(true);
+			const size_t before = registry.Count();
+			WriteSysfsInput(root, "input9000", true);
+			const std::string message = MakeUevent("add", "input9000");
+			start = BenchClock::now();
+			send(fds[1], message.data(), message.size(), 0);
+			while (registry.Count() == before && ElapsedUs(start, BenchClock::now()) < 1e6) {
+				std::this_thread::yield();
+			}
+			const double arrivalUs = ElapsedUs(start, BenchClock::now());
+			const std::string remove = MakeUevent("remove", "input9000");
+			send(fds[1], remove.data(), remove.size(), 0);
+			while (registry.Count() != before && ElapsedUs(start, BenchClock::now()) < 1e6) {
+				std::this_thread::yield();
+			}
+			monitor.Stop();
+			loop.join();
+			printf("hotplug_rescan arrival_while_locked_us=%.1f locked_on_arrival=%llu disables=%llu devices_after_remove=%zu\n",
+				arrivalUs, (unsigned long long)registry.LockedOnArrival(), (unsigned long long)toggler.Disables(), registry.Count());
+		}
+		close(fds[1]);
+	}
+
+	names.push_back("input9000");
+	for (const auto& name : names) {
+		const std::string dir = std::string(root) + "/" + name;
+		unlink((dir + "/properties").c_str());
+		unlink((dir + "/capabilities/abs").c_str());
+		rmdir((dir + "/capabilities").c_str());
+		rmdir(dir.c_str());
+	}
+	rmdir(root);
+}
+#endif
+
+// ---- Sweep suite --------------------------------------------------------------------------------
+// One benchmark per hot-path component, each swept over the parameters that move it (devices,
+// gestures, event rate). Every data point goes through Report, which prints a text line or, with
+// --json, collects it into the document main prints at the end:
+//
+//	{"schema":1,"tool":"sage_lock_bench","cores":N,"failed":false,"results":[
+//	 {"bench":"match_sweep","params":{"gestures":8,...},"metrics":{"ns_per_event":12.5,...}},...]}
+//
+// Keep bench, param and metric names stable; tracking tools key on them. Add fields rather than
+// renaming, and bump kBenchJsonSchema if a name has to change meaning.
+
+constexpr int kBenchJsonSchema = 1;
+
+struct BenchValue {
+	const char* name;
+	double value;
+};
+
+static bool g_Json = false;
+static std::string g_JsonResults;
+
+static void AppendNumber(std::string& out, double value) {
+	char buffer[64];
+	if (!std::isfinite(value)) {
+		snprintf(buffer, sizeof(buffer), "null");
+	}
+	else if (value == std::floor(value) && std::fabs(value) < 1e15) {
+		snprintf(buffer, sizeof(buffer), "%.0f", value);
+	}
+	else {
+		snprintf(buffer, sizeof(buffer), "%.6g", value);
+	}
+	out += buffer;
+}
+
+static void AppendValues(std::string& out, std::initializer_list<BenchValue> values, bool json) {
+	bool first = true;
+	for (const auto& value : values) {
+		if (json) {
+			out += first ? "\"" : ",\"";
+			out += value.name;
+			out += "\":";
+		}
+		else {
+			out += " ";
+			out += value.name;
+			out += "=";
+		}
+		AppendNumber(out, value.value);
+		first = false;
+	}
+}
+
+static void Report(const char* bench, std::initializer_list<BenchValue> params, std::initializer_list<BenchValue> metrics) {
+	std::string line;
+	if (g_Json) {
+		line += g_JsonResults.empty() ? "\n {\"bench\":\"" : ",\n {\"bench\":\"";
+		line += bench;
+		line += "\",\"params\":{";
+		AppendValues(line, params, true);
+		line += "},\"metrics\":{";
+		AppendValues(line, metrics, true);
+		line += "}}";
+		g_JsonResults += line;
+		return;
+	}
+	line += bench;
+	AppendValues(line, params, false);
+	AppendValues(line, metrics, false);
+	printf("%s\n", line.c_str());
+}
+
+#ifdef __linux__
+static double ThreadCpuMs() {
+	timespec cpu;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	return cpu.tv_sec * 1e3 + cpu.tv_nsec / 1e6;
+}
+
+// evdev records to KeyEvents: keyboards are pipes fed at a steady packet rate for a fixed time,
+// and the cost is the input thread's CPU time per record, wakeups and reads included.
+static void BenchDecodeSweep() {
+	constexpr auto kDuration = std::chrono::milliseconds(200);
+	constexpr auto kTick = std::chrono::milliseconds(1);
+	for (size_t devices : { 1, 4, 16 }) {
+		for (unsigned rateHz : { 1000, 10000, 100000 }) {
+			uint64_t keyEvents = 0;
+			std::counting_semaphore<> unplugged(0);
+			EvdevInput input([&](const KeyEvent&) { keyEvents++; });
+			input.SetRemovedCallback([&](uint64_t) { unplugged.release(); });
+			if (!input.Init()) {
+				printf("decode_sweep skipped: epoll unavailable\n");
+				return;
+			}
+			std::vector<int> writers;
+			for (size_t d = 0; d < devices; d++) {
+				int fds[2];
+				if (pipe(fds) != 0) {
+					break;
+				}
+				input.AddFd(fds[0], d + 1);
+				writers.push_back(fds[1]);
+			}
+			double cpuMs = 0;
+			std::thread loop([&] {
+				input.Run();
+				cpuMs = ThreadCpuMs();
+			});
+
+			// each packet is a key record and its SYN_REPORT, dealt round robin across the keyboards;
+			// a keyboard's share of a tick goes out in one write
+			const size_t packetsPerTick = std::max<size_t>(1, rateHz / 1000);
+			const uint16_t keys[] = { KEY_VOLUMEUP, KEY_VOLUMEDOWN };
+			std::vector<std::vector<input_event>> bursts(writers.size());
+			size_t packet = 0;
+			const auto start = BenchClock::now();
+			for (auto tick = start; tick < start + kDuration; tick += kTick) {
+				std::this_thread::sleep_until(tick);
+				for (size_t p = 0; p < packetsPerTick; p++, packet++) {
+					auto& burst = bursts[packet % writers.size()];
+					const size_t press = packet / writers.size();
+					burst.push_back(MakeInputEvent(EV_KEY, keys[(press / 2) % 2], (int32_t)((press + 1) % 2)));
+					burst.push_back(MakeInputEvent(EV_SYN, SYN_REPORT, 0));
+				}
+				for (size_t d = 0; d < writers.size(); d++) {
+					if (!bursts[d].empty() && write(writers[d], bursts[d].data(), bursts[d].size() * sizeof(input_event)) < 0) {
+						g_Failed = true;
+					}
+					bursts[d].clear();
+				}
+			}
+			for (int fd : writers) {
+				close(fd);
+			}
+			for (size_t d = 0; d < writers.size(); d++) {
+				unplugged.acquire();
+			}
+			input.Stop();
+			loop.join();
+
+			const EvdevStats& stats = input.Stats();
+			g_Failed |= keyEvents != packet;
+			Report("decode_sweep", { { "devices", (double)devices }, { "rate_hz", (double)rateHz } },
+				{ { "events", (double)stats.events }, { "key_events", (double)keyEvents }, { "cpu_ns_per_event", cpuMs * 1e6 / stats.events },
+				{ "wakeups_per_event", (double)stats.wakeups / stats.events }, { "reads_per_event", (double)stats.reads / stats.events } });
+		}
+	}
+}
+#endif
+
+// Gesture engine (autorepeat filter plus matcher) on press/release streams, over the gesture count,
+// the number of keyboards interleaving presses and the press rate, which decides how often a
+// gesture times out mid-sequence.
+static void BenchMatchSweep() {
+	constexpr size_t kPresses = 400000;
+	for (size_t gestures : { 1, 8, 32 }) {
+		for (size_t keyboards : { 1, 4 }) {
+			for (uint32_t rateHz : { 5, 50 }) {
+				XorShift rng;
+				GestureSet set;
+				AddRandomGestures(set, gestures, rng);
+				// gaps of 1 ms plus up to 2/rate, so about rate presses per second
+				const auto presses = MakeKeyStream(kPresses, 2000 / rateHz);
+				std::vector<KeyEvent> events;
+				events.reserve(kPresses * 2);
+				for (size_t i = 0; i < kPresses; i++) {
+					KeyEvent event = presses[i];
+					event.device = 1 + i % keyboards;
+					events.push_back(event);
+					event.timeNs += i + 1 < kPresses ? (presses[i + 1].timeNs - presses[i].timeNs) / 2 : kNsPerMs;
+					event.down = false;
+					events.push_back(event);
+				}
+
+				auto engine = std::make_unique<GestureEngine>(set);
+				size_t matches = 0;
+				auto start = BenchClock::now();
+				for (const auto& event : events) {
+					matches += engine->OnKeyEvent(event) >= 0;
+				}
+				const double us = ElapsedUs(start, BenchClock::now());
+				Report("match_sweep", { { "gestures", (double)set.Count() }, { "keyboards", (double)keyboards }, { "rate_hz", (double)rateHz } },
+					{ { "events", (double)events.size() }, { "matches", (double)matches }, { "ns_per_event", us * 1000 / events.size() } });
+			}
+		}
+	}
+}
+
+// What the lock executor does with the registry every cycle: take the device list and walk it.
+// With churn, one device arrives and one leaves between cycles, so every cycle rebuilds the list.
+static void BenchRegistrySweep() {
+	for (size_t devices : { 1, 8, 64, 512 }) {
+		for (int churn : { 0, 1 }) {
+			SimDeviceRegistry sim;
+			sim.AddMany(devices, 0, 0, 0);
+			SystemClock clock;
+			SimDeviceToggler toggler(sim, clock);
+			TouchDeviceRegistry registry(toggler);
+			registry.Reset(sim.Ids());
+			const size_t cycles = std::max<size_t>(1000, (churn ? 200000 : 2000000) / devices);
+			const std::string extra[] = { "SIM\\EXTRA\\0", "SIM\\EXTRA\\1" };
+			size_t bytes = 0;
+			auto start = BenchClock::now();
+			for (size_t c = 0; c < cycles; c++) {
+				if (churn) {
+					registry.Add(extra[c % 2]);
+					registry.Remove(extra[(c + 1) % 2]);
+				}
+				// unlocked, so Add does not toggle the new device
+				const DeviceList list = registry.BeginCycle(false);
+				for (const auto& id : *list) {
+					bytes += id.size();
+				}
+			}
+			const double us = ElapsedUs(start, BenchClock::now());
+			g_Failed |= bytes == 0;
+			Report("registry_sweep", { { "devices", (double)devices }, { "churn", (double)churn } },
+				{ { "cycles", (double)cycles }, { "ns_per_cycle", us * 1000 / cycles }, { "ns_per_device", us * 1000 / cycles / devices } });
+		}
+	}
+}
+
+// One lock/unlock through ToggleFanout into simulated devices, over the device count, the worker
+// pool and the per-device toggle latency.
+static void BenchDispatchSweep() {
+	for (size_t devices : { 1, 4, 16, 64 }) {
+		for (unsigned workers : { 1, 4 }) {
+			for (unsigned latencyUs : { 0, 100 }) {
+				SimDeviceRegistry sim;
+				sim.AddMany(devices, latencyUs * 1000ull, 0, 0);
+				SystemClock clock;
+				SimDeviceToggler toggler(sim, clock);
+				ToggleFanout fanout([&toggler](std::string_view id, bool enable) { return toggler.Toggle(id, enable); }, workers, clock);
+				const DeviceList list = MakeDeviceList(sim.Ids());
+				fanout.Reserve(devices);
+				std::vector<ToggleResult> results;
+				LatencyHistogram latency;
+				const size_t cycles = latencyUs != 0 ? 50 : 2000;
+				size_t failed = 0;
+				for (size_t c = 0; c < cycles; c++) {
+					const uint64_t startNs = MonotonicNowNs();
+					fanout.Run(list, c % 2 != 0, std::chrono::milliseconds(10000), results);
+					latency.Record(MonotonicNowNs() - startNs);
+					for (const auto& result : results) {
+						failed += result.status != ToggleStatus::Ok;
+					}
+				}
+				g_Failed |= failed != 0;
+				Report("dispatch_sweep", { { "devices", (double)devices }, { "workers", (double)workers }, { "latency_us", (double)latencyUs } },
+					{ { "cycles", (double)cycles }, { "p50_us", latency.Percentile(50) / 1000.0 }, { "p99_us", latency.Percentile(99) / 1000.0 },
+					{ "max_us", latency.Max() / 1000.0 }, { "failed", (double)failed } });
+			}
+		}
+	}
+}
+
+// SAGE_LOG caller cost from one or more threads into a /dev/null sink. Each thread logs in bursts
+// that fit its ring and flushes in between, untimed, so the calls measured are the ones the daemon
+// makes and not the drop path.
+static void BenchLogSweep() {
+	constexpr size_t kCalls = 100000;
+	constexpr size_t kBurst = 128;
+	const char* id = "HID\\VID_045E&PID_0C1A&MI_00\\7&2A4B2D1&0&0000";
+	for (unsigned threads : { 1, 2, 4 }) {
+		FILE* devNull = fopen("/dev/null", "w");
+		if (devNull == nullptr) {
+			printf("log_sweep skipped: no /dev/null\n");
+			return;
+		}
+		const LogStats before = DeferredLogStats();
+		StartDeferredLog(std::make_unique<FileLogSink>(devNull));
+		std::vector<std::thread> callers;
+		std::atomic<uint64_t> callNs{ 0 };
+		for (unsigned t = 0; t < threads; t++) {
+			callers.emplace_back([&] {
+				for (size_t i = 0; i < kCalls; i += kBurst) {
+					const uint64_t startNs = MonotonicNowNs();
+					for (size_t j = i; j < i + kBurst && j < kCalls; j++) {
+						SAGE_LOG("Toggle %s via %s: %s in %llu us\n", id, "setupapi", "ok", (unsigned long long)j);
+					}
+					callNs.fetch_add(MonotonicNowNs() - startNs, std::memory_order_relaxed);
+					FlushDeferredLog();
+				}
+			});
+		}
+		for (auto& caller : callers) {
+			caller.join();
+		}
+		StopDeferredLog();
+		fclose(devNull);
+		const LogStats after = DeferredLogStats();
+		const uint64_t records = after.records - before.records;
+		Report("log_sweep", { { "threads", (double)threads } },
+			{ { "calls", (double)threads * kCalls }, { "ns_per_call", (double)callNs.load() / (threads * kCalls) },
+			{ "written", (double)records }, { "dropped", (double)(after.dropped - before.dropped) },
+			{ "format_ns_per_record", records != 0 ? (double)(after.formatNs - before.formatNs) / records : 0.0 } });
+	}
+}
+
+struct Benchmark {
+	const char* name;
+	void (*run)();
+	bool json = false; // reports through Report, so it can run under --json
+};
+
+static const Benchmark g_Benchmarks[] = {
+	{ "input_stall", BenchInputStall },
+	{ "toggle_fanout", BenchToggleFanout },
+#ifdef __linux__
+	{ "toggler_backends", BenchTogglerBackends },
+#endif
+	{ "gesture_matcher", BenchGestureMatcher },
+	{ "compiled_gesture", BenchCompiledGesture },
+	{ "device_gestures", BenchDeviceGestures },
+	{ "trace_replay", BenchTraceReplay },
+	{ "hid_classify", BenchHidClassify },
+	{ "autorepeat_storm", BenchAutorepeatStorm },
+	{ "pipeline_latency", BenchPipelineLatency },
+	{ "lock_stages", BenchLockStages },
+	{ "shared_metrics", BenchSharedMetrics },
+	{ "startup_cache", BenchStartupCache },
+	{ "probe_fanout", BenchProbeFanout },
+	{ "id_table", BenchIdTable },
+	{ "log_call", BenchLogCall },
+	{ "trace_spans", BenchTraceSpans },
+#ifdef __linux__
+	{ "evdev_wakeup", BenchEvdevWakeup },
+	{ "evdev_mask", BenchEvdevMask },
+	{ "evdev_burst", BenchEvdevBurst },
+	{ "hotplug_rescan", BenchHotplugRescan },
+	{ "decode_sweep", BenchDecodeSweep, true },
+#endif
+	{ "match_sweep", BenchMatchSweep, true },
+	{ "registry_sweep", BenchRegistrySweep, true },
+	{ "dispatch_sweep", BenchDispatchSweep, true },
+	{ "log_sweep", BenchLogSweep, true },
+};
+
+int main(int argc, char** argv) {
+	std::vector<const char*> only;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--json") == 0) {
+			g_Json = true;
+		}
+		else {
+			only.push_back(argv[i]);
+		}
+	}
+	// check every name before running anything, so a typo does not cost a long run first
+	for (const char* name : only) {
+		if (std::none_of(std::begin(g_Benchmarks), std::end(g_Benchmarks), [&](const Benchmark& bench) { return strcmp(name, bench.name) == 0; })) {
+			fprintf(stderr, "no benchmark named %s; valid names:\n", name);
+			for (const auto& bench : g_Benchmarks) {
+				fprintf(stderr, "  %s%s\n", bench.name, bench.json ? " (--json)" : "");
+			}
+			return 2;
+		}
+	}
+	for (const auto& bench : g_Benchmarks) {
+		const bool named = std::any_of(only.begin(), only.end(), [&](const char* name) { return strcmp(name, bench.name) == 0; });
+		if (g_Json && named && !bench.json) {
+			fprintf(stderr, "%s has no --json output\n", bench.name);
+			return 2;
+		}
+		// with --json and no names, the whole sweep suite
+		if (only.empty() ? (!g_Json || bench.json) : named) {
+			bench.run();
+		}
+	}
+	if (g_Json) {
+		printf("{\"schema\":%d,\"tool\":\"sage_lock_bench\",\"cores\":%u,\"failed\":%s,\"results\":[%s\n]}\n", kBenchJsonSchema,
+			std::thread::hardware_concurrency(), g_Failed ? "true" : "false", g_JsonResults.c_str());
+	}
+	return g_Failed;
+}
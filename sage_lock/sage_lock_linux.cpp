@@ -0,0 +1,303 @@
+/////////////
+// sage_lock_linux.cpp : Linux daemon. Locks touch screens when a volume up/down pattern is detected,
+// with the same gesture and lock pipeline as the Windows build.
+//
+// usage: sage_lock [--trace=<file>] [--input=<dir>] [--sysfs=<dir>] [--cache=<file>] [--log=<file>]
+//                  [--metrics=<shm name>] [--spans=<file>]
+//
+// Diagnostics go through the deferred logger, to --log=<file> or else stderr. Counters and latency
+// are published in shared memory (default /sage_lock.metrics) for sage_lock_stat. In a build with
+// SAGE_TRACE_SPANS=1, --spans=<file> writes the trace spans as Chrome trace JSON on SIGUSR1 and at exit.
+//////
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <semaphore.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "clock.h"
+#include "deferred_log.h"
+#include "device_cache.h"
+#include "device_toggler.h"
+#include "evdev_input.h"
+#include "gesture_dsl.h"
+#include "input_trace.h"
+#include "key_event.h"
+#include "lock_pipeline.h"
+#include "probe_fanout.h"
+#include "shared_metrics.h"
+#include "touch_hotplug.h"
+#include "trace_spans.h"
+
+constexpr GestureSet g_Gestures = CompileGestures({ kToggleGestureDsl });
+constexpr int kToggleGesture = 0;
+constexpr unsigned kMaxToggleWorkers = 4;
+constexpr std::chrono::milliseconds kToggleDeadline{ 10000 };
+constexpr unsigned kMaxProbeWorkers = 8;
+constexpr std::chrono::milliseconds kProbeTimeout{ 2000 };
+
+InputTraceRecorder g_TraceRecorder;
+EvdevInput* g_Input = nullptr;
+TouchHotplugMonitor* g_Hotplug = nullptr;
+sem_t g_DumpSpans; // posted by SIGUSR1; sem_post is async-signal-safe, fopen is not
+
+// Returns the value of "--name=value", or nullptr.
+static const char* FindArg(int argc, char** argv, const char* name) {
+	const size_t len = strlen(name);
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], name, len) == 0) {
+			return argv[i] + len;
+		}
+	}
+	return nullptr;
+}
+
+static void OnStopSignal(int) {
+	g_Input->Stop();
+	if (g_Hotplug != nullptr) {
+		g_Hotplug->Stop();
+	}
+}
+
+static void OnDumpSpansSignal(int) {
+	sem_post(&g_DumpSpans);
+}
+
+// Cache file: --cache=<file>, else $XDG_CACHE_HOME or ~/.cache. Empty if there is nowhere to put it.
+static std::string DeviceCachePath(int argc, char** argv) {
+	if (const char* path = FindArg(argc, argv, "--cache=")) {
+		return path;
+	}
+	if (const char* xdg = getenv("XDG_CACHE_HOME")) {
+		return std::string(xdg) + "/sage_lock.devices";
+	}
+	if (const char* home = getenv("HOME")) {
+		return std::string(home) + "/.cache/sage_lock.devices";
+	}
+	return std::string();
+}
+
+// Cached touch screens whose input node still belongs to the same device. One identity read per
+// cached device instead of probing every input node.
+static std::vector<CachedDevice> LoadCachedTouchScreens(const DeviceCache& cache, const std::string& sysfsRoot) {
+	std::vector<CachedDevice> devices;
+	for (auto& device : cache.Load(DeviceCacheNow())) {
+		if (SysfsInputIdentity(sysfsRoot, device.id) == device.identity) {
+			devices.push_back(std::move(device));
+		}
+	}
+	return devices;
+}
+
+// Full scan, one input node per probe on a few threads: sysfs reads of a device that is resuming
+// or being unbound can block, and must not hold up the rest of the scan. A node that does not
+// answer within kProbeTimeout goes to late if it turns out to be a touch screen.
+static ProbeReport EnumerateTouchScreens(const std::string& sysfsRoot, std::shared_ptr<LateProbeSink> late) {
+	// captures the root by value: abandoned probes outlive the call
+	return ProbeDevices(ListSysfsInputNodes(sysfsRoot), [sysfsRoot](const std::string& name, CachedDevice& device) {
+		if (!IsSysfsTouchScreen(sysfsRoot, name)) {
+			return false;
+		}
+		device.identity = SysfsInputIdentity(sysfsRoot, name);
+		HidClassification hid;
+		if (ReadSysfsHidClassification(sysfsRoot + "/" + name + "/device/report_descriptor", hid)) {
+			device.classes = hid.classes;
+		}
+		device.id = name;
+		return true;
+	}, kMaxProbeWorkers, kProbeTimeout, std::move(late));
+}
+
+static void LogLockCycle(const LockCycle& cycle) {
+	size_t failed = 0;
+	for (const auto& result : *cycle.results) {
+		failed += result.status != ToggleStatus::Ok;
+	}
+	SAGE_LOG("%s took %llu us from last key press, %zu device(s) failed\n", cycle.action == LockAction::Lock ? "Lock" : "Unlock",
+		(cycle.completeNs - cycle.triggerNs) / 1000, failed);
+}
+
+// p50/p99/p999 of every lock cycle stage since startup.
+static void LogLatency(const LockPipeline& pipeline) {
+	for (size_t i = 0; i < (size_t)LockStage::Count; i++) {
+		const LatencyHistogram& latency = pipeline.Latency((LockStage)i);
+		SAGE_LOG("Latency %s: n=%llu p50=%.1f us p99=%.1f us p999=%.1f us max=%.1f us\n", LockStageName((LockStage)i), latency.Count(),
+			latency.Percentile(50) / 1000.0, latency.Percentile(99) / 1000.0, latency.Percentile(99.9) / 1000.0, latency.Max() / 1000.0);
+	}
+}
+
+int main(int argc, char** argv) {
+	std::unique_ptr<LogSink> logSink;
+	if (const char* logPath = FindArg(argc, argv, "--log=")) {
+		logSink = FileLogSink::Open(logPath);
+		if (!logSink) {
+			fprintf(stderr, "Could not open log file %s, logging to stderr\n", logPath);
+		}
+	}
+	StartDeferredLog(logSink ? std::move(logSink) : std::make_unique<FileLogSink>(stderr));
+
+	const char* inputDir = FindArg(argc, argv, "--input=");
+	const char* sysfsArg = FindArg(argc, argv, "--sysfs=");
+	const std::string sysfsRoot = sysfsArg != nullptr ? sysfsArg : "/sys/class/input";
+
+	if (const char* tracePath = FindArg(argc, argv, "--trace=")) {
+		if (!g_TraceRecorder.Start(tracePath)) {
+			SAGE_LOG("Could not open trace file %s\n", tracePath);
+		}
+	}
+
+	// declared before the pipeline, which publishes into it until destroyed
+	SharedMetrics metrics;
+	const char* metricsArg = FindArg(argc, argv, "--metrics=");
+	const char* metricsName = metricsArg != nullptr ? metricsArg : kDefaultMetricsName;
+	uint64_t metricsOwner = 0;
+	if (!metrics.Create(metricsName, &metricsOwner)) {
+		if (metricsOwner != 0) {
+			SAGE_LOG("Metrics segment %s belongs to running pid %llu; not publishing metrics\n", metricsName,
+				(unsigned long long)metricsOwner);
+		}
+		else {
+			SAGE_LOG("Could not create metrics segment %s\n", metricsName);
+		}
+	}
+
+	SystemClock clock;
+	auto toggler = CreateSysfsInhibitToggler(sysfsRoot);
+	LockPipelineConfig config;
+	config.toggleGesture = kToggleGesture;
+	config.toggleWorkers = kMaxToggleWorkers;
+	config.toggleDeadline = kToggleDeadline;
+	auto pipeline = std::make_unique<LockPipeline>(g_Gestures, *toggler, clock, config);
+	// subscribe before the scan so a device plugged in meanwhile is not missed; the registry ignores duplicates
+	TouchHotplugMonitor hotplug(OpenUeventSocket(), sysfsRoot, pipeline->Devices());
+	const bool hotplugReady = hotplug.Init();
+	if (!hotplugReady) {
+		SAGE_LOG("No uevent socket; touch screens plugged in later will not be locked\n");
+	}
+	// start from the cached set and listen right away; the full scan runs in the background
+	DeviceCache cache;
+	const std::string cachePath = DeviceCachePath(argc, argv);
+	std::vector<CachedDevice> cached;
+	if (!cachePath.empty() && cache.Open(cachePath.c_str())) {
+		cached = LoadCachedTouchScreens(cache, sysfsRoot);
+	}
+	std::vector<std::string> seeded;
+	for (const auto& device : cached) {
+		seeded.push_back(device.id);
+	}
+	pipeline->SetDevices(seeded);
+	pipeline->SetFeedback([](bool devicesEnabled) {
+		SAGE_LOG("Touch screens %s\n", devicesEnabled ? "unlocked" : "locked");
+	});
+	pipeline->SetCycleObserver(LogLockCycle);
+	if (metrics.IsOpen()) {
+		pipeline->SetMetrics(&metrics);
+	}
+	SAGE_LOG("Using %s toggle backend, %zu cached touch screen(s)\n", toggler->Name(), seeded.size());
+
+	EvdevInput input([&](const KeyEvent& event) {
+		g_TraceRecorder.Record(event);
+		pipeline->OnKeyEvent(event);
+	});
+	input.SetRemovedCallback([&](uint64_t device) { pipeline->ForgetDevice(device); });
+	if (!input.Init()) {
+		perror("epoll");
+		StopDeferredLog();
+		return 1;
+	}
+	if (input.OpenKeyboards(inputDir != nullptr ? inputDir : "/dev/input") == 0) {
+		fprintf(stderr, "No readable keyboard with volume keys (is the user in the input group?)\n");
+		StopDeferredLog();
+		return 1;
+	}
+	if (input.Stats().unmaskedDevices > 0) {
+		SAGE_LOG("Kernel has no EVIOCSMASK; every key press on %llu keyboard(s) will wake the daemon\n", input.Stats().unmaskedDevices);
+	}
+	if (input.Stats().maskFailures > 0) {
+		SAGE_LOG("EVIOCSMASK failed on %llu keyboard(s); every key press on them will wake the daemon\n", input.Stats().maskFailures);
+	}
+	if (input.Stats().clockFallbacks > 0) {
+		SAGE_LOG("EVIOCSCLOCKID failed on %llu keyboard(s); their key presses are timed as read, not as sent\n", input.Stats().clockFallbacks);
+	}
+
+	g_Input = &input;
+	std::thread hotplugThread;
+	if (hotplugReady) {
+		g_Hotplug = &hotplug;
+		hotplugThread = std::thread([&] { hotplug.Run(); });
+	}
+	signal(SIGINT, OnStopSignal);
+	signal(SIGTERM, OnStopSignal);
+	const char* spansPath = FindArg(argc, argv, "--spans=");
+	bool stopDumper = false;
+	std::thread dumperThread;
+	if (spansPath != nullptr) {
+		if (!SAGE_TRACE_SPANS) {
+			SAGE_LOG("--spans given, but this build has no trace spans (SAGE_TRACE_SPANS=0)\n");
+		}
+		sem_init(&g_DumpSpans, 0, 0);
+		dumperThread = std::thread([&] {
+			for (;;) {
+				if (sem_wait(&g_DumpSpans) != 0) {
+					continue; // EINTR
+				}
+				if (stopDumper) {
+					return;
+				}
+				if (!WriteTraceSpans(spansPath)) {
+					SAGE_LOG("Could not write trace spans to %s\n", spansPath);
+				}
+			}
+		});
+		signal(SIGUSR1, OnDumpSpansSignal);
+	}
+	pipeline->Start();
+	// closed before the pipeline goes away; an abandoned probe may answer at any time until then
+	auto lateProbes = std::make_shared<LateProbeSink>([&](const CachedDevice& device) {
+		if (pipeline->Devices().Add(device.id)) {
+			SAGE_LOG("Touch screen answered late: %s\n", device.id);
+		}
+	});
+	std::thread validateThread([&] {
+		ProbeReport report = EnumerateTouchScreens(sysfsRoot, lateProbes);
+		// a cached touch screen that did not answer in time is still there, just slow
+		for (const auto& name : report.timedOut) {
+			for (const auto& device : cached) {
+				if (device.id == name) {
+					report.found.push_back(device);
+				}
+			}
+		}
+		const CacheValidation validation = ApplyEnumeration(pipeline->Devices(), seeded, report.found);
+		cache.Store(report.found, DeviceCacheNow());
+		SAGE_LOG("Found %zu touch screen(s) in %llu us, %zu probe(s) timed out: %zu not cached, %zu cached but gone\n",
+			report.found.size(), report.elapsedUs, report.timedOut.size(), validation.added, validation.removed);
+	});
+	input.Run();
+	validateThread.join();
+	lateProbes->Close();
+	if (hotplugThread.joinable()) {
+		hotplug.Stop();
+		hotplugThread.join();
+	}
+	const EvdevStats& stats = input.Stats();
+	SAGE_LOG("Input: %llu wakeups, %llu events read, %llu gesture key events\n", stats.wakeups, stats.events, stats.keyEvents);
+	pipeline->Stop();
+	LogLatency(*pipeline);
+	if (dumperThread.joinable()) {
+		signal(SIGUSR1, SIG_IGN);
+		stopDumper = true;
+		sem_post(&g_DumpSpans);
+		dumperThread.join();
+		if (!WriteTraceSpans(spansPath)) {
+			SAGE_LOG("Could not write trace spans to %s\n", spansPath);
+		}
+	}
+	g_TraceRecorder.Stop();
+	StopDeferredLog();
+	return 0;
+}
@@ -0,0 +1,95 @@
+/////////////
+// sage_lock_replay.cpp : Replays a binary input trace (recorded with --trace=<file>) through the gesture
+// engine at full speed. The recorded timestamps act as the clock, so every run is deterministic.
+//
+// usage: sage_lock_replay <trace> [--gesture "<dsl>"]... [--quiet]
+// Without --gesture the built-in toggle gesture is used.
+//////
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include "gesture_dsl.h"
+#include "gesture_engine.h"
+#include "input_trace.h"
+
+static const char* KeyName(GestureKey key) {
+	switch (key) {
+	case GestureKey::VolumeUp: return "VOLUP";
+	case GestureKey::VolumeDown: return "VOLDOWN";
+	case GestureKey::VolumeMute: return "MUTE";
+	default: return "?";
+	}
+}
+
+int main(int argc, char** argv) {
+	const char* tracePath = nullptr;
+	bool quiet = false;
+	GestureSet gestures;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--quiet") == 0) {
+			quiet = true;
+		}
+		else if (strcmp(argv[i], "--gesture") == 0 && i + 1 < argc) {
+			GestureParseResult parsed = ParseGesture(argv[++i]);
+			if (parsed.error != nullptr) {
+				fprintf(stderr, "bad gesture \"%s\": %s\n", argv[i], parsed.error);
+				return 2;
+			}
+			if (gestures.Add(parsed.spec) < 0) {
+				fprintf(stderr, "too many gestures\n");
+				return 2;
+			}
+		}
+		else if (tracePath == nullptr) {
+			tracePath = argv[i];
+		}
+		else {
+			fprintf(stderr, "usage: %s <trace> [--gesture \"<dsl>\"]... [--quiet]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (tracePath == nullptr) {
+		fprintf(stderr, "usage: %s <trace> [--gesture \"<dsl>\"]... [--quiet]\n", argv[0]);
+		return 2;
+	}
+	if (gestures.Count() == 0) {
+		gestures.Add(ParseGesture(kToggleGestureDsl).spec);
+	}
+
+	InputTraceReader trace;
+	if (!trace.Open(tracePath)) {
+		fprintf(stderr, "%s: not a readable sage_lock trace\n", tracePath);
+		return 1;
+	}
+
+	auto engine = std::make_unique<GestureEngine>(gestures);
+	const TraceRecord* records = trace.Records();
+	const uint64_t startNs = trace.Count() > 0 ? records[0].timeNs : 0;
+	size_t matches = 0;
+	auto wallStart = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < trace.Count(); i++) {
+		KeyEvent event;
+		if (!ToKeyEvent(records[i], event)) {
+			continue;
+		}
+		int gesture = engine->OnKeyEvent(event);
+		if (gesture >= 0) {
+			matches++;
+			if (!quiet) {
+				printf("match gesture=%d device=0x%llx t=%.3fms last_key=%s\n", gesture, (unsigned long long)event.device,
+					(event.timeNs - startNs) / 1e6, KeyName(event.key));
+			}
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+	const KeyFilterStats& stats = engine->Stats();
+	if (trace.Invalid() != 0) {
+		fprintf(stderr, "%s: skipped %zu record(s) with an unknown key\n", tracePath, trace.Invalid());
+	}
+	printf("records=%zu invalid=%zu matches=%zu presses=%llu releases=%llu repeats_dropped=%llu replay_ms=%.3f events_per_sec=%.0f\n",
+		trace.Count(), trace.Invalid(), matches, (unsigned long long)stats.presses, (unsigned long long)stats.releases,
+		(unsigned long long)stats.repeatsDropped, seconds * 1e3, seconds > 0 ? trace.Count() / seconds : 0.0);
+	return 0;
+}
@@ -0,0 +1,75 @@
+/////////////
+// sage_lock_stat.cpp : Prints the counters, gauges and latency summary a running daemon publishes in
+// shared memory. Reads the segment directly; the daemon is never asked for anything.
+//
+// usage: sage_lock_stat [--name=<segment>] [--watch=<ms>]
+// Output is one "key=value" per line, a blank line between samples with --watch. A segment whose
+// latency summary stays mid-update, because its daemon died while publishing, is reported as
+// stale=1 and makes the exit status 1.
+//////
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "shared_metrics.h"
+
+// Returns false if the segment is stale.
+static bool PrintSample(const SharedMetrics& metrics) {
+	MetricsStageSummary stages[kMetricsStages] = {};
+	const bool fresh = metrics.ReadLatency(stages);
+	printf("stale=%d\n", fresh ? 0 : 1);
+	printf("pid=%llu\n", (unsigned long long)metrics.Pid());
+	printf("start_unix_sec=%llu\n", (unsigned long long)metrics.StartUnixSec());
+	for (size_t i = 0; i < (size_t)MetricCounter::Count; i++) {
+		printf("%s=%llu\n", MetricCounterName((MetricCounter)i), (unsigned long long)metrics.Get((MetricCounter)i));
+	}
+	for (size_t i = 0; i < (size_t)MetricGauge::Count; i++) {
+		printf("%s=%llu\n", MetricGaugeName((MetricGauge)i), (unsigned long long)metrics.Get((MetricGauge)i));
+	}
+	for (size_t i = 0; i < kMetricsStages && fresh; i++) {
+		const char* stage = MetricStageName(i);
+		printf("latency.%s.count=%llu\n", stage, (unsigned long long)stages[i].count);
+		printf("latency.%s.p50_us=%.1f\n", stage, stages[i].p50Ns / 1000.0);
+		printf("latency.%s.p99_us=%.1f\n", stage, stages[i].p99Ns / 1000.0);
+		printf("latency.%s.p999_us=%.1f\n", stage, stages[i].p999Ns / 1000.0);
+		printf("latency.%s.max_us=%.1f\n", stage, stages[i].maxNs / 1000.0);
+	}
+	if (!fresh) {
+		fprintf(stderr, "latency summary stuck mid-update; daemon pid %llu probably died while publishing\n",
+			(unsigned long long)metrics.Pid());
+	}
+	return fresh;
+}
+
+int main(int argc, char** argv) {
+	const char* name = kDefaultMetricsName;
+	long watchMs = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--name=", 7) == 0) {
+			name = argv[i] + 7;
+		}
+		else if (strncmp(argv[i], "--watch=", 8) == 0) {
+			watchMs = atol(argv[i] + 8);
+		}
+		else {
+			fprintf(stderr, "usage: %s [--name=<segment>] [--watch=<ms>]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	SharedMetrics metrics;
+	if (!metrics.OpenRead(name)) {
+		fprintf(stderr, "no sage_lock metrics at %s (daemon not running, or a different version)\n", name);
+		return 1;
+	}
+	bool fresh = PrintSample(metrics);
+	while (watchMs > 0) {
+		fflush(stdout);
+		std::this_thread::sleep_for(std::chrono::milliseconds(watchMs));
+		printf("\n");
+		fresh = PrintSample(metrics);
+	}
+	return fresh ? 0 : 1;
+}
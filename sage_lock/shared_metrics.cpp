@@ -0,0 +1,270 @@
+/////////////
+// shared_metrics.cpp : Segment mapping and the latency seqlock for SharedMetrics.
+//////
+
+#include "shared_metrics.h"
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const char* MetricCounterName(MetricCounter counter) {
+	switch (counter) {
+	case MetricCounter::KeyEvents: return "key_events";
+	case MetricCounter::Gestures: return "gestures";
+	case MetricCounter::Locks: return "locks";
+	case MetricCounter::Unlocks: return "unlocks";
+	case MetricCounter::TogglesOk: return "toggles_ok";
+	case MetricCounter::ToggleFailures: return "toggle_failures";
+	case MetricCounter::ToggleTimeouts: return "toggle_timeouts";
+	case MetricCounter::DroppedCommands: return "dropped_commands";
+	case MetricCounter::Count: break;
+	}
+	return "unknown";
+}
+
+const char* MetricGaugeName(MetricGauge gauge) {
+	switch (gauge) {
+	case MetricGauge::Locked: return "locked";
+	case MetricGauge::Devices: return "devices";
+	case MetricGauge::LastLatencyUs: return "last_latency_us";
+	case MetricGauge::Count: break;
+	}
+	return "unknown";
+}
+
+const char* MetricStageName(size_t stage) {
+	static const char* const kNames[kMetricsStages] = { "match", "dispatch", "device", "toggle", "end-to-end" };
+	return stage < kMetricsStages ? kNames[stage] : "unknown";
+}
+
+SharedMetrics::~SharedMetrics() {
+	Close();
+}
+
+static void InitLayout(MetricsLayout* layout, uint64_t pid) {
+	new (layout) MetricsLayout();
+	layout->version = kMetricsVersion;
+	layout->size = sizeof(MetricsLayout);
+	layout->pid = pid;
+	layout->startUnixSec = (uint64_t)std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	layout->magic.store(kMetricsMagic, std::memory_order_release);
+}
+
+static bool IsKnownLayout(const MetricsLayout* layout) {
+	return layout->magic.load(std::memory_order_acquire) == kMetricsMagic && layout->version == kMetricsVersion &&
+		layout->size == sizeof(MetricsLayout);
+}
+
+#ifdef _WIN32
+
+bool SharedMetrics::Create(const char* name, uint64_t*) {
+	// CheckIfAlreadyRunning keeps this to one daemon per session
+	Close();
+	m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(MetricsLayout), name);
+	if (m_mapping == NULL) {
+		m_mapping = nullptr;
+		return false;
+	}
+	m_layout = (MetricsLayout*)MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(MetricsLayout));
+	if (m_layout == NULL) {
+		m_layout = nullptr;
+		Close();
+		return false;
+	}
+	InitLayout(m_layout, GetCurrentProcessId());
+	m_writable = true;
+	return true;
+}
+
+bool SharedMetrics::OpenRead(const char* name) {
+	Close();
+	m_mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+	if (m_mapping == NULL) {
+		m_mapping = nullptr;
+		return false;
+	}
+	m_layout = (MetricsLayout*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, sizeof(MetricsLayout));
+	if (m_layout == NULL || !IsKnownLayout(m_layout)) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void SharedMetrics::Close() {
+	// the segment goes away with its last handle, so readers simply stop finding it
+	if (m_layout != nullptr) {
+		UnmapViewOfFile(m_layout);
+		m_layout = nullptr;
+	}
+	if (m_mapping != nullptr) {
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+	m_writable = false;
+}
+
+#else
+
+// The pid that created the segment, if that process is still running; 0 if the segment is
+// missing, not a metrics segment, or its daemon is gone.
+static uint64_t LiveOwner(const char* name) {
+	const int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		return 0;
+	}
+	struct stat st;
+	void* data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= offsetof(MetricsLayout, pid) + sizeof(uint64_t)) {
+		data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (data == MAP_FAILED) {
+		return 0;
+	}
+	// the header only ever grows at the end, so any version's pid is where this one's is
+	const MetricsLayout* layout = (const MetricsLayout*)data;
+	uint64_t pid = layout->magic.load(std::memory_order_acquire) == kMetricsMagic ? layout->pid : 0;
+	munmap(data, (size_t)st.st_size);
+	// signal 0 only checks; EPERM is a live process of another user
+	if (pid != 0 && kill((pid_t)pid, 0) != 0 && errno != EPERM) {
+		pid = 0;
+	}
+	return pid;
+}
+
+bool SharedMetrics::Create(const char* name, uint64_t* ownerPid) {
+	Close();
+	if (strlen(name) >= sizeof(m_name)) {
+		return false;
+	}
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0 && errno == EEXIST) {
+		// a running daemon keeps its segment; one left behind by a daemon that died is replaced
+		const uint64_t owner = LiveOwner(name);
+		if (owner != 0) {
+			if (ownerPid != nullptr) {
+				*ownerPid = owner;
+			}
+			return false;
+		}
+		shm_unlink(name);
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	}
+	if (fd < 0) {
+		return false;
+	}
+	void* data = MAP_FAILED;
+	if (ftruncate(fd, sizeof(MetricsLayout)) == 0) {
+		data = mmap(nullptr, sizeof(MetricsLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (data == MAP_FAILED) {
+		shm_unlink(name);
+		return false;
+	}
+	strcpy(m_name, name);
+	m_layout = (MetricsLayout*)data;
+	InitLayout(m_layout, (uint64_t)getpid());
+	m_writable = true;
+	return true;
+}
+
+bool SharedMetrics::OpenRead(const char* name) {
+	Close();
+	const int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		return false;
+	}
+	void* data = mmap(nullptr, sizeof(MetricsLayout), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	m_layout = (MetricsLayout*)data;
+	if (!IsKnownLayout(m_layout)) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void SharedMetrics::Close() {
+	if (m_layout == nullptr) {
+		return;
+	}
+	munmap(m_layout, sizeof(MetricsLayout));
+	m_layout = nullptr;
+	if (m_writable) {
+		// readers that already have it mapped keep their copy; new ones find nothing
+		shm_unlink(m_name);
+	}
+	m_writable = false;
+	m_name[0] = '\0';
+}
+
+#endif
+
+void SharedMetrics::PublishLatency(const MetricsStageSummary (&stages)[kMetricsStages]) {
+	if (!m_writable) {
+		return;
+	}
+	uint64_t words[kMetricsStages * kStageSummaryWords];
+	memcpy(words, stages, sizeof(words));
+	const uint64_t sequence = m_layout->latencySequence.load(std::memory_order_relaxed);
+	m_layout->latencySequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (size_t i = 0; i < std::size(words); i++) {
+		m_layout->latency[i].store(words[i], std::memory_order_relaxed);
+	}
+	m_layout->latencySequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool SharedMetrics::ReadLatency(MetricsStageSummary (&stages)[kMetricsStages], unsigned* retries) const {
+	uint64_t words[kMetricsStages * kStageSummaryWords];
+	std::chrono::steady_clock::time_point giveUp{};
+	for (unsigned attempt = 0;; attempt++) {
+		if (retries != nullptr) {
+			*retries = attempt;
+		}
+		if ((attempt & 63) == 63) {
+			// the writer may have been preempted mid-update; on a busy core, spinning only keeps it
+			// off. Or it died there, and the sequence stays odd for good.
+			const auto now = std::chrono::steady_clock::now();
+			if (attempt == 63) {
+				giveUp = now + kLatencyReadTimeout;
+			}
+			else if (now >= giveUp) {
+				return false;
+			}
+			std::this_thread::yield();
+		}
+		const uint64_t before = m_layout->latencySequence.load(std::memory_order_acquire);
+		if (before & 1) {
+			continue;
+		}
+		for (size_t i = 0; i < std::size(words); i++) {
+			words[i] = m_layout->latency[i].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (m_layout->latencySequence.load(std::memory_order_relaxed) == before) {
+			memcpy(stages, words, sizeof(words));
+			return true;
+		}
+	}
+}
@@ -0,0 +1,132 @@
+/////////////
+// shared_metrics.h : Runtime counters and gauges in a named shared-memory segment (POSIX shm on Linux,
+// a pagefile-backed mapping on Windows), so a monitoring agent can sample a running daemon by reading
+// memory, without a single call into it.
+//
+// Counters and gauges are single atomic words. The latency summary spans many words and is published
+// under a seqlock: the writer makes the sequence odd, writes, then makes it even again; a reader
+// retries until it sees the same even sequence before and after its copy.
+//
+// The layout is versioned. Only ever append fields, and bump kMetricsVersion when an existing one
+// changes meaning; readers refuse a segment whose magic, version or size they do not know.
+//////
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+constexpr uint64_t kMetricsMagic = 0x43495254454D4C53ull; // "SLMETRIC"
+constexpr uint32_t kMetricsVersion = 1;
+#ifdef _WIN32
+constexpr const char* kDefaultMetricsName = "Local\\sage_lock_metrics";
+#else
+constexpr const char* kDefaultMetricsName = "/sage_lock.metrics";
+#endif
+
+enum class MetricCounter : uint8_t {
+	KeyEvents,       // volume key events that reached the pipeline
+	Gestures,        // gestures matched, toggle or not
+	Locks,
+	Unlocks,
+	TogglesOk,
+	ToggleFailures,  // the backend reported failure, e.g. pnputil could not be started
+	ToggleTimeouts,  // still running, or never started, at the toggle deadline
+	DroppedCommands, // gestures lost to a full executor queue
+	Count,
+};
+
+enum class MetricGauge : uint8_t {
+	Locked,         // 1 while the touch devices are disabled
+	Devices,        // touch devices in the last cycle
+	LastLatencyUs,  // key press to feedback, last cycle
+	Count,
+};
+
+// Matches the LockStage order; kept separate so the reader does not need the pipeline.
+constexpr size_t kMetricsStages = 5;
+
+struct MetricsStageSummary {
+	uint64_t count = 0;
+	uint64_t p50Ns = 0;
+	uint64_t p99Ns = 0;
+	uint64_t p999Ns = 0;
+	uint64_t maxNs = 0;
+};
+
+constexpr size_t kStageSummaryWords = sizeof(MetricsStageSummary) / sizeof(uint64_t);
+// A publish takes well under a microsecond, so a summary still mid-update after this is stale.
+constexpr std::chrono::milliseconds kLatencyReadTimeout{ 100 };
+
+struct MetricsLayout {
+	std::atomic<uint64_t> magic;  // stored last, once everything else in the header is set
+	uint32_t version;
+	uint32_t size;                // sizeof(MetricsLayout)
+	uint64_t pid;
+	uint64_t startUnixSec;
+
+	alignas(64) std::atomic<uint64_t> counters[(size_t)MetricCounter::Count];
+	std::atomic<uint64_t> gauges[(size_t)MetricGauge::Count];
+
+	alignas(64) std::atomic<uint64_t> latencySequence; // odd while the writer is mid-update
+	std::atomic<uint64_t> latency[kMetricsStages * kStageSummaryWords];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared counters must be address-free");
+static_assert(sizeof(MetricsStageSummary) == 40, "summaries are copied word by word");
+
+const char* MetricCounterName(MetricCounter counter);
+const char* MetricGaugeName(MetricGauge gauge);
+const char* MetricStageName(size_t stage);
+
+class SharedMetrics {
+public:
+	SharedMetrics() = default;
+	~SharedMetrics();
+
+	SharedMetrics(const SharedMetrics&) = delete;
+	SharedMetrics& operator=(const SharedMetrics&) = delete;
+
+	// Daemon side: creates a zeroed segment, or takes over one whose daemon is gone, and removes it
+	// again on Close. Fails if a running process owns it; ownerPid then receives that pid.
+	bool Create(const char* name, uint64_t* ownerPid = nullptr);
+	// Reader side: maps an existing segment read-only. Fails if it has an unknown magic, version or size.
+	bool OpenRead(const char* name);
+	void Close();
+	bool IsOpen() const { return m_layout != nullptr; }
+
+	// Writers; single writer per counter or gauge, any thread.
+	void Add(MetricCounter counter, uint64_t n = 1) {
+		if (m_writable) {
+			m_layout->counters[(size_t)counter].fetch_add(n, std::memory_order_relaxed);
+		}
+	}
+	void Set(MetricGauge gauge, uint64_t value) {
+		if (m_writable) {
+			m_layout->gauges[(size_t)gauge].store(value, std::memory_order_relaxed);
+		}
+	}
+	// One thread only.
+	void PublishLatency(const MetricsStageSummary (&stages)[kMetricsStages]);
+
+	// Readers.
+	uint64_t Get(MetricCounter counter) const { return m_layout->counters[(size_t)counter].load(std::memory_order_relaxed); }
+	uint64_t Get(MetricGauge gauge) const { return m_layout->gauges[(size_t)gauge].load(std::memory_order_relaxed); }
+	// Copies a consistent latency summary; retries receives how many retries concurrent writes cost.
+	// Returns false, leaving stages alone, if no consistent copy turns up within kLatencyReadTimeout,
+	// e.g. because the daemon died mid-publish and left the segment stale.
+	bool ReadLatency(MetricsStageSummary (&stages)[kMetricsStages], unsigned* retries = nullptr) const;
+	uint64_t Pid() const { return m_layout->pid; }
+	uint64_t StartUnixSec() const { return m_layout->startUnixSec; }
+
+private:
+	MetricsLayout* m_layout = nullptr;
+	bool m_writable = false;
+#ifdef _WIN32
+	void* m_mapping = nullptr;
+#else
+	char m_name[256] = {};
+#endif
+};
@@ -0,0 +1,86 @@
+/////////////
+// sim_devices.cpp : Simulated device registry and toggler.
+//////
+
+#include "sim_devices.h"
+#include <cstdio>
+
+namespace {
+
+// splitmix64: a stateless hash of (seed, call number), so concurrent toggles need no shared RNG
+uint64_t Mix(uint64_t x) {
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+}
+
+void SimDeviceRegistry::Add(SimDeviceConfig config) {
+	auto device = std::make_unique<Device>();
+	device->config = std::move(config);
+	m_devices.push_back(std::move(device));
+}
+
+void SimDeviceRegistry::AddMany(size_t count, uint64_t latencyNs, uint64_t jitterNs, double failureRate) {
+	for (size_t i = 0; i < count; i++) {
+		char id[32];
+		snprintf(id, sizeof(id), "SIM\\TOUCH\\%04zu", m_devices.size());
+		SimDeviceConfig config;
+		config.id = id;
+		config.latencyNs = latencyNs;
+		config.jitterNs = jitterNs;
+		config.failureRate = failureRate;
+		Add(std::move(config));
+	}
+}
+
+std::vector<std::string> SimDeviceRegistry::Ids() const {
+	std::vector<std::string> ids;
+	ids.reserve(m_devices.size());
+	for (const auto& device : m_devices) {
+		ids.push_back(device->config.id);
+	}
+	return ids;
+}
+
+int SimDeviceRegistry::Find(std::string_view id) const {
+	for (size_t i = 0; i < m_devices.size(); i++) {
+		if (m_devices[i]->config.id == id) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+SimDeviceToggler::SimDeviceToggler(SimDeviceRegistry& registry, Clock& clock, uint64_t seed)
+	: m_registry(registry), m_clock(clock), m_seed(seed) {
+}
+
+bool SimDeviceToggler::Toggle(std::string_view deviceId, bool enable) {
+	const int index = m_registry.Find(deviceId);
+	if (index < 0) {
+		return false;
+	}
+	SimDeviceRegistry::Device& device = *m_registry.m_devices[index];
+	const uint64_t call = m_toggles.fetch_add(1, std::memory_order_relaxed);
+	const uint64_t roll = Mix(m_seed ^ Mix(call));
+
+	uint64_t latencyNs = device.config.latencyNs;
+	if (device.config.jitterNs != 0) {
+		latencyNs += roll % device.config.jitterNs;
+	}
+	if (latencyNs != 0) {
+		m_clock.SleepNs(latencyNs);
+	}
+
+	// top 53 bits as a uniform double in [0, 1)
+	const double chance = (double)(Mix(roll) >> 11) * (1.0 / 9007199254740992.0);
+	if (chance < device.config.failureRate) {
+		m_failures.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	device.enabled.store(enable, std::memory_order_release);
+	return true;
+}
@@ -0,0 +1,69 @@
+/////////////
+// sim_devices.h : Simulated touch devices and a toggler for them, so the whole detect -> toggle ->
+// feedback pipeline runs headless. Each device has its own latency, jitter and failure rate.
+//////
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "clock.h"
+#include "device_toggler.h"
+
+struct SimDeviceConfig {
+	std::string id;
+	uint64_t latencyNs = 0; // every toggle takes at least this long
+	uint64_t jitterNs = 0;  // plus a uniform extra in [0, jitterNs)
+	double failureRate = 0; // chance in [0, 1] that a toggle fails
+};
+
+// Stands in for SetupDi/sysfs enumeration. Fill it before handing it to a pipeline.
+class SimDeviceRegistry {
+public:
+	void Add(SimDeviceConfig config);
+	// Adds count devices with ids SIM\TOUCH\0000, SIM\TOUCH\0001, ...
+	void AddMany(size_t count, uint64_t latencyNs, uint64_t jitterNs, double failureRate);
+
+	std::vector<std::string> Ids() const;
+	size_t Count() const { return m_devices.size(); }
+
+	// Index of the device, or -1.
+	int Find(std::string_view id) const;
+	const SimDeviceConfig& Config(size_t device) const { return m_devices[device]->config; }
+	bool Enabled(size_t device) const { return m_devices[device]->enabled.load(std::memory_order_acquire); }
+
+private:
+	friend class SimDeviceToggler;
+
+	struct Device {
+		SimDeviceConfig config;
+		std::atomic<bool> enabled{ true };
+	};
+	std::vector<std::unique_ptr<Device>> m_devices;
+};
+
+// Sleeps out each device's simulated latency on the given clock, then fails or flips the device.
+// On a VirtualClock the latency advances simulated time instead of blocking, so pipeline latencies
+// measured against that clock are the simulated ones. Deterministic for a given seed and call order.
+class SimDeviceToggler : public DeviceToggler {
+public:
+	// registry and clock must outlive the toggler.
+	SimDeviceToggler(SimDeviceRegistry& registry, Clock& clock, uint64_t seed = 1);
+
+	const char* Name() const override { return "sim"; }
+	bool Toggle(std::string_view deviceId, bool enable) override;
+
+	uint64_t Toggles() const { return m_toggles.load(std::memory_order_relaxed); }
+	uint64_t Failures() const { return m_failures.load(std::memory_order_relaxed); }
+
+private:
+	SimDeviceRegistry& m_registry;
+	Clock& m_clock;
+	const uint64_t m_seed;
+	std::atomic<uint64_t> m_toggles{ 0 };
+	std::atomic<uint64_t> m_failures{ 0 };
+};
@@ -0,0 +1,59 @@
+/////////////
+// spsc_queue.h : Bounded lock-free single-producer / single-consumer queue.
+// Used to hand work from the input thread to worker threads without ever blocking the producer.
+//////
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+constexpr size_t kCacheLineSize = 64;
+
+template <typename T, size_t Capacity>
+class SpscQueue {
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+	// Producer side. Returns false instead of waiting when the queue is full.
+	bool TryPush(const T& item) {
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_headCache == Capacity) {
+			m_headCache = m_head.load(std::memory_order_acquire);
+			if (tail - m_headCache == Capacity) {
+				return false;
+			}
+		}
+		m_items[tail & (Capacity - 1)] = item;
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side. Returns false when there is nothing to pop.
+	bool TryPop(T& item) {
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tailCache) {
+			m_tailCache = m_tail.load(std::memory_order_acquire);
+			if (head == m_tailCache) {
+				return false;
+			}
+		}
+		item = m_items[head & (Capacity - 1)];
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Empty() const {
+		return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+	}
+
+private:
+	// consumer-owned line
+	alignas(kCacheLineSize) std::atomic<size_t> m_head{ 0 };
+	size_t m_tailCache = 0;
+	// producer-owned line
+	alignas(kCacheLineSize) std::atomic<size_t> m_tail{ 0 };
+	size_t m_headCache = 0;
+	alignas(kCacheLineSize) std::array<T, Capacity> m_items{};
+};
@@ -0,0 +1,266 @@
+/////////////
+// alloc_free_test.cpp : The steady-state lock path never touches the heap. This file replaces every
+// global operator new and delete for the whole test binary; new only counts while a test asks it to.
+//////
+
+#include "test.h"
+#include "clock.h"
+#include "deferred_log.h"
+#include "gesture_dsl.h"
+#include "lock_pipeline.h"
+#include "shared_metrics.h"
+#include "sim_devices.h"
+#include "trace_spans.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+std::atomic<bool> g_CountAllocations{ false };
+std::atomic<uint64_t> g_Allocations{ 0 };
+
+// Every operator new below comes through here; aligned_alloc wants the size in whole alignments.
+void* CountedAlloc(size_t size, size_t alignment) noexcept {
+	if (g_CountAllocations.load(std::memory_order_relaxed)) {
+		g_Allocations.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (size == 0) {
+		size = 1;
+	}
+	if (alignment <= alignof(std::max_align_t)) {
+		return malloc(size);
+	}
+	return aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+}
+
+void* CountedNew(size_t size, size_t alignment) {
+	if (void* p = CountedAlloc(size, alignment)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+}
+
+// GCC pairs the inlined free below with operator new rather than malloc and warns
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+	return CountedNew(size, 0);
+}
+void* operator new[](size_t size) {
+	return CountedNew(size, 0);
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+	return CountedNew(size, (size_t)alignment);
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+	return CountedNew(size, (size_t)alignment);
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	return CountedAlloc(size, 0);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+	return CountedAlloc(size, 0);
+}
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	return CountedAlloc(size, (size_t)alignment);
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	return CountedAlloc(size, (size_t)alignment);
+}
+
+// malloc and aligned_alloc memory both go back through free, whatever the overload
+void operator delete(void* p) noexcept {
+	free(p);
+}
+void operator delete[](void* p) noexcept {
+	free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+	free(p);
+}
+void operator delete(void* p, std::align_val_t) noexcept {
+	free(p);
+}
+void operator delete[](void* p, std::align_val_t) noexcept {
+	free(p);
+}
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+	free(p);
+}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+	free(p);
+}
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+	free(p);
+}
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+	free(p);
+}
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+	free(p);
+}
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+	free(p);
+}
+
+namespace {
+
+// Takes what the log thread writes and throws it away, counting lines.
+class CountingLogSink : public LogSink {
+public:
+	explicit CountingLogSink(std::atomic<uint64_t>& lines) : m_lines(lines) {}
+
+	void Write(const std::string&) override { m_lines.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t>& m_lines;
+};
+
+// What the daemons' cycle observer logs, a line per device and one for the cycle.
+void LogLockCycle(const LockCycle& cycle, const DeviceToggler& toggler) {
+	const auto& results = *cycle.results;
+	for (size_t i = 0; i < results.size(); i++) {
+		SAGE_LOG("Toggle %s via %s: %s in %llu us\n", (*cycle.devices)[i], toggler.Name(), ToggleStatusName(results[i].status), results[i].elapsedUs);
+	}
+	SAGE_LOG("%s took %llu us from last key press\n", cycle.action == LockAction::Lock ? "Lock" : "Unlock", (cycle.completeNs - cycle.triggerNs) / 1000);
+}
+
+// Passes pointers out where the compiler cannot see, so it keeps every new and delete below.
+void* volatile g_Escape = nullptr;
+
+}
+
+// A million key events from three keyboards, presses, releases and repeats, through the whole
+// pipeline with every lock/unlock toggling four simulated devices, and with everything the daemon
+// runs alongside switched on: the deferred log, the shared metrics segment and, in the spans build,
+// trace spans. The first tenth of the events warms up whatever grows on first use (per-thread log
+// and span rings, the log thread's buffers); after that nothing on the input thread, the executor,
+// the fanout workers or the log thread may allocate.
+SAGE_TEST(PipelineSteadyStateAllocatesNothing) {
+	static constexpr GestureSet kGestures = CompileGestures({ kToggleGestureDsl });
+	constexpr size_t kEvents = 1000000;
+	constexpr size_t kWarmUpEvents = kEvents / 10;
+	std::vector<KeyEvent> events(kEvents);
+	uint64_t state = 0x9E3779B97F4A7C15ull;
+	auto next = [&](uint32_t below) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return (uint32_t)(state % below);
+	};
+	uint64_t timeNs = 0;
+	for (auto& event : events) {
+		timeNs += 1000 + next(300 * 1000) * 1000ull;
+		event.timeNs = timeNs;
+		event.key = (GestureKey)next(kGestureKeyCount);
+		event.device = 1 + next(3);
+		event.down = next(4) != 0;
+	}
+
+	std::atomic<uint64_t> logLines{ 0 };
+	REQUIRE(StartDeferredLog(std::make_unique<CountingLogSink>(logLines)));
+	SharedMetrics metrics;
+	const std::string metricsName = "/sage_lock_test." + std::to_string((long long)getpid()) + ".alloc";
+	REQUIRE(metrics.Create(metricsName.c_str()));
+	const uint64_t spansBefore = TraceSpanCount();
+
+	VirtualClock clock(0);
+	SimDeviceRegistry registry;
+	registry.AddMany(4, 0, 0, 0);
+	SimDeviceToggler toggler(registry, clock);
+	LockPipeline pipeline(kGestures, toggler, clock);
+	pipeline.SetDevices(registry.Ids());
+	pipeline.SetMetrics(&metrics);
+	std::atomic<size_t> cycles{ 0 };
+	pipeline.SetCycleObserver([&](const LockCycle& cycle) {
+		SAGE_SPAN("cycle log");
+		LogLockCycle(cycle, toggler);
+		cycles.fetch_add(1, std::memory_order_release);
+	});
+	pipeline.Start();
+
+	size_t gestures = 0;
+	g_Allocations = 0;
+	for (size_t i = 0; i < kEvents; i++) {
+		if (i == kWarmUpEvents) {
+			FlushDeferredLog();
+			g_CountAllocations = true;
+		}
+		const KeyEvent& event = events[i];
+		clock.SetNs(event.timeNs);
+		SAGE_SPAN("key event");
+		if (pipeline.OnKeyEvent(event) == 0) {
+			// one command in flight at a time, so none is dropped and every cycle is counted
+			gestures++;
+			while (cycles.load(std::memory_order_acquire) != gestures) {
+				std::this_thread::yield();
+			}
+		}
+	}
+	// the log thread's last drains happen inside the count too
+	FlushDeferredLog();
+	g_CountAllocations = false;
+	const uint64_t allocations = g_Allocations.load();
+	pipeline.Stop();
+	StopDeferredLog();
+
+	CHECK(gestures > 100); // enough lock cycles for the check to mean something
+	CHECK(toggler.Toggles() == gestures * 4);
+	CHECK(pipeline.DroppedCommands() == 0);
+	CHECK(allocations == 0);
+	// and the extras really ran
+	CHECK(logLines.load() > gestures);
+	CHECK(metrics.Get(MetricCounter::Locks) + metrics.Get(MetricCounter::Unlocks) == gestures);
+	CHECK(metrics.Get(MetricCounter::TogglesOk) == gestures * 4);
+	if (SAGE_TRACE_SPANS) {
+		CHECK(TraceSpanCount() > spansBefore);
+	}
+	metrics.Close();
+}
+
+// the counter sees every form of new, or the test above proves nothing
+SAGE_TEST(AllocationCounterSeesHeapUse) {
+	struct alignas(64) CacheLine {
+		char bytes[64];
+	};
+	g_Allocations = 0;
+	g_CountAllocations = true;
+	auto* vector = new std::vector<int>(100);
+	g_Escape = vector;
+	auto* ints = new int[4];
+	g_Escape = ints;
+	auto* line = new CacheLine;
+	g_Escape = line;
+	auto* lines = new CacheLine[2];
+	g_Escape = lines;
+	auto* nothrowInt = new (std::nothrow) int;
+	g_Escape = nothrowInt;
+	auto* nothrowLine = new (std::nothrow) CacheLine;
+	g_Escape = nothrowLine;
+	g_CountAllocations = false;
+	CHECK(g_Allocations.load() == 7);
+	CHECK((uintptr_t)line % 64 == 0);
+	CHECK((uintptr_t)lines % 64 == 0);
+	CHECK((uintptr_t)nothrowLine % 64 == 0);
+	delete vector;
+	delete[] ints;
+	delete line;
+	delete[] lines;
+	delete nothrowInt;
+	delete nothrowLine;
+}
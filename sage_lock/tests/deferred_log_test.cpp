@@ -0,0 +1,196 @@
+/////////////
+// deferred_log_test.cpp : Record encoding and formatting, a full ring, and cross-thread ordering.
+//////
+
+#include "test.h"
+#include "deferred_log.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Encodes the arguments the way SAGE_LOG does and formats them straight back.
+template <typename... Args>
+std::string Format(const char* format, const Args&... args) {
+	LogRecord record;
+	record.timeNs = 0;
+	record.format = 1;
+	record.argCount = 0;
+	record.size = 0;
+	deferred_log_detail::RecordWriter writer(record);
+	(writer.Put(args), ...);
+	std::string out;
+	FormatLogRecord(record, format, out);
+	return out;
+}
+
+// Lines the log thread wrote, kept by the test; the sink itself goes away on StopDeferredLog. When
+// gated, Write blocks until the gate opens, which holds the log thread mid-drain.
+struct CapturedLog {
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::vector<std::string> lines;
+	bool gated = false;
+	bool blocked = false;
+
+	void WaitForBlocked() {
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [&] { return blocked; });
+	}
+	void Open() {
+		std::lock_guard<std::mutex> lock(mutex);
+		gated = false;
+		changed.notify_all();
+	}
+};
+
+class CaptureSink : public LogSink {
+public:
+	explicit CaptureSink(std::shared_ptr<CapturedLog> log) : m_log(std::move(log)) {}
+
+	void Write(const std::string& line) override {
+		std::unique_lock<std::mutex> lock(m_log->mutex);
+		m_log->lines.push_back(line);
+		m_log->blocked = m_log->gated;
+		m_log->changed.notify_all();
+		m_log->changed.wait(lock, [&] { return !m_log->gated; });
+		m_log->blocked = false;
+	}
+
+private:
+	std::shared_ptr<CapturedLog> m_log;
+};
+
+// The log thread stuck inside its sink, with every ring already drained.
+std::shared_ptr<CapturedLog> StartBlockedLog() {
+	auto log = std::make_shared<CapturedLog>();
+	log->gated = true;
+	if (!StartDeferredLog(std::make_unique<CaptureSink>(log))) {
+		return nullptr;
+	}
+	SAGE_LOG("gate\n");
+	log->WaitForBlocked();
+	return log;
+}
+
+// Seconds since the log started, from the "[    0.000123] " prefix.
+double LineTime(const std::string& line) {
+	return strtod(line.c_str() + 1, nullptr);
+}
+
+}
+
+SAGE_TEST(LogFormatsArguments) {
+	CHECK(Format("%s=%d %u %llu %5.2f %x %c\n", "key", -3, 7u, 12345678901234ull, 2.5, 255, 'z') ==
+		"key=-3 7 12345678901234  2.50 ff z\n");
+	CHECK(Format("100%% of %d%%", 5) == "100% of 5%");
+	CHECK(Format("%%s stays literal") == "%s stays literal");
+	CHECK(Format("missing %d and %s", 1) == "missing 1 and <?>");
+	CHECK(Format("null %s", (const char*)nullptr) == "null (null)");
+	CHECK(Format("%-6s|%4d|", "ab", 42) == "ab    |  42|");
+}
+
+SAGE_TEST(LogUnknownFormatIsReported) {
+	LogRecord record{};
+	record.format = 77;
+	std::string out;
+	FormatLogRecord(record, nullptr, out);
+	CHECK(out == "(unknown log format 77)");
+}
+
+SAGE_TEST(LogTruncatesStringsToTheRecord) {
+	const std::string longText(400, 'a');
+	const std::string out = Format("%s", longText);
+	// one string fills the payload less its type and length bytes
+	CHECK(out == std::string(sizeof(LogRecord::payload) - 2, 'a'));
+
+	// arguments past a full record are lost, not misread
+	CHECK(Format("%s %d", longText, 5) == std::string(sizeof(LogRecord::payload) - 2, 'a') + " <?>");
+	// a number that does not fit is dropped whole
+	const std::string nearlyFull(sizeof(LogRecord::payload) - 2 - 4, 'b');
+	CHECK(Format("%s|%llu", nearlyFull, 1ull) == nearlyFull + "|<?>");
+}
+
+SAGE_TEST(LogEncodesWideStrings) {
+	CHECK(Format("%ls", L"plain") == "plain");
+	CHECK(Format("%ls", L"café €") == "caf\xc3\xa9 \xe2\x82\xac");
+	CHECK(Format("%ls", L"\U0001F600!") == "\xf0\x9f\x98\x80!");
+	CHECK(Format("%S and %s", std::wstring(L"wide"), std::string("narrow")) == "wide and narrow");
+	CHECK(Format("%ls", (const wchar_t*)nullptr) == "(null)");
+
+	// a wide string is cut at the record too, two bytes a unit
+	const std::wstring longText(400, L'w');
+	CHECK(Format("%ls", longText) == std::string((sizeof(LogRecord::payload) - 2) / 2, 'w'));
+	// never between the halves of a surrogate pair
+	std::wstring tail((sizeof(LogRecord::payload) - 2) / 2 - 1, L'w');
+	CHECK(Format("%ls", tail + L"\U0001F600") == std::string(tail.size(), 'w'));
+}
+
+SAGE_TEST(LogCountsRecordsLostToAFullRing) {
+	const LogStats before = DeferredLogStats();
+	auto log = StartBlockedLog();
+	REQUIRE(log != nullptr);
+	// the ring holds 256 records; the log thread cannot empty it while its sink is blocked
+	constexpr int kPushed = 300;
+	for (int i = 0; i < kPushed; i++) {
+		SAGE_LOG("burst %d\n", i);
+	}
+	log->Open();
+	FlushDeferredLog();
+	StopDeferredLog();
+
+	const LogStats after = DeferredLogStats();
+	CHECK(after.dropped - before.dropped == kPushed - 256);
+	CHECK(after.records - before.records == 1 + 256);
+	std::lock_guard<std::mutex> lock(log->mutex);
+	REQUIRE(log->lines.size() == 1 + 256 + 1);
+	// the drain the sink was holding up reports the loss, then the next one writes what the ring kept
+	CHECK(log->lines[1].find("(44 log record(s) dropped on thread ") == 0);
+	CHECK(log->lines[2].find("burst 0\n") != std::string::npos);
+	CHECK(log->lines[257].find("burst 255\n") != std::string::npos);
+}
+
+SAGE_TEST(LogFlushMergesThreadsInTimeOrder) {
+	auto log = StartBlockedLog();
+	REQUIRE(log != nullptr);
+	constexpr int kThreads = 4;
+	constexpr int kPerThread = 50;
+	std::atomic<int> ready{ 0 };
+	std::vector<std::thread> threads;
+	for (int t = 0; t < kThreads; t++) {
+		threads.emplace_back([t, &ready] {
+			ready++;
+			while (ready.load() < kThreads) {
+			}
+			for (int i = 0; i < kPerThread; i++) {
+				SAGE_LOG("thread %d record %d\n", t, i);
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	log->Open();
+	FlushDeferredLog();
+	StopDeferredLog();
+
+	std::lock_guard<std::mutex> lock(log->mutex);
+	REQUIRE(log->lines.size() == 1 + kThreads * kPerThread);
+	int next[kThreads] = {};
+	for (size_t i = 1; i < log->lines.size(); i++) {
+		const std::string& line = log->lines[i];
+		CHECK(LineTime(line) >= LineTime(log->lines[i - 1]));
+		int t = -1, record = -1;
+		REQUIRE(sscanf(line.c_str(), "[%*f] thread %d record %d", &t, &record) == 2);
+		REQUIRE(t >= 0 && t < kThreads);
+		CHECK(record == next[t]);
+		next[t] = record + 1;
+	}
+}
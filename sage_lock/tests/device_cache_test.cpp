@@ -0,0 +1,157 @@
+/////////////
+// device_cache_test.cpp : DeviceCache file round trip, damage, expiry and capacity.
+//////
+
+#include "test.h"
+#include "device_cache.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr uint64_t kNow = 1700000000;
+
+std::vector<CachedDevice> Devices(const char* prefix, size_t count) {
+	std::vector<CachedDevice> devices;
+	for (size_t i = 0; i < count; i++) {
+		CachedDevice device;
+		device.id = std::string(prefix) + std::to_string(i);
+		device.identity = "identity of " + device.id;
+		device.classes = (uint8_t)(i + 1);
+		devices.push_back(device);
+	}
+	return devices;
+}
+
+bool Has(const std::vector<CachedDevice>& devices, const std::string& id) {
+	return std::any_of(devices.begin(), devices.end(), [&](const CachedDevice& d) { return d.id == id; });
+}
+
+// Writes two devices and closes the file.
+void WriteTwo(const std::string& path) {
+	DeviceCache cache;
+	if (cache.Open(path.c_str())) {
+		cache.Store(Devices("dev", 2), kNow);
+	}
+}
+
+// Overwrites one byte of the file, past the header.
+void FlipByte(const std::string& path, std::streamoff offset) {
+	std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+	file.seekg(offset);
+	const char c = (char)file.get();
+	file.seekp(offset);
+	file.put((char)(c ^ 0x5A));
+}
+
+}
+
+SAGE_TEST(CacheRoundTrips) {
+	const std::string path = sage_test::TempPath("roundtrip.devices");
+	WriteTwo(path);
+	DeviceCache cache;
+	REQUIRE(cache.Open(path.c_str()));
+	const auto loaded = cache.Load(kNow);
+	REQUIRE(loaded.size() == 2);
+	CHECK(loaded[0].id == "dev0");
+	CHECK(loaded[0].identity == "identity of dev0");
+	CHECK(loaded[0].classes == 1);
+	CHECK(loaded[0].lastSeen == kNow);
+	CHECK(loaded[1].id == "dev1");
+	cache.Close();
+	std::filesystem::remove(path);
+}
+
+SAGE_TEST(CacheDropsCorruptEntries) {
+	const std::string path = sage_test::TempPath("corrupt.devices");
+	WriteTwo(path);
+	FlipByte(path, 16 + 3); // inside the first entry's identity
+	DeviceCache cache;
+	REQUIRE(cache.Open(path.c_str()));
+	CHECK(cache.Load(kNow).empty());
+	// the reset file takes a new enumeration
+	cache.Store(Devices("new", 1), kNow);
+	const auto loaded = cache.Load(kNow);
+	REQUIRE(loaded.size() == 1);
+	CHECK(loaded[0].id == "new0");
+	cache.Close();
+	std::filesystem::remove(path);
+}
+
+SAGE_TEST(CacheDropsTruncatedFile) {
+	const std::string path = sage_test::TempPath("truncated.devices");
+	WriteTwo(path);
+	const auto size = std::filesystem::file_size(path);
+	// keeps the header and the first entry; Open grows the file back with zeros
+	std::filesystem::resize_file(path, 16 + (size - 16) / kDeviceCacheCapacity + 8);
+	DeviceCache cache;
+	REQUIRE(cache.Open(path.c_str()));
+	CHECK(cache.Load(kNow).empty());
+	cache.Close();
+	CHECK(std::filesystem::file_size(path) == size);
+
+	std::filesystem::resize_file(path, 3); // not even a header
+	REQUIRE(cache.Open(path.c_str()));
+	CHECK(cache.Load(kNow).empty());
+	cache.Close();
+	std::filesystem::remove(path);
+}
+
+SAGE_TEST(CacheExpiresUnseenEntries) {
+	const std::string path = sage_test::TempPath("expiry.devices");
+	DeviceCache cache;
+	REQUIRE(cache.Open(path.c_str()));
+	cache.Store(Devices("old", 1), kNow);
+	const uint64_t later = kNow + kDeviceCacheExpirySec;
+	cache.Store(Devices("new", 1), later);
+
+	// absent devices keep their last-seen time, and last until the expiry has fully passed
+	auto loaded = cache.Load(later);
+	REQUIRE(loaded.size() == 2);
+	CHECK(loaded[0].id == "new0");
+	CHECK(loaded[1].id == "old0");
+	CHECK(loaded[1].lastSeen == kNow);
+
+	loaded = cache.Load(later + 1);
+	REQUIRE(loaded.size() == 1);
+	CHECK(loaded[0].id == "new0");
+
+	// and the next store leaves the expired entry out of the file
+	cache.Store({}, later + 1);
+	CHECK(cache.Load(kNow).size() == 1);
+	cache.Close();
+	std::filesystem::remove(path);
+}
+
+SAGE_TEST(CacheKeepsMostRecentPastCapacity) {
+	const std::string path = sage_test::TempPath("capacity.devices");
+	DeviceCache cache;
+	REQUIRE(cache.Open(path.c_str()));
+	cache.Store(Devices("old", kDeviceCacheCapacity), kNow);
+	cache.Store(Devices("new", 20), kNow + 60);
+
+	auto loaded = cache.Load(kNow + 60);
+	REQUIRE(loaded.size() == kDeviceCacheCapacity);
+	for (size_t i = 0; i < 20; i++) {
+		CHECK(loaded[i].id == "new" + std::to_string(i));
+	}
+	// of the older entries, the ones listed first survive
+	for (size_t i = 0; i < kDeviceCacheCapacity - 20; i++) {
+		CHECK(loaded[20 + i].id == "old" + std::to_string(i));
+	}
+	CHECK(!Has(loaded, "old" + std::to_string(kDeviceCacheCapacity - 1)));
+
+	// a present device with an id too long for an entry is left out rather than cut short
+	CachedDevice huge;
+	huge.id = std::string(kDeviceCacheMaxString + 1, 'x');
+	huge.identity = "huge";
+	cache.Store({ huge }, kNow + 120);
+	loaded = cache.Load(kNow + 120);
+	CHECK(loaded.size() == kDeviceCacheCapacity);
+	CHECK(!Has(loaded, huge.id));
+	cache.Close();
+	std::filesystem::remove(path);
+}
@@ -0,0 +1,228 @@
+/////////////
+// evdev_input_test.cpp : EvdevInput fed through pipes standing in for /dev/input nodes.
+//////
+
+#include "test.h"
+#include "clock.h"
+#include "evdev_input.h"
+#include "uinput_keyboard.h"
+#include <atomic>
+#include <fcntl.h>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+input_event Event(uint16_t type, uint16_t code, int32_t value, uint64_t timeUs = 0) {
+	input_event ev = {};
+	ev.input_event_sec = (time_t)(timeUs / 1000000);
+	ev.input_event_usec = (suseconds_t)(timeUs % 1000000);
+	ev.type = type;
+	ev.code = code;
+	ev.value = value;
+	return ev;
+}
+
+bool WriteAll(int fd, const void* data, size_t size) {
+	return write(fd, data, size) == (ssize_t)size;
+}
+
+// Runs input until every device it watches has gone away, with a watchdog so a regression fails
+// the test instead of hanging it.
+void RunUntilAllRemoved(EvdevInput& input, std::vector<uint64_t>& removed) {
+	input.SetRemovedCallback([&](uint64_t device) {
+		removed.push_back(device);
+		if (input.DeviceCount() == 0) {
+			input.Stop();
+		}
+	});
+	std::atomic<bool> finished{ false };
+	std::thread watchdog([&] {
+		for (int i = 0; i < 500 && !finished.load(); i++) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		input.Stop();
+	});
+	input.Run();
+	finished = true;
+	watchdog.join();
+}
+
+}
+
+SAGE_TEST(EvdevWantsOnlyGestureKeysAndSyn) {
+	CHECK(EvdevWanted(EV_SYN, SYN_REPORT));
+	CHECK(EvdevWanted(EV_KEY, KEY_VOLUMEUP));
+	CHECK(EvdevWanted(EV_KEY, KEY_VOLUMEDOWN));
+	CHECK(EvdevWanted(EV_KEY, KEY_MUTE));
+	CHECK(!EvdevWanted(EV_KEY, KEY_A));
+	CHECK(!EvdevWanted(EV_MSC, MSC_SCAN));
+	CHECK(!EvdevWanted(EV_REL, KEY_VOLUMEUP)); // the code only counts as a key under EV_KEY
+}
+
+SAGE_TEST(EvdevTurnsRecordsIntoKeyEvents) {
+	std::vector<KeyEvent> seen;
+	EvdevInput input([&](const KeyEvent& event) { seen.push_back(event); });
+	REQUIRE(input.Init());
+	int fds[2];
+	REQUIRE(pipe2(fds, O_CLOEXEC) == 0);
+	REQUIRE(input.AddFd(fds[0], 42));
+
+	const input_event events[] = {
+		Event(EV_MSC, MSC_SCAN, 0x70, 1000000),
+		Event(EV_KEY, KEY_VOLUMEUP, 1, 1000250),
+		Event(EV_SYN, SYN_REPORT, 0, 1000250),
+		Event(EV_KEY, KEY_A, 1, 1500000),
+		Event(EV_KEY, KEY_VOLUMEUP, 2, 2000000), // autorepeat
+		Event(EV_KEY, KEY_VOLUMEUP, 0, 2100000),
+		Event(EV_KEY, KEY_MUTE, 1, 3000000),
+	};
+	REQUIRE(WriteAll(fds[1], events, sizeof(events)));
+	close(fds[1]);
+	std::vector<uint64_t> removed;
+	RunUntilAllRemoved(input, removed);
+
+	REQUIRE(seen.size() == 4);
+	CHECK(seen[0].timeNs == 1000250000ull && seen[0].device == 42 && seen[0].key == GestureKey::VolumeUp && seen[0].down);
+	CHECK(seen[1].key == GestureKey::VolumeUp && seen[1].down); // repeats pass as presses
+	CHECK(seen[2].timeNs == 2100000000ull && !seen[2].down);
+	CHECK(seen[3].key == GestureKey::VolumeMute && seen[3].down);
+	CHECK(input.Stats().events == 7);
+	CHECK(input.Stats().keyEvents == 4);
+	CHECK(removed == std::vector<uint64_t>{ 42 });
+}
+
+// A keyboard that refused EVIOCSCLOCKID sends CLOCK_REALTIME times, which mean nothing next to
+// MonotonicNowNs: its events are timed as they are read.
+SAGE_TEST(EvdevStampsAsReadWhenRecordTimesAreForeign) {
+	std::vector<KeyEvent> seen;
+	EvdevInput input([&](const KeyEvent& event) { seen.push_back(event); });
+	REQUIRE(input.Init());
+	int fds[2];
+	REQUIRE(pipe2(fds, O_CLOEXEC) == 0);
+	REQUIRE(input.AddFd(fds[0], 7, false));
+
+	const uint64_t beforeNs = MonotonicNowNs();
+	const input_event events[] = {
+		Event(EV_KEY, KEY_VOLUMEDOWN, 1, 1700000000000000ull), // wall clock, in 2023
+		Event(EV_KEY, KEY_VOLUMEDOWN, 0, 1700000000100000ull),
+	};
+	REQUIRE(WriteAll(fds[1], events, sizeof(events)));
+	close(fds[1]);
+	std::vector<uint64_t> removed;
+	RunUntilAllRemoved(input, removed);
+	const uint64_t afterNs = MonotonicNowNs();
+
+	REQUIRE(seen.size() == 2);
+	for (const auto& event : seen) {
+		CHECK(event.timeNs >= beforeNs && event.timeNs <= afterNs);
+		CHECK(event.device == 7);
+	}
+	CHECK(seen[0].down && !seen[1].down);
+}
+
+SAGE_TEST(EvdevDrainsInReadBatches) {
+	constexpr size_t kEvents = 100;
+	size_t seen = 0;
+	EvdevInput input([&](const KeyEvent&) { seen++; });
+	REQUIRE(input.Init());
+	input.SetReadBatch(8);
+	int fds[2];
+	REQUIRE(pipe2(fds, O_CLOEXEC) == 0);
+	REQUIRE(input.AddFd(fds[0], 1));
+	std::vector<input_event> events;
+	for (size_t i = 0; i < kEvents; i++) {
+		events.push_back(Event(EV_KEY, KEY_VOLUMEDOWN, i % 2, i));
+	}
+	REQUIRE(WriteAll(fds[1], events.data(), events.size() * sizeof(input_event)));
+	close(fds[1]);
+	std::vector<uint64_t> removed;
+	RunUntilAllRemoved(input, removed);
+	CHECK(seen == kEvents);
+	CHECK(input.Stats().reads >= kEvents / 8);
+}
+
+// a record cut short can only come from a broken writer; the device is dropped rather than misread
+SAGE_TEST(EvdevDropsDeviceOnTornRecord) {
+	size_t seen = 0;
+	EvdevInput input([&](const KeyEvent&) { seen++; });
+	REQUIRE(input.Init());
+	int good[2], torn[2];
+	REQUIRE(pipe2(good, O_CLOEXEC) == 0 && pipe2(torn, O_CLOEXEC) == 0);
+	REQUIRE(input.AddFd(good[0], 1));
+	REQUIRE(input.AddFd(torn[0], 2));
+	CHECK(input.DeviceCount() == 2);
+	const input_event press = Event(EV_KEY, KEY_VOLUMEUP, 1);
+	REQUIRE(WriteAll(torn[1], &press, sizeof(press) / 2));
+	REQUIRE(WriteAll(good[1], &press, sizeof(press)));
+	close(good[1]);
+	std::vector<uint64_t> removed;
+	RunUntilAllRemoved(input, removed);
+	close(torn[1]);
+	CHECK(seen == 1);
+	CHECK(removed.size() == 2);
+	CHECK(input.DeviceCount() == 0);
+}
+
+// Stop from another thread ends Run with devices still open and quiet
+SAGE_TEST(EvdevStopsFromAnotherThread) {
+	EvdevInput input([](const KeyEvent&) {});
+	REQUIRE(input.Init());
+	int fds[2];
+	REQUIRE(pipe2(fds, O_CLOEXEC) == 0);
+	REQUIRE(input.AddFd(fds[0], 1));
+	std::thread stopper([&] {
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		input.Stop();
+	});
+	input.Run();
+	stopper.join();
+	CHECK(input.DeviceCount() == 1);
+	close(fds[1]);
+}
+
+// A real event node: EVIOCSMASK must take every type the keyboard reports, EV_REP included, and
+// the kernel then drops the letters, their scan codes and their SYN_REPORTs.
+SAGE_TEST(EvdevMasksUinputKeyboard) {
+	auto keyboard = std::make_unique<UinputKeyboard>();
+	if (!keyboard->Create("sage_lock_tests keyboard")) {
+		SKIP_TEST("cannot create a uinput keyboard");
+	}
+	std::vector<KeyEvent> seen;
+	std::atomic<size_t> delivered{ 0 };
+	EvdevInput input([&](const KeyEvent& event) {
+		seen.push_back(event);
+		delivered++;
+	});
+	REQUIRE(input.Init());
+	REQUIRE(input.OpenKeyboard(keyboard->EventPath().c_str()));
+	CHECK(input.Stats().maskFailures == 0);
+	CHECK(input.Stats().clockFallbacks == 0); // Linux 3.4 and later
+	const bool masked = input.Stats().unmaskedDevices == 0; // a kernel before 4.4 has no EVIOCSMASK
+
+	// evdev discards unread events on unplug, so the keyboard goes only once the loop has read them
+	std::thread typist([&] {
+		const uint16_t keys[] = { KEY_Q, KEY_VOLUMEUP, KEY_W, KEY_VOLUMEDOWN, KEY_E };
+		for (auto key : keys) {
+			keyboard->SendKey(key, 1);
+			keyboard->SendKey(key, 0);
+		}
+		for (int i = 0; i < 500 && delivered.load() < 4; i++) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		keyboard.reset();
+	});
+	std::vector<uint64_t> removed;
+	RunUntilAllRemoved(input, removed);
+	typist.join();
+
+	REQUIRE(seen.size() == 4);
+	CHECK(seen[0].key == GestureKey::VolumeUp && seen[0].down);
+	CHECK(seen[3].key == GestureKey::VolumeDown && !seen[3].down);
+	CHECK(removed.size() == 1);
+	if (masked) {
+		CHECK(input.Stats().events == 8); // each volume key packet, down to the key and its SYN_REPORT
+	}
+}
@@ -0,0 +1,106 @@
+/////////////
+// gesture_dsl_test.cpp : Gesture text parsed at runtime and compiled at build time.
+//////
+
+#include "test.h"
+#include "gesture_dsl.h"
+#include <string>
+
+namespace {
+
+constexpr uint64_t kMs = 1000000;
+constexpr uint64_t kUnlimited = std::numeric_limits<uint64_t>::max();
+
+// compiled once here, so a change to the DSL that breaks the built-in gesture also breaks this file's build
+constexpr GestureSet kToggleSet = CompileGestures({ kToggleGestureDsl, "MUTE MUTE within 1s" });
+
+}
+
+SAGE_TEST(DslToggleGestureCompilesToTable) {
+	const GestureSet& set = kToggleSet;
+	REQUIRE(set.Count() == 2);
+	CHECK(set.Positions() == 6);
+	CHECK(set.Spec(0).length == 4);
+	CHECK(set.Spec(0).windowNs == 2000 * kMs && set.Spec(0).maxGapNs == 500 * kMs);
+	CHECK(set.Spec(1).windowNs == 1000 * kMs && set.Spec(1).maxGapNs == kUnlimited);
+	// one bit per position; the toggle gesture takes 0..3 and MUTE MUTE 4..5
+	CHECK(set.KeyMask(GestureKey::VolumeUp).w[0] == 0b000101);
+	CHECK(set.KeyMask(GestureKey::VolumeDown).w[0] == 0b001010);
+	CHECK(set.KeyMask(GestureKey::VolumeMute).w[0] == 0b110000);
+	CHECK(set.StartMask().w[0] == 0b010001);
+	CHECK(set.EndMask().w[0] == 0b101000);
+}
+
+SAGE_TEST(DslRuntimeParseMatchesCompiled) {
+	const GestureParseResult result = ParseGesture(kToggleGestureDsl);
+	REQUIRE(result.error == nullptr);
+	const GestureSpec& compiled = kToggleSet.Spec(0);
+	CHECK(result.spec.length == compiled.length);
+	CHECK(result.spec.keys == compiled.keys);
+	CHECK(result.spec.windowNs == compiled.windowNs);
+	CHECK(result.spec.maxGapNs == compiled.maxGapNs);
+}
+
+SAGE_TEST(DslParsesDurationUnits) {
+	auto window = [](const char* text) { return ParseGesture(text).spec.windowNs; };
+	CHECK(window("VOLUP within 250us") == 250000);
+	CHECK(window("VOLUP within 250ms") == 250 * kMs);
+	CHECK(window("VOLUP within 2s") == 2000 * kMs);
+	CHECK(window("VOLUP within 2 s") == 2000 * kMs);
+	CHECK(window("VOLUP") == kUnlimited);
+	const GestureParseResult spaced = ParseGesture("  VOLUP,MUTE\tVOLDOWN ,max gap 500 ms, within 1s ");
+	REQUIRE(spaced.error == nullptr);
+	CHECK(spaced.spec.length == 3);
+	CHECK(spaced.spec.keys[1] == GestureKey::VolumeMute);
+	CHECK(spaced.spec.maxGapNs == 500 * kMs);
+	CHECK(spaced.spec.windowNs == 1000 * kMs);
+}
+
+SAGE_TEST(DslRejectsMalformedText) {
+	auto error = [](const char* text) {
+		const char* message = ParseGesture(text).error;
+		return std::string(message != nullptr ? message : "");
+	};
+	CHECK(error("") == "gesture has no keys");
+	CHECK(error("within 1s") == "gesture has no keys");
+	CHECK(error("VOLUP LEFT") == "unknown token");
+	CHECK(error("volup") == "unknown token");
+	CHECK(error("VOLUP within") == "expected a duration after 'within'");
+	CHECK(error("VOLUP within 5 minutes") == "expected a duration after 'within'");
+	CHECK(error("VOLUP within ms") == "expected a duration after 'within'");
+	CHECK(error("VOLUP max 500ms") == "expected 'max gap <duration>'");
+	CHECK(error("VOLUP max gap") == "expected 'max gap <duration>'");
+
+	std::string longest;
+	for (size_t i = 0; i < kMaxGestureLength; i++) {
+		longest += "MUTE ";
+	}
+	CHECK(error(longest.c_str()).empty());
+	CHECK(error((longest + "MUTE").c_str()) == "gesture is too long");
+}
+
+SAGE_TEST(DslRejectsDurationsPastUint64) {
+	auto parse = [](const std::string& text) { return ParseGesture(text); };
+	// UINT64_MAX is 18446744073709551615 ns: 18446744073709551 us, 18446744073709 ms, 18446744073 s
+	CHECK(parse("VOLUP within 18446744073709551us").spec.windowNs == 18446744073709551000ull);
+	CHECK(parse("VOLUP within 18446744073709ms").spec.windowNs == 18446744073709000000ull);
+	CHECK(parse("VOLUP max gap 18446744073s").spec.maxGapNs == 18446744073000000000ull);
+	CHECK(std::string(parse("VOLUP within 18446744073709552us").error) == "duration out of range");
+	CHECK(std::string(parse("VOLUP within 18446744073710ms").error) == "duration out of range");
+	CHECK(std::string(parse("VOLUP max gap 18446744074s").error) == "duration out of range");
+	// too many digits for the value itself, before any unit
+	CHECK(std::string(parse("VOLUP within 18446744073709551616us").error) == "duration out of range");
+	CHECK(std::string(parse("VOLUP within 99999999999999999999999999s").error) == "duration out of range");
+	CHECK(std::string(parse("VOLUP within 99999999999999999999999999").error) == "expected a duration after 'within'");
+}
+
+SAGE_TEST(DslRejectsRepeatedClauses) {
+	auto error = [](const char* text) {
+		const char* message = ParseGesture(text).error;
+		return std::string(message != nullptr ? message : "");
+	};
+	CHECK(error("VOLUP within 1s within 2s") == "'within' given twice");
+	CHECK(error("VOLUP within 1s VOLDOWN within 1s") == "'within' given twice");
+	CHECK(error("VOLUP max gap 1s, max gap 2s") == "'max gap' given twice");
+	CHECK(error("VOLUP max gap 1s within 2s") == "");
+}
@@ -0,0 +1,90 @@
+/////////////
+// gesture_engine_test.cpp : Gesture timing at its boundaries, with presses stamped by a virtual clock
+// so every gap is exact to the nanosecond.
+//////
+
+#include "test.h"
+#include "clock.h"
+#include "gesture_dsl.h"
+#include "gesture_engine.h"
+#include <memory>
+
+namespace {
+
+constexpr uint64_t kMs = 1000000;
+constexpr uint64_t kKeyboard = 7;
+constexpr GestureSet kToggle = CompileGestures({ kToggleGestureDsl });
+constexpr GestureSet kShortWindow = CompileGestures({ "VOLUP VOLDOWN VOLUP VOLDOWN within 1000ms" });
+
+// Presses VOLUP VOLDOWN VOLUP VOLDOWN, each key released 10ms after it goes down, advancing the
+// clock by the given gaps between presses. Returns what the last press matched.
+int PressWithGaps(const GestureSet& gestures, const uint64_t (&gapsNs)[3]) {
+	VirtualClock clock(5000 * kMs);
+	auto engine = std::make_unique<GestureEngine>(gestures);
+	const GestureKey keys[] = { GestureKey::VolumeUp, GestureKey::VolumeDown, GestureKey::VolumeUp, GestureKey::VolumeDown };
+	int match = -1;
+	for (size_t i = 0; i < 4; i++) {
+		if (i > 0) {
+			clock.SetNs(clock.NowNs() + gapsNs[i - 1] - 10 * kMs);
+		}
+		match = engine->OnKeyEvent({ clock.NowNs(), kKeyboard, keys[i], true });
+		engine->OnKeyEvent({ clock.AdvanceNs(10 * kMs), kKeyboard, keys[i], false });
+	}
+	return match;
+}
+
+}
+
+// max gap is inclusive: 500ms still continues the gesture, 501ms breaks it
+SAGE_TEST(EngineMaxGapBoundary) {
+	CHECK(PressWithGaps(kToggle, { 100 * kMs, 499 * kMs, 100 * kMs }) == 0);
+	CHECK(PressWithGaps(kToggle, { 100 * kMs, 500 * kMs, 100 * kMs }) == 0);
+	CHECK(PressWithGaps(kToggle, { 100 * kMs, 501 * kMs, 100 * kMs }) == -1);
+	CHECK(PressWithGaps(kToggle, { 100 * kMs, 500 * kMs + 1, 100 * kMs }) == -1);
+}
+
+// the window is inclusive too: 1000ms first to last press matches, 1001ms does not
+SAGE_TEST(EngineWindowBoundary) {
+	CHECK(PressWithGaps(kShortWindow, { 400 * kMs, 400 * kMs, 199 * kMs }) == 0);
+	CHECK(PressWithGaps(kShortWindow, { 400 * kMs, 400 * kMs, 200 * kMs }) == 0);
+	CHECK(PressWithGaps(kShortWindow, { 400 * kMs, 400 * kMs, 201 * kMs }) == -1);
+	CHECK(PressWithGaps(kShortWindow, { 400 * kMs, 400 * kMs, 200 * kMs + 1 }) == -1);
+	// the toggle gesture's 2000ms window can never bind: three gaps of at most 500ms span 1500ms
+	CHECK(PressWithGaps(kToggle, { 500 * kMs, 500 * kMs, 500 * kMs }) == 0);
+}
+
+// a held key autorepeats without releases; the repeats must neither advance nor reset the gesture
+SAGE_TEST(EngineIgnoresAutorepeat) {
+	VirtualClock clock(1000 * kMs);
+	auto engine = std::make_unique<GestureEngine>(kToggle);
+	auto press = [&](GestureKey key, uint64_t afterNs) {
+		return engine->OnKeyEvent({ clock.AdvanceNs(afterNs), kKeyboard, key, true });
+	};
+	auto release = [&](GestureKey key) { engine->OnKeyEvent({ clock.AdvanceNs(kMs), kKeyboard, key, false }); };
+	CHECK(press(GestureKey::VolumeUp, 0) == -1);
+	for (int i = 0; i < 10; i++) {
+		CHECK(press(GestureKey::VolumeUp, 30 * kMs) == -1);
+	}
+	release(GestureKey::VolumeUp);
+	CHECK(press(GestureKey::VolumeDown, 100 * kMs) == -1);
+	release(GestureKey::VolumeDown);
+	CHECK(press(GestureKey::VolumeUp, 100 * kMs) == -1);
+	release(GestureKey::VolumeUp);
+	CHECK(press(GestureKey::VolumeDown, 100 * kMs) == 0);
+	CHECK(engine->Stats().repeatsDropped == 10);
+	CHECK(engine->Stats().presses == 4);
+}
+
+// presses from two keyboards never complete each other's gesture
+SAGE_TEST(EngineKeepsDevicesApart) {
+	VirtualClock clock(1000 * kMs);
+	auto engine = std::make_unique<GestureEngine>(kToggle);
+	const GestureKey keys[] = { GestureKey::VolumeUp, GestureKey::VolumeDown, GestureKey::VolumeUp, GestureKey::VolumeDown };
+	int match = -1;
+	for (size_t i = 0; i < 4; i++) {
+		const uint64_t device = i % 2 == 0 ? 1 : 2;
+		match = engine->OnKeyEvent({ clock.AdvanceNs(50 * kMs), device, keys[i], true });
+		engine->OnKeyEvent({ clock.AdvanceNs(kMs), device, keys[i], false });
+	}
+	CHECK(match == -1);
+}
@@ -0,0 +1,139 @@
+/////////////
+// gesture_matcher_test.cpp : Shift-And matcher behaviour at runtime, on hand-built gesture sets.
+//////
+
+#include "test.h"
+#include "gesture_matcher.h"
+
+namespace {
+
+constexpr uint64_t kMs = 1000000;
+
+GestureSpec MakeSpec(std::initializer_list<GestureKey> keys, uint64_t windowNs, uint64_t maxGapNs) {
+	GestureSpec spec;
+	for (auto key : keys) {
+		spec.keys[spec.length++] = key;
+	}
+	spec.windowNs = windowNs;
+	spec.maxGapNs = maxGapNs;
+	return spec;
+}
+
+constexpr GestureKey kUp = GestureKey::VolumeUp;
+constexpr GestureKey kDown = GestureKey::VolumeDown;
+constexpr GestureKey kMute = GestureKey::VolumeMute;
+
+}
+
+SAGE_TEST(MatcherMatchesSequence) {
+	GestureSet set;
+	REQUIRE(set.Add(MakeSpec({ kUp, kDown, kUp, kDown }, 2000 * kMs, 500 * kMs)) == 0);
+	GestureMatcher matcher(set);
+	CHECK(matcher.OnKey(kUp, 100 * kMs) == -1);
+	CHECK(matcher.OnKey(kDown, 200 * kMs) == -1);
+	CHECK(matcher.OnKey(kUp, 300 * kMs) == -1);
+	CHECK(matcher.OnKey(kDown, 400 * kMs) == 0);
+	// a match clears partial state: the next gesture needs four fresh presses
+	CHECK(matcher.OnKey(kUp, 500 * kMs) == -1);
+	CHECK(matcher.OnKey(kDown, 600 * kMs) == -1);
+}
+
+SAGE_TEST(MatcherFindsGestureAfterNoise) {
+	GestureSet set;
+	REQUIRE(set.Add(MakeSpec({ kUp, kDown, kUp, kDown }, 2000 * kMs, 500 * kMs)) == 0);
+	GestureMatcher matcher(set);
+	const GestureKey keys[] = { kUp, kUp, kMute, kUp, kDown, kUp, kUp, kDown, kUp, kDown };
+	int match = -1;
+	uint64_t timeNs = 0;
+	for (auto key : keys) {
+		timeNs += 100 * kMs;
+		match = matcher.OnKey(key, timeNs);
+		if (match >= 0) {
+			break;
+		}
+	}
+	CHECK(match == 0);
+	CHECK(timeNs == 1000 * kMs); // on the last press, not before
+}
+
+SAGE_TEST(MatcherGapBreaksPrefix) {
+	GestureSet set;
+	REQUIRE(set.Add(MakeSpec({ kUp, kDown, kUp, kDown }, 2000 * kMs, 500 * kMs)) == 0);
+	GestureMatcher matcher(set);
+	matcher.OnKey(kUp, 0);
+	matcher.OnKey(kDown, 100 * kMs);
+	matcher.OnKey(kUp, 200 * kMs);
+	// 600ms gap: the three-key prefix dies, and this press can only start a new one
+	CHECK(matcher.OnKey(kDown, 800 * kMs) == -1);
+	CHECK(matcher.OnKey(kUp, 900 * kMs) == -1);
+	CHECK(matcher.OnKey(kDown, 1000 * kMs) == -1);
+	CHECK(matcher.OnKey(kUp, 1100 * kMs) == -1);
+	CHECK(matcher.OnKey(kDown, 1200 * kMs) == 0);
+}
+
+SAGE_TEST(MatcherWindowRejectsSlowGesture) {
+	GestureSet set;
+	REQUIRE(set.Add(MakeSpec({ kUp, kUp, kUp }, 500 * kMs, 400 * kMs)) == 0);
+	GestureMatcher matcher(set);
+	matcher.OnKey(kUp, 0);
+	matcher.OnKey(kUp, 300 * kMs);
+	CHECK(matcher.OnKey(kUp, 600 * kMs) == -1); // every gap fits, the window does not
+	CHECK(matcher.OnKey(kUp, 700 * kMs) == 0);  // 300..700 does
+}
+
+SAGE_TEST(MatcherReportsEachGesture) {
+	GestureSet set;
+	REQUIRE(set.Add(MakeSpec({ kUp, kDown }, 1000 * kMs, 1000 * kMs)) == 0);
+	REQUIRE(set.Add(MakeSpec({ kMute, kMute }, 1000 * kMs, 1000 * kMs)) == 1);
+	GestureMatcher matcher(set);
+	matcher.OnKey(kMute, 0);
+	CHECK(matcher.OnKey(kMute, 10 * kMs) == 1);
+	matcher.OnKey(kUp, 20 * kMs);
+	CHECK(matcher.OnKey(kDown, 30 * kMs) == 0);
+}
+
+// a gesture whose positions straddle the two words of the bitmask
+SAGE_TEST(MatcherCarriesAcrossWords) {
+	GestureSet set;
+	GestureSpec filler;
+	filler.length = 16;
+	filler.keys.fill(kMute);
+	filler.windowNs = filler.maxGapNs = 1000 * kMs;
+	GestureSpec alternating = filler;
+	alternating.length = 14;
+	for (size_t i = 0; i < alternating.length; i++) {
+		alternating.keys[i] = i % 2 == 0 ? kUp : kDown;
+	}
+	for (int i = 0; i < 3; i++) {
+		REQUIRE(set.Add(filler) >= 0);
+	}
+	REQUIRE(set.Add(alternating) == 3);
+	REQUIRE(set.Positions() == 62);
+	REQUIRE(set.Add(MakeSpec({ kDown, kDown, kUp }, 1000 * kMs, 1000 * kMs)) == 4); // positions 62..64
+	GestureMatcher matcher(set);
+	uint64_t timeNs = 0;
+	int match = -1;
+	for (size_t i = 0; i < alternating.length; i++) {
+		match = matcher.OnKey(alternating.keys[i], timeNs += kMs);
+	}
+	CHECK(match == 3);
+	CHECK(matcher.OnKey(kDown, timeNs += kMs) == -1);
+	CHECK(matcher.OnKey(kDown, timeNs += kMs) == -1);
+	CHECK(matcher.OnKey(kUp, timeNs += kMs) == 4);
+}
+
+SAGE_TEST(GestureSetRejectsOverflow) {
+	GestureSet set;
+	CHECK(set.Add(GestureSpec{}) == -1); // no keys
+	const auto spec = MakeSpec({ kUp, kDown, kUp, kDown }, 1000 * kMs, 1000 * kMs);
+	size_t added = 0;
+	while (set.Add(spec) >= 0) {
+		added++;
+	}
+	CHECK(added == kMaxGestures);
+	GestureSet gaps;
+	for (uint64_t gap = 1; gap <= kMaxGapClasses; gap++) {
+		CHECK(gaps.Add(MakeSpec({ kUp }, 1000 * kMs, gap * kMs)) >= 0);
+	}
+	CHECK(gaps.Add(MakeSpec({ kUp }, 1000 * kMs, 100 * kMs)) == -1);
+}
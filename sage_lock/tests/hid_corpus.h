@@ -0,0 +1,56 @@
+/////////////
+// hid_corpus.h : HID report descriptors for the classifier's tests and benchmark: real layouts
+// trimmed to the items that matter, plus malformed ones.
+//////
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace hid_corpus {
+
+// A Windows precision touch screen: one finger collection plus contact count and contact count maximum.
+inline constexpr std::array<uint8_t, 65> kTouchScreen = {
+	0x05, 0x0D, 0x09, 0x04, 0xA1, 0x01, 0x85, 0x01, 0x09, 0x22, 0xA1, 0x02, 0x09, 0x42, 0x15, 0x00,
+	0x25, 0x01, 0x75, 0x01, 0x95, 0x01, 0x81, 0x02, 0x95, 0x07, 0x81, 0x03, 0x75, 0x08, 0x09, 0x51,
+	0x95, 0x01, 0x81, 0x02, 0x05, 0x01, 0x26, 0xFF, 0x0F, 0x75, 0x10, 0x09, 0x30, 0x09, 0x31, 0x95,
+	0x02, 0x81, 0x02, 0xC0, 0x05, 0x0D, 0x09, 0x54, 0x25, 0x7F, 0x95, 0x01, 0x75, 0x08, 0x81, 0x02,
+	0xC0,
+};
+
+// Pen and touch pad are digitizers too, but were never locked.
+inline constexpr std::array<uint8_t, 18> kPen = {
+	0x05, 0x0D, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x02, 0x09, 0x20, 0xA1, 0x00, 0x09, 0x42, 0x81, 0x02, 0xC0, 0xC0,
+};
+inline constexpr std::array<uint8_t, 12> kTouchPad = { 0x05, 0x0D, 0x09, 0x05, 0xA1, 0x01, 0x09, 0x22, 0xA1, 0x02, 0xC0, 0xC0 };
+
+inline constexpr std::array<uint8_t, 6> kHeatMap = { 0x05, 0x0D, 0x09, 0x0F, 0xA1, 0x01 };
+inline constexpr std::array<uint8_t, 7> kHeatMapClosed = { 0x05, 0x0D, 0x09, 0x0F, 0xA1, 0x01, 0xC0 };
+inline constexpr std::array<uint8_t, 7> kMultiPoint = { 0x05, 0x0D, 0x09, 0x0C, 0xA1, 0x01, 0xC0 };
+
+// A boot keyboard with no digitizer at all, and the same keyboard composited with a touch screen.
+inline constexpr std::array<uint8_t, 23> kKeyboard = {
+	0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01,
+	0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0xC0,
+};
+inline constexpr std::array<uint8_t, 30> kKeyboardAndTouch = {
+	0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01,
+	0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0xC0, 0x05, 0x0D, 0x09, 0x04, 0xA1, 0x01, 0xC0,
+};
+
+// A touch screen usage nested inside another application is not a top-level function.
+inline constexpr std::array<uint8_t, 14> kNestedTouch = { 0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x05, 0x0D, 0x09, 0x04, 0xA1, 0x01, 0xC0, 0xC0 };
+
+// Extended (4-byte) usages carry their own page; Push/Pop restore the usage page; long items are skipped.
+inline constexpr std::array<uint8_t, 10> kExtendedUsage = { 0x05, 0x01, 0x0B, 0x04, 0x00, 0x0D, 0x00, 0xA1, 0x01, 0xC0 };
+inline constexpr std::array<uint8_t, 11> kPushPop = { 0x05, 0x0D, 0xA4, 0x05, 0x01, 0xB4, 0x09, 0x04, 0xA1, 0x01, 0xC0 };
+inline constexpr std::array<uint8_t, 12> kLongItem = { 0xFE, 0x02, 0x10, 0xAA, 0xBB, 0x05, 0x0D, 0x09, 0x0F, 0xA1, 0x01, 0xC0 };
+
+// Malformed descriptors are reported, never classified.
+inline constexpr std::array<uint8_t, 6> kTruncated = { 0x05, 0x0D, 0x09, 0x04, 0x26, 0xFF };
+inline constexpr std::array<uint8_t, 1> kStrayEnd = { 0xC0 };
+inline constexpr std::array<uint8_t, 1> kStrayPop = { 0xB4 };
+inline constexpr std::array<uint8_t, 3> kTruncatedLong = { 0xFE, 0x08, 0x10 };
+
+}
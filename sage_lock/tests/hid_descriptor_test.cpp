@@ -0,0 +1,82 @@
+/////////////
+// hid_descriptor_test.cpp : Report descriptor classification over the corpus in hid_corpus.h.
+//////
+
+#include "test.h"
+#include "hid_corpus.h"
+#include "hid_descriptor.h"
+
+namespace {
+
+template <size_t N>
+constexpr HidClassification Classify(const std::array<uint8_t, N>& bytes) {
+	return ClassifyHidDescriptor(std::span<const uint8_t>(bytes.data(), bytes.size()));
+}
+
+constexpr uint8_t Bit(HidClass c) {
+	return (uint8_t)(1u << (unsigned)c);
+}
+
+// the classifier stays usable at compile time
+static_assert(Classify(hid_corpus::kTouchScreen).IsTouchTarget());
+
+}
+
+using namespace hid_corpus;
+
+SAGE_TEST(HidClassifiesTouchScreen) {
+	const HidClassification result = Classify(kTouchScreen);
+	CHECK(result.error == nullptr);
+	CHECK(result.classes == Bit(HidClass::TouchScreen));
+	CHECK(result.applications == 1);
+	CHECK(result.IsTouchTarget());
+}
+
+SAGE_TEST(HidClassifiesOtherDigitizers) {
+	// pen and touch pad are digitizers too, but were never locked
+	CHECK(Classify(kPen).classes == Bit(HidClass::Pen) && !Classify(kPen).IsTouchTarget());
+	CHECK(Classify(kTouchPad).classes == Bit(HidClass::TouchPad) && !Classify(kTouchPad).IsTouchTarget());
+	CHECK(Classify(kHeatMapClosed).classes == Bit(HidClass::HeatMap) && Classify(kHeatMapClosed).IsTouchTarget());
+	CHECK(Classify(kMultiPoint).classes == Bit(HidClass::MultiPoint) && Classify(kMultiPoint).IsTouchTarget());
+}
+
+SAGE_TEST(HidClassifiesCompositeDevices) {
+	const HidClassification keyboard = Classify(kKeyboard);
+	CHECK(keyboard.error == nullptr && keyboard.classes == 0 && keyboard.applications == 1);
+	const HidClassification composite = Classify(kKeyboardAndTouch);
+	CHECK(composite.error == nullptr);
+	CHECK(composite.classes == Bit(HidClass::TouchScreen));
+	CHECK(composite.applications == 2);
+	// a touch screen usage nested inside another application is not a top-level function
+	CHECK(Classify(kNestedTouch).classes == 0 && Classify(kNestedTouch).applications == 1);
+}
+
+SAGE_TEST(HidFollowsUsagePagesAndSkipsLongItems) {
+	CHECK(Classify(kExtendedUsage).classes == Bit(HidClass::TouchScreen));
+	CHECK(Classify(kPushPop).classes == Bit(HidClass::TouchScreen));
+	CHECK(Classify(kLongItem).classes == Bit(HidClass::HeatMap));
+	CHECK(Classify(kLongItem).error == nullptr);
+}
+
+// malformed descriptors are reported, never classified as something to lock
+SAGE_TEST(HidReportsMalformedDescriptors) {
+	CHECK(Classify(kHeatMap).error != nullptr); // unterminated collection
+	CHECK(!Classify(kHeatMap).IsTouchTarget());
+	CHECK(Classify(kTruncated).error != nullptr && !Classify(kTruncated).IsTouchTarget());
+	CHECK(Classify(kStrayEnd).error != nullptr);
+	CHECK(Classify(kStrayPop).error != nullptr);
+	CHECK(Classify(kTruncatedLong).error != nullptr);
+	CHECK(ClassifyHidDescriptor({}).applications == 0);
+
+	// every prefix of a good descriptor either parses or says why not, without reading past the end
+	for (size_t size = 0; size < kTouchScreen.size(); size++) {
+		const HidClassification result = ClassifyHidDescriptor(std::span<const uint8_t>(kTouchScreen.data(), size));
+		CHECK(result.error != nullptr || result.classes == 0);
+	}
+}
+
+SAGE_TEST(HidPushStackIsBounded) {
+	std::array<uint8_t, 16> pushes;
+	pushes.fill(0xA4);
+	CHECK(Classify(pushes).error != nullptr);
+}
@@ -0,0 +1,135 @@
+/////////////
+// input_trace_test.cpp : Trace files written by InputTraceRecorder and read back by InputTraceReader.
+//////
+
+#include "test.h"
+#include "input_trace.h"
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+namespace {
+
+void WriteFile(const std::string& path, const void* data, size_t size) {
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file != nullptr) {
+		fwrite(data, 1, size, file);
+		fclose(file);
+	}
+}
+
+std::vector<uint8_t> TraceBytes(const std::vector<TraceRecord>& records) {
+	TraceFileHeader header = {};
+	memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+	header.version = kTraceVersion;
+	header.recordSize = sizeof(TraceRecord);
+	std::vector<uint8_t> bytes(sizeof(header) + records.size() * sizeof(TraceRecord));
+	memcpy(bytes.data(), &header, sizeof(header));
+	if (!records.empty()) {
+		memcpy(bytes.data() + sizeof(header), records.data(), records.size() * sizeof(TraceRecord));
+	}
+	return bytes;
+}
+
+}
+
+SAGE_TEST(TraceRoundTrip) {
+	const std::string path = sage_test::TempPath("roundtrip.trace");
+	std::vector<KeyEvent> events;
+	for (uint64_t i = 0; i < 10000; i++) {
+		KeyEvent event;
+		event.timeNs = 1000000 * i + 7;
+		event.device = 1 + i % 3;
+		event.key = (GestureKey)(i % kGestureKeyCount);
+		event.down = i % 2 == 0;
+		events.push_back(event);
+	}
+	{
+		InputTraceRecorder recorder;
+		REQUIRE(recorder.Start(path.c_str()));
+		// short pauses so the writer keeps up with the ring and nothing is dropped
+		for (size_t i = 0; i < events.size(); i++) {
+			recorder.Record(events[i]);
+			if (i % 1024 == 1023) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			}
+		}
+		recorder.Stop();
+		REQUIRE(recorder.Dropped() == 0);
+	}
+	{
+		InputTraceReader reader;
+		REQUIRE(reader.Open(path.c_str()));
+		REQUIRE(reader.Count() == events.size());
+		for (size_t i = 0; i < events.size(); i++) {
+			KeyEvent event;
+			REQUIRE(ToKeyEvent(reader.Records()[i], event));
+			CHECK(event.timeNs == events[i].timeNs && event.device == events[i].device && event.key == events[i].key &&
+				event.down == events[i].down);
+		}
+	}
+	std::filesystem::remove(path);
+}
+
+SAGE_TEST(TraceReaderIgnoresPartialRecord) {
+	const std::string path = sage_test::TempPath("partial.trace");
+	TraceRecord record = {};
+	record.timeNs = 42;
+	auto bytes = TraceBytes({ record, record });
+	bytes.resize(bytes.size() - 5);
+	WriteFile(path, bytes.data(), bytes.size());
+	{
+		InputTraceReader reader;
+		REQUIRE(reader.Open(path.c_str()));
+		CHECK(reader.Count() == 1);
+		CHECK(reader.Records()[0].timeNs == 42);
+	}
+	std::filesystem::remove(path);
+}
+
+SAGE_TEST(TraceReaderRejectsBadHeader) {
+	const std::string path = sage_test::TempPath("bad.trace");
+	InputTraceReader reader;
+	CHECK(!reader.Open(path.c_str())); // missing
+
+	auto bytes = TraceBytes({});
+	bytes[0] = 'X';
+	WriteFile(path, bytes.data(), bytes.size());
+	CHECK(!reader.Open(path.c_str()));
+
+	bytes = TraceBytes({});
+	bytes[8] = (uint8_t)(kTraceVersion + 1);
+	WriteFile(path, bytes.data(), bytes.size());
+	CHECK(!reader.Open(path.c_str()));
+
+	WriteFile(path, bytes.data(), 10); // shorter than a header
+	CHECK(!reader.Open(path.c_str()));
+	std::filesystem::remove(path);
+}
+
+SAGE_TEST(TraceReaderCountsUnknownKeys) {
+	const std::string path = sage_test::TempPath("badkey.trace");
+	std::vector<TraceRecord> records(4);
+	for (size_t i = 0; i < records.size(); i++) {
+		records[i].timeNs = i;
+		records[i].down = 1;
+	}
+	records[1].key = (uint8_t)kGestureKeyCount;
+	records[3].key = 0xff;
+	const auto bytes = TraceBytes(records);
+	WriteFile(path, bytes.data(), bytes.size());
+	{
+		InputTraceReader reader;
+		REQUIRE(reader.Open(path.c_str()));
+		CHECK(reader.Count() == 4);
+		CHECK(reader.Invalid() == 2);
+		KeyEvent event;
+		event.timeNs = 99;
+		CHECK(!ToKeyEvent(reader.Records()[1], event));
+		CHECK(!ToKeyEvent(reader.Records()[3], event));
+		CHECK(event.timeNs == 99);
+		CHECK(ToKeyEvent(reader.Records()[2], event));
+		CHECK(event.timeNs == 2 && event.key == (GestureKey)0);
+	}
+	std::filesystem::remove(path);
+}
@@ -0,0 +1,42 @@
+/////////////
+// key_event_test.cpp : Arrival times worked out from message tick stamps.
+//////
+
+#include "test.h"
+#include "key_event.h"
+
+namespace {
+
+constexpr uint64_t kNowNs = 5000000000000ull; // 5000 s into the monotonic clock
+
+}
+
+SAGE_TEST(ArrivalOfCurrentMessageIsNow) {
+	CHECK(MessageArrivalNs(123456, 123456, kNowNs) == kNowNs);
+}
+
+// A batch drained together keeps the gaps between its messages instead of collapsing onto the
+// time it was handled.
+SAGE_TEST(ArrivalKeepsGapsWithinABatch) {
+	const uint32_t tickNowMs = 900000;
+	const uint32_t sent[] = { tickNowMs - 450, tickNowMs - 300, tickNowMs - 16, tickNowMs };
+	uint64_t arrival[4];
+	for (int i = 0; i < 4; i++) {
+		arrival[i] = MessageArrivalNs(sent[i], tickNowMs, kNowNs);
+	}
+	CHECK(arrival[0] == kNowNs - 450000000ull);
+	CHECK(arrival[1] - arrival[0] == 150000000ull);
+	CHECK(arrival[2] - arrival[1] == 284000000ull);
+	CHECK(arrival[3] == kNowNs);
+}
+
+SAGE_TEST(ArrivalAcrossTickWrap) {
+	CHECK(MessageArrivalNs(0xFFFFFFF0u, 0x10u, kNowNs) == kNowNs - 32000000ull);
+}
+
+SAGE_TEST(ArrivalNeverAheadOfNow) {
+	// a stamp from a tick read after ours
+	CHECK(MessageArrivalNs(1005, 1000, kNowNs) == kNowNs);
+	// older than the monotonic clock itself
+	CHECK(MessageArrivalNs(0, 60000, 1000000) == 0);
+}
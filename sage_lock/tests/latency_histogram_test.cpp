@@ -0,0 +1,102 @@
+/////////////
+// latency_histogram_test.cpp : LatencyHistogram percentiles checked against the exact ones.
+//////
+
+#include "test.h"
+#include "latency_histogram.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// The sample a percentile should report: same 1-based rank rule as LatencyHistogram::Percentile.
+uint64_t ExactPercentile(const std::vector<uint64_t>& sorted, double p) {
+	const uint64_t rank = std::clamp<uint64_t>((uint64_t)std::ceil(p / 100.0 * (double)sorted.size()), 1, sorted.size());
+	return sorted[rank - 1];
+}
+
+}
+
+SAGE_TEST(HistogramEmptyReportsZero) {
+	LatencyHistogram histogram;
+	CHECK(histogram.Count() == 0);
+	CHECK(histogram.Max() == 0);
+	CHECK(histogram.Percentile(50) == 0);
+	CHECK(histogram.Percentile(100) == 0);
+}
+
+// the edges where exact buckets give way to split powers of two, and the open-ended last bucket
+SAGE_TEST(HistogramBucketEdges) {
+	CHECK(LatencyHistogram::BucketIndex(255) == 255);
+	CHECK(LatencyHistogram::BucketIndex(256) == 256);
+	CHECK(LatencyHistogram::BucketIndex(257) == 256);
+	CHECK(LatencyHistogram::BucketIndex(258) == 257);
+	CHECK(LatencyHistogram::BucketHighest(256) == 257);
+	CHECK(LatencyHistogram::BucketHighest(383) == 511);
+	CHECK(LatencyHistogram::BucketIndex(512) == 384);
+	CHECK(LatencyHistogram::BucketHighest(384) == 515);
+	CHECK(LatencyHistogram::BucketIndex(uint64_t(1) << LatencyHistogram::kMaxBits) == LatencyHistogram::kBucketCount - 1);
+	CHECK(LatencyHistogram::BucketIndex(~0ull) == LatencyHistogram::kBucketCount - 1);
+}
+
+// every bucket ends right before the next one starts, from the first to the last
+SAGE_TEST(HistogramBucketsAreContiguous) {
+	for (size_t i = 0; i + 1 < LatencyHistogram::kBucketCount; i++) {
+		const uint64_t highest = LatencyHistogram::BucketHighest(i);
+		REQUIRE(LatencyHistogram::BucketIndex(highest) == i);
+		REQUIRE(LatencyHistogram::BucketIndex(highest + 1) == i + 1);
+	}
+}
+
+SAGE_TEST(HistogramSmallValuesAreExact) {
+	LatencyHistogram histogram;
+	for (uint64_t value = 1; value <= 200; value++) {
+		histogram.Record(value);
+	}
+	CHECK(histogram.Count() == 200);
+	CHECK(histogram.Max() == 200);
+	CHECK(histogram.Percentile(50) == 100);
+	CHECK(histogram.Percentile(99) == 198);
+	CHECK(histogram.Percentile(100) == 200);
+	CHECK(histogram.Percentile(0) == 1);
+}
+
+// Latencies spread over six decades, as a lock cycle's stages are: every reported percentile is
+// at or above the exact one and less than 1/128 over it.
+SAGE_TEST(HistogramPercentilesWithinBucketError) {
+	LatencyHistogram histogram;
+	std::vector<uint64_t> values;
+	uint64_t state = 0x2545F4914F6CDD1Dull;
+	for (int i = 0; i < 100000; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		const uint64_t value = (state >> 40) >> (state % 24); // 0 .. 16M ns, skewed low
+		values.push_back(value);
+		histogram.Record(value);
+	}
+	std::sort(values.begin(), values.end());
+	CHECK(histogram.Count() == values.size());
+	CHECK(histogram.Max() == values.back());
+	for (double p : { 1.0, 50.0, 90.0, 99.0, 99.9, 99.99, 100.0 }) {
+		const uint64_t exact = ExactPercentile(values, p);
+		const uint64_t reported = histogram.Percentile(p);
+		CHECK(reported >= exact);
+		CHECK(reported <= exact + exact / 128);
+	}
+	CHECK(histogram.Percentile(100) == values.back());
+}
+
+SAGE_TEST(HistogramClampsHugeValuesAndResets) {
+	LatencyHistogram histogram;
+	histogram.Record(~0ull);
+	histogram.Record(1000);
+	CHECK(histogram.Max() == ~0ull);
+	CHECK(histogram.Percentile(50) == LatencyHistogram::BucketHighest(LatencyHistogram::BucketIndex(1000)));
+	CHECK(histogram.Percentile(100) == ~0ull); // the last bucket is open-ended, so it reports Max
+	histogram.Reset();
+	CHECK(histogram.Count() == 0);
+	CHECK(histogram.Max() == 0);
+	CHECK(histogram.Percentile(99) == 0);
+}
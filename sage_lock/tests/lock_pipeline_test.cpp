@@ -0,0 +1,285 @@
+/////////////
+// lock_pipeline_test.cpp : Headless lock cycles over simulated devices, timed by a virtual clock.
+//////
+
+#include "test.h"
+#include "clock.h"
+#include "gesture_dsl.h"
+#include "lock_pipeline.h"
+#include "shared_metrics.h"
+#include "sim_devices.h"
+#include <atomic>
+#include <chrono>
+#include <semaphore>
+#include <string>
+#include <thread>
+#include <utility>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+constexpr uint64_t kMs = 1000000;
+constexpr GestureSet kToggle = CompileGestures({ kToggleGestureDsl });
+
+// Runs one toggle gesture through the pipeline and returns the cycle it produced.
+LockCycle RunCycle(LockPipeline& pipeline, VirtualClock& clock) {
+	LockCycle seen;
+	std::binary_semaphore done(0);
+	pipeline.SetCycleObserver([&](const LockCycle& cycle) {
+		seen = cycle;
+		seen.devices = nullptr;
+		seen.results = nullptr;
+		done.release();
+	});
+	pipeline.Start();
+	const GestureKey keys[] = { GestureKey::VolumeUp, GestureKey::VolumeDown, GestureKey::VolumeUp, GestureKey::VolumeDown };
+	for (auto key : keys) {
+		clock.AdvanceNs(100 * kMs);
+		pipeline.OnKeyEvent({ clock.NowNs(), 1, key, true });
+		pipeline.OnKeyEvent({ clock.NowNs(), 1, key, false });
+	}
+	done.acquire();
+	pipeline.Stop();
+	return seen;
+}
+
+}
+
+SAGE_TEST(VirtualClockSleepAdvances) {
+	VirtualClock clock(1000);
+	clock.SleepNs(500);
+	CHECK(clock.NowNs() == 1500);
+	clock.AdvanceToNs(1200); // never backwards
+	CHECK(clock.NowNs() == 1500);
+	clock.AdvanceToNs(2000);
+	CHECK(clock.NowNs() == 2000);
+}
+
+// the toggle latency is spent on the virtual clock, so the cycle reports exactly the simulated time
+SAGE_TEST(PipelineVirtualLatencyIsSimulatedLatency) {
+	VirtualClock clock(1000 * kMs);
+	SimDeviceRegistry registry;
+	registry.AddMany(1, 300000, 0, 0);
+	SimDeviceToggler toggler(registry, clock);
+	LockPipeline pipeline(kToggle, toggler, clock);
+	pipeline.SetDevices(registry.Ids());
+	const LockCycle cycle = RunCycle(pipeline, clock);
+	CHECK(cycle.action == LockAction::Lock);
+	CHECK(!registry.Enabled(0));
+	CHECK(cycle.matchNs == cycle.triggerNs);
+	CHECK(cycle.dispatchNs == cycle.triggerNs);
+	CHECK(cycle.completeNs - cycle.dispatchNs == 300000);
+	CHECK(pipeline.Latency(LockStage::Device).Count() == 1);
+	CHECK(pipeline.Latency(LockStage::Device).Max() == 300000);
+	CHECK(pipeline.Latency(LockStage::EndToEnd).Max() == 300000);
+}
+
+// devices toggled in parallel overlap on the virtual clock: the cycle takes exactly the slowest
+// device, however the workers happened to be scheduled
+SAGE_TEST(PipelineVirtualLatencyWithParallelDevices) {
+	VirtualClock clock(1000 * kMs);
+	SimDeviceRegistry registry;
+	for (uint64_t latencyUs : { 100, 400, 250 }) {
+		SimDeviceConfig config;
+		config.id = "SIM\\TOUCH\\" + std::to_string(latencyUs);
+		config.latencyNs = latencyUs * 1000;
+		registry.Add(config);
+	}
+	SimDeviceToggler toggler(registry, clock);
+	LockPipeline pipeline(kToggle, toggler, clock);
+	pipeline.SetDevices(registry.Ids());
+	for (int i = 0; i < 20; i++) {
+		const LockCycle cycle = RunCycle(pipeline, clock);
+		CHECK(cycle.completeNs - cycle.dispatchNs == 400000);
+	}
+	CHECK(toggler.Toggles() == 60);
+}
+
+// Fewer workers than devices: the third device goes to whichever worker frees up first in
+// simulated time, so it starts at 100us and ends at 450us, after the 400us device.
+SAGE_TEST(PipelineVirtualLatencyQueuesBehindFirstFreeWorker) {
+	VirtualClock clock(1000 * kMs);
+	SimDeviceRegistry registry;
+	for (uint64_t latencyUs : { 100, 400, 350 }) {
+		SimDeviceConfig config;
+		config.id = "SIM\\TOUCH\\" + std::to_string(latencyUs);
+		config.latencyNs = latencyUs * 1000;
+		registry.Add(config);
+	}
+	SimDeviceToggler toggler(registry, clock);
+	LockPipeline pipeline(kToggle, toggler, clock, { .toggleWorkers = 2 });
+	pipeline.SetDevices(registry.Ids());
+	for (int i = 0; i < 20; i++) {
+		const LockCycle cycle = RunCycle(pipeline, clock);
+		CHECK(cycle.completeNs - cycle.dispatchNs == 450000);
+	}
+}
+
+// Sleeps on other threads that start together end together at the latest of them, whichever
+// thread got to run first.
+SAGE_TEST(VirtualClockParallelSleepsEndAtLatest) {
+	VirtualClock clock(0);
+	clock.Hold(3);
+	std::atomic<uint64_t> woke[3] = {};
+	std::vector<std::thread> threads;
+	const uint64_t sleeps[3] = { 300, 100, 200 };
+	for (int i = 0; i < 3; i++) {
+		threads.emplace_back([&, i] {
+			clock.SleepNs(sleeps[i]);
+			woke[i] = clock.NowNs();
+			clock.Release(1);
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	CHECK(woke[0] == 300);
+	CHECK(woke[1] == 100);
+	CHECK(woke[2] == 200);
+	CHECK(clock.NowNs() == 300);
+}
+
+// The Device stage is timed on the pipeline's clock, so over simulated devices its percentiles are
+// the configured latencies, within the histogram's bucket error.
+SAGE_TEST(PipelineDeviceStageMatchesSimulatedLatencies) {
+	const uint64_t latenciesNs[] = { 100000, 400000, 250000, 1200000 };
+	VirtualClock clock(1000 * kMs);
+	SimDeviceRegistry registry;
+	for (uint64_t latencyNs : latenciesNs) {
+		SimDeviceConfig config;
+		config.id = "SIM\\TOUCH\\" + std::to_string(latencyNs);
+		config.latencyNs = latencyNs;
+		registry.Add(config);
+	}
+	SimDeviceToggler toggler(registry, clock);
+	LockPipeline pipeline(kToggle, toggler, clock);
+	pipeline.SetDevices(registry.Ids());
+	for (int i = 0; i < 10; i++) {
+		RunCycle(pipeline, clock);
+	}
+	const LatencyHistogram& device = pipeline.Latency(LockStage::Device);
+	CHECK(device.Count() == 40);
+	CHECK(device.Max() == 1200000);
+	// ten samples of each latency: p25 is the 10th sample, p50 the 20th, p75 the 30th
+	const std::pair<double, uint64_t> expected[] = { { 25, 100000 }, { 50, 250000 }, { 75, 400000 }, { 99.9, 1200000 } };
+	for (const auto& [p, exactNs] : expected) {
+		const uint64_t reported = device.Percentile(p);
+		CHECK(reported >= exactNs);
+		CHECK(reported <= exactNs + exactNs / 128);
+	}
+}
+
+namespace {
+
+// Toggles instantly, except for one device that blocks until released.
+class StallingToggler : public DeviceToggler {
+public:
+	const char* Name() const override { return "stalling"; }
+	bool Toggle(std::string_view deviceId, bool) override {
+		while (deviceId == "stuck" && !release.load()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return true;
+	}
+	std::atomic<bool> release{ false };
+};
+
+}
+
+// A device still toggling at the deadline is the tail the Device stage exists to show: it is
+// recorded at the time the run gave up on it, not dropped.
+SAGE_TEST(PipelineDeviceStageKeepsTimedOutDevices) {
+	SystemClock clock;
+	StallingToggler toggler;
+	LockPipelineConfig config;
+	config.toggleDeadline = std::chrono::milliseconds(30);
+	LockPipeline pipeline(kToggle, toggler, clock, config);
+	pipeline.SetDevices({ "fast", "stuck" });
+	std::binary_semaphore done(0);
+	ToggleStatus stuck = ToggleStatus::Pending;
+	pipeline.SetCycleObserver([&](const LockCycle& cycle) {
+		stuck = (*cycle.results)[1].status;
+		done.release();
+	});
+	pipeline.Start();
+	const GestureKey keys[] = { GestureKey::VolumeUp, GestureKey::VolumeDown, GestureKey::VolumeUp, GestureKey::VolumeDown };
+	for (auto key : keys) {
+		pipeline.OnKeyEvent({ clock.NowNs(), 1, key, true });
+	}
+	done.acquire();
+	toggler.release = true;
+	pipeline.Stop();
+	CHECK(stuck == ToggleStatus::TimedOut);
+	const LatencyHistogram& device = pipeline.Latency(LockStage::Device);
+	CHECK(device.Count() == 2);
+	CHECK(device.Max() >= 30 * kMs);
+	CHECK(device.Percentile(100) >= 30 * kMs);
+}
+
+// Every stage gets one sample per cycle, and on the virtual clock the timed stages are exact: the
+// key press is matched and dispatched at once, and toggling takes the simulated device latency.
+SAGE_TEST(PipelineRecordsEveryStage) {
+	VirtualClock clock(1000 * kMs);
+	SimDeviceRegistry registry;
+	registry.AddMany(2, 300000, 0, 0);
+	SimDeviceToggler toggler(registry, clock);
+	LockPipeline pipeline(kToggle, toggler, clock, { .toggleWorkers = 1 });
+	pipeline.SetDevices(registry.Ids());
+	for (int i = 0; i < 3; i++) {
+		const LockCycle cycle = RunCycle(pipeline, clock);
+		CHECK(cycle.action == (i % 2 == 0 ? LockAction::Lock : LockAction::Unlock));
+	}
+	CHECK(pipeline.Latency(LockStage::Match).Count() == 3);
+	CHECK(pipeline.Latency(LockStage::Match).Max() == 0);
+	CHECK(pipeline.Latency(LockStage::Dispatch).Count() == 3);
+	CHECK(pipeline.Latency(LockStage::Device).Count() == 6);
+	for (LockStage stage : { LockStage::Toggle, LockStage::EndToEnd }) {
+		const LatencyHistogram& latency = pipeline.Latency(stage);
+		CHECK(latency.Count() == 3);
+		// one worker, so the two devices run back to back
+		CHECK(latency.Percentile(50) == 600000);
+		CHECK(latency.Percentile(99.9) == 600000);
+	}
+	CHECK(registry.Enabled(0) == false && registry.Enabled(1) == false);
+}
+
+// What a monitoring agent reading the segment sees after a lock and an unlock.
+SAGE_TEST(PipelinePublishesMetrics) {
+	const std::string name = "/sage_lock_test." + std::to_string((long long)getpid()) + ".pipeline";
+	SharedMetrics metrics;
+	REQUIRE(metrics.Create(name.c_str()));
+	SharedMetrics reader;
+	REQUIRE(reader.OpenRead(name.c_str()));
+	VirtualClock clock(1000 * kMs);
+	SimDeviceRegistry registry;
+	registry.AddMany(2, 300000, 0, 0);
+	SimDeviceToggler toggler(registry, clock);
+	LockPipeline pipeline(kToggle, toggler, clock);
+	pipeline.SetDevices(registry.Ids());
+	pipeline.SetMetrics(&metrics);
+
+	RunCycle(pipeline, clock);
+	CHECK(reader.Get(MetricGauge::Locked) == 1);
+	CHECK(reader.Get(MetricGauge::Devices) == 2);
+	CHECK(reader.Get(MetricGauge::LastLatencyUs) >= 300);
+	RunCycle(pipeline, clock);
+	CHECK(reader.Get(MetricGauge::Locked) == 0);
+	CHECK(reader.Get(MetricCounter::KeyEvents) == 16);
+	CHECK(reader.Get(MetricCounter::Gestures) == 2);
+	CHECK(reader.Get(MetricCounter::Locks) == 1);
+	CHECK(reader.Get(MetricCounter::Unlocks) == 1);
+	CHECK(reader.Get(MetricCounter::TogglesOk) == 4);
+	CHECK(reader.Get(MetricCounter::ToggleFailures) == 0);
+
+	MetricsStageSummary stages[kMetricsStages];
+	REQUIRE(reader.ReadLatency(stages));
+	for (size_t i = 0; i < kMetricsStages; i++) {
+		const LatencyHistogram& latency = pipeline.Latency((LockStage)i);
+		CHECK(stages[i].count == latency.Count());
+		CHECK(stages[i].p50Ns == latency.Percentile(50));
+		CHECK(stages[i].p999Ns == latency.Percentile(99.9));
+		CHECK(stages[i].maxNs == latency.Max());
+	}
+	CHECK(stages[(size_t)LockStage::EndToEnd].count == 2);
+}
@@ -0,0 +1,127 @@
+/////////////
+// probe_fanout_test.cpp : ProbeDevices ordering, timeouts and late results.
+//////
+
+#include "test.h"
+#include "probe_fanout.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Shared with the probes, which may outlive the test's call to ProbeDevices.
+struct FakeDevices {
+	std::atomic<bool> release{ false };  // lets the stuck path answer
+	std::atomic<int> finished{ 0 };      // probes that have returned
+	std::atomic<int> late{ 0 };          // late touch screens reported
+	std::string stuck;                   // the path that blocks until released
+};
+
+// "devN" is a touch screen when N is even. Later paths answer sooner, so completion order is the
+// reverse of the list.
+ProbeFn MakeProbe(std::shared_ptr<FakeDevices> fake, size_t count) {
+	return [fake, count](const std::string& path, CachedDevice& device) {
+		const size_t n = std::stoul(path.substr(3));
+		std::this_thread::sleep_for(std::chrono::microseconds(200 * (count - n)));
+		while (path == fake->stuck && !fake->release.load()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		const bool touch = n % 2 == 0;
+		if (touch) {
+			device.id = path;
+			device.identity = "identity of " + path;
+		}
+		fake->finished++;
+		return touch;
+	};
+}
+
+std::vector<std::string> Paths(size_t count) {
+	std::vector<std::string> paths;
+	for (size_t i = 0; i < count; i++) {
+		paths.push_back("dev" + std::to_string(i));
+	}
+	return paths;
+}
+
+template <typename Pred>
+bool WaitFor(Pred pred) {
+	for (int i = 0; i < 5000 && !pred(); i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return pred();
+}
+
+}
+
+SAGE_TEST(ProbeFindsInEnumerationOrder) {
+	auto fake = std::make_shared<FakeDevices>();
+	const auto report = ProbeDevices(Paths(20), MakeProbe(fake, 20), 4, std::chrono::milliseconds(5000));
+	REQUIRE(report.found.size() == 10);
+	for (size_t i = 0; i < report.found.size(); i++) {
+		CHECK(report.found[i].id == "dev" + std::to_string(2 * i));
+		CHECK(report.found[i].identity == "identity of dev" + std::to_string(2 * i));
+	}
+	CHECK(report.timedOut.empty());
+	CHECK(fake->finished == 20);
+}
+
+SAGE_TEST(ProbeEmptyListReturnsAtOnce) {
+	auto fake = std::make_shared<FakeDevices>();
+	const auto report = ProbeDevices({}, MakeProbe(fake, 0), 4, std::chrono::milliseconds(5000));
+	CHECK(report.found.empty());
+	CHECK(report.timedOut.empty());
+}
+
+// One worker, stuck on the third path: a replacement takes over the rest of the list at the
+// timeout, and the stuck path's touch screen arrives later through the sink.
+SAGE_TEST(ProbeAbandonsStuckDeviceAndReportsItLate) {
+	auto fake = std::make_shared<FakeDevices>();
+	fake->stuck = "dev2";
+	std::vector<std::string> lateIds;
+	std::mutex lateMutex;
+	auto sink = std::make_shared<LateProbeSink>([fake, &lateIds, &lateMutex](const CachedDevice& device) {
+		std::lock_guard<std::mutex> lock(lateMutex);
+		lateIds.push_back(device.id);
+		fake->late++;
+	});
+	const auto start = std::chrono::steady_clock::now();
+	const auto report = ProbeDevices(Paths(8), MakeProbe(fake, 8), 1, std::chrono::milliseconds(30), sink);
+	const auto elapsed = std::chrono::steady_clock::now() - start;
+	CHECK(elapsed >= std::chrono::milliseconds(30));
+	CHECK(elapsed < std::chrono::milliseconds(2000));
+	CHECK(report.timedOut == std::vector<std::string>{ "dev2" });
+	REQUIRE(report.found.size() == 3);
+	CHECK(report.found[0].id == "dev0");
+	CHECK(report.found[1].id == "dev4");
+	CHECK(report.found[2].id == "dev6");
+	CHECK(fake->late == 0);
+
+	fake->release = true;
+	CHECK(WaitFor([&] { return fake->late.load() == 1; }));
+	sink->Close();
+	std::lock_guard<std::mutex> lock(lateMutex);
+	CHECK(lateIds == std::vector<std::string>{ "dev2" });
+}
+
+// After Close, a probe that answers late reaches nobody: the caller may tear down what the
+// callback used.
+SAGE_TEST(ProbeClosedSinkDropsLateResult) {
+	auto fake = std::make_shared<FakeDevices>();
+	fake->stuck = "dev0";
+	auto sink = std::make_shared<LateProbeSink>([fake](const CachedDevice&) { fake->late++; });
+	const auto report = ProbeDevices(Paths(2), MakeProbe(fake, 2), 2, std::chrono::milliseconds(20), sink);
+	CHECK(report.timedOut == std::vector<std::string>{ "dev0" });
+	CHECK(report.found.empty()); // dev1 is not a touch screen
+	sink->Close();
+	fake->release = true;
+	CHECK(WaitFor([&] { return fake->finished.load() == 2; }));
+	// the report follows the probe's return; give it the time to happen if it wrongly would
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	CHECK(fake->late == 0);
+}
@@ -0,0 +1,209 @@
+/////////////
+// shared_metrics_test.cpp : SharedMetrics over a real POSIX shm segment, daemon and reader side.
+//////
+
+#include "test.h"
+#include "shared_metrics.h"
+#include <chrono>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// A segment name of this process's own, so parallel test runs never share one.
+std::string SegmentName(const char* name) {
+	return "/sage_lock_test." + std::to_string((long long)getpid()) + "." + name;
+}
+
+bool SegmentExists(const std::string& name) {
+	const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if (fd < 0) {
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+// Rewrites the segment behind the daemon's back, as a build with a different layout, or a daemon
+// that died mid-publish, would have left it.
+template <typename Fn>
+void PatchLayout(const std::string& name, Fn patch) {
+	const int fd = shm_open(name.c_str(), O_RDWR, 0);
+	if (fd < 0) {
+		return;
+	}
+	void* data = mmap(nullptr, sizeof(MetricsLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data != MAP_FAILED) {
+		patch(*(MetricsLayout*)data);
+		munmap(data, sizeof(MetricsLayout));
+	}
+}
+
+// The pid of a child that has already exited and been reaped.
+pid_t DeadPid() {
+	const pid_t child = fork();
+	if (child == 0) {
+		_exit(0);
+	}
+	waitpid(child, nullptr, 0);
+	return child;
+}
+
+}
+
+SAGE_TEST(MetricsReaderSeesDaemonCounters) {
+	const std::string name = SegmentName("counters");
+	SharedMetrics daemon;
+	REQUIRE(daemon.Create(name.c_str()));
+	daemon.Add(MetricCounter::KeyEvents, 8);
+	daemon.Add(MetricCounter::Locks);
+	daemon.Set(MetricGauge::Devices, 3);
+
+	SharedMetrics reader;
+	REQUIRE(reader.OpenRead(name.c_str()));
+	CHECK(reader.Pid() == (uint64_t)getpid());
+	CHECK(reader.StartUnixSec() != 0);
+	CHECK(reader.Get(MetricCounter::KeyEvents) == 8);
+	CHECK(reader.Get(MetricCounter::Locks) == 1);
+	CHECK(reader.Get(MetricCounter::Unlocks) == 0);
+	CHECK(reader.Get(MetricGauge::Devices) == 3);
+	// the reader's mapping is live, not a snapshot
+	daemon.Add(MetricCounter::Locks);
+	CHECK(reader.Get(MetricCounter::Locks) == 2);
+	// and read-only
+	reader.Add(MetricCounter::Locks);
+	reader.Set(MetricGauge::Devices, 9);
+	CHECK(daemon.Get(MetricCounter::Locks) == 2);
+	CHECK(daemon.Get(MetricGauge::Devices) == 3);
+}
+
+SAGE_TEST(MetricsCreateReplacesSegmentOfDeadDaemon) {
+	const std::string name = SegmentName("stale");
+	SharedMetrics crashed;
+	REQUIRE(crashed.Create(name.c_str()));
+	crashed.Add(MetricCounter::Gestures, 5);
+	const pid_t dead = DeadPid();
+	REQUIRE(dead > 0);
+	PatchLayout(name, [&](MetricsLayout& layout) { layout.pid = (uint64_t)dead; });
+	SharedMetrics daemon;
+	REQUIRE(daemon.Create(name.c_str()));
+	SharedMetrics reader;
+	REQUIRE(reader.OpenRead(name.c_str()));
+	CHECK(reader.Get(MetricCounter::Gestures) == 0);
+	CHECK(reader.Pid() == (uint64_t)getpid());
+}
+
+// a second daemon must not take the segment from one that is still running
+SAGE_TEST(MetricsCreateRefusesRunningOwner) {
+	const std::string name = SegmentName("owned");
+	SharedMetrics running;
+	REQUIRE(running.Create(name.c_str()));
+	running.Add(MetricCounter::Locks, 3);
+	SharedMetrics second;
+	uint64_t owner = 0;
+	CHECK(!second.Create(name.c_str(), &owner));
+	CHECK(owner == (uint64_t)getpid());
+	CHECK(!second.IsOpen());
+	SharedMetrics reader;
+	REQUIRE(reader.OpenRead(name.c_str()));
+	CHECK(reader.Get(MetricCounter::Locks) == 3);
+}
+
+SAGE_TEST(MetricsCloseRemovesSegment) {
+	const std::string name = SegmentName("close");
+	SharedMetrics daemon;
+	REQUIRE(daemon.Create(name.c_str()));
+	SharedMetrics reader;
+	REQUIRE(reader.OpenRead(name.c_str()));
+	daemon.Add(MetricCounter::Unlocks, 4);
+	daemon.Close();
+	CHECK(!SegmentExists(name));
+	CHECK(reader.Get(MetricCounter::Unlocks) == 4); // an open reader keeps its mapping
+	SharedMetrics late;
+	CHECK(!late.OpenRead(name.c_str()));
+}
+
+SAGE_TEST(MetricsReaderRejectsUnknownLayout) {
+	const std::string name = SegmentName("version");
+	SharedMetrics daemon;
+	REQUIRE(daemon.Create(name.c_str()));
+	PatchLayout(name, [](MetricsLayout& layout) { layout.version = kMetricsVersion + 1; });
+	SharedMetrics reader;
+	CHECK(!reader.OpenRead(name.c_str()));
+	CHECK(!reader.IsOpen());
+	PatchLayout(name, [](MetricsLayout& layout) { layout.version = kMetricsVersion; });
+	CHECK(reader.OpenRead(name.c_str()));
+	CHECK(!reader.OpenRead(SegmentName("missing").c_str()));
+}
+
+// One writer republishing as fast as it can, every word of a summary set to the same generation:
+// a reader that ever sees two generations in one copy got a torn read past the seqlock.
+SAGE_TEST(MetricsLatencyReadIsNeverTorn) {
+	const std::string name = SegmentName("seqlock");
+	SharedMetrics daemon;
+	REQUIRE(daemon.Create(name.c_str()));
+	SharedMetrics reader;
+	REQUIRE(reader.OpenRead(name.c_str()));
+
+	std::atomic<bool> stop{ false };
+	std::thread writer([&] {
+		MetricsStageSummary stages[kMetricsStages];
+		for (uint64_t generation = 1; !stop.load(std::memory_order_relaxed); generation++) {
+			for (auto& stage : stages) {
+				stage = { generation, generation, generation, generation, generation };
+			}
+			daemon.PublishLatency(stages);
+		}
+	});
+	size_t torn = 0;
+	uint64_t last = 0;
+	bool monotonic = true;
+	for (int i = 0; i < 200000; i++) {
+		MetricsStageSummary stages[kMetricsStages];
+		CHECK(reader.ReadLatency(stages));
+		const uint64_t generation = stages[0].count;
+		for (const auto& stage : stages) {
+			if (stage.count != generation || stage.p50Ns != generation || stage.p99Ns != generation ||
+				stage.p999Ns != generation || stage.maxNs != generation) {
+				torn++;
+			}
+		}
+		monotonic = monotonic && generation >= last;
+		last = generation;
+	}
+	stop = true;
+	writer.join();
+	CHECK(torn == 0);
+	CHECK(monotonic);
+	CHECK(last != 0);
+}
+
+// A daemon killed mid-publish leaves the sequence odd for good: the reader gives up instead of
+// spinning forever, and leaves the caller's copy alone.
+SAGE_TEST(MetricsStaleSummaryTimesOut) {
+	const std::string name = SegmentName("midpublish");
+	SharedMetrics daemon;
+	REQUIRE(daemon.Create(name.c_str()));
+	SharedMetrics reader;
+	REQUIRE(reader.OpenRead(name.c_str()));
+	PatchLayout(name, [](MetricsLayout& layout) { layout.latencySequence.fetch_add(1); });
+	MetricsStageSummary stages[kMetricsStages];
+	stages[0].count = 77;
+	const auto start = std::chrono::steady_clock::now();
+	CHECK(!reader.ReadLatency(stages));
+	const auto waited = std::chrono::steady_clock::now() - start;
+	CHECK(waited >= kLatencyReadTimeout);
+	CHECK(waited < kLatencyReadTimeout * 10);
+	CHECK(stages[0].count == 77);
+	// the next publish makes it consistent again
+	const MetricsStageSummary zero[kMetricsStages] = {};
+	PatchLayout(name, [](MetricsLayout& layout) { layout.latencySequence.fetch_add(1); });
+	daemon.PublishLatency(zero);
+	CHECK(reader.ReadLatency(stages));
+	CHECK(stages[0].count == 0);
+}
@@ -0,0 +1,36 @@
+/////////////
+// test.h : Self-registering test cases for sage_lock_tests. No third-party framework, so the tests
+// build wherever the core library does.
+//
+//	SAGE_TEST(MatcherDropsStalePrefix) {
+//		CHECK(matcher.OnKey(GestureKey::VolumeUp, 0) == -1);
+//	}
+//
+// CHECK records a failure and carries on; REQUIRE also ends the test. SKIP_TEST ends it as skipped,
+// for machines without something the test needs, e.g. /dev/uinput.
+//////
+
+#pragma once
+
+#include <string>
+
+namespace sage_test {
+
+using TestFn = void (*)();
+
+bool Register(const char* name, TestFn fn);
+void Fail(const char* file, int line, const char* expr);
+void Skip(const char* reason);
+// A path in the temp directory, unique to this process; the caller removes the file.
+std::string TempPath(const char* name);
+
+}
+
+#define SAGE_TEST(name) \
+	static void name(); \
+	[[maybe_unused]] static const bool name##Registered = sage_test::Register(#name, name); \
+	static void name()
+
+#define CHECK(expr) do { if (!(expr)) { sage_test::Fail(__FILE__, __LINE__, #expr); } } while (0)
+#define REQUIRE(expr) do { if (!(expr)) { sage_test::Fail(__FILE__, __LINE__, #expr); return; } } while (0)
+#define SKIP_TEST(reason) do { sage_test::Skip(reason); return; } while (0)
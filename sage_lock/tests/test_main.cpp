@@ -0,0 +1,99 @@
+/////////////
+// test_main.cpp : Runs the registered tests in registration order; pass test names to run just those.
+// Exits non-zero if any test failed or a name matched nothing.
+//////
+
+#include "test.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct TestCase {
+	const char* name;
+	sage_test::TestFn fn;
+};
+
+// function-local, so registrations from other translation units never see it unconstructed
+std::vector<TestCase>& Tests() {
+	static std::vector<TestCase> tests;
+	return tests;
+}
+
+int g_Failures = 0;     // CHECKs failed in the running test
+const char* g_Skipped = nullptr;
+
+}
+
+namespace sage_test {
+
+bool Register(const char* name, TestFn fn) {
+	Tests().push_back({ name, fn });
+	return true;
+}
+
+void Fail(const char* file, int line, const char* expr) {
+	fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", file, line, expr);
+	g_Failures++;
+}
+
+void Skip(const char* reason) {
+	g_Skipped = reason;
+}
+
+std::string TempPath(const char* name) {
+	return (std::filesystem::temp_directory_path() / ("sage_lock_test." + std::to_string((long long)getpid()) + "." + name)).string();
+}
+
+}
+
+int main(int argc, char** argv) {
+	int failed = 0, skipped = 0, ran = 0;
+	std::vector<bool> matched(argc, false);
+	for (const auto& test : Tests()) {
+		bool wanted = argc < 2;
+		for (int i = 1; i < argc; i++) {
+			if (strcmp(argv[i], test.name) == 0) {
+				matched[i] = wanted = true;
+			}
+		}
+		if (!wanted) {
+			continue;
+		}
+		g_Failures = 0;
+		g_Skipped = nullptr;
+		const auto start = std::chrono::steady_clock::now();
+		test.fn();
+		const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		ran++;
+		if (g_Failures != 0) {
+			printf("FAIL %s (%d check(s))\n", test.name, g_Failures);
+			failed++;
+		}
+		else if (g_Skipped != nullptr) {
+			printf("skip %s: %s\n", test.name, g_Skipped);
+			skipped++;
+		}
+		else {
+			printf("ok   %s (%.1f ms)\n", test.name, ms);
+		}
+		fflush(stdout);
+	}
+	for (int i = 1; i < argc; i++) {
+		if (!matched[i]) {
+			fprintf(stderr, "no test named %s\n", argv[i]);
+			return 2;
+		}
+	}
+	printf("%d test(s), %d failed, %d skipped\n", ran, failed, skipped);
+	return failed != 0 ? 1 : 0;
+}
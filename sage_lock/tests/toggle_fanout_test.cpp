@@ -0,0 +1,138 @@
+/////////////
+// toggle_fanout_test.cpp : ToggleFanout results, ordering and deadlines.
+//////
+
+#include "test.h"
+#include "toggle_fanout.h"
+#include <atomic>
+#include <map>
+#include <string>
+
+namespace {
+
+SystemClock g_Clock;
+
+DeviceList MakeDevices(size_t count) {
+	std::vector<std::string> ids;
+	for (size_t i = 0; i < count; i++) {
+		ids.push_back("dev" + std::to_string(i));
+	}
+	return MakeDeviceList(std::move(ids));
+}
+
+}
+
+SAGE_TEST(FanoutTogglesEveryDeviceOnce) {
+	std::mutex mutex;
+	std::map<std::string, int> calls;
+	ToggleFanout fanout([&](std::string_view id, bool enable) {
+		std::lock_guard<std::mutex> lock(mutex);
+		calls[std::string(id)] += enable ? 100 : 1;
+		return true;
+	}, 3, g_Clock);
+	const DeviceList devices = MakeDevices(10);
+	auto results = fanout.Run(devices, false, std::chrono::milliseconds(5000));
+	REQUIRE(results.size() == 10);
+	for (const auto& result : results) {
+		CHECK(result.status == ToggleStatus::Ok);
+	}
+	results = fanout.Run(devices, true, std::chrono::milliseconds(5000));
+	REQUIRE(calls.size() == 10);
+	for (const auto& entry : calls) {
+		CHECK(entry.second == 101);
+	}
+}
+
+SAGE_TEST(FanoutReportsFailuresInListOrder) {
+	ToggleFanout fanout([](std::string_view id, bool) { return id != "dev2"; }, 2, g_Clock);
+	const auto results = fanout.Run(MakeDevices(4), false, std::chrono::milliseconds(5000));
+	REQUIRE(results.size() == 4);
+	CHECK(results[0].status == ToggleStatus::Ok);
+	CHECK(results[1].status == ToggleStatus::Ok);
+	CHECK(results[2].status == ToggleStatus::Failed);
+	CHECK(results[3].status == ToggleStatus::Ok);
+}
+
+SAGE_TEST(FanoutEmptyListReturnsNothing) {
+	std::atomic<int> calls{ 0 };
+	ToggleFanout fanout([&](std::string_view, bool) { calls++; return true; }, 2, g_Clock);
+	CHECK(fanout.Run(MakeDevices(0), false, std::chrono::milliseconds(100)).empty());
+	CHECK(fanout.Run(nullptr, false, std::chrono::milliseconds(100)).empty());
+	CHECK(calls == 0);
+}
+
+SAGE_TEST(FanoutReportsDeviceStillRunningAsTimedOut) {
+	std::atomic<bool> release{ false };
+	ToggleFanout fanout([&](std::string_view id, bool) {
+		while (id == "dev1" && !release.load()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return true;
+	}, 2, g_Clock);
+	const auto results = fanout.Run(MakeDevices(2), false, std::chrono::milliseconds(50));
+	release = true;
+	REQUIRE(results.size() == 2);
+	CHECK(results[0].status == ToggleStatus::Ok);
+	CHECK(results[1].status == ToggleStatus::TimedOut);
+}
+
+// A lock whose first device overruns the deadline, then an unlock while that device is still
+// stuck: once it comes back, the worker must not go on to disable the rest of the lock's devices,
+// which would leave them dead while the pipeline believes it is unlocked.
+SAGE_TEST(FanoutWithdrawsUnstartedDevicesAtDeadline) {
+	std::mutex mutex;
+	std::map<std::string, std::vector<bool>> applied; // every enable value each device saw
+	std::atomic<bool> release{ false };
+	std::atomic<bool> slowDone{ false };
+	ToggleFanout fanout([&](std::string_view id, bool enable) {
+		if (id == "dev0" && !enable) {
+			while (!release.load()) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			applied[std::string(id)].push_back(enable);
+		}
+		if (id == "dev0" && !enable) {
+			slowDone = true;
+		}
+		return true;
+	}, 1, g_Clock);
+	const DeviceList devices = MakeDevices(3);
+
+	auto lock = fanout.Run(devices, false, std::chrono::milliseconds(30));
+	REQUIRE(lock.size() == 3);
+	CHECK(lock[0].status == ToggleStatus::TimedOut);
+	CHECK(lock[1].status == ToggleStatus::NotStarted);
+	CHECK(lock[2].status == ToggleStatus::NotStarted);
+
+	// the only worker is still stuck, so the unlock cannot start anything either
+	auto unlock = fanout.Run(devices, true, std::chrono::milliseconds(30));
+	REQUIRE(unlock.size() == 3);
+	for (const auto& result : unlock) {
+		CHECK(result.status == ToggleStatus::NotStarted);
+	}
+
+	release = true;
+	while (!slowDone.load()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	// give a worker that wrongly kept going time to reach the other devices
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		CHECK(applied.count("dev1") == 0);
+		CHECK(applied.count("dev2") == 0);
+	}
+
+	// the next unlock reaches every device, the stuck one included
+	unlock = fanout.Run(devices, true, std::chrono::milliseconds(5000));
+	for (const auto& result : unlock) {
+		CHECK(result.status == ToggleStatus::Ok);
+	}
+	std::lock_guard<std::mutex> guard(mutex);
+	CHECK(applied["dev1"] == std::vector<bool>{ true });
+	CHECK(applied["dev2"] == std::vector<bool>{ true });
+	CHECK(applied["dev0"].back());
+}
@@ -0,0 +1,146 @@
+/////////////
+// touch_device_registry_test.cpp : Hotplug adds and removes against lock cycles.
+//////
+
+#include "test.h"
+#include "touch_device_registry.h"
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Remembers the last state applied to each device; an optional hook runs inside every Toggle.
+class RecordingToggler : public DeviceToggler {
+public:
+	const char* Name() const override { return "recording"; }
+	bool Toggle(std::string_view deviceId, bool enable) override {
+		if (hook) {
+			hook(deviceId, enable);
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_state[std::string(deviceId)] = enable;
+		m_calls++;
+		return true;
+	}
+
+	// 1 enabled, 0 disabled, -1 never toggled
+	int State(const std::string& id) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_state.find(id);
+		return it == m_state.end() ? -1 : it->second;
+	}
+	int Calls() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_calls;
+	}
+
+	std::function<void(std::string_view, bool)> hook;
+
+private:
+	std::mutex m_mutex;
+	std::map<std::string, bool> m_state;
+	int m_calls = 0;
+};
+
+bool WaitFor(const std::atomic<bool>& flag) {
+	for (int i = 0; i < 500 && !flag.load(); i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	}
+	return flag.load();
+}
+
+}
+
+SAGE_TEST(RegistryDisablesDeviceArrivingWhileLocked) {
+	RecordingToggler toggler;
+	TouchDeviceRegistry registry(toggler);
+	registry.Reset({ "a" });
+	CHECK(registry.Add("b"));
+	CHECK(toggler.Calls() == 0); // unlocked: nothing to do
+	registry.BeginCycle(true);
+	CHECK(registry.Add("c"));
+	CHECK(toggler.State("c") == 0);
+	CHECK(!registry.Add("c"));
+	CHECK(registry.LockedOnArrival() == 1);
+	CHECK(registry.Count() == 3);
+	// while locked a removal is likely our own disable, so the device stays
+	CHECK(!registry.RemoveUnlessLocked("c"));
+	registry.BeginCycle(false);
+	CHECK(registry.RemoveUnlessLocked("c"));
+	CHECK(registry.Count() == 2);
+}
+
+// a device that takes its time to disable must not hold the registry against the executor or other hotplug threads
+SAGE_TEST(RegistryTogglesArrivalOutsideItsLock) {
+	RecordingToggler toggler;
+	TouchDeviceRegistry registry(toggler);
+	std::atomic<bool> listed{ false };
+	std::thread reader;
+	toggler.hook = [&](std::string_view, bool) {
+		reader = std::thread([&] {
+			registry.List();
+			listed = true;
+		});
+		WaitFor(listed);
+	};
+	registry.BeginCycle(true);
+	CHECK(registry.Add("slow"));
+	CHECK(listed.load());
+	reader.join();
+	CHECK(toggler.State("slow") == 0);
+}
+
+// the unlock cycle lists the new device and enables it while the arrival's disable is still running;
+// if the disable lands last, Add must enable the device again rather than leave it dead while unlocked
+SAGE_TEST(RegistryReappliesStateWhenCycleOverlapsArrival) {
+	RecordingToggler toggler;
+	TouchDeviceRegistry registry(toggler);
+	std::atomic<bool> disabling{ false };
+	std::atomic<bool> release{ false };
+	toggler.hook = [&](std::string_view id, bool enable) {
+		if (id == "late" && !enable) {
+			disabling = true;
+			while (!release.load()) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+	};
+	registry.BeginCycle(true);
+	std::thread hotplug([&] { registry.Add("late"); });
+	REQUIRE(WaitFor(disabling));
+
+	const DeviceList devices = registry.BeginCycle(false);
+	REQUIRE(devices->size() == 1);
+	toggler.Toggle((*devices)[0], true); // what the executor's fan-out does
+	release = true;
+	hotplug.join();
+	CHECK(toggler.State("late") == 1);
+}
+
+// Lists hand out views of the interned ids, which stay put while the table grows past a chunk.
+SAGE_TEST(RegistryListsViewInternedIds) {
+	RecordingToggler toggler;
+	TouchDeviceRegistry registry(toggler);
+	registry.Reset({ "first", "second" });
+	const DeviceList before = registry.List();
+	REQUIRE(before->size() == 2);
+	const char* first = (*before)[0].data();
+
+	std::string longId(5000, 'x'); // larger than an arena chunk
+	CHECK(registry.Add(longId));
+	for (int i = 0; i < 500; i++) {
+		registry.Add("HID\\VID_045E&PID_0000\\" + std::to_string(i));
+	}
+	CHECK(registry.Remove("second"));
+	const DeviceList after = registry.List();
+	REQUIRE(after->size() == 502);
+	CHECK((*after)[0].data() == first);
+	CHECK((*after)[1] == longId);
+	CHECK((*after)[501] == "HID\\VID_045E&PID_0000\\499");
+	CHECK((*before)[0] == "first");
+	CHECK((*before)[1] == "second"); // removed, but the older list still reads it
+	CHECK(registry.List() == after); // unchanged set, same list
+}
@@ -0,0 +1,198 @@
+/////////////
+// touch_hotplug_test.cpp : Touch screen detection against a fake /sys/class/input tree.
+//////
+
+#include "test.h"
+#include "hid_corpus.h"
+#include "touch_hotplug.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <linux/input.h>
+
+namespace {
+
+constexpr uint64_t kAbsXY = (1ull << ABS_X) | (1ull << ABS_Y) | (1ull << ABS_PRESSURE);
+constexpr uint64_t kAbsMultitouch = (1ull << ABS_X) | (1ull << ABS_Y) | (1ull << ABS_MT_SLOT) | (1ull << ABS_MT_POSITION_X) |
+	(1ull << ABS_MT_POSITION_Y) | (1ull << ABS_MT_TRACKING_ID);
+
+void WriteText(const std::filesystem::path& path, const std::string& text) {
+	if (FILE* file = fopen(path.c_str(), "w")) {
+		fputs(text.c_str(), file);
+		fclose(file);
+	}
+}
+
+// A bitmap the way the kernel prints it: one hex word per long, most significant first.
+std::string Bitmap(uint64_t bits) {
+	char text[48];
+	if (sizeof(unsigned long) == 8) {
+		snprintf(text, sizeof(text), "%lx\n", (unsigned long)bits);
+	}
+	else {
+		snprintf(text, sizeof(text), "%lx %lx\n", (unsigned long)(bits >> 32), (unsigned long)bits);
+	}
+	return text;
+}
+
+class FakeSysfs {
+public:
+	FakeSysfs() : m_root(sage_test::TempPath("sysfs")) {
+		std::filesystem::create_directories(m_root / "devices");
+	}
+	~FakeSysfs() { std::filesystem::remove_all(m_root); }
+
+	std::string Root() const { return m_root.string(); }
+
+	// A HID device whose input nodes all link to it, as /sys/class/input/inputN/device does.
+	template <size_t N>
+	void AddHidDevice(const std::string& device, const std::array<uint8_t, N>& descriptor) {
+		std::filesystem::create_directories(m_root / "devices" / device);
+		if (FILE* file = fopen((m_root / "devices" / device / "report_descriptor").c_str(), "wb")) {
+			fwrite(descriptor.data(), 1, descriptor.size(), file);
+			fclose(file);
+		}
+	}
+	// An input node; device names the HID device it belongs to, or is empty for a non-HID one.
+	void AddInput(const std::string& name, bool direct, uint64_t abs, const std::string& device = {}) {
+		const std::filesystem::path dir = m_root / name;
+		std::filesystem::create_directories(dir / "capabilities");
+		SetCapabilities(name, direct, abs);
+		if (!device.empty()) {
+			std::filesystem::create_directory_symlink(m_root / "devices" / device, dir / "device");
+		}
+	}
+	// What a driver rebinding or a mode switch does to an existing node.
+	void SetCapabilities(const std::string& name, bool direct, uint64_t abs) {
+		WriteText(m_root / name / "properties", Bitmap(direct ? 1ull << INPUT_PROP_DIRECT : 0));
+		WriteText(m_root / name / "capabilities" / "abs", Bitmap(abs));
+	}
+	void RemoveInput(const std::string& name) { std::filesystem::remove_all(m_root / name); }
+
+private:
+	std::filesystem::path m_root;
+};
+
+class NullToggler : public DeviceToggler {
+public:
+	const char* Name() const override { return "null"; }
+	bool Toggle(std::string_view, bool) override { return true; }
+};
+
+Uevent InputUevent(std::string_view action, std::string_view devpath) {
+	Uevent event;
+	event.action = action;
+	event.subsystem = "input";
+	event.devpath = devpath;
+	return event;
+}
+
+std::vector<std::string> Sorted(std::vector<std::string> ids) {
+	std::sort(ids.begin(), ids.end());
+	return ids;
+}
+
+}
+
+// a keyboard with a built-in touch screen and pen: one HID descriptor, three input nodes
+SAGE_TEST(HotplugLocksOnlyTheTouchNodeOfCompositeDevice) {
+	FakeSysfs sysfs;
+	sysfs.AddHidDevice("composite", hid_corpus::kKeyboardAndTouch);
+	sysfs.AddInput("input10", false, 0, "composite");
+	sysfs.AddInput("input11", true, kAbsMultitouch, "composite");
+	sysfs.AddInput("input12", true, kAbsXY, "composite");
+	CHECK(!IsSysfsTouchScreen(sysfs.Root(), "input10"));
+	CHECK(IsSysfsTouchScreen(sysfs.Root(), "input11"));
+	CHECK(!IsSysfsTouchScreen(sysfs.Root(), "input12"));
+	CHECK(FindSysfsTouchScreens(sysfs.Root()) == std::vector<std::string>{ "input11" });
+}
+
+SAGE_TEST(HotplugDescriptorOnlyRulesNodesOut) {
+	FakeSysfs sysfs;
+	sysfs.AddHidDevice("pen", hid_corpus::kPen);
+	sysfs.AddHidDevice("broken", hid_corpus::kTruncated);
+	sysfs.AddHidDevice("touch", hid_corpus::kTouchScreen);
+	// multitouch node on a device whose descriptor has no touch collection
+	sysfs.AddInput("input1", true, kAbsMultitouch, "pen");
+	// a descriptor that does not parse neither vetoes nor vouches
+	sysfs.AddInput("input2", true, kAbsMultitouch, "broken");
+	// touch screen descriptor, but a touchpad-like node: not direct
+	sysfs.AddInput("input3", false, kAbsMultitouch, "touch");
+	// no HID device at all, e.g. an I2C or serial touch controller
+	sysfs.AddInput("input4", true, kAbsMultitouch);
+	sysfs.AddInput("input5", true, kAbsXY);
+	CHECK(!IsSysfsTouchScreen(sysfs.Root(), "input1"));
+	CHECK(IsSysfsTouchScreen(sysfs.Root(), "input2"));
+	CHECK(!IsSysfsTouchScreen(sysfs.Root(), "input3"));
+	CHECK(IsSysfsTouchScreen(sysfs.Root(), "input4"));
+	CHECK(!IsSysfsTouchScreen(sysfs.Root(), "input5"));
+	CHECK(!IsSysfsTouchScreen(sysfs.Root(), "input99")); // gone
+	auto found = FindSysfsTouchScreens(sysfs.Root());
+	std::sort(found.begin(), found.end());
+	CHECK(found == (std::vector<std::string>{ "input2", "input4" }));
+}
+
+SAGE_TEST(HotplugParsesUevents) {
+	const char message[] = "add@/devices/pci0000:00/usb1/1-2/input/input12\0ACTION=add\0DEVPATH=/devices/pci0000:00/usb1/1-2/input/input12\0SUBSYSTEM=input\0SEQNUM=1";
+	Uevent event;
+	REQUIRE(ParseUevent(message, sizeof(message), event));
+	CHECK(event.action == "add");
+	CHECK(event.subsystem == "input");
+	CHECK(event.Name() == "input12");
+	const char udev[] = "libudev\0\xfe\xed\xca\xfe";
+	CHECK(!ParseUevent(udev, sizeof(udev), event));
+}
+
+SAGE_TEST(HotplugChangeDropsNodeThatStoppedBeingTouch) {
+	FakeSysfs sysfs;
+	sysfs.AddInput("input4", true, kAbsMultitouch);
+	NullToggler toggler;
+	TouchDeviceRegistry registry(toggler);
+	TouchHotplugMonitor monitor(-1, sysfs.Root(), registry);
+	monitor.OnUevent(InputUevent("add", "/devices/platform/i2c/input/input4"));
+	CHECK(registry.Snapshot() == std::vector<std::string>{ "input4" });
+
+	// a change that keeps it a touch screen changes nothing
+	monitor.OnUevent(InputUevent("change", "/devices/platform/i2c/input/input4"));
+	CHECK(registry.Count() == 1);
+
+	// one that does not removes it, except while locked: it is still disabled and must come back on
+	sysfs.SetCapabilities("input4", false, kAbsMultitouch);
+	registry.BeginCycle(true);
+	monitor.OnUevent(InputUevent("change", "/devices/platform/i2c/input/input4"));
+	CHECK(registry.Count() == 1);
+	registry.BeginCycle(false);
+	monitor.OnUevent(InputUevent("change", "/devices/platform/i2c/input/input4"));
+	CHECK(registry.Count() == 0);
+	CHECK(monitor.Stats().added == 1);
+	CHECK(monitor.Stats().removed == 1);
+}
+
+// What Run does after ENOBUFS: the uevents in between are lost, so a full scan catches up.
+SAGE_TEST(HotplugRescanCatchesUpOnLostUevents) {
+	FakeSysfs sysfs;
+	sysfs.AddInput("input1", true, kAbsMultitouch);
+	sysfs.AddInput("input2", true, kAbsMultitouch);
+	sysfs.AddInput("input3", false, 0);
+	NullToggler toggler;
+	TouchDeviceRegistry registry(toggler);
+	registry.Reset({ "input1", "input2" });
+	TouchHotplugMonitor monitor(-1, sysfs.Root(), registry);
+
+	// missed: input2 unplugged, input5 plugged in, input1 stopped being a touch screen
+	sysfs.RemoveInput("input2");
+	sysfs.AddInput("input5", true, kAbsMultitouch);
+	sysfs.SetCapabilities("input1", true, kAbsXY);
+	monitor.Rescan();
+	CHECK(registry.Snapshot() == std::vector<std::string>{ "input5" });
+	CHECK(monitor.Stats().rescans == 1);
+	CHECK(monitor.Stats().added == 1);
+	CHECK(monitor.Stats().removed == 2);
+
+	// while locked, nothing leaves the set
+	sysfs.AddInput("input6", true, kAbsMultitouch);
+	sysfs.RemoveInput("input5");
+	registry.BeginCycle(true);
+	monitor.Rescan();
+	CHECK(Sorted(registry.Snapshot()) == (std::vector<std::string>{ "input5", "input6" }));
+}
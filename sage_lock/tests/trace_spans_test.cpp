@@ -0,0 +1,163 @@
+/////////////
+// trace_spans_test.cpp : SAGE_SPAN recording, ring wraparound and the Chrome trace JSON.
+//
+// Built with spans compiled in whatever SAGE_LOCK_TRACE_SPANS says, so the markers are tested in
+// every build; trace_spans.h is the same either way apart from what SAGE_SPAN expands to.
+//////
+
+#undef SAGE_TRACE_SPANS
+#define SAGE_TRACE_SPANS 1
+
+#include "test.h"
+#include "trace_spans.h"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// The tests record on the main thread, which claims its ring before any test runs: with spans
+// compiled into the whole build, the other tests' worker threads can use up the pool.
+[[maybe_unused]] const bool g_RingClaimed = trace_spans_detail::t_Ring != nullptr || trace_spans_detail::AttachThread() != nullptr;
+
+struct Event {
+	std::string name;
+	unsigned tid = 0;
+	double ts = 0;
+	double dur = 0;
+};
+
+// The whole dump, and its events parsed back. False if the file is not laid out as WriteTraceSpans
+// writes it: the header, one complete event per line, the closing brackets.
+bool ReadTrace(const std::string& path, std::string& text, std::vector<Event>& events) {
+	std::ifstream file(path, std::ios::binary);
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	text = buffer.str();
+	const std::string head = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+	const std::string tail = "\n]}\n";
+	if (text.compare(0, head.size(), head) != 0 || text.size() < head.size() + tail.size() ||
+		text.compare(text.size() - tail.size(), tail.size(), tail) != 0) {
+		return false;
+	}
+	std::istringstream lines(text.substr(head.size(), text.size() - head.size() - tail.size()));
+	std::string line;
+	while (std::getline(lines, line)) {
+		if (!line.empty() && line.back() == ',') {
+			line.pop_back();
+		}
+		// {"name":"...","ph":"X","pid":1,"tid":N,"ts":T,"dur":D}
+		if (line.compare(0, 9, "{\"name\":\"") != 0) {
+			return false;
+		}
+		Event event;
+		size_t i = 9;
+		for (; i < line.size() && line[i] != '"'; i++) {
+			if (line[i] == '\\') {
+				i++;
+			}
+			event.name += line[i];
+		}
+		int consumed = 0;
+		if (sscanf(line.c_str() + i, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lf,\"dur\":%lf}%n", &event.tid, &event.ts, &event.dur,
+			&consumed) != 3 || (size_t)consumed != line.size() - i) {
+			return false;
+		}
+		events.push_back(event);
+	}
+	return true;
+}
+
+std::vector<Event> Named(const std::vector<Event>& events, const std::string& name) {
+	std::vector<Event> named;
+	for (const auto& event : events) {
+		if (event.name == name) {
+			named.push_back(event);
+		}
+	}
+	return named;
+}
+
+}
+
+SAGE_TEST(SpansCoverTheEnclosingScope) {
+	const uint64_t before = TraceSpanCount();
+	{
+		SAGE_SPAN("test.outer");
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		{
+			SAGE_SPAN("test.inner");
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+	}
+	CHECK(TraceSpanCount() == before + 2);
+
+	const std::string path = sage_test::TempPath("spans.json");
+	REQUIRE(WriteTraceSpans(path.c_str()));
+	std::string text;
+	std::vector<Event> events;
+	REQUIRE(ReadTrace(path, text, events));
+	const auto outer = Named(events, "test.outer");
+	const auto inner = Named(events, "test.inner");
+	REQUIRE(outer.size() == 1);
+	REQUIRE(inner.size() == 1);
+	CHECK(outer[0].tid == inner[0].tid);
+	CHECK(inner[0].dur >= 2000);
+	CHECK(outer[0].dur >= inner[0].dur + 1000);
+	CHECK(inner[0].ts >= outer[0].ts);
+	CHECK(inner[0].ts + inner[0].dur <= outer[0].ts + outer[0].dur);
+	std::filesystem::remove(path);
+}
+
+// Past a full ring, a dump holds the newest kSpanRingSize - 1 spans of the thread, oldest first.
+SAGE_TEST(SpansWrapToTheNewestWindow) {
+	constexpr uint64_t kRecorded = kSpanRingSize * 2 + 100;
+	for (uint64_t i = 0; i < kRecorded; i++) {
+		// span i starts at i us and lasts 0.5 us
+		trace_spans_detail::Record("test.wrap", i * 1000, i * 1000 + 500);
+	}
+
+	const std::string path = sage_test::TempPath("wrap.json");
+	REQUIRE(WriteTraceSpans(path.c_str()));
+	std::string text;
+	std::vector<Event> events;
+	REQUIRE(ReadTrace(path, text, events));
+	const auto wrap = Named(events, "test.wrap");
+	REQUIRE(wrap.size() == kSpanRingSize - 1);
+	for (size_t i = 0; i < wrap.size(); i++) {
+		CHECK(wrap[i].ts == (double)(kRecorded - (kSpanRingSize - 1) + i));
+		CHECK(wrap[i].dur == 0.5);
+		CHECK(wrap[i].tid == wrap[0].tid);
+	}
+	std::filesystem::remove(path);
+}
+
+SAGE_TEST(SpansWriteValidJsonStrings) {
+	trace_spans_detail::Record("test \"quoted\" \\ back\nline", 1000, 2000);
+	trace_spans_detail::Record(nullptr, 3000, 4000);
+
+	const std::string path = sage_test::TempPath("names.json");
+	REQUIRE(WriteTraceSpans(path.c_str()));
+	std::string text;
+	std::vector<Event> events;
+	REQUIRE(ReadTrace(path, text, events));
+	// quotes and backslashes escaped, control characters dropped
+	CHECK(text.find("\"name\":\"test \\\"quoted\\\" \\\\ back" "line\"") != std::string::npos);
+	const auto quoted = Named(events, "test \"quoted\" \\ backline");
+	REQUIRE(quoted.size() == 1);
+	CHECK(quoted[0].ts == 1);
+	CHECK(quoted[0].dur == 1);
+	const auto unnamed = Named(events, "?");
+	REQUIRE(!unnamed.empty());
+	CHECK(unnamed.back().tid == quoted[0].tid);
+	std::filesystem::remove(path);
+}
+
+SAGE_TEST(SpansWriteFailsOnBadPath) {
+	CHECK(!WriteTraceSpans("/nonexistent-dir/spans.json"));
+}
@@ -0,0 +1,196 @@
+/////////////
+// toggle_fanout.cpp : Worker pool that spreads one lock/unlock across all touch devices.
+//////
+
+#include "toggle_fanout.h"
+#include "trace_spans.h"
+#include <algorithm>
+#include <atomic>
+
+// One lock/unlock request. Shared with the workers so a device that overruns the deadline
+// can still finish and record into it after Run has returned. Reset for the next run once it
+// is no longer shared.
+struct ToggleFanout::Batch {
+	void Reset(DeviceList newDevices, bool newEnable, uint64_t newStartNs) {
+		devices = std::move(newDevices);
+		enable = newEnable;
+		deviceCount = devices->size();
+		startNs = newStartNs;
+		next.store(0, std::memory_order_relaxed);
+		results.assign(deviceCount, ToggleResult{});
+		remaining = deviceCount;
+	}
+
+	DeviceList devices;
+	bool enable = false;
+	size_t deviceCount = 0;
+	uint64_t startNs = 0;
+	std::atomic<size_t> next{ 0 };
+	// workers that picked this batch up and may still read it; taken under the pool mutex
+	std::atomic<unsigned> users{ 0 };
+	// clock holds taken for idle workers and not yet handed to one; guarded by the pool mutex
+	unsigned holds = 0;
+	// results and remaining are guarded by doneMutex
+	std::mutex doneMutex;
+	std::condition_variable done;
+	std::vector<ToggleResult> results;
+	size_t remaining = 0;
+};
+
+const char* ToggleStatusName(ToggleStatus status) {
+	switch (status) {
+	case ToggleStatus::Pending: return "pending";
+	case ToggleStatus::Ok: return "ok";
+	case ToggleStatus::Failed: return "failed";
+	case ToggleStatus::TimedOut: return "timed-out";
+	case ToggleStatus::NotStarted: return "not-started";
+	}
+	return "unknown";
+}
+
+ToggleFanout::ToggleFanout(ToggleFn toggle, unsigned workerCount, Clock& clock)
+	: m_toggle(std::move(toggle)),
+	m_clock(clock) {
+	if (workerCount == 0) {
+		workerCount = 1;
+	}
+	for (unsigned i = 0; i < workerCount; i++) {
+		m_workers.emplace_back(&ToggleFanout::WorkerLoop, this);
+	}
+}
+
+ToggleFanout::~ToggleFanout() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_wake.notify_all();
+	for (auto& worker : m_workers) {
+		worker.join();
+	}
+}
+
+std::vector<ToggleResult> ToggleFanout::Run(DeviceList devices, bool enable, std::chrono::milliseconds deadline) {
+	std::vector<ToggleResult> results;
+	Run(std::move(devices), enable, deadline, results);
+	return results;
+}
+
+void ToggleFanout::Run(DeviceList devices, bool enable, std::chrono::milliseconds deadline, std::vector<ToggleResult>& results) {
+	results.clear();
+	if (!devices || devices->empty()) {
+		return;
+	}
+
+	std::shared_ptr<Batch> batch = TakeBatch();
+	batch->Reset(std::move(devices), enable, m_clock.NowNs());
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_batch = batch;
+		m_generation++;
+		// on a simulated clock, no device may finish before every idle worker has started one
+		batch->holds = (unsigned)m_workers.size() - m_busy;
+		m_clock.Hold(batch->holds);
+	}
+	m_wake.notify_all();
+
+	{
+		std::unique_lock<std::mutex> lock(batch->doneMutex);
+		if (!batch->done.wait_for(lock, deadline, [&] { return batch->remaining == 0; })) {
+			// indices from here on were never claimed; taking them all leaves workers nothing to start
+			const size_t claimed = std::min(batch->next.exchange(batch->deviceCount), batch->deviceCount);
+			for (size_t i = claimed; i < batch->deviceCount; i++) {
+				batch->results[i].status = ToggleStatus::NotStarted;
+			}
+			batch->remaining -= batch->deviceCount - claimed;
+		}
+		results.assign(batch->results.begin(), batch->results.end());
+	}
+	// the devices that did not make it are the latency tail; they count as done when given up on
+	const uint64_t gaveUpNs = m_clock.NowNs() - batch->startNs;
+	for (auto& result : results) {
+		if (result.status == ToggleStatus::Pending) {
+			result.status = ToggleStatus::TimedOut;
+		}
+		if (result.status == ToggleStatus::TimedOut || result.status == ToggleStatus::NotStarted) {
+			result.doneNs = gaveUpNs;
+		}
+	}
+	// a worker that has not woken yet finds no batch and goes back to sleep
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_batch.reset();
+	m_clock.Release(batch->holds);
+	batch->holds = 0;
+	m_spare = std::move(batch);
+}
+
+void ToggleFanout::Reserve(size_t deviceCount) {
+	std::shared_ptr<Batch> batch = TakeBatch();
+	batch->results.reserve(deviceCount);
+	m_spare = std::move(batch);
+}
+
+std::shared_ptr<ToggleFanout::Batch> ToggleFanout::TakeBatch() {
+	// m_batch is cleared when Run returns, so no worker can pick the spare up again; once the
+	// ones that did have let go, nothing can touch it any more
+	if (m_spare && m_spare->users.load(std::memory_order_acquire) == 0) {
+		return std::move(m_spare);
+	}
+	return std::make_shared<Batch>();
+}
+
+void ToggleFanout::WorkerLoop() {
+	uint64_t seenGeneration = 0;
+	for (;;) {
+		std::shared_ptr<Batch> batch;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [&] { return m_stopping || m_generation != seenGeneration; });
+			if (m_stopping) {
+				return;
+			}
+			seenGeneration = m_generation;
+			batch = m_batch;
+			if (batch) {
+				batch->users.fetch_add(1, std::memory_order_relaxed);
+				m_busy++;
+				// a worker that was busy when the run began had no hold taken for it
+				if (batch->holds > 0) {
+					batch->holds--;
+				}
+				else {
+					m_clock.Hold(1);
+				}
+			}
+		}
+		if (!batch) {
+			continue;
+		}
+
+		for (size_t i = batch->next.fetch_add(1); i < batch->deviceCount; i = batch->next.fetch_add(1)) {
+			// the pipeline's clock, so simulated devices report simulated time
+			const uint64_t startNs = m_clock.NowNs();
+			bool ok;
+			{
+				SAGE_SPAN("device toggle");
+				ok = m_toggle((*batch->devices)[i], batch->enable);
+			}
+			const uint64_t endNs = m_clock.NowNs();
+
+			std::lock_guard<std::mutex> lock(batch->doneMutex);
+			batch->results[i].status = ok ? ToggleStatus::Ok : ToggleStatus::Failed;
+			batch->results[i].elapsedUs = (endNs - startNs) / 1000;
+			batch->results[i].doneNs = endNs - batch->startNs;
+			if (--batch->remaining == 0) {
+				batch->done.notify_one();
+			}
+		}
+		batch->users.fetch_sub(1, std::memory_order_release);
+		batch.reset();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_busy--;
+		}
+		m_clock.Release(1);
+	}
+}
@@ -0,0 +1,80 @@
+/////////////
+// toggle_fanout.h : Toggles every touch device concurrently on a small pool of worker threads.
+// Lock latency becomes the slowest device instead of the sum of all devices.
+//////
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "clock.h"
+#include "device_toggler.h"
+
+enum class ToggleStatus : uint8_t {
+	Pending,
+	Ok,
+	Failed,
+	TimedOut,   // still running at the deadline; the toggle may yet complete
+	NotStarted, // no worker reached it before the deadline, and none ever will
+};
+
+const char* ToggleStatusName(ToggleStatus status);
+
+struct ToggleResult {
+	ToggleStatus status = ToggleStatus::Pending;
+	uint64_t elapsedUs = 0; // the toggle call alone
+	// From the start of the run until this device finished, waiting for a worker included; for a
+	// device that did not finish in time, until the run gave up on it. Timed on the fanout's clock.
+	uint64_t doneNs = 0;
+};
+
+class ToggleFanout {
+public:
+	// Toggles one device. Returns false on failure.
+	using ToggleFn = std::function<bool(std::string_view deviceId, bool enable)>;
+
+	// Workers sleep on clock while toggling simulated devices; it must outlive the fanout.
+	ToggleFanout(ToggleFn toggle, unsigned workerCount, Clock& clock);
+	~ToggleFanout();
+
+	ToggleFanout(const ToggleFanout&) = delete;
+	ToggleFanout& operator=(const ToggleFanout&) = delete;
+
+	// Toggles every device in the list and waits until all of them finish or the deadline passes.
+	// At the deadline the devices no worker has started are withdrawn and reported as NotStarted,
+	// so a late worker cannot apply this run's action after a newer run has applied the opposite
+	// one. Devices already being toggled are reported as TimedOut and left to finish.
+	// Results follow the list order.
+	std::vector<ToggleResult> Run(DeviceList devices, bool enable, std::chrono::milliseconds deadline);
+	// Same, into the caller's vector. Once Reserve has covered the device count, a run whose devices
+	// all finished in time leaves nothing to free, and the next run allocates nothing.
+	void Run(DeviceList devices, bool enable, std::chrono::milliseconds deadline, std::vector<ToggleResult>& results);
+	// Sizes the reusable run state for up to deviceCount devices.
+	void Reserve(size_t deviceCount);
+
+	unsigned WorkerCount() const { return (unsigned)m_workers.size(); }
+
+private:
+	struct Batch;
+	void WorkerLoop();
+	// A batch no worker still holds, or a new one if the last run left a worker behind.
+	std::shared_ptr<Batch> TakeBatch();
+
+	ToggleFn m_toggle;
+	Clock& m_clock;
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::shared_ptr<Batch> m_batch; // the run in progress, for workers to pick up
+	std::shared_ptr<Batch> m_spare; // the last run's batch, reused once no worker is using it
+	uint64_t m_generation = 0;
+	unsigned m_busy = 0; // workers holding a batch
+	bool m_stopping = false;
+};
@@ -0,0 +1,150 @@
+/////////////
+// touch_device_registry.cpp : Incrementally maintained touch device set.
+//////
+
+#include "touch_device_registry.h"
+#include <algorithm>
+
+namespace {
+
+std::vector<std::string> IdsOf(const DeviceIdTable& table, const std::vector<DeviceHandle>& members) {
+	std::vector<std::string> ids;
+	ids.reserve(members.size());
+	for (DeviceHandle handle : members) {
+		ids.emplace_back(table.View(handle));
+	}
+	return ids;
+}
+
+}
+
+TouchDeviceRegistry::TouchDeviceRegistry(DeviceToggler& toggler)
+	: m_toggler(toggler) {
+}
+
+void TouchDeviceRegistry::Reset(std::vector<std::string> ids) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (DeviceHandle handle : m_members) {
+		m_isMember[handle] = false;
+	}
+	m_members.clear();
+	for (const auto& id : ids) {
+		Insert(id);
+	}
+	m_generation++;
+}
+
+bool TouchDeviceRegistry::Add(std::string_view id) {
+	bool enable;
+	uint64_t cycle;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!Insert(id)) {
+			return false;
+		}
+		m_generation++;
+		if (!m_locked) {
+			return true;
+		}
+		m_lockedOnArrival++;
+		enable = false;
+		cycle = m_cycles;
+	}
+	// A cycle that begins from here on already lists the device and applies its own state to it, but
+	// its toggle and this one can land in either order. So once this toggle is done, if any cycle has
+	// begun meanwhile, apply the latest cycle's state again: whichever lands last, the device ends
+	// up as the lock says.
+	for (;;) {
+		m_toggler.Toggle(id, enable);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_cycles == cycle) {
+			return true;
+		}
+		enable = !m_locked;
+		cycle = m_cycles;
+	}
+}
+
+bool TouchDeviceRegistry::Remove(std::string_view id) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return Erase(id);
+}
+
+bool TouchDeviceRegistry::RemoveUnlessLocked(std::string_view id) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return !m_locked && Erase(id);
+}
+
+bool TouchDeviceRegistry::Insert(std::string_view id) {
+	const DeviceHandle handle = m_idTable.Intern(id);
+	if (handle >= m_isMember.size()) {
+		m_isMember.resize(handle + 1);
+	}
+	if (m_isMember[handle]) {
+		return false;
+	}
+	m_isMember[handle] = true;
+	m_members.push_back(handle);
+	return true;
+}
+
+bool TouchDeviceRegistry::Erase(std::string_view id) {
+	const DeviceHandle handle = m_idTable.Find(id);
+	if (handle == kNoDeviceHandle || !m_isMember[handle]) {
+		return false;
+	}
+	m_isMember[handle] = false;
+	m_members.erase(std::find(m_members.begin(), m_members.end(), handle));
+	m_generation++;
+	return true;
+}
+
+DeviceList TouchDeviceRegistry::BeginCycle(bool locked) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_locked = locked;
+	m_cycles++;
+	return CurrentList();
+}
+
+DeviceList TouchDeviceRegistry::List() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return CurrentList();
+}
+
+DeviceList TouchDeviceRegistry::CurrentList() {
+	if (m_cycleGeneration != m_generation) {
+		auto views = std::make_shared<std::vector<std::string_view>>();
+		views->reserve(m_members.size());
+		for (DeviceHandle handle : m_members) {
+			views->push_back(m_idTable.View(handle));
+		}
+		m_cycleDevices = std::move(views);
+		m_cycleGeneration = m_generation;
+	}
+	return m_cycleDevices;
+}
+
+bool TouchDeviceRegistry::Locked() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_locked;
+}
+
+size_t TouchDeviceRegistry::Count() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_members.size();
+}
+
+std::vector<std::string> TouchDeviceRegistry::Snapshot() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return IdsOf(m_idTable, m_members);
+}
+
+uint64_t TouchDeviceRegistry::Generation() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_generation;
+}
+
+uint64_t TouchDeviceRegistry::LockedOnArrival() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_lockedOnArrival;
+}
@@ -0,0 +1,72 @@
+/////////////
+// touch_device_registry.h : The set of touch devices the lock applies to, kept up to date by hotplug
+// notifications instead of a one-shot enumeration at startup.
+//
+// Ids are interned in a DeviceIdTable, so the set itself is a list of handles and a device that
+// comes and goes does not allocate again. Hotplug threads add and remove devices one at a time.
+// The lock executor takes a snapshot for each lock/unlock and records the state it is applying, so
+// a device that arrives while the screen is locked is disabled as it is added rather than at the
+// next lock.
+//////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "device_id_table.h"
+#include "device_toggler.h"
+
+class TouchDeviceRegistry {
+public:
+	// The toggler must outlive the registry.
+	explicit TouchDeviceRegistry(DeviceToggler& toggler);
+
+	// Replaces the whole set, e.g. with the result of the startup enumeration.
+	void Reset(std::vector<std::string> ids);
+	// Returns false if the device is already known. A device added while locked is disabled before Add
+	// returns. The toggle runs outside the registry's lock, so a slow device stalls only this caller.
+	bool Add(std::string_view id);
+	// Returns false if the device was not known.
+	bool Remove(std::string_view id);
+	// Remove, except while locked: a disabled device drops out of enumeration but must stay in the set
+	// to be enabled again on unlock. Returns false if nothing was removed.
+	bool RemoveUnlessLocked(std::string_view id);
+
+	// Lock executor only: records the state this cycle applies and returns the devices to apply it to.
+	// The list is rebuilt only when the set has changed since the last cycle.
+	DeviceList BeginCycle(bool locked);
+	// The set as an immutable list, rebuilt only if the set has changed since it was last built.
+	// The ids are views into the registry's table, so the list copies no strings. Calling it at
+	// startup keeps the first cycle from allocating.
+	DeviceList List();
+
+	bool Locked() const;
+	size_t Count() const;
+	std::vector<std::string> Snapshot() const;
+	// Bumped on every change to the set.
+	uint64_t Generation() const;
+	// Devices disabled on arrival because the lock was on.
+	uint64_t LockedOnArrival() const;
+
+private:
+	// Caller holds m_mutex.
+	bool Insert(std::string_view id);
+	bool Erase(std::string_view id);
+	DeviceList CurrentList();
+
+	DeviceToggler& m_toggler;
+	mutable std::mutex m_mutex;
+	DeviceIdTable m_idTable;               // every id ever seen
+	std::vector<DeviceHandle> m_members;   // the current set, in arrival order
+	std::vector<bool> m_isMember;          // by handle
+	uint64_t m_generation = 1;
+	DeviceList m_cycleDevices; // built from m_members at m_cycleGeneration
+	uint64_t m_cycleGeneration = 0;
+	uint64_t m_cycles = 0; // BeginCycle calls, so Add can tell a cycle started while it was toggling
+	uint64_t m_lockedOnArrival = 0;
+	bool m_locked = false;
+};
@@ -0,0 +1,90 @@
+/////////////
+// touch_hotplug.h : Linux touch screen discovery. A full sysfs scan at startup, then kernel uevents
+// keep the TouchDeviceRegistry current one device at a time. Linux only.
+//
+// Any SOCK_DGRAM fd carrying kernel-format uevents works as the source, so a socketpair stands in
+// for the netlink socket in the bench.
+//////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "hid_descriptor.h"
+#include "touch_device_registry.h"
+
+// Reads and classifies a sysfs report_descriptor file. False if it is missing or too large.
+bool ReadSysfsHidClassification(const std::string& path, HidClassification& result);
+
+// True if /sys/class/input/<name> is a touch screen: the node has INPUT_PROP_DIRECT and multitouch
+// positions. For a HID device the report descriptor (<name>/device is the same HID device as
+// /sys/class/hidraw/hidrawN/device) can veto that when it has no touch collection, but never stands
+// in for it: it describes the whole device, not the node.
+bool IsSysfsTouchScreen(const std::string& sysfsInputRoot, std::string_view name);
+// Every sysfs input node, such as "input7", touch screen or not.
+std::vector<std::string> ListSysfsInputNodes(const std::string& sysfsInputRoot);
+// Full serial scan; names are sysfs input nodes such as "input7".
+std::vector<std::string> FindSysfsTouchScreens(const std::string& sysfsInputRoot);
+// "name|phys|vendor:product" of /sys/class/input/<name>, or empty if it does not exist. Input node
+// numbers are handed out again after a reboot; this tells whether a cached node is the same device.
+std::string SysfsInputIdentity(const std::string& sysfsInputRoot, std::string_view name);
+
+// One kernel uevent: "ACTION@DEVPATH\0ACTION=...\0SUBSYSTEM=...\0...". Views point into the message.
+struct Uevent {
+	std::string_view action;    // "add", "remove", "change", ...
+	std::string_view subsystem; // "input", "usb", ...
+	std::string_view devpath;   // "/devices/.../input/input12"
+
+	// Last component of the device path, e.g. "input12".
+	std::string_view Name() const;
+};
+
+// Returns false for malformed messages and for udevd's re-broadcasts (they start with "libudev").
+bool ParseUevent(const char* data, size_t size, Uevent& event);
+
+// Netlink socket subscribed to kernel uevents, or -1.
+int OpenUeventSocket();
+
+struct HotplugStats {
+	uint64_t messages = 0; // uevents received
+	uint64_t probes = 0;   // single-device sysfs probes
+	uint64_t added = 0;
+	uint64_t removed = 0;
+	uint64_t rescans = 0;  // full scans after the kernel dropped uevents (ENOBUFS)
+};
+
+class TouchHotplugMonitor {
+public:
+	// Takes ownership of fd. The registry must outlive the monitor.
+	TouchHotplugMonitor(int fd, std::string sysfsInputRoot, TouchDeviceRegistry& registry);
+	~TouchHotplugMonitor();
+
+	TouchHotplugMonitor(const TouchHotplugMonitor&) = delete;
+	TouchHotplugMonitor& operator=(const TouchHotplugMonitor&) = delete;
+
+	bool Init();
+	// Applies uevents to the registry until Stop is called.
+	void Run();
+	// Safe from any thread and from a signal handler.
+	void Stop();
+
+	// Probes and applies one uevent; Run calls this for every message. A "change" that leaves a node
+	// no longer a touch screen removes it, unless the lock is on (see RemoveUnlessLocked).
+	void OnUevent(const Uevent& event);
+	// Brings the registry in line with a full sysfs scan. Run calls this when the socket overflowed
+	// and uevents were lost; devices that are gone are removed unless the lock is on.
+	void Rescan();
+
+	// Counted on the Run thread; read after Run returns.
+	const HotplugStats& Stats() const { return m_stats; }
+
+private:
+	int m_fd;
+	int m_stopEvent = -1;
+	const std::string m_sysfsRoot;
+	TouchDeviceRegistry& m_registry;
+	HotplugStats m_stats;
+};
@@ -0,0 +1,279 @@
+/////////////
+// touch_hotplug_linux.cpp : sysfs touch screen probing and the netlink uevent monitor.
+//////
+
+#include "touch_hotplug.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// First line of a small sysfs attribute, without the newline.
+std::string ReadLine(const std::string& path) {
+	char line[256] = {};
+	if (FILE* file = fopen(path.c_str(), "r")) {
+		if (fgets(line, sizeof(line), file) == nullptr) {
+			line[0] = '\0';
+		}
+		fclose(file);
+	}
+	line[strcspn(line, "\n")] = '\0';
+	return line;
+}
+
+// Tests one bit of a sysfs bitmap such as properties or capabilities/abs: hex words, most
+// significant first, each one an unsigned long of the running kernel.
+bool SysfsBitSet(const std::string& path, unsigned bit) {
+	constexpr unsigned kLongBits = sizeof(unsigned long) * 8;
+	const std::string line = ReadLine(path);
+	unsigned long words[8];
+	size_t count = 0;
+	for (const char* p = line.c_str(); *p != '\0' && count < std::size(words);) {
+		char* end;
+		words[count] = strtoul(p, &end, 16);
+		if (end == p) {
+			break;
+		}
+		count++;
+		p = end;
+	}
+	const size_t index = bit / kLongBits;
+	return index < count && (words[count - 1 - index] >> (bit % kLongBits)) & 1;
+}
+
+}
+
+bool ReadSysfsHidClassification(const std::string& path, HidClassification& result) {
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	// one byte of slack tells a full-size descriptor from a truncated read
+	uint8_t descriptor[kHidMaxDescriptorSize + 1];
+	size_t size = 0;
+	ssize_t got;
+	while (size < sizeof(descriptor) && (got = read(fd, descriptor + size, sizeof(descriptor) - size)) > 0) {
+		size += (size_t)got;
+	}
+	close(fd);
+	if (size == 0 || size > kHidMaxDescriptorSize) {
+		return false;
+	}
+	result = ClassifyHidDescriptor(std::span<const uint8_t>(descriptor, size));
+	return true;
+}
+
+bool IsSysfsTouchScreen(const std::string& sysfsInputRoot, std::string_view name) {
+	std::string base = sysfsInputRoot;
+	base += '/';
+	base += name;
+	// The node itself must be a direct multitouch surface. Every input node of a composite device
+	// shares its report descriptor, so the keyboard and pen nodes of a keyboard with a touch screen
+	// would otherwise be inhibited with it. INPUT_PROP_DIRECT separates touch screens from touchpads;
+	// pens are direct too, but report ABS_X/ABS_Y without multitouch positions.
+	if (!SysfsBitSet(base + "/properties", INPUT_PROP_DIRECT) || !SysfsBitSet(base + "/capabilities/abs", ABS_MT_POSITION_X) ||
+		!SysfsBitSet(base + "/capabilities/abs", ABS_MT_POSITION_Y)) {
+		return false;
+	}
+	// the descriptor can only rule a node out: a device without a touch collection is no touch screen
+	HidClassification hid;
+	return !ReadSysfsHidClassification(base + "/device/report_descriptor", hid) || hid.error != nullptr || hid.IsTouchTarget();
+}
+
+std::vector<std::string> ListSysfsInputNodes(const std::string& sysfsInputRoot) {
+	std::vector<std::string> nodes;
+	DIR* dir = opendir(sysfsInputRoot.c_str());
+	if (dir == nullptr) {
+		return nodes;
+	}
+	while (dirent* entry = readdir(dir)) {
+		if (strncmp(entry->d_name, "input", 5) == 0) {
+			nodes.push_back(entry->d_name);
+		}
+	}
+	closedir(dir);
+	return nodes;
+}
+
+std::vector<std::string> FindSysfsTouchScreens(const std::string& sysfsInputRoot) {
+	std::vector<std::string> touchScreens;
+	for (auto& name : ListSysfsInputNodes(sysfsInputRoot)) {
+		if (IsSysfsTouchScreen(sysfsInputRoot, name)) {
+			touchScreens.push_back(std::move(name));
+		}
+	}
+	return touchScreens;
+}
+
+std::string SysfsInputIdentity(const std::string& sysfsInputRoot, std::string_view name) {
+	std::string base = sysfsInputRoot;
+	base += '/';
+	base += name;
+	std::string deviceName = ReadLine(base + "/name");
+	if (deviceName.empty()) {
+		return deviceName;
+	}
+	return deviceName + "|" + ReadLine(base + "/phys") + "|" + ReadLine(base + "/id/vendor") + ":" + ReadLine(base + "/id/product");
+}
+
+std::string_view Uevent::Name() const {
+	const size_t slash = devpath.rfind('/');
+	return slash == std::string_view::npos ? devpath : devpath.substr(slash + 1);
+}
+
+bool ParseUevent(const char* data, size_t size, Uevent& event) {
+	std::string_view message(data, size);
+	const size_t headerEnd = message.find('\0');
+	const std::string_view header = message.substr(0, headerEnd);
+	if (header.find('@') == std::string_view::npos) {
+		return false; // includes "libudev" messages, which carry a binary header
+	}
+	event = {};
+	size_t pos = headerEnd;
+	while (pos != std::string_view::npos && pos + 1 < message.size()) {
+		const size_t begin = pos + 1;
+		pos = message.find('\0', begin);
+		const std::string_view field = message.substr(begin, pos == std::string_view::npos ? std::string_view::npos : pos - begin);
+		if (field.starts_with("ACTION=")) {
+			event.action = field.substr(7);
+		}
+		else if (field.starts_with("SUBSYSTEM=")) {
+			event.subsystem = field.substr(10);
+		}
+		else if (field.starts_with("DEVPATH=")) {
+			event.devpath = field.substr(8);
+		}
+	}
+	return !event.action.empty() && !event.devpath.empty();
+}
+
+int OpenUeventSocket() {
+	int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (fd < 0) {
+		return -1;
+	}
+	sockaddr_nl addr = {};
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1; // kernel broadcasts; udevd re-broadcasts on group 2
+	if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+TouchHotplugMonitor::TouchHotplugMonitor(int fd, std::string sysfsInputRoot, TouchDeviceRegistry& registry)
+	: m_fd(fd), m_sysfsRoot(std::move(sysfsInputRoot)), m_registry(registry) {
+}
+
+TouchHotplugMonitor::~TouchHotplugMonitor() {
+	if (m_stopEvent >= 0) {
+		close(m_stopEvent);
+	}
+	if (m_fd >= 0) {
+		close(m_fd);
+	}
+}
+
+bool TouchHotplugMonitor::Init() {
+	m_stopEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	return m_fd >= 0 && m_stopEvent >= 0;
+}
+
+void TouchHotplugMonitor::Run() {
+	char buffer[8192];
+	pollfd fds[2] = { { m_fd, POLLIN, 0 }, { m_stopEvent, POLLIN, 0 } };
+	for (;;) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		if (fds[1].revents != 0) {
+			return;
+		}
+		// the kernel drops uevents rather than block when the socket buffer is full, and says so once
+		// with ENOBUFS; what is still queued is applied first, then a full scan catches up
+		bool overflowed = false;
+		for (;;) {
+			sockaddr_storage from = {};
+			socklen_t fromLen = sizeof(from);
+			ssize_t got = recvfrom(m_fd, buffer, sizeof(buffer), MSG_DONTWAIT, (sockaddr*)&from, &fromLen);
+			if (got < 0 && (errno == ENOBUFS || errno == EINTR)) {
+				overflowed |= errno == ENOBUFS;
+				continue;
+			}
+			if (got <= 0) {
+				break;
+			}
+			// only the kernel (port 0) may tell us about devices
+			if (from.ss_family == AF_NETLINK && ((sockaddr_nl*)&from)->nl_pid != 0) {
+				continue;
+			}
+			m_stats.messages++;
+			Uevent event;
+			if (ParseUevent(buffer, (size_t)got, event)) {
+				OnUevent(event);
+			}
+		}
+		if (overflowed) {
+			Rescan();
+		}
+	}
+}
+
+void TouchHotplugMonitor::Stop() {
+	const uint64_t one = 1;
+	write(m_stopEvent, &one, sizeof(one));
+}
+
+void TouchHotplugMonitor::OnUevent(const Uevent& event) {
+	// the input class device ("input12") carries the capabilities; its event/mouse children are ignored
+	const std::string_view name = event.Name();
+	if (event.subsystem != "input" || !name.starts_with("input")) {
+		return;
+	}
+	if (event.action == "add" || event.action == "change") {
+		m_stats.probes++;
+		if (IsSysfsTouchScreen(m_sysfsRoot, name)) {
+			if (m_registry.Add(name)) {
+				m_stats.added++;
+			}
+		}
+		// the node is still there, so while locked it stays in the set to be enabled on unlock
+		else if (event.action == "change" && m_registry.RemoveUnlessLocked(name)) {
+			m_stats.removed++;
+		}
+	}
+	else if (event.action == "remove" && m_registry.Remove(name)) {
+		m_stats.removed++;
+	}
+}
+
+void TouchHotplugMonitor::Rescan() {
+	m_stats.rescans++;
+	std::vector<std::string> found = FindSysfsTouchScreens(m_sysfsRoot);
+	for (const auto& name : found) {
+		if (m_registry.Add(name)) {
+			m_stats.added++;
+		}
+	}
+	std::sort(found.begin(), found.end());
+	for (const auto& id : m_registry.Snapshot()) {
+		if (!std::binary_search(found.begin(), found.end(), id) && m_registry.RemoveUnlessLocked(id)) {
+			m_stats.removed++;
+		}
+	}
+}
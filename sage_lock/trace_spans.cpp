@@ -0,0 +1,101 @@
+/////////////
+// trace_spans.cpp : Ring registration and the Chrome trace-event writer for trace spans.
+//////
+
+#include "trace_spans.h"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+// Rings are claimed for good: a thread's spans stay readable after it exits, and only instrumented
+// threads (input, executor, toggle workers) ever claim one. Zero-initialised, so an unclaimed ring
+// costs address space but no memory. Threads that find the pool empty share the overflow ring,
+// which is never dumped.
+trace_spans_detail::SpanRing g_Rings[kMaxSpanThreads];
+trace_spans_detail::SpanRing g_OverflowRing;
+std::atomic<size_t> g_RingsClaimed{ 0 };
+
+size_t RingsInUse() {
+	return std::min(g_RingsClaimed.load(std::memory_order_acquire), kMaxSpanThreads);
+}
+
+// JSON string body; span names are literals in this codebase, but keep the output valid regardless.
+void WriteJsonString(FILE* file, const char* text) {
+	fputc('"', file);
+	for (const char* p = text; *p != '\0'; p++) {
+		if (*p == '"' || *p == '\\') {
+			fputc('\\', file);
+		}
+		if ((unsigned char)*p >= 0x20) {
+			fputc(*p, file);
+		}
+	}
+	fputc('"', file);
+}
+
+struct Span {
+	const char* name;
+	uint64_t startNs;
+	uint64_t endNs;
+};
+
+}
+
+namespace trace_spans_detail {
+
+SpanRing* AttachThread() {
+	const size_t index = g_RingsClaimed.fetch_add(1, std::memory_order_acq_rel);
+	t_Ring = index < kMaxSpanThreads ? &g_Rings[index] : &g_OverflowRing;
+	return t_Ring;
+}
+
+}
+
+bool WriteTraceSpans(const char* path) {
+	FILE* file = fopen(path, "w");
+	if (file == nullptr) {
+		return false;
+	}
+	fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file);
+	bool first = true;
+	std::vector<Span> spans;
+	const size_t rings = RingsInUse();
+	for (size_t thread = 0; thread < rings; thread++) {
+		const trace_spans_detail::SpanRing* ring = &g_Rings[thread];
+		// copy the retained window, then drop whatever the thread overwrote while we were copying
+		const uint64_t end = ring->written.load(std::memory_order_acquire);
+		const uint64_t begin = end > kSpanRingSize ? end - kSpanRingSize : 0;
+		spans.clear();
+		for (uint64_t i = begin; i < end; i++) {
+			const auto& slot = ring->slots[i & (kSpanRingSize - 1)];
+			spans.push_back({ slot.name.load(std::memory_order_relaxed), slot.startNs.load(std::memory_order_relaxed),
+				slot.endNs.load(std::memory_order_relaxed) });
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const uint64_t now = ring->written.load(std::memory_order_relaxed);
+		// the slot of index now may be mid-write already
+		const uint64_t valid = now + 1 > kSpanRingSize ? now + 1 - kSpanRingSize : 0;
+		for (uint64_t i = std::max(begin, valid); i < end; i++) {
+			const Span& span = spans[(size_t)(i - begin)];
+			fputs(first ? "\n" : ",\n", file);
+			first = false;
+			fputs("{\"name\":", file);
+			WriteJsonString(file, span.name != nullptr ? span.name : "?");
+			fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", (unsigned)thread + 1, span.startNs / 1000.0,
+				(span.endNs - span.startNs) / 1000.0);
+		}
+	}
+	fputs("\n]}\n", file);
+	return fclose(file) == 0;
+}
+
+uint64_t TraceSpanCount() {
+	uint64_t count = 0;
+	const size_t rings = RingsInUse();
+	for (size_t thread = 0; thread < rings; thread++) {
+		count += g_Rings[thread].written.load(std::memory_order_relaxed);
+	}
+	return count;
+}
@@ -0,0 +1,87 @@
+/////////////
+// trace_spans.h : Scoped timing spans around the stages of the detect -> toggle -> feedback path,
+// kept in a per-thread ring and written out on demand as Chrome trace-event JSON (chrome://tracing,
+// ui.perfetto.dev).
+//
+//	SAGE_SPAN("CreateProcessW");
+//
+// marks the rest of the enclosing scope. Names must be string literals. SAGE_SPAN expands to
+// nothing unless the build defines SAGE_TRACE_SPANS=1, so instrumented code costs nothing by
+// default; when enabled, a span is two clock reads and three relaxed stores into the calling
+// thread's ring. A dump holds the most recent kSpanRingSize - 1 spans of each thread; the oldest
+// slot is left out, as it may be mid-overwrite. Rings come from a fixed pool, so recording never
+// allocates; threads past the first kMaxSpanThreads go unrecorded.
+//////
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "clock.h"
+
+#ifndef SAGE_TRACE_SPANS
+#define SAGE_TRACE_SPANS 0
+#endif
+
+constexpr size_t kSpanRingSize = 4096;
+constexpr size_t kMaxSpanThreads = 64;
+
+// Writes every thread's retained spans to path. Safe while spans are being recorded; a span
+// overwritten mid-copy is left out. Returns false if the file cannot be written.
+bool WriteTraceSpans(const char* path);
+// Spans recorded since startup, across all threads, including those since overwritten.
+uint64_t TraceSpanCount();
+
+namespace trace_spans_detail {
+
+static_assert((kSpanRingSize & (kSpanRingSize - 1)) == 0, "kSpanRingSize must be a power of two");
+
+struct SpanSlot {
+	std::atomic<const char*> name{ nullptr };
+	std::atomic<uint64_t> startNs{ 0 };
+	std::atomic<uint64_t> endNs{ 0 };
+};
+
+// Written by its own thread only; read by WriteTraceSpans.
+struct SpanRing {
+	std::array<SpanSlot, kSpanRingSize> slots;
+	std::atomic<uint64_t> written{ 0 };
+};
+
+inline thread_local SpanRing* t_Ring = nullptr;
+SpanRing* AttachThread();
+
+inline void Record(const char* name, uint64_t startNs, uint64_t endNs) {
+	SpanRing* ring = t_Ring != nullptr ? t_Ring : AttachThread();
+	const uint64_t index = ring->written.load(std::memory_order_relaxed);
+	SpanSlot& slot = ring->slots[index & (kSpanRingSize - 1)];
+	slot.name.store(name, std::memory_order_relaxed);
+	slot.startNs.store(startNs, std::memory_order_relaxed);
+	slot.endNs.store(endNs, std::memory_order_relaxed);
+	ring->written.store(index + 1, std::memory_order_release);
+}
+
+}
+
+class TraceSpan {
+public:
+	explicit TraceSpan(const char* name) : m_name(name), m_startNs(MonotonicNowNs()) {}
+	~TraceSpan() { trace_spans_detail::Record(m_name, m_startNs, MonotonicNowNs()); }
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+	const char* m_name;
+	const uint64_t m_startNs;
+};
+
+#if SAGE_TRACE_SPANS
+#define SAGE_SPAN_NAME2(line) sageSpan##line
+#define SAGE_SPAN_NAME(line) SAGE_SPAN_NAME2(line)
+#define SAGE_SPAN(name) TraceSpan SAGE_SPAN_NAME(__LINE__)(name)
+#else
+#define SAGE_SPAN(name) static_cast<void>(0)
+#endif
@@ -0,0 +1,31 @@
+/////////////
+// uinput_keyboard.h : A virtual keyboard created through /dev/uinput, so the evdev backend can be
+// exercised against real kernel event nodes, EVIOCSMASK included. Linux only; bench and tests only.
+//////
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+class UinputKeyboard {
+public:
+	UinputKeyboard() = default;
+	~UinputKeyboard();
+
+	UinputKeyboard(const UinputKeyboard&) = delete;
+	UinputKeyboard& operator=(const UinputKeyboard&) = delete;
+
+	// Creates a keyboard with the volume keys, letters, MSC_SCAN and autorepeat (EV_REP), and waits
+	// up to a second for its event node to appear. Fails without /dev/uinput or write access to it.
+	bool Create(const char* name);
+	// The /dev/input/eventN node of the keyboard once Create has succeeded.
+	const std::string& EventPath() const { return m_eventPath; }
+
+	// Writes one packet the way a USB keyboard reports a key: MSC_SCAN, the key, SYN_REPORT.
+	bool SendKey(uint16_t code, int32_t value);
+
+private:
+	int m_fd = -1;
+	std::string m_eventPath;
+};
@@ -0,0 +1,95 @@
+/////////////
+// uinput_keyboard_linux.cpp : Virtual uinput keyboard for the bench and the tests.
+//////
+
+#include "uinput_keyboard.h"
+#include <chrono>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// The eventN entry under /sys/class/input/<sysname>, or an empty string while it is not there yet.
+std::string FindEventNode(const char* sysName) {
+	const std::string dir = std::string("/sys/class/input/") + sysName;
+	DIR* input = opendir(dir.c_str());
+	if (input == nullptr) {
+		return {};
+	}
+	std::string node;
+	while (dirent* entry = readdir(input)) {
+		if (std::string(entry->d_name).rfind("event", 0) == 0) {
+			node = entry->d_name;
+			break;
+		}
+	}
+	closedir(input);
+	return node;
+}
+
+}
+
+UinputKeyboard::~UinputKeyboard() {
+	if (m_fd >= 0) {
+		ioctl(m_fd, UI_DEV_DESTROY);
+		close(m_fd);
+	}
+}
+
+bool UinputKeyboard::Create(const char* name) {
+	m_fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+	if (m_fd < 0) {
+		return false;
+	}
+	bool ok = ioctl(m_fd, UI_SET_EVBIT, EV_KEY) == 0 && ioctl(m_fd, UI_SET_EVBIT, EV_MSC) == 0 &&
+		ioctl(m_fd, UI_SET_EVBIT, EV_REP) == 0 && ioctl(m_fd, UI_SET_MSCBIT, MSC_SCAN) == 0;
+	for (int key : { KEY_VOLUMEUP, KEY_VOLUMEDOWN, KEY_MUTE }) {
+		ok = ok && ioctl(m_fd, UI_SET_KEYBIT, key) == 0;
+	}
+	for (int key = KEY_Q; key <= KEY_P; key++) {
+		ok = ok && ioctl(m_fd, UI_SET_KEYBIT, key) == 0;
+	}
+	uinput_setup setup = {};
+	setup.id.bustype = BUS_VIRTUAL;
+	setup.id.vendor = 0x5a6e;
+	setup.id.product = 0x1;
+	snprintf(setup.name, sizeof(setup.name), "%s", name);
+	if (!ok || ioctl(m_fd, UI_DEV_SETUP, &setup) != 0 || ioctl(m_fd, UI_DEV_CREATE) != 0) {
+		close(m_fd);
+		m_fd = -1;
+		return false;
+	}
+
+	char sysName[64] = {};
+	if (ioctl(m_fd, UI_GET_SYSNAME(sizeof(sysName)), sysName) < 0) {
+		return false;
+	}
+	// the node is created asynchronously, by devtmpfs or udev
+	for (int i = 0; i < 100; i++) {
+		const std::string node = FindEventNode(sysName);
+		if (!node.empty() && access(("/dev/input/" + node).c_str(), R_OK) == 0) {
+			m_eventPath = "/dev/input/" + node;
+			return true;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return false;
+}
+
+bool UinputKeyboard::SendKey(uint16_t code, int32_t value) {
+	input_event packet[3] = {};
+	packet[0].type = EV_MSC;
+	packet[0].code = MSC_SCAN;
+	packet[0].value = code;
+	packet[1].type = EV_KEY;
+	packet[1].code = code;
+	packet[1].value = value;
+	packet[2].type = EV_SYN;
+	packet[2].code = SYN_REPORT;
+	return write(m_fd, packet, sizeof(packet)) == (ssize_t)sizeof(packet);
+}